@@ -0,0 +1,160 @@
+#include "AllocatorTest.h"
+#include "MemoryAllocator.h"
+#include "ErrorAndLog.h"
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#define TEST_GRANULARITY (128ull * 1024)	// the biggest bufferImageGranularity around, the strictest check
+#define TEST_MAX_LIVE 1024					// allocations alive at once, the frees catch up from there
+
+namespace vm {
+	struct TestBlock
+	{
+		struct Range
+		{
+			uint64_t	end;
+			bool		optimal;
+		};
+		BuddyAllocator				buddy;
+		std::map<uint64_t, Range>	live;	// offset -> range, the allocations of the block
+		TestBlock() : buddy(MEMORY_BLOCK_SIZE, MEMORY_MIN_BLOCK_SIZE) {}
+	};
+	struct TestAllocation
+	{
+		uint32_t	pool;
+		TestBlock	*block;
+		uint64_t	offset;
+	};
+	typedef std::map<uint32_t, std::vector<std::unique_ptr<TestBlock>>> TestPools;
+
+	static bool check(const TestBlock &block, uint64_t offset, uint64_t size, uint64_t alignment, bool optimal)
+	{
+		if (offset % alignment) {
+			REPORT("Allocator test: offset " << offset << " is not aligned to " << alignment << "\n");
+			return false;
+		}
+		if (offset + size > MEMORY_BLOCK_SIZE) {
+			REPORT("Allocator test: " << offset << " + " << size << " is out of the block\n");
+			return false;
+		}
+		auto next = block.live.upper_bound(offset);
+		if ((next != block.live.end() && next->first < offset + size) || (next != block.live.begin() && std::prev(next)->second.end > offset)) {
+			REPORT("Allocator test: " << offset << " + " << size << " overlaps a live allocation\n");
+			return false;
+		}
+		// the linear and the optimal resources must not share a granularity page
+		const uint64_t pageStart = offset / TEST_GRANULARITY * TEST_GRANULARITY;
+		const uint64_t pageEnd = (offset + size + TEST_GRANULARITY - 1) / TEST_GRANULARITY * TEST_GRANULARITY;
+		auto it = block.live.lower_bound(pageStart);
+		if (it != block.live.begin())
+			--it;
+		for (; it != block.live.end() && it->first < pageEnd; ++it) {
+			if (it->second.end > pageStart && it->second.optimal != optimal) {
+				REPORT("Allocator test: " << offset << " + " << size << " shares a " << TEST_GRANULARITY << " byte page with " << (optimal ? "a linear" : "an optimal") << " resource\n");
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static void logBlocks(const TestPools &pools, uint32_t iteration, size_t liveCount)
+	{
+		uint64_t used = 0, requested = 0;
+		for (auto &pool : pools) {
+			for (auto &block : pool.second) {
+				used += block->buddy.getUsedSize();
+				requested += block->buddy.getRequestedSize();
+			}
+		}
+		REPORT("Allocator test, iteration " << iteration << ": " << liveCount << " live allocations, " << requested / 1024 << " KB requested, " << used / 1024 << " KB used with the padding\n");
+		for (auto &pool : pools) {
+			for (auto &block : pool.second) {
+				const BuddyAllocator &buddy = block->buddy;
+				REPORT("  block of type " << (pool.first >> 1) << ((pool.first & 1) ? " (optimal images)" : "") << ": " << buddy.getAllocationCount() << " sub-allocations, " << buddy.getUsedSize() / 1024 << " KB used, largest free " << buddy.getLargestFreeBlock() / 1024 << " KB, fragmentation: " << buddy.getFragmentation() * 100.f << "%\n");
+			}
+		}
+	}
+
+	bool AllocatorTest::run(uint32_t iterations, uint32_t seed)
+	{
+		std::mt19937 rng(seed);
+		TestPools pools;
+		std::vector<TestAllocation> live;
+		const uint32_t logEvery = iterations >= 4 ? iterations / 4 : 1;
+
+		for (uint32_t i = 0; i < iterations; ++i) {
+			if (live.empty() || (live.size() < TEST_MAX_LIVE && rng() % 100 < 55)) {
+				// two memory types, sizes from 256 bytes to 8 MB with as many small ones as big ones,
+				// the alignments of buffers and of optimal images
+				const ResourceType type = static_cast<ResourceType>(rng() % 3);
+				const uint32_t memoryType = rng() % 2;
+				uint64_t size = 256ull << (rng() % 15);
+				size += rng() % size;
+				const uint64_t alignment = type == ResourceType::OptimalImage ? 4096ull << (rng() % 5) : 4ull << (rng() % 7);
+				const bool optimal = type == ResourceType::OptimalImage;
+
+				// the first block with room, or a new one, like MemoryAllocator::allocate
+				const uint32_t key = MemoryAllocator::poolKey(memoryType, type);
+				auto &blocks = pools[key];
+				TestBlock *block = nullptr;
+				uint64_t offset = 0;
+				for (auto &b : blocks) {
+					if (b->buddy.allocate(size, alignment, offset)) {
+						block = b.get();
+						break;
+					}
+				}
+				if (!block) {
+					blocks.push_back(std::make_unique<TestBlock>());
+					block = blocks.back().get();
+					if (!block->buddy.allocate(size, alignment, offset)) {
+						REPORT("Allocator test: " << size << " bytes do not fit in an empty block\n");
+						return false;
+					}
+				}
+				if (!check(*block, offset, size, alignment, optimal))
+					return false;
+				block->live[offset] = { offset + size, optimal };
+				live.push_back({ key, block, offset });
+			}
+			else {
+				const size_t index = rng() % live.size();
+				const TestAllocation a = live[index];
+				live[index] = live.back();
+				live.pop_back();
+				a.block->buddy.free(a.offset);
+				a.block->live.erase(a.offset);
+
+				// one empty block per pool is kept, like MemoryAllocator::free
+				auto &blocks = pools[a.pool];
+				if (a.block->buddy.isEmpty() && blocks.size() > 1) {
+					for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+						if (it->get() == a.block) {
+							blocks.erase(it);
+							break;
+						}
+					}
+				}
+			}
+			if ((i + 1) % logEvery == 0)
+				logBlocks(pools, i + 1, live.size());
+		}
+
+		// with everything freed the buddies must have merged back to one free block each
+		for (auto &a : live)
+			a.block->buddy.free(a.offset);
+		for (auto &pool : pools) {
+			for (auto &block : pool.second) {
+				if (!block->buddy.isEmpty() || block->buddy.getLargestFreeBlock() != block->buddy.getSize()) {
+					REPORT("Allocator test: a block did not merge back after the last free\n");
+					return false;
+				}
+			}
+		}
+		REPORT("Allocator test passed: " << iterations << " iterations, seed " << seed << "\n");
+		return true;
+	}
+}
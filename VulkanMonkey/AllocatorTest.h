@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+namespace vm {
+	// Drives the block sub-allocation of MemoryAllocator on the cpu alone, run with --allocator-test before the game
+	// starts: random allocations (buffers, linear and optimal images of two memory types) and frees go through
+	// BuddyAllocator blocks picked like MemoryAllocator picks them. Every allocation is checked for its alignment,
+	// its range in the block, overlaps and bufferImageGranularity against the live ones of its block, and the
+	// blocks are logged with their fragmentation along the way.
+	class AllocatorTest
+	{
+	public:
+		// false at the first check that fails
+		static bool run(uint32_t iterations, uint32_t seed);
+	};
+}
@@ -0,0 +1,221 @@
+#include "AssetArchive.h"
+#include "ErrorAndLog.h"
+#include "TextureCooker.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stb-master/stb_image.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vm {
+	AssetArchive::~AssetArchive()
+	{
+		close();
+	}
+
+	bool AssetArchive::open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		HANDLE mappingHandle = GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0 ? CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		void *view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!view) {
+			if (mappingHandle)
+				CloseHandle(mappingHandle);
+			CloseHandle(fileHandle);
+			return false;
+		}
+		file = fileHandle;
+		mapping = mappingHandle;
+		size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void *view = fstat(fd, &st) == 0 && st.st_size > 0 ? mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd); // the mapping keeps the file
+		if (view == MAP_FAILED)
+			return false;
+		size = static_cast<size_t>(st.st_size);
+#endif
+		base = static_cast<const unsigned char*>(view);
+
+		// the table is checked once here, the lookups trust it
+		header = reinterpret_cast<const ArchiveHeader*>(base);
+		bool valid = size >= sizeof(ArchiveHeader) && memcmp(header->magic, "VMPK", 4) == 0 && header->version == ASSET_ARCHIVE_VERSION &&
+			header->tableOffset + header->entryCount * sizeof(ArchiveEntry) <= size && header->namesOffset <= size;
+		if (valid) {
+			entries = reinterpret_cast<const ArchiveEntry*>(base + header->tableOffset);
+			names = reinterpret_cast<const char*>(base + header->namesOffset);
+			for (uint32_t i = 0; i < header->entryCount && valid; ++i) {
+				const ArchiveEntry &e = entries[i];
+				valid = e.offset + e.size <= size && header->namesOffset + e.nameOffset + e.nameSize <= size;
+			}
+		}
+		if (!valid) {
+			LOG(path.c_str() << " is not a valid asset archive (version " << ASSET_ARCHIVE_VERSION << "), the loose files are read\n");
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void AssetArchive::close()
+	{
+		if (!base)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+		CloseHandle(static_cast<HANDLE>(mapping));
+		CloseHandle(static_cast<HANDLE>(file));
+#else
+		munmap(const_cast<unsigned char*>(base), size);
+#endif
+		base = nullptr;
+		size = 0;
+		header = nullptr;
+		entries = nullptr;
+		names = nullptr;
+		file = nullptr;
+		mapping = nullptr;
+	}
+
+	bool AssetArchive::isOpen() const
+	{
+		return base != nullptr;
+	}
+
+	bool AssetArchive::exists(const std::string &path) const
+	{
+		return find(path, AssetType::Raw) || std::ifstream(path).good();
+	}
+
+	bool AssetArchive::read(const std::string &path, AssetView &view) const
+	{
+		if (const ArchiveEntry *e = find(path, AssetType::Raw)) {
+			view.mapped = reinterpret_cast<const char*>(base + e->offset);
+			view.mappedSize = static_cast<size_t>(e->size);
+			return true;
+		}
+		std::ifstream stream(path, std::ios::ate | std::ios::binary);
+		if (!stream.is_open())
+			return false;
+		view.mapped = nullptr;
+		view.loose.resize(static_cast<size_t>(stream.tellg()));
+		stream.seekg(0);
+		stream.read(view.loose.data(), view.loose.size());
+		return true;
+	}
+
+	bool AssetArchive::getImageSize(const std::string &path, int &width, int &height) const
+	{
+		const ArchiveEntry *e = find(path, AssetType::Pixels);
+		if (!e)
+			e = find(path, AssetType::Cooked);
+		if (e) {
+			width = static_cast<int>(e->width);
+			height = static_cast<int>(e->height);
+			return true;
+		}
+		int channels;
+		return stbi_info(path.c_str(), &width, &height, &channels) != 0;
+	}
+
+	bool AssetArchive::loadImage(const std::string &path, AssetImage &image) const
+	{
+		if (const ArchiveEntry *e = find(path, AssetType::Pixels)) {
+			image.mapped = base + e->offset;
+			image.width = static_cast<int>(e->width);
+			image.height = static_cast<int>(e->height);
+			return true;
+		}
+		int channels;
+		stbi_uc* pixels = stbi_load(path.c_str(), &image.width, &image.height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+			return false;
+		// the shaders and the blending take premultiplied alpha, like the packed and the cooked textures
+		TextureCooker::premultiplyAlpha(pixels, image.width * image.height);
+		image.mapped = nullptr;
+		image.decoded.assign(pixels, pixels + image.width * image.height * 4);
+		stbi_image_free(pixels);
+		return true;
+	}
+
+	bool AssetArchive::loadCooked(const std::string &path, CookedTexture &cooked) const
+	{
+		const ArchiveEntry *e = find(path, AssetType::Cooked);
+		if (!e)
+			return false;
+		cooked.width = e->width;
+		cooked.height = e->height;
+		cooked.mipLevels = e->mipLevels;
+		cooked.format = static_cast<vk::Format>(e->format);
+		cooked.data.clear();
+		cooked.mapped = base + e->offset;
+		cooked.mappedSize = static_cast<size_t>(e->size);
+		return true;
+	}
+
+	uint32_t AssetArchive::getEntryCount() const
+	{
+		return header ? header->entryCount : 0;
+	}
+
+	std::string AssetArchive::getEntryName(uint32_t i) const
+	{
+		return std::string(names + entries[i].nameOffset, entries[i].nameSize);
+	}
+
+	AssetType AssetArchive::getEntryType(uint32_t i) const
+	{
+		return static_cast<AssetType>(entries[i].type);
+	}
+
+	size_t AssetArchive::getMappedSize() const
+	{
+		return size;
+	}
+
+	uint64_t AssetArchive::hashName(const std::string &path)
+	{
+		uint64_t h = 14695981039346656037ull; // fnv-1a
+		for (char c : path)
+			h = (h ^ static_cast<unsigned char>(c == '\\' ? '/' : c)) * 1099511628211ull;
+		return h;
+	}
+
+	const ArchiveEntry *AssetArchive::find(const std::string &path, AssetType type) const
+	{
+		if (!base)
+			return nullptr;
+		const uint64_t hash = hashName(path);
+		const uint32_t t = static_cast<uint32_t>(type);
+		const ArchiveEntry *end = entries + header->entryCount;
+		const ArchiveEntry *e = std::lower_bound(entries, end, std::make_pair(hash, t), [](const ArchiveEntry &a, const std::pair<uint64_t, uint32_t> &key) {
+			return a.hash < key.first || (a.hash == key.first && a.type < key.second);
+		});
+		// the names of a collision follow each other
+		for (; e != end && e->hash == hash && e->type == t; ++e) {
+			if (e->nameSize != path.size())
+				continue;
+			bool same = true;
+			for (uint32_t i = 0; i < e->nameSize && same; ++i)
+				same = names[e->nameOffset + i] == (path[i] == '\\' ? '/' : path[i]);
+			if (same)
+				return e;
+		}
+		return nullptr;
+	}
+}
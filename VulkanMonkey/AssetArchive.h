@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "TextureCooker.h"
+
+#define ASSET_ARCHIVE "assets.vmpak"	// next to the exe, made by --pack, the loose files are read if it is not there
+#define ASSET_ARCHIVE_VERSION 1			// bump when the layout changes, an old archive is not opened
+#define ASSET_ALIGNMENT 64				// of every payload in the file, the spir-v and the bc blocks are read in place
+
+namespace vm {
+	enum class AssetType : uint32_t {
+		Raw,		// the file as it is: spir-v, scene data
+		Pixels,		// an image decoded: premultiplied rgba8, flipped like stb_image loads them here, level 0
+		Cooked		// an image cooked like the TextureCooker cooks it: bc1/bc3, every mip level
+	};
+
+	// the start of the archive, the payloads follow, then the names and the table
+	struct ArchiveHeader
+	{
+		char		magic[4];		// VMPK
+		uint32_t	version;
+		uint32_t	entryCount;
+		uint32_t	reserved;
+		uint64_t	tableOffset;	// entryCount entries sorted by hash then type, found with a binary search
+		uint64_t	namesOffset;
+	};
+	struct ArchiveEntry
+	{
+		uint64_t	hash;			// of the name, AssetArchive::hashName
+		uint32_t	type;			// AssetType
+		uint32_t	nameOffset;		// from namesOffset, to tell the names of a hash collision apart
+		uint32_t	nameSize;
+		uint32_t	width;			// images only
+		uint32_t	height;
+		uint32_t	mipLevels;
+		uint32_t	format;			// VkFormat
+		uint32_t	reserved;
+		uint64_t	offset;			// of the payload, ASSET_ALIGNMENT aligned
+		uint64_t	size;
+	};
+
+	// the bytes of a file, in the archive's mapping or read from the loose file
+	struct AssetView
+	{
+		const char					*mapped = nullptr;
+		size_t						mappedSize = 0;
+		std::vector<char>			loose;
+		const char *data() const { return mapped ? mapped : loose.data(); }
+		size_t size() const { return mapped ? mappedSize : loose.size(); }
+	};
+	// premultiplied rgba8, in the archive's mapping or decoded from the loose file
+	struct AssetImage
+	{
+		const unsigned char			*mapped = nullptr;
+		std::vector<unsigned char>	decoded;
+		int							width = 0;
+		int							height = 0;
+		const unsigned char *data() const { return mapped ? mapped : decoded.data(); }
+	};
+
+	// The assets packed in one file (AssetPacker), mapped in memory: the loaders read the payloads where they are
+	// in the mapping, nothing is copied until the staging buffer. Every asset not in the archive is read from its
+	// loose file, so the archive is optional, an asset in the archive is read from it even if its loose file is there.
+	// Only read once it is open, the streaming threads read from it too.
+	class AssetArchive
+	{
+	public:
+		~AssetArchive();
+		bool open(const std::string &path);	// false if it is not there or not a valid archive
+		void close();
+		bool isOpen() const;
+
+		// the archive first, then the loose file
+		bool exists(const std::string &path) const;
+		bool read(const std::string &path, AssetView &view) const;
+		bool getImageSize(const std::string &path, int &width, int &height) const;
+		// the loose images are decoded with stb_image (flipped if it is set) and premultiplied
+		bool loadImage(const std::string &path, AssetImage &image) const;
+		// the archive only, TextureCooker::load reads the loose ones from its cache
+		bool loadCooked(const std::string &path, CookedTexture &cooked) const;
+
+		uint32_t getEntryCount() const;
+		std::string getEntryName(uint32_t i) const;
+		AssetType getEntryType(uint32_t i) const;
+		size_t getMappedSize() const;
+
+		// fnv-1a of the path with forward slashes
+		static uint64_t hashName(const std::string &path);
+
+	private:
+		const unsigned char		*base = nullptr;
+		size_t					size = 0;
+		const ArchiveHeader		*header = nullptr;
+		const ArchiveEntry		*entries = nullptr;
+		const char				*names = nullptr;
+		void					*file = nullptr;	// the handles of the file and of the mapping on windows
+		void					*mapping = nullptr;
+
+		const ArchiveEntry *find(const std::string &path, AssetType type) const;
+	};
+}
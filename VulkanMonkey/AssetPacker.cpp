@@ -0,0 +1,193 @@
+#include "AssetPacker.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stb-master/stb_image.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+namespace vm {
+	static std::string extension(const std::string &path)
+	{
+		const size_t dot = path.rfind('.');
+		std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+		return ext;
+	}
+
+	bool AssetPacker::pack(const std::string &archivePath)
+	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+		ResourceManager &rm = ResourceManager::getInstance();
+		rm.assetArchive.close(); // the loose files are packed
+		stbi_set_flip_vertically_on_load(true);
+
+		std::ofstream file(archivePath, std::ios::binary | std::ios::trunc);
+		if (!file.good()) {
+			REPORT("Could not write " << archivePath.c_str() << "\n");
+			return false;
+		}
+		ArchiveHeader header{};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		// the payloads as they are made, every one aligned
+		std::vector<ArchiveEntry> entries;
+		std::string names;
+		uint64_t offset = sizeof(header);
+		auto const add = [&](const std::string &name, AssetType type, const void *data, size_t size, uint32_t width, uint32_t height, uint32_t mipLevels, vk::Format format) {
+			static const char padding[ASSET_ALIGNMENT] = {};
+			const uint64_t aligned = (offset + ASSET_ALIGNMENT - 1) / ASSET_ALIGNMENT * ASSET_ALIGNMENT;
+			file.write(padding, aligned - offset);
+			file.write(static_cast<const char*>(data), size);
+			ArchiveEntry e{};
+			e.hash = AssetArchive::hashName(name);
+			e.type = static_cast<uint32_t>(type);
+			e.nameOffset = static_cast<uint32_t>(names.size());
+			e.nameSize = static_cast<uint32_t>(name.size());
+			e.width = width;
+			e.height = height;
+			e.mipLevels = mipLevels;
+			e.format = static_cast<uint32_t>(format);
+			e.offset = aligned;
+			e.size = size;
+			entries.push_back(e);
+			names += name;
+			offset = aligned + size;
+		};
+
+		std::vector<std::string> files;
+		listFiles("textures", files);
+		for (auto &path : files) {
+			const std::string ext = extension(path);
+			if (ext != "png" && ext != "jpg" && ext != "jpeg" && ext != "bmp" && ext != "tga")
+				continue;
+			AssetImage image;
+			if (!rm.assetArchive.loadImage(path, image)) {
+				LOG("failed to load " << path.c_str() << ", not packed\n");
+				continue;
+			}
+			add(path, AssetType::Pixels, image.data(), image.width * image.height * 4, image.width, image.height, 1, vk::Format::eR8G8B8A8Unorm);
+			// the ones with an image of their own are loaded cooked if the gpu takes bc, it is not known here
+			CookedTexture cooked;
+			if (!rm.textureAtlas.accepts(image.width, image.height) && rm.textureCooker.load(path, cooked))
+				add(path, AssetType::Cooked, cooked.blocks(), cooked.blockBytes(), cooked.width, cooked.height, cooked.mipLevels, cooked.format);
+		}
+		files.clear();
+		listFiles("shaders", files);
+		listFiles("scenes", files);
+		for (auto &path : files) {
+			if (path.compare(0, 8, "shaders/") == 0 && extension(path) != "spv")
+				continue;
+			AssetView view;
+			if (rm.assetArchive.read(path, view))
+				add(path, AssetType::Raw, view.data(), view.size(), 0, 0, 0, vk::Format::eUndefined);
+		}
+
+		// the table sorted for the binary search of AssetArchive::find
+		std::sort(entries.begin(), entries.end(), [](const ArchiveEntry &a, const ArchiveEntry &b) {
+			return a.hash < b.hash || (a.hash == b.hash && a.type < b.type);
+		});
+		memcpy(header.magic, "VMPK", 4);
+		header.version = ASSET_ARCHIVE_VERSION;
+		header.entryCount = static_cast<uint32_t>(entries.size());
+		header.namesOffset = offset;
+		file.write(names.data(), names.size());
+		offset += names.size();
+		header.tableOffset = (offset + 7) / 8 * 8;
+		file.write("\0\0\0\0\0\0\0", header.tableOffset - offset);
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ArchiveEntry));
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (!file.good()) {
+			REPORT("Could not write " << archivePath.c_str() << "\n");
+			return false;
+		}
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		REPORT("Packed " << entries.size() << " assets in " << archivePath.c_str() << " (" << (header.tableOffset + entries.size() * sizeof(ArchiveEntry)) / 1024 << " KB, " << time.count() << " ms)\n");
+		return true;
+	}
+
+	void AssetPacker::benchmark(const std::string &archivePath)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		stbi_set_flip_vertically_on_load(true);
+		if (!rm.assetArchive.open(archivePath)) {
+			REPORT("No asset archive at " << archivePath.c_str() << ", make it with --pack\n");
+			return;
+		}
+		std::vector<std::pair<std::string, AssetType>> assets;
+		for (uint32_t i = 0; i < rm.assetArchive.getEntryCount(); ++i)
+			assets.push_back({ rm.assetArchive.getEntryName(i), rm.assetArchive.getEntryType(i) });
+		rm.assetArchive.close();
+
+		// the same loaders for both, with the archive closed they read the loose files (the cooked ones from the cache).
+		// every asset is copied once, like to a staging buffer
+		std::vector<unsigned char> staging;
+		const char *passes[] = { "cold", "warm" };
+		for (auto pass : passes) {
+			for (int archive = 0; archive < 2; ++archive) {
+				auto const startTime = std::chrono::high_resolution_clock::now();
+				if (archive)
+					rm.assetArchive.open(archivePath);
+				size_t bytes = 0;
+				for (auto &asset : assets) {
+					const unsigned char *data = nullptr;
+					size_t size = 0;
+					AssetView view;
+					AssetImage image;
+					CookedTexture cooked;
+					if (asset.second == AssetType::Raw && rm.assetArchive.read(asset.first, view)) {
+						data = reinterpret_cast<const unsigned char*>(view.data());
+						size = view.size();
+					}
+					else if (asset.second == AssetType::Pixels && rm.assetArchive.loadImage(asset.first, image)) {
+						data = image.data();
+						size = image.width * image.height * 4;
+					}
+					else if (asset.second == AssetType::Cooked && rm.textureCooker.load(asset.first, cooked)) {
+						data = cooked.blocks();
+						size = cooked.blockBytes();
+					}
+					staging.assign(data, data + size);
+					bytes += size;
+				}
+				rm.assetArchive.close();
+				std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+				REPORT("Asset load, " << pass << ", " << (archive ? "archive" : "loose files") << ": " << assets.size() << " assets, " << bytes / 1024 << " KB in " << time.count() << " ms\n");
+			}
+		}
+	}
+
+	void AssetPacker::listFiles(const std::string &directory, std::vector<std::string> &files)
+	{
+		std::vector<std::string> found;
+#ifdef _WIN32
+		_finddata_t data;
+		intptr_t handle = _findfirst((directory + "/*").c_str(), &data);
+		if (handle != -1) {
+			do {
+				if (!(data.attrib & _A_SUBDIR))
+					found.push_back(directory + "/" + data.name);
+			} while (_findnext(handle, &data) == 0);
+			_findclose(handle);
+		}
+#else
+		if (DIR *dir = opendir(directory.c_str())) {
+			while (dirent *entry = readdir(dir)) {
+				if (entry->d_type != DT_DIR)
+					found.push_back(directory + "/" + entry->d_name);
+			}
+			closedir(dir);
+		}
+#endif
+		std::sort(found.begin(), found.end());
+		files.insert(files.end(), found.begin(), found.end());
+	}
+}
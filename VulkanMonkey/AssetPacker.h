@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "AssetArchive.h"
+
+namespace vm {
+	// Makes the asset archive from the loose files, run with --pack before the game starts:
+	// the images of textures/ decoded (and cooked too if they are too big for the atlas), the spir-v of shaders/
+	// and the files of scenes/ as they are.
+	class AssetPacker
+	{
+	public:
+		static bool pack(const std::string &archivePath);
+		// loads every asset of the archive through the loaders, from the loose files then from the archive.
+		// twice: cold, the first reads of the run (the os may still cache the files of an earlier run, copy
+		// the assets or reboot before it for a cold disk), then warm, and logs the times
+		static void benchmark(const std::string &archivePath);
+
+	private:
+		static void listFiles(const std::string &directory, std::vector<std::string> &files);	// sorted, no subdirectories
+	};
+}
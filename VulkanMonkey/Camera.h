@@ -1,6 +1,7 @@
 #pragma once
 #include "glm_.h"
 #include "Vulkan_.h"
+#include <vector>
 
 namespace vm {
 	struct UniformCameraBufferObject {
@@ -16,10 +17,11 @@ namespace vm {
 		UniformCameraBufferObject	UCBO;
 		bool						isUCBOmapped;
 		float						zoom;
-		vk::DeviceSize				bufferSize;
-		vk::Buffer					uniformBuffer;
+		vk::DeviceSize				bufferSize;			// of one frame's slice, minUniformBufferOffsetAlignment aligned
+		uint32_t					frameCount;
+		vk::Buffer					uniformBuffer;		// a slice per frame in flight, the gpu reads one while the next is written
 		vk::DeviceMemory			uniformBufferMem;
-		vk::DescriptorSet			descriptorSet;
+		std::vector<vk::DescriptorSet>	descriptorSets;	// of every slice
 		glm::mat4					*attachedMat;
 		Helper						helper;
 	public:
@@ -31,23 +33,34 @@ namespace vm {
 		void createDescriptorSet(const vk::DescriptorPool &descriptorPool)
 		{
 			ResourceManager &rm = ResourceManager::getInstance();
-			// CAMERA DESCRIPTORSET
+			// CAMERA DESCRIPTORSETS, one per slice
+			std::vector<vk::DescriptorSetLayout> layouts(frameCount, rm.cameraDescriptorSetLayout);
+			descriptorSets.resize(frameCount);
 			auto const camAllocateInfo = vk::DescriptorSetAllocateInfo()
 				.setDescriptorPool(descriptorPool)
-				.setDescriptorSetCount(1)
-				.setPSetLayouts(&ResourceManager::getInstance().cameraDescriptorSetLayout);
-			rm.getDevice().allocateDescriptorSets(&camAllocateInfo, &descriptorSet);
-			auto const camWriteDset = vk::WriteDescriptorSet()
-				.setDstSet(descriptorSet)							//descriptor set
-				.setDstBinding(0)											//binding number in shader
-				.setDstArrayElement(0)										//start element in array
-				.setDescriptorType(vk::DescriptorType::eUniformBuffer)		//descriptor type
-				.setDescriptorCount(1)										//descriptor count
-				.setPBufferInfo(&vk::DescriptorBufferInfo()
-					.setBuffer(uniformBuffer)						//buffer
-					.setOffset(0)											//buffer offset
-					.setRange(bufferSize));							//buffer size	
-			rm.getDevice().updateDescriptorSets(1, &camWriteDset, 0, nullptr);
+				.setDescriptorSetCount(frameCount)
+				.setPSetLayouts(layouts.data());
+			rm.getDevice().allocateDescriptorSets(&camAllocateInfo, descriptorSets.data());
+			for (uint32_t i = 0; i < frameCount; ++i) {
+				auto const bufferInfo = vk::DescriptorBufferInfo()
+					.setBuffer(uniformBuffer)								//buffer
+					.setOffset(i * bufferSize)								//buffer offset
+					.setRange(sizeof(UniformCameraBufferObject));			//buffer size
+				auto const camWriteDset = vk::WriteDescriptorSet()
+					.setDstSet(descriptorSets[i])							//descriptor set
+					.setDstBinding(0)										//binding number in shader
+					.setDstArrayElement(0)									//start element in array
+					.setDescriptorType(vk::DescriptorType::eUniformBuffer)	//descriptor type
+					.setDescriptorCount(1)									//descriptor count
+					.setPBufferInfo(&bufferInfo);
+				rm.getDevice().updateDescriptorSets(1, &camWriteDset, 0, nullptr);
+			}
+		}
+		// the frame's fence is waited, the gpu is done with its slice
+		void write(uint32_t frameIndex)
+		{
+			if (isUCBOmapped)
+				memcpy(static_cast<char*>(data) + frameIndex * bufferSize, &UCBO, sizeof(UniformCameraBufferObject));
 		}
 
 	public:
@@ -63,15 +76,24 @@ namespace vm {
 		{
 			return uniformBufferMem;
 		}
-		vk::DescriptorSet& getDescriptorSet() 
+		vk::DescriptorSet getDescriptorSet(uint32_t frameIndex) const
 		{
-			return descriptorSet;
+			return descriptorSets[frameIndex];
 		}
 		float getZoom() const
 		{
 			return zoom;
 		}
-		void init(uint32_t screenWidth, uint32_t screenHeight, vk::PhysicalDevice gpu, vk::Device device, vk::PhysicalDeviceProperties gpuProperties)
+		// the world rect on screen, the ndc corners back through proj and camPos
+		void getVisibleRect(glm::vec2 &min, glm::vec2 &max) const
+		{
+			glm::mat4 inv = glm::inverse(UCBO.proj * UCBO.camPos);
+			glm::vec4 a = inv * glm::vec4(-1.0f, -1.0f, 0.0f, 1.0f);
+			glm::vec4 b = inv * glm::vec4(1.0f, 1.0f, 0.0f, 1.0f);
+			min = glm::min(glm::vec2(a), glm::vec2(b));
+			max = glm::max(glm::vec2(a), glm::vec2(b));
+		}
+		void init(uint32_t screenWidth, uint32_t screenHeight, vk::PhysicalDevice gpu, vk::Device device, vk::PhysicalDeviceProperties gpuProperties, uint32_t frameCount)
 		{
 			position = glm::vec3(0.0f, 0.0f, 0.9f);
 			lookVector = glm::vec3(0.0f);
@@ -84,21 +106,23 @@ namespace vm {
 			}; // proj, camPos
 			//UCBO.camPos = glm::scale(UCBO.camPos, glm::vec3(1.f, -1.f, 1.f));
 			startingCamPos = UCBO.camPos;
-			bufferSize = sizeof(UniformCameraBufferObject);
+			const vk::DeviceSize alignment = gpuProperties.limits.minUniformBufferOffsetAlignment;
+			bufferSize = (sizeof(UniformCameraBufferObject) + alignment - 1) / alignment * alignment;
+			this->frameCount = frameCount;
 			isUCBOmapped = false;
 
-			if (bufferSize < gpuProperties.limits.minUniformBufferOffsetAlignment)
-				bufferSize = gpuProperties.limits.minUniformBufferOffsetAlignment;
 			// camera uniform buffer
-			helper.createBuffer(gpu, device, bufferSize,
+			vk::DeviceSize size = bufferSize * frameCount;
+			helper.createBuffer(gpu, device, size,
 				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eUniformBuffer,
 				vk::MemoryPropertyFlagBits::eHostVisible,
 				uniformBuffer, uniformBufferMem);
 
 			// camera uniform buffer mapping
-			device.mapMemory(uniformBufferMem, vk::DeviceSize(), bufferSize, vk::MemoryMapFlags(), &data);
-			memcpy(data, &UCBO, bufferSize);
+			data = helper.mapBuffer(device, uniformBuffer);
 			isUCBOmapped = data ? true : false;
+			for (uint32_t i = 0; i < frameCount; ++i)
+				write(i);
 		}
 		void move(const float x, const float y, const float z = 0.0f)
 		{
@@ -121,8 +145,7 @@ namespace vm {
 			else
 				pos = glm::vec4(position, 1.0f);
 			UCBO.camPos = glm::translate(startingCamPos, glm::vec3(-pos.x, -pos.y, 0.0f));
-
-			memcpy(data, &UCBO, bufferSize);
+			// copied to the gpu by write() when the renderer records the next frame
 		}
 		void attachTo(glm::mat4 &attachMat, float xOffset = 0.0f, float yOffset = 0.0f)
 		{
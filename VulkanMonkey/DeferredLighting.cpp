@@ -0,0 +1,408 @@
+#include "DeferredLighting.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+#include <array>
+#include <fstream>
+
+namespace vm {
+	bool DeferredLighting::create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, vk::Format colorFormat, vk::Format depthFormat, vk::ImageLayout finalLayout)
+	{
+		this->gpu = gpu;
+		this->device = device;
+		const AssetArchive &assets = ResourceManager::getInstance().assetArchive;
+		if (!assets.exists("shaders/light.vert.spv") || !assets.exists("shaders/light.frag.spv") ||
+			!assets.exists("shaders/composite.vert.spv") || !assets.exists("shaders/composite.frag.spv")) {
+			LOG("deferred lighting shaders not found, deferred lighting is disabled\n");
+			return false;
+		}
+
+		// albedo and lights never leave the render pass, lazily allocated memory if the gpu has it (tilers)
+		attachmentUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
+		attachmentMemory = vk::MemoryPropertyFlagBits::eDeviceLocal;
+		vk::PhysicalDeviceMemoryProperties memProperties = gpu.getMemoryProperties();
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
+			if (memProperties.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated) {
+				attachmentMemory |= vk::MemoryPropertyFlagBits::eLazilyAllocated;
+				break;
+			}
+		}
+
+		createRenderPass(colorFormat, depthFormat, finalLayout);
+
+		// the composite reads albedo and lights at its own pixel only
+		vk::DescriptorSetLayoutBinding bindings[2];
+		for (uint32_t i = 0; i < 2; ++i) {
+			bindings[i]
+				.setBinding(i)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eInputAttachment)
+				.setStageFlags(vk::ShaderStageFlagBits::eFragment);
+		}
+		auto const dslci = vk::DescriptorSetLayoutCreateInfo()
+			.setBindingCount(2)
+			.setPBindings(bindings);
+		errCheck(device.createDescriptorSetLayout(&dslci, nullptr, &inputDescriptorSetLayout));
+
+		createPipelines(pipelineCache);
+		available = true;
+		return true;
+	}
+
+	void DeferredLighting::createRenderPass(vk::Format colorFormat, vk::Format depthFormat, vk::ImageLayout finalLayout)
+	{
+		std::array<vk::AttachmentDescription, 4> attachments;
+		attachments[0] = vk::AttachmentDescription() // swapchain image, written by the composite only
+			.setFormat(colorFormat)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setLoadOp(vk::AttachmentLoadOp::eClear)
+			.setStoreOp(vk::AttachmentStoreOp::eStore)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setFinalLayout(finalLayout);
+		attachments[1] = vk::AttachmentDescription() // depth, the sprites only
+			.setFormat(depthFormat)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setLoadOp(vk::AttachmentLoadOp::eClear)
+			.setStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+			.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+		attachments[2] = vk::AttachmentDescription() // albedo
+			.setFormat(ALBEDO_FORMAT)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setLoadOp(vk::AttachmentLoadOp::eClear)
+			.setStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+			.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+		attachments[3] = attachments[2]; // light accumulation
+		attachments[3].setFormat(LIGHT_ACCUMULATION_FORMAT);
+
+		auto const albedoRef = vk::AttachmentReference().setAttachment(2).setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+		auto const depthRef = vk::AttachmentReference().setAttachment(1).setLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+		auto const lightRef = vk::AttachmentReference().setAttachment(3).setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+		auto const colorRef = vk::AttachmentReference().setAttachment(0).setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+		vk::AttachmentReference inputRefs[] = {
+			vk::AttachmentReference().setAttachment(2).setLayout(vk::ImageLayout::eShaderReadOnlyOptimal),
+			vk::AttachmentReference().setAttachment(3).setLayout(vk::ImageLayout::eShaderReadOnlyOptimal) };
+		const uint32_t preserveAlbedo = 2;
+
+		std::array<vk::SubpassDescription, 3> subpasses;
+		subpasses[0] = vk::SubpassDescription() // sprites
+			.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+			.setColorAttachmentCount(1)
+			.setPColorAttachments(&albedoRef)
+			.setPDepthStencilAttachment(&depthRef);
+		subpasses[1] = vk::SubpassDescription() // lights, the albedo is kept for the composite
+			.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+			.setColorAttachmentCount(1)
+			.setPColorAttachments(&lightRef)
+			.setPreserveAttachmentCount(1)
+			.setPPreserveAttachments(&preserveAlbedo);
+		subpasses[2] = vk::SubpassDescription() // composite
+			.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+			.setColorAttachmentCount(1)
+			.setPColorAttachments(&colorRef)
+			.setInputAttachmentCount(2)
+			.setPInputAttachments(inputRefs);
+
+		std::array<vk::SubpassDependency, 4> dependencies;
+		// the (shared) attachments of the previous frame in flight, as in the forward render pass
+		dependencies[0] = vk::SubpassDependency()
+			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+			.setDstSubpass(0)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests | vk::PipelineStageFlagBits::eFragmentShader)
+			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests)
+			.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eInputAttachmentRead)
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+		// the composite reads albedo and lights at the same pixel, by region keeps them on chip
+		for (uint32_t i = 1; i < 3; ++i) {
+			dependencies[i] = vk::SubpassDependency()
+				.setSrcSubpass(i - 1)
+				.setDstSubpass(2)
+				.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+				.setDstStageMask(vk::PipelineStageFlagBits::eFragmentShader)
+				.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eInputAttachmentRead)
+				.setDependencyFlags(vk::DependencyFlagBits::eByRegion);
+		}
+		// the swapchain image is first written by the composite, after the acquire semaphore's stage
+		dependencies[3] = vk::SubpassDependency()
+			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+			.setDstSubpass(2)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite);
+
+		auto const rpci = vk::RenderPassCreateInfo()
+			.setAttachmentCount(static_cast<uint32_t>(attachments.size()))
+			.setPAttachments(attachments.data())
+			.setSubpassCount(static_cast<uint32_t>(subpasses.size()))
+			.setPSubpasses(subpasses.data())
+			.setDependencyCount(static_cast<uint32_t>(dependencies.size()))
+			.setPDependencies(dependencies.data());
+		errCheck(device.createRenderPass(&rpci, nullptr, &renderPass));
+	}
+
+	void DeferredLighting::createPipelines(vk::PipelineCache pipelineCache)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		// no vertex buffers, the quads and the fullscreen triangle come from gl_VertexIndex
+		auto const visci = vk::PipelineVertexInputStateCreateInfo();
+		auto const iasci = vk::PipelineInputAssemblyStateCreateInfo()
+			.setTopology(vk::PrimitiveTopology::eTriangleList)
+			.setPrimitiveRestartEnable(VK_FALSE);
+		auto const viewportState = vk::PipelineViewportStateCreateInfo()
+			.setViewportCount(1)
+			.setScissorCount(1);
+		vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+		auto const dynamicState = vk::PipelineDynamicStateCreateInfo()
+			.setDynamicStateCount(2)
+			.setPDynamicStates(dynamicStates);
+		auto const rasterizer = vk::PipelineRasterizationStateCreateInfo()
+			.setPolygonMode(vk::PolygonMode::eFill)
+			.setLineWidth(1.0f)
+			.setCullMode(vk::CullModeFlagBits::eNone);
+		auto const multisampling = vk::PipelineMultisampleStateCreateInfo()
+			.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+		auto const depthStencil = vk::PipelineDepthStencilStateCreateInfo()
+			.setDepthTestEnable(VK_FALSE)
+			.setDepthWriteEnable(VK_FALSE);
+
+		AssetView vertCode, fragCode;
+		vk::ShaderModule vertModule, fragModule;
+		auto const loadStages = [&](const std::string &vert, const std::string &frag) {
+			rm.assetArchive.read(vert, vertCode);
+			rm.assetArchive.read(frag, fragCode);
+			auto const vsmci = vk::ShaderModuleCreateInfo()
+				.setCodeSize(vertCode.size())
+				.setPCode(reinterpret_cast<const uint32_t*>(vertCode.data()));
+			errCheck(device.createShaderModule(&vsmci, nullptr, &vertModule));
+			auto const fsmci = vk::ShaderModuleCreateInfo()
+				.setCodeSize(fragCode.size())
+				.setPCode(reinterpret_cast<const uint32_t*>(fragCode.data()));
+			errCheck(device.createShaderModule(&fsmci, nullptr, &fragModule));
+		};
+		vk::PipelineShaderStageCreateInfo stages[2];
+		stages[0].setStage(vk::ShaderStageFlagBits::eVertex).setPName("main");
+		stages[1].setStage(vk::ShaderStageFlagBits::eFragment).setPName("main");
+
+		auto const pushConstantRange = vk::PushConstantRange()
+			.setStageFlags(vk::ShaderStageFlagBits::eFragment)
+			.setOffset(0)
+			.setSize(sizeof(glm::vec4));
+
+		{
+			// LIGHTS: additive, one channel
+			loadStages("shaders/light.vert.spv", "shaders/light.frag.spv");
+			stages[0].setModule(vertModule);
+			stages[1].setModule(fragModule);
+
+			vk::DescriptorSetLayout setLayouts[] = { rm.cameraDescriptorSetLayout, rm.pointLightsDescriptorSetLayout };
+			auto const plci = vk::PipelineLayoutCreateInfo()
+				.setSetLayoutCount(2)
+				.setPSetLayouts(setLayouts);
+			errCheck(device.createPipelineLayout(&plci, nullptr, &lightPipelineLayout));
+
+			auto const blendAttachment = vk::PipelineColorBlendAttachmentState()
+				.setColorWriteMask(vk::ColorComponentFlagBits::eR)
+				.setBlendEnable(VK_TRUE)
+				.setSrcColorBlendFactor(vk::BlendFactor::eOne)
+				.setDstColorBlendFactor(vk::BlendFactor::eOne)
+				.setColorBlendOp(vk::BlendOp::eAdd)
+				.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+				.setDstAlphaBlendFactor(vk::BlendFactor::eOne)
+				.setAlphaBlendOp(vk::BlendOp::eAdd);
+			auto const colorBlending = vk::PipelineColorBlendStateCreateInfo()
+				.setAttachmentCount(1)
+				.setPAttachments(&blendAttachment);
+
+			auto const gpci = vk::GraphicsPipelineCreateInfo()
+				.setStageCount(2)
+				.setPStages(stages)
+				.setPVertexInputState(&visci)
+				.setPInputAssemblyState(&iasci)
+				.setPViewportState(&viewportState)
+				.setPRasterizationState(&rasterizer)
+				.setPMultisampleState(&multisampling)
+				.setPDepthStencilState(&depthStencil)
+				.setPColorBlendState(&colorBlending)
+				.setPDynamicState(&dynamicState)
+				.setLayout(lightPipelineLayout)
+				.setRenderPass(renderPass)
+				.setSubpass(1);
+			errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &lightPipeline));
+			device.destroyShaderModule(vertModule);
+			device.destroyShaderModule(fragModule);
+		}
+		{
+			// COMPOSITE: blended over the clear color like the forward sprites
+			loadStages("shaders/composite.vert.spv", "shaders/composite.frag.spv");
+			stages[0].setModule(vertModule);
+			stages[1].setModule(fragModule);
+
+			auto const plci = vk::PipelineLayoutCreateInfo()
+				.setSetLayoutCount(1)
+				.setPSetLayouts(&inputDescriptorSetLayout)
+				.setPushConstantRangeCount(1)
+				.setPPushConstantRanges(&pushConstantRange);
+			errCheck(device.createPipelineLayout(&plci, nullptr, &compositePipelineLayout));
+
+			auto const blendAttachment = vk::PipelineColorBlendAttachmentState()
+				.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)
+				.setBlendEnable(VK_TRUE)
+				.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+				.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+				.setColorBlendOp(vk::BlendOp::eAdd)
+				.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+				.setDstAlphaBlendFactor(vk::BlendFactor::eZero)
+				.setAlphaBlendOp(vk::BlendOp::eAdd);
+			auto const colorBlending = vk::PipelineColorBlendStateCreateInfo()
+				.setAttachmentCount(1)
+				.setPAttachments(&blendAttachment);
+
+			auto const gpci = vk::GraphicsPipelineCreateInfo()
+				.setStageCount(2)
+				.setPStages(stages)
+				.setPVertexInputState(&visci)
+				.setPInputAssemblyState(&iasci)
+				.setPViewportState(&viewportState)
+				.setPRasterizationState(&rasterizer)
+				.setPMultisampleState(&multisampling)
+				.setPDepthStencilState(&depthStencil)
+				.setPColorBlendState(&colorBlending)
+				.setPDynamicState(&dynamicState)
+				.setLayout(compositePipelineLayout)
+				.setRenderPass(renderPass)
+				.setSubpass(2);
+			errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &compositePipeline));
+			device.destroyShaderModule(vertModule);
+			device.destroyShaderModule(fragModule);
+		}
+	}
+
+	void DeferredLighting::destroy()
+	{
+		if (!available)
+			return;
+		device.destroyPipeline(lightPipeline);
+		device.destroyPipelineLayout(lightPipelineLayout);
+		device.destroyPipeline(compositePipeline);
+		device.destroyPipelineLayout(compositePipelineLayout);
+		device.destroyDescriptorSetLayout(inputDescriptorSetLayout);
+		device.destroyRenderPass(renderPass);
+		available = false;
+	}
+
+	bool DeferredLighting::isAvailable() const
+	{
+		return available;
+	}
+
+	vk::RenderPass DeferredLighting::getRenderPass() const
+	{
+		return renderPass;
+	}
+
+	DeferredTargets DeferredLighting::createTargets(vk::Extent2D extent, const std::vector<vk::ImageView> &swapchainImageViews, vk::ImageView depthImageView)
+	{
+		DeferredTargets targets;
+		if (!available)
+			return targets;
+
+		helper.createImage(gpu, device, extent.width, extent.height, ALBEDO_FORMAT, vk::ImageTiling::eOptimal, attachmentUsage, attachmentMemory, targets.albedoImage, targets.albedoImageMem);
+		helper.createImageView(device, targets.albedoImage, ALBEDO_FORMAT, targets.albedoImageView);
+		helper.createImage(gpu, device, extent.width, extent.height, LIGHT_ACCUMULATION_FORMAT, vk::ImageTiling::eOptimal, attachmentUsage, attachmentMemory, targets.lightImage, targets.lightImageMem);
+		helper.createImageView(device, targets.lightImage, LIGHT_ACCUMULATION_FORMAT, targets.lightImageView);
+
+		// a pool of its own, so a retired set is freed with its images
+		auto const poolSize = vk::DescriptorPoolSize()
+			.setType(vk::DescriptorType::eInputAttachment)
+			.setDescriptorCount(2);
+		auto const dpci = vk::DescriptorPoolCreateInfo()
+			.setMaxSets(1)
+			.setPoolSizeCount(1)
+			.setPPoolSizes(&poolSize);
+		errCheck(device.createDescriptorPool(&dpci, nullptr, &targets.descriptorPool));
+		auto const dsai = vk::DescriptorSetAllocateInfo()
+			.setDescriptorPool(targets.descriptorPool)
+			.setDescriptorSetCount(1)
+			.setPSetLayouts(&inputDescriptorSetLayout);
+		errCheck(device.allocateDescriptorSets(&dsai, &targets.descriptorSet));
+
+		vk::DescriptorImageInfo imageInfos[] = {
+			vk::DescriptorImageInfo().setImageView(targets.albedoImageView).setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal),
+			vk::DescriptorImageInfo().setImageView(targets.lightImageView).setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal) };
+		vk::WriteDescriptorSet writes[2];
+		for (uint32_t i = 0; i < 2; ++i) {
+			writes[i]
+				.setDstSet(targets.descriptorSet)
+				.setDstBinding(i)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eInputAttachment)
+				.setPImageInfo(&imageInfos[i]);
+		}
+		device.updateDescriptorSets(2, writes, 0, nullptr);
+
+		targets.frameBuffers.resize(swapchainImageViews.size());
+		for (size_t i = 0; i < swapchainImageViews.size(); ++i) {
+			std::array<vk::ImageView, 4> attachments = { swapchainImageViews[i], depthImageView, targets.albedoImageView, targets.lightImageView };
+			auto const fbci = vk::FramebufferCreateInfo()
+				.setRenderPass(renderPass)
+				.setAttachmentCount(static_cast<uint32_t>(attachments.size()))
+				.setPAttachments(attachments.data())
+				.setWidth(extent.width)
+				.setHeight(extent.height)
+				.setLayers(1);
+			errCheck(device.createFramebuffer(&fbci, nullptr, &targets.frameBuffers[i]));
+		}
+		return targets;
+	}
+
+	void DeferredLighting::destroyTargets(DeferredTargets &targets)
+	{
+		if (!targets.albedoImage)
+			return;
+		for (auto fb : targets.frameBuffers)
+			device.destroyFramebuffer(fb);
+		targets.frameBuffers.clear();
+		device.destroyDescriptorPool(targets.descriptorPool);
+		device.destroyImageView(targets.albedoImageView);
+		helper.destroyImage(device, targets.albedoImage, targets.albedoImageMem);
+		device.destroyImageView(targets.lightImageView);
+		helper.destroyImage(device, targets.lightImage, targets.lightImageMem);
+		targets = DeferredTargets();
+	}
+
+	void DeferredLighting::recordLighting(vk::CommandBuffer cmd, const DeferredTargets &targets, vk::Extent2D extent, vk::DescriptorSet cameraSet, vk::DescriptorSet lightsSet, uint32_t lightCount, const glm::vec4 &ambient)
+	{
+		auto const viewport = vk::Viewport()
+			.setWidth((float)extent.width)
+			.setHeight((float)extent.height)
+			.setMinDepth(0.0f)
+			.setMaxDepth(1.0f);
+		auto const scissor = vk::Rect2D()
+			.setOffset({ 0, 0 })
+			.setExtent(extent);
+
+		// a quad per light, instanced from the lights buffer
+		cmd.nextSubpass(vk::SubpassContents::eInline);
+		cmd.setViewport(0, 1, &viewport);
+		cmd.setScissor(0, 1, &scissor);
+		if (lightCount > 0) {
+			const vk::DescriptorSet dSets[] = { cameraSet, lightsSet };
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, lightPipeline);
+			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, lightPipelineLayout, 0, 2, dSets, 0, nullptr);
+			cmd.draw(6, lightCount, 0, 0);
+		}
+
+		// albedo * (ambient + lights) over the clear color
+		cmd.nextSubpass(vk::SubpassContents::eInline);
+		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, compositePipeline);
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, compositePipelineLayout, 0, 1, &targets.descriptorSet, 0, nullptr);
+		cmd.pushConstants(compositePipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(glm::vec4), &ambient);
+		cmd.draw(3, 1, 0, 0);
+	}
+}
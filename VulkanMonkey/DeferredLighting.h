@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+#include "glm_.h"
+
+#define LIGHT_ACCUMULATION_FORMAT vk::Format::eR16Sfloat	// the light factor only scales the alpha, one channel is enough
+#define ALBEDO_FORMAT vk::Format::eR8G8B8A8Unorm
+
+namespace vm {
+	// the size dependent part of the deferred path, recreated (and retired) with the swapchain
+	struct DeferredTargets {
+		vk::Image						albedoImage;
+		vk::DeviceMemory				albedoImageMem;
+		vk::ImageView					albedoImageView;
+		vk::Image						lightImage;
+		vk::DeviceMemory				lightImageMem;
+		vk::ImageView					lightImageView;
+		vk::DescriptorPool				descriptorPool;
+		vk::DescriptorSet				descriptorSet;		// albedo and light as input attachments of the composite
+		std::vector<vk::Framebuffer>	frameBuffers{};		// per swapchain image: color, depth, albedo, light
+	};
+
+	// Deferred 2d lighting in one render pass of three subpasses:
+	//	0. the sprites write their unlit albedo (the renderer records them, with the albedo pipelines)
+	//	1. every point light is a quad of its reach, added into the light accumulation attachment
+	//	2. a fullscreen triangle combines albedo, lights and ambient into the swapchain image
+	// Albedo and lights stay in tile memory on gpus that can (transient, read as input attachments),
+	// and the lighting costs the lit screen area instead of sprites * lights.
+	class DeferredLighting
+	{
+	public:
+		// false if the shaders are missing, the forward path is used then
+		bool create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, vk::Format colorFormat, vk::Format depthFormat, vk::ImageLayout finalLayout);
+		void destroy();
+		bool isAvailable() const;
+		vk::RenderPass getRenderPass() const;
+
+		DeferredTargets createTargets(vk::Extent2D extent, const std::vector<vk::ImageView> &swapchainImageViews, vk::ImageView depthImageView);
+		void destroyTargets(DeferredTargets &targets);
+
+		// after the sprites of subpass 0, ends in subpass 2 (the caller ends the render pass)
+		void recordLighting(vk::CommandBuffer cmd, const DeferredTargets &targets, vk::Extent2D extent, vk::DescriptorSet cameraSet, vk::DescriptorSet lightsSet, uint32_t lightCount, const glm::vec4 &ambient);
+
+	private:
+		vk::PhysicalDevice			gpu;
+		vk::Device					device;
+		vk::RenderPass				renderPass;
+		vk::DescriptorSetLayout		inputDescriptorSetLayout;
+		vk::PipelineLayout			lightPipelineLayout;
+		vk::Pipeline				lightPipeline;
+		vk::PipelineLayout			compositePipelineLayout;
+		vk::Pipeline				compositePipeline;
+		vk::ImageUsageFlags			attachmentUsage;
+		vk::MemoryPropertyFlags		attachmentMemory;
+		bool						available = false;
+		Helper						helper;
+
+		void createRenderPass(vk::Format colorFormat, vk::Format depthFormat, vk::ImageLayout finalLayout);
+		void createPipelines(vk::PipelineCache pipelineCache);
+	};
+}
@@ -0,0 +1,114 @@
+#include "DescriptorAllocator.h"
+#include "ErrorAndLog.h"
+
+namespace vm {
+	void DescriptorAllocator::create(vk::Device device, uint32_t firstPoolSets)
+	{
+		this->device = device;
+		this->firstPoolSets = firstPoolSets > 0 ? firstPoolSets : 1;
+		created = true;
+	}
+
+	void DescriptorAllocator::destroy()
+	{
+		for (auto &l : layouts) {
+			for (auto &pool : l.pools)
+				device.destroyDescriptorPool(pool);
+		}
+		layouts.clear();
+		poolCount = 0;
+		setCount = 0;
+		reuseCount = 0;
+		created = false;
+	}
+
+	bool DescriptorAllocator::isCreated() const
+	{
+		return created;
+	}
+
+	vk::DescriptorSet DescriptorAllocator::allocate(vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize> &sizes)
+	{
+		LayoutPools *pools = &find(layout);
+		if (!pools->free.empty()) {
+			vk::DescriptorSet set = pools->free.back();
+			pools->free.pop_back();
+			++reuseCount;
+			return set;
+		}
+
+		// the last pool is full, the next one is twice as big
+		if (pools->used == pools->capacity) {
+			pools->capacity = pools->capacity ? pools->capacity * 2 : firstPoolSets;
+			pools->used = 0;
+
+			std::vector<vk::DescriptorPoolSize> poolSizes(sizes);
+			for (auto &s : poolSizes)
+				s.setDescriptorCount(s.descriptorCount * pools->capacity);
+			auto const dpci = vk::DescriptorPoolCreateInfo()
+				.setMaxSets(pools->capacity)
+				.setPoolSizeCount((uint32_t)poolSizes.size())
+				.setPPoolSizes(poolSizes.data());
+			pools->pools.push_back(vk::DescriptorPool());
+			errCheck(device.createDescriptorPool(&dpci, nullptr, &pools->pools.back()));
+			++poolCount;
+		}
+
+		vk::DescriptorSet set;
+		auto const allocateInfo = vk::DescriptorSetAllocateInfo()
+			.setDescriptorPool(pools->pools.back())
+			.setDescriptorSetCount(1)
+			.setPSetLayouts(&layout);
+		errCheck(device.allocateDescriptorSets(&allocateInfo, &set));
+		++pools->used;
+		++setCount;
+		return set;
+	}
+
+	void DescriptorAllocator::retire(vk::DescriptorSetLayout layout, vk::DescriptorSet set, uint64_t frameNumber)
+	{
+		if (set)
+			find(layout).retired.push_back({ set, frameNumber });
+	}
+
+	void DescriptorAllocator::update(uint64_t frameNumber, uint32_t framesInFlight)
+	{
+		// the frames before (frameNumber - framesInFlight) are done, like the retired images of TextureResidency
+		for (auto &l : layouts) {
+			for (auto it = l.retired.begin(); it != l.retired.end();) {
+				if (frameNumber < it->frameNumber + framesInFlight) {
+					++it;
+					continue;
+				}
+				l.free.push_back(it->set);
+				it = l.retired.erase(it);
+			}
+		}
+	}
+
+	DescriptorAllocator::LayoutPools &DescriptorAllocator::find(vk::DescriptorSetLayout layout)
+	{
+		for (auto &l : layouts) {
+			if (l.layout == layout)
+				return l;
+		}
+		layouts.push_back(LayoutPools());
+		layouts.back().layout = layout;
+		return layouts.back();
+	}
+
+	uint32_t DescriptorAllocator::getPoolCount() const
+	{
+		return poolCount;
+	}
+
+	uint32_t DescriptorAllocator::getSetCount() const
+	{
+		return setCount;
+	}
+
+	uint32_t DescriptorAllocator::getReuseCount() const
+	{
+		return reuseCount;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+
+namespace vm {
+	// Descriptor sets from pools created on demand, so nothing has to be counted before the scene is loaded.
+	// The sets of a layout come from pools of their own, every new pool holds twice the sets of the previous one.
+	// The sets replaced while the frames in flight may still bind them are retired, and handed out again by allocate
+	// once these frames are done (the pools are not made to free single sets), they all go with destroy.
+	class DescriptorAllocator
+	{
+	public:
+		void create(vk::Device device, uint32_t firstPoolSets);
+		void destroy();
+		bool isCreated() const;
+
+		// sizes: the descriptors of one set of the layout
+		// a reused set keeps the descriptors of its last use, they are all written again
+		vk::DescriptorSet allocate(vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize> &sizes);
+		// not bound from frameNumber on, reused once the frames in flight before it are done
+		void retire(vk::DescriptorSetLayout layout, vk::DescriptorSet set, uint64_t frameNumber);
+		void update(uint64_t frameNumber, uint32_t framesInFlight);
+
+		uint32_t getPoolCount() const;
+		uint32_t getSetCount() const;
+		uint32_t getReuseCount() const;
+
+	private:
+		struct RetiredSet
+		{
+			vk::DescriptorSet	set;
+			uint64_t			frameNumber;
+		};
+		// the pools of one layout, only the last one has room left
+		struct LayoutPools
+		{
+			vk::DescriptorSetLayout			layout;
+			std::vector<vk::DescriptorPool>	pools;
+			uint32_t						used = 0;		// sets allocated from the last pool
+			uint32_t						capacity = 0;	// sets of the last pool
+			std::vector<RetiredSet>			retired{};
+			std::vector<vk::DescriptorSet>	free{};			// retired and done, allocate takes these first
+		};
+		vk::Device					device;
+		std::vector<LayoutPools>	layouts{};
+		uint32_t					firstPoolSets = 16;
+		uint32_t					poolCount = 0;
+		uint32_t					setCount = 0;
+		uint32_t					reuseCount = 0;
+		bool						created = false;
+
+		LayoutPools &find(vk::DescriptorSetLayout layout);
+	};
+}
@@ -0,0 +1,620 @@
+#include "DistanceField.h"
+#include "ResourceManager.h"
+#include "Entity.h"
+#include "ErrorAndLog.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#define DISTANCE_FIELD_CIRCLE_SEGMENTS 16
+
+namespace vm {
+	// collects the fixtures whose (fat) aabb overlaps the query, from the broad-phase dynamic tree
+	class OccluderQuery : public b2QueryCallback
+	{
+	public:
+		explicit OccluderQuery(std::vector<b2Fixture*> &fixtures) : fixtures(fixtures) {}
+		bool ReportFixture(b2Fixture *fixture) override
+		{
+			fixtures.push_back(fixture);
+			return true;
+		}
+	private:
+		std::vector<b2Fixture*> &fixtures;
+	};
+
+	bool DistanceField::create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, uint32_t frameCount)
+	{
+		this->gpu = gpu;
+		this->device = device;
+		createImages();
+
+		const AssetArchive &assets = ResourceManager::getInstance().assetArchive;
+		if (!assets.exists("shaders/occupancy.vert.spv") || !assets.exists("shaders/occupancy.frag.spv") ||
+			!assets.exists("shaders/jumpFlood.comp.spv")) {
+			LOG("distance field shaders not found, distance field shadows are disabled\n");
+			return false;
+		}
+		createRenderPass();
+		auto const fbci = vk::FramebufferCreateInfo()
+			.setRenderPass(renderPass)
+			.setAttachmentCount(1)
+			.setPAttachments(&occupancyImageView)
+			.setWidth(DISTANCE_FIELD_MAX_SIZE)
+			.setHeight(DISTANCE_FIELD_MAX_SIZE)
+			.setLayers(1);
+		errCheck(device.createFramebuffer(&fbci, nullptr, &frameBuffer));
+		createPipelines(pipelineCache);
+
+		const vk::PhysicalDeviceProperties &properties = ResourceManager::getInstance().getGpuProperties();
+		if (properties.limits.timestampComputeAndGraphics) {
+			auto const qpci = vk::QueryPoolCreateInfo()
+				.setQueryType(vk::QueryType::eTimestamp)
+				.setQueryCount(DISTANCE_FIELD_TIMESTAMPS * frameCount);
+			errCheck(device.createQueryPool(&qpci, nullptr, &queryPool));
+			timestampPeriod = properties.limits.timestampPeriod;
+		}
+
+		// a first guess, the buffers grow with the occluders
+		frames.resize(frameCount);
+		for (auto &frame : frames)
+			resize(frame, 64 * 1024);
+		available = true;
+		return true;
+	}
+
+	void DistanceField::createImages()
+	{
+		const uint32_t size = DISTANCE_FIELD_MAX_SIZE;
+		helper.createImage(gpu, device, size, size, vk::Format::eR8Unorm, vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, occupancyImage, occupancyImageMem);
+		helper.createImageView(device, occupancyImage, vk::Format::eR8Unorm, occupancyImageView);
+		for (uint32_t i = 0; i < 2; ++i) {
+			helper.createImage(gpu, device, size, size, vk::Format::eR16G16B16A16Uint, vk::ImageTiling::eOptimal,
+				vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal, seedImages[i], seedImageMems[i]);
+			helper.createImageView(device, seedImages[i], vk::Format::eR16G16B16A16Uint, seedImageViews[i]);
+		}
+		helper.createImage(gpu, device, size, size, vk::Format::eR32Sfloat, vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, distanceImage, distanceImageMem);
+		helper.createImageView(device, distanceImage, vk::Format::eR32Sfloat, distanceImageView);
+
+		auto sci = vk::SamplerCreateInfo()
+			.setMagFilter(vk::Filter::eNearest)
+			.setMinFilter(vk::Filter::eNearest)
+			.setMipmapMode(vk::SamplerMipmapMode::eNearest)
+			.setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+			.setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+			.setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+			.setAnisotropyEnable(VK_FALSE)
+			.setMaxAnisotropy(1.f)
+			.setCompareEnable(VK_FALSE)
+			.setCompareOp(vk::CompareOp::eAlways)
+			.setBorderColor(vk::BorderColor::eFloatTransparentBlack)
+			.setUnnormalizedCoordinates(VK_FALSE);
+		errCheck(device.createSampler(&sci, nullptr, &nearestSampler));
+		// the tracing reads between the texels
+		sci.setMagFilter(vk::Filter::eLinear).setMinFilter(vk::Filter::eLinear);
+		errCheck(device.createSampler(&sci, nullptr, &linearSampler));
+	}
+
+	void DistanceField::createRenderPass()
+	{
+		auto const attachment = vk::AttachmentDescription()
+			.setFormat(vk::Format::eR8Unorm)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setLoadOp(vk::AttachmentLoadOp::eClear)
+			.setStoreOp(vk::AttachmentStoreOp::eStore)
+			.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+			.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+		auto const colorRef = vk::AttachmentReference().setAttachment(0).setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+		auto const subpass = vk::SubpassDescription()
+			.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+			.setColorAttachmentCount(1)
+			.setPColorAttachments(&colorRef);
+
+		vk::SubpassDependency dependencies[2];
+		// the seeds pass of the previous frame in flight is done with the occupancy
+		dependencies[0] = vk::SubpassDependency()
+			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+			.setDstSubpass(0)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eComputeShader)
+			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite);
+		// and this frame's reads it after
+		dependencies[1] = vk::SubpassDependency()
+			.setSrcSubpass(0)
+			.setDstSubpass(VK_SUBPASS_EXTERNAL)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+			.setDstStageMask(vk::PipelineStageFlagBits::eComputeShader)
+			.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+		auto const rpci = vk::RenderPassCreateInfo()
+			.setAttachmentCount(1)
+			.setPAttachments(&attachment)
+			.setSubpassCount(1)
+			.setPSubpasses(&subpass)
+			.setDependencyCount(2)
+			.setPDependencies(dependencies);
+		errCheck(device.createRenderPass(&rpci, nullptr, &renderPass));
+	}
+
+	void DistanceField::createPipelines(vk::PipelineCache pipelineCache)
+	{
+		const AssetArchive &assets = ResourceManager::getInstance().assetArchive;
+		{
+			// OCCUPANCY: the occluder triangles write 1
+			AssetView vertCode, fragCode;
+			assets.read("shaders/occupancy.vert.spv", vertCode);
+			assets.read("shaders/occupancy.frag.spv", fragCode);
+			vk::ShaderModule vertModule, fragModule;
+			auto const vsmci = vk::ShaderModuleCreateInfo()
+				.setCodeSize(vertCode.size())
+				.setPCode(reinterpret_cast<const uint32_t*>(vertCode.data()));
+			errCheck(device.createShaderModule(&vsmci, nullptr, &vertModule));
+			auto const fsmci = vk::ShaderModuleCreateInfo()
+				.setCodeSize(fragCode.size())
+				.setPCode(reinterpret_cast<const uint32_t*>(fragCode.data()));
+			errCheck(device.createShaderModule(&fsmci, nullptr, &fragModule));
+			vk::PipelineShaderStageCreateInfo stages[2];
+			stages[0].setStage(vk::ShaderStageFlagBits::eVertex).setModule(vertModule).setPName("main");
+			stages[1].setStage(vk::ShaderStageFlagBits::eFragment).setModule(fragModule).setPName("main");
+
+			auto const vibd = vk::VertexInputBindingDescription()
+				.setBinding(0)
+				.setStride(sizeof(glm::vec2))
+				.setInputRate(vk::VertexInputRate::eVertex);
+			auto const viad = vk::VertexInputAttributeDescription()
+				.setBinding(0)
+				.setLocation(0)
+				.setFormat(vk::Format::eR32G32Sfloat)
+				.setOffset(0);
+			auto const visci = vk::PipelineVertexInputStateCreateInfo()
+				.setVertexBindingDescriptionCount(1)
+				.setPVertexBindingDescriptions(&vibd)
+				.setVertexAttributeDescriptionCount(1)
+				.setPVertexAttributeDescriptions(&viad);
+			auto const iasci = vk::PipelineInputAssemblyStateCreateInfo()
+				.setTopology(vk::PrimitiveTopology::eTriangleList)
+				.setPrimitiveRestartEnable(VK_FALSE);
+			auto const viewportState = vk::PipelineViewportStateCreateInfo()
+				.setViewportCount(1)
+				.setScissorCount(1);
+			vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+			auto const dynamicState = vk::PipelineDynamicStateCreateInfo()
+				.setDynamicStateCount(2)
+				.setPDynamicStates(dynamicStates);
+			auto const rasterizer = vk::PipelineRasterizationStateCreateInfo()
+				.setPolygonMode(vk::PolygonMode::eFill)
+				.setLineWidth(1.0f)
+				.setCullMode(vk::CullModeFlagBits::eNone);
+			auto const multisampling = vk::PipelineMultisampleStateCreateInfo()
+				.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+			auto const depthStencil = vk::PipelineDepthStencilStateCreateInfo()
+				.setDepthTestEnable(VK_FALSE)
+				.setDepthWriteEnable(VK_FALSE);
+			auto const blendAttachment = vk::PipelineColorBlendAttachmentState()
+				.setColorWriteMask(vk::ColorComponentFlagBits::eR)
+				.setBlendEnable(VK_FALSE);
+			auto const colorBlending = vk::PipelineColorBlendStateCreateInfo()
+				.setAttachmentCount(1)
+				.setPAttachments(&blendAttachment);
+
+			auto const plci = vk::PipelineLayoutCreateInfo();
+			errCheck(device.createPipelineLayout(&plci, nullptr, &occupancyPipelineLayout));
+
+			auto const gpci = vk::GraphicsPipelineCreateInfo()
+				.setStageCount(2)
+				.setPStages(stages)
+				.setPVertexInputState(&visci)
+				.setPInputAssemblyState(&iasci)
+				.setPViewportState(&viewportState)
+				.setPRasterizationState(&rasterizer)
+				.setPMultisampleState(&multisampling)
+				.setPDepthStencilState(&depthStencil)
+				.setPColorBlendState(&colorBlending)
+				.setPDynamicState(&dynamicState)
+				.setLayout(occupancyPipelineLayout)
+				.setRenderPass(renderPass)
+				.setSubpass(0);
+			errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &occupancyPipeline));
+			device.destroyShaderModule(vertModule);
+			device.destroyShaderModule(fragModule);
+		}
+		{
+			// JUMP FLOOD: 0: occupancy, 1: source seeds, 2: destination seeds, 3: distance
+			vk::DescriptorSetLayoutBinding bindings[4];
+			for (uint32_t i = 0; i < 4; ++i) {
+				bindings[i]
+					.setBinding(i)
+					.setDescriptorCount(1)
+					.setDescriptorType(i == 0 ? vk::DescriptorType::eCombinedImageSampler : vk::DescriptorType::eStorageImage)
+					.setStageFlags(vk::ShaderStageFlagBits::eCompute);
+			}
+			auto const dslci = vk::DescriptorSetLayoutCreateInfo()
+				.setBindingCount(4)
+				.setPBindings(bindings);
+			errCheck(device.createDescriptorSetLayout(&dslci, nullptr, &floodDescriptorSetLayout));
+
+			vk::DescriptorPoolSize poolSizes[] = {
+				vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(2),
+				vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageImage).setDescriptorCount(6) };
+			auto const dpci = vk::DescriptorPoolCreateInfo()
+				.setMaxSets(2)
+				.setPoolSizeCount(2)
+				.setPPoolSizes(poolSizes);
+			errCheck(device.createDescriptorPool(&dpci, nullptr, &floodDescriptorPool));
+			const vk::DescriptorSetLayout layouts[] = { floodDescriptorSetLayout, floodDescriptorSetLayout };
+			auto const dsai = vk::DescriptorSetAllocateInfo()
+				.setDescriptorPool(floodDescriptorPool)
+				.setDescriptorSetCount(2)
+				.setPSetLayouts(layouts);
+			errCheck(device.allocateDescriptorSets(&dsai, floodDescriptorSets));
+
+			// set i reads the seeds i and writes the other ones
+			for (uint32_t i = 0; i < 2; ++i) {
+				vk::DescriptorImageInfo imageInfos[] = {
+					vk::DescriptorImageInfo().setSampler(nearestSampler).setImageView(occupancyImageView).setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal),
+					vk::DescriptorImageInfo().setImageView(seedImageViews[i]).setImageLayout(vk::ImageLayout::eGeneral),
+					vk::DescriptorImageInfo().setImageView(seedImageViews[1 - i]).setImageLayout(vk::ImageLayout::eGeneral),
+					vk::DescriptorImageInfo().setImageView(distanceImageView).setImageLayout(vk::ImageLayout::eGeneral) };
+				vk::WriteDescriptorSet writes[4];
+				for (uint32_t b = 0; b < 4; ++b) {
+					writes[b]
+						.setDstSet(floodDescriptorSets[i])
+						.setDstBinding(b)
+						.setDescriptorCount(1)
+						.setDescriptorType(b == 0 ? vk::DescriptorType::eCombinedImageSampler : vk::DescriptorType::eStorageImage)
+						.setPImageInfo(&imageInfos[b]);
+				}
+				device.updateDescriptorSets(4, writes, 0, nullptr);
+			}
+
+			auto const pushConstantRange = vk::PushConstantRange()
+				.setStageFlags(vk::ShaderStageFlagBits::eCompute)
+				.setOffset(0)
+				.setSize(sizeof(PushConstants));
+			auto const plci = vk::PipelineLayoutCreateInfo()
+				.setSetLayoutCount(1)
+				.setPSetLayouts(&floodDescriptorSetLayout)
+				.setPushConstantRangeCount(1)
+				.setPPushConstantRanges(&pushConstantRange);
+			errCheck(device.createPipelineLayout(&plci, nullptr, &floodPipelineLayout));
+
+			AssetView code;
+			assets.read("shaders/jumpFlood.comp.spv", code);
+			vk::ShaderModule module;
+			auto const smci = vk::ShaderModuleCreateInfo()
+				.setCodeSize(code.size())
+				.setPCode(reinterpret_cast<const uint32_t*>(code.data()));
+			errCheck(device.createShaderModule(&smci, nullptr, &module));
+			auto const cpci = vk::ComputePipelineCreateInfo()
+				.setStage(vk::PipelineShaderStageCreateInfo().setStage(vk::ShaderStageFlagBits::eCompute).setModule(module).setPName("main"))
+				.setLayout(floodPipelineLayout);
+			errCheck(device.createComputePipelines(pipelineCache, 1, &cpci, nullptr, &floodPipeline));
+			device.destroyShaderModule(module);
+		}
+	}
+
+	void DistanceField::destroy()
+	{
+		for (auto &frame : frames) {
+			if (!frame.buffer)
+				continue;
+			helper.destroyBuffer(device, frame.buffer, frame.memory);
+		}
+		frames.clear();
+		if (available) {
+			if (queryPool)
+				device.destroyQueryPool(queryPool);
+			device.destroyPipeline(floodPipeline);
+			device.destroyPipelineLayout(floodPipelineLayout);
+			device.destroyDescriptorPool(floodDescriptorPool);
+			device.destroyDescriptorSetLayout(floodDescriptorSetLayout);
+			device.destroyPipeline(occupancyPipeline);
+			device.destroyPipelineLayout(occupancyPipelineLayout);
+			device.destroyFramebuffer(frameBuffer);
+			device.destroyRenderPass(renderPass);
+		}
+		device.destroySampler(nearestSampler);
+		device.destroySampler(linearSampler);
+		device.destroyImageView(occupancyImageView);
+		helper.destroyImage(device, occupancyImage, occupancyImageMem);
+		for (uint32_t i = 0; i < 2; ++i) {
+			device.destroyImageView(seedImageViews[i]);
+			helper.destroyImage(device, seedImages[i], seedImageMems[i]);
+		}
+		device.destroyImageView(distanceImageView);
+		helper.destroyImage(device, distanceImage, distanceImageMem);
+		queryPool = nullptr;
+		available = false;
+		fieldReady = false;
+	}
+
+	bool DistanceField::isAvailable() const
+	{
+		return available;
+	}
+
+	vk::DescriptorImageInfo DistanceField::getDistanceInfo() const
+	{
+		return vk::DescriptorImageInfo()
+			.setSampler(linearSampler)
+			.setImageView(distanceImageView)
+			.setImageLayout(vk::ImageLayout::eGeneral);
+	}
+
+	void DistanceField::setScale(uint32_t scale)
+	{
+		this->scale = scale > 0 ? scale : 1;
+		sums = PassTimes();
+	}
+
+	uint32_t DistanceField::getScale() const
+	{
+		return scale;
+	}
+
+	void DistanceField::resize(FrameBuffers &frame, vk::DeviceSize size)
+	{
+		if (frame.buffer) {
+			helper.destroyBuffer(device, frame.buffer, frame.memory);
+		}
+		frame.size = size;
+		helper.createBuffer(gpu, device, size, vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, frame.buffer, frame.memory);
+		frame.data = helper.mapBuffer(device, frame.buffer);
+	}
+
+	void DistanceField::readTimestamps(uint32_t frameIndex)
+	{
+		FrameBuffers &frame = frames[frameIndex];
+		if (!frame.timestamps)
+			return;
+		frame.timestamps = false;
+		// the frame's fence is waited, no need to wait for the results
+		uint64_t ticks[DISTANCE_FIELD_TIMESTAMPS];
+		if (device.getQueryPoolResults(queryPool, frameIndex * DISTANCE_FIELD_TIMESTAMPS, DISTANCE_FIELD_TIMESTAMPS, sizeof(ticks), ticks,
+			sizeof(uint64_t), vk::QueryResultFlagBits::e64) != vk::Result::eSuccess)
+			return;
+		const double toMs = timestampPeriod / 1e6;
+		sums.occupancy += (ticks[1] - ticks[0]) * toMs;
+		sums.seeds += (ticks[2] - ticks[1]) * toMs;
+		sums.flood += (ticks[3] - ticks[2]) * toMs;
+		sums.resolve += (ticks[4] - ticks[3]) * toMs;
+		++sums.gpuFrames;
+	}
+
+	void DistanceField::build()
+	{
+		// the fixtures over the field, their triangles in its ndc (the world is in meters)
+		vertices.clear();
+		fixtures.clear();
+		OccluderQuery query(fixtures);
+		b2AABB aabb;
+		aabb.lowerBound = b2Vec2(fieldMin.x * P2M, fieldMin.y * P2M);
+		aabb.upperBound = b2Vec2((fieldMin.x + fieldSize.x) * P2M, (fieldMin.y + fieldSize.y) * P2M);
+		ResourceManager::getInstance().world->QueryAABB(&query, aabb);
+
+		const glm::vec2 toNdc = 2.f / fieldSize;
+		auto const ndc = [&](const b2Vec2 &v) { return (glm::vec2(v.x * M2P, v.y * M2P) - fieldMin) * toNdc - 1.f; };
+		for (auto fixture : fixtures) {
+			if (fixture->IsSensor())
+				continue;
+			const b2Transform &xf = fixture->GetBody()->GetTransform();
+			const b2Shape *shape = fixture->GetShape();
+			if (shape->GetType() == b2Shape::e_polygon) {
+				const b2PolygonShape *polygon = static_cast<const b2PolygonShape*>(shape);
+				const glm::vec2 first = ndc(b2Mul(xf, polygon->m_vertices[0]));
+				for (int32 i = 1; i + 1 < polygon->m_count; ++i) {
+					vertices.push_back(first);
+					vertices.push_back(ndc(b2Mul(xf, polygon->m_vertices[i])));
+					vertices.push_back(ndc(b2Mul(xf, polygon->m_vertices[i + 1])));
+				}
+			}
+			else if (shape->GetType() == b2Shape::e_circle) {
+				const b2CircleShape *circle = static_cast<const b2CircleShape*>(shape);
+				const b2Vec2 c = b2Mul(xf, circle->m_p);
+				const glm::vec2 center = ndc(c);
+				for (int i = 0; i < DISTANCE_FIELD_CIRCLE_SEGMENTS; ++i) {
+					const float a0 = 6.2831853f * i / DISTANCE_FIELD_CIRCLE_SEGMENTS;
+					const float a1 = 6.2831853f * (i + 1) / DISTANCE_FIELD_CIRCLE_SEGMENTS;
+					vertices.push_back(center);
+					vertices.push_back(ndc(c + circle->m_radius * b2Vec2(std::cos(a0), std::sin(a0))));
+					vertices.push_back(ndc(c + circle->m_radius * b2Vec2(std::cos(a1), std::sin(a1))));
+				}
+			}
+		}
+	}
+
+	void DistanceField::update(uint32_t frameIndex, bool enabled, const glm::vec2 &visibleMin, const glm::vec2 &visibleMax, vk::Extent2D screen)
+	{
+		this->enabled = enabled && available;
+		if (!this->enabled)
+			return;
+		if (queryPool)
+			readTimestamps(frameIndex);
+
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		// the field covers the visible rect, with square texels, the lights off screen see no occluders off screen
+		uint32_t width = (screen.width + scale - 1) / scale;
+		uint32_t height = (screen.height + scale - 1) / scale;
+		const uint32_t largest = width > height ? width : height;
+		if (largest > DISTANCE_FIELD_MAX_SIZE) {
+			width = width * DISTANCE_FIELD_MAX_SIZE / largest;
+			height = height * DISTANCE_FIELD_MAX_SIZE / largest;
+		}
+		extent = vk::Extent2D(width > 0 ? width : 1, height > 0 ? height : 1);
+		fieldMin = visibleMin;
+		fieldSize = glm::max(visibleMax - visibleMin, glm::vec2(1.f));
+		build();
+
+		FrameBuffers &frame = frames[frameIndex];
+		const vk::DeviceSize size = vertices.size() * sizeof(glm::vec2);
+		if (size > frame.size)
+			resize(frame, size * 2);
+		memcpy(frame.data, vertices.data(), static_cast<size_t>(size));
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		sums.build += time.count();
+		++sums.frames;
+	}
+
+	void DistanceField::record(vk::CommandBuffer cmd, uint32_t frameIndex)
+	{
+		auto const fieldRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+		if (!enabled) {
+			// nothing to draw, but the field needs its layout once for the light sets
+			if (fieldReady)
+				return;
+			auto const barrier = vk::ImageMemoryBarrier()
+				.setOldLayout(vk::ImageLayout::eUndefined)
+				.setNewLayout(vk::ImageLayout::eGeneral)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(distanceImage)
+				.setSubresourceRange(fieldRange)
+				.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+			fieldReady = true;
+			return;
+		}
+
+		const uint32_t firstQuery = frameIndex * DISTANCE_FIELD_TIMESTAMPS;
+		if (queryPool) {
+			cmd.resetQueryPool(queryPool, firstQuery, DISTANCE_FIELD_TIMESTAMPS);
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool, firstQuery);
+		}
+
+		// OCCUPANCY, in the top left extent of the image
+		{
+			vk::ClearValue clearValue;
+			clearValue.setColor(vk::ClearColorValue().setFloat32({ 0.f, 0.f, 0.f, 0.f }));
+			const vk::Rect2D area({ 0, 0 }, extent);
+			auto const renderPassInfo = vk::RenderPassBeginInfo()
+				.setRenderPass(renderPass)
+				.setFramebuffer(frameBuffer)
+				.setRenderArea(area)
+				.setClearValueCount(1)
+				.setPClearValues(&clearValue);
+			cmd.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+			if (!vertices.empty()) {
+				auto const viewport = vk::Viewport()
+					.setWidth(static_cast<float>(extent.width))
+					.setHeight(static_cast<float>(extent.height))
+					.setMinDepth(0.0f)
+					.setMaxDepth(1.0f);
+				const vk::DeviceSize offset = 0;
+				cmd.setViewport(0, 1, &viewport);
+				cmd.setScissor(0, 1, &area);
+				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, occupancyPipeline);
+				cmd.bindVertexBuffers(0, 1, &frames[frameIndex].buffer, &offset);
+				cmd.draw(static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+			}
+			cmd.endRenderPass();
+		}
+		if (queryPool)
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery + 1);
+
+		// the seeds are rewritten whole, the field waits for the fragment shaders of the previous frame in flight
+		vk::ImageMemoryBarrier barriers[3];
+		for (uint32_t i = 0; i < 3; ++i) {
+			barriers[i]
+				.setOldLayout(i < 2 || !fieldReady ? vk::ImageLayout::eUndefined : vk::ImageLayout::eGeneral)
+				.setNewLayout(vk::ImageLayout::eGeneral)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(i < 2 ? seedImages[i] : distanceImage)
+				.setSubresourceRange(fieldRange)
+				.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		}
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), 0, nullptr, 0, nullptr, 3, barriers);
+		fieldReady = true;
+
+		auto const passBarrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+		PushConstants constants{ glm::ivec2(extent.width, extent.height), 0, 0, fieldSize.x / extent.width };
+		const uint32_t groupsX = (extent.width + 7) / 8;
+		const uint32_t groupsY = (extent.height + 7) / 8;
+		cmd.bindPipeline(vk::PipelineBindPoint::eCompute, floodPipeline);
+
+		// SEEDS, written in the seeds 0 (by the set writing them)
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, floodPipelineLayout, 0, 1, &floodDescriptorSets[1], 0, nullptr);
+		cmd.pushConstants(floodPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &constants);
+		cmd.dispatch(groupsX, groupsY, 1);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 1, &passBarrier, 0, nullptr, 0, nullptr);
+		if (queryPool)
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery + 2);
+
+		// FLOOD, halving steps from half the field down to 1 texel
+		uint32_t step = 1;
+		while (step * 2 < (extent.width > extent.height ? extent.width : extent.height))
+			step *= 2;
+		uint32_t current = 0; // the seeds holding the result so far
+		sums.floodPasses = 0;
+		for (; step > 0; step /= 2) {
+			constants.pass = 1;
+			constants.step = static_cast<int32_t>(step);
+			cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, floodPipelineLayout, 0, 1, &floodDescriptorSets[current], 0, nullptr);
+			cmd.pushConstants(floodPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &constants);
+			cmd.dispatch(groupsX, groupsY, 1);
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 1, &passBarrier, 0, nullptr, 0, nullptr);
+			current = 1 - current;
+			++sums.floodPasses;
+		}
+		if (queryPool)
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery + 3);
+
+		// RESOLVE, signed distance in world pixels for the fragment shaders
+		constants.pass = 2;
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, floodPipelineLayout, 0, 1, &floodDescriptorSets[current], 0, nullptr);
+		cmd.pushConstants(floodPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &constants);
+		cmd.dispatch(groupsX, groupsY, 1);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), 1, &passBarrier, 0, nullptr, 0, nullptr);
+		if (queryPool) {
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery + 4);
+			frames[frameIndex].timestamps = true;
+		}
+	}
+
+	glm::vec4 DistanceField::getWorldToUV() const
+	{
+		const glm::vec2 toUV = glm::vec2(extent.width, extent.height) / (fieldSize * static_cast<float>(DISTANCE_FIELD_MAX_SIZE));
+		return glm::vec4(fieldMin, toUV);
+	}
+
+	glm::vec2 DistanceField::getUVMax() const
+	{
+		return glm::vec2(extent.width, extent.height) / static_cast<float>(DISTANCE_FIELD_MAX_SIZE);
+	}
+
+	float DistanceField::getTexelSize() const
+	{
+		return extent.width > 0 ? fieldSize.x / extent.width : 1.f;
+	}
+
+	vk::Extent2D DistanceField::getExtent() const
+	{
+		return extent;
+	}
+
+	DistanceField::PassTimes DistanceField::getTimes() const
+	{
+		PassTimes times = sums;
+		if (sums.frames > 0)
+			times.build /= sums.frames;
+		if (sums.gpuFrames > 0) {
+			times.occupancy /= sums.gpuFrames;
+			times.seeds /= sums.gpuFrames;
+			times.flood /= sums.gpuFrames;
+			times.resolve /= sums.gpuFrames;
+		}
+		return times;
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+#include "glm_.h"
+
+#define DISTANCE_FIELD_MAX_SIZE 1024	// texels of the field images, the field of a frame uses (screen / scale) of it at most
+#define DISTANCE_FIELD_TIMESTAMPS 5		// start, after occupancy, seeds, flood, resolve
+
+class b2Fixture;
+
+namespace vm {
+	// Soft shadows traced in a signed distance field of the occluders, an alternative to the ShadowCasting volumes.
+	// Every frame the Box2D fixtures over the visible rect are rasterized into an occupancy image, a jump flood
+	// (compute, log2(size) passes) finds the nearest occupied and the nearest empty texel of every texel, and the
+	// resolve writes the signed distance in world pixels (negative inside the occluders).
+	// The fragment shaders sphere trace from the pixel to every light in it: the cost of the field does not depend
+	// on the lights, and the tracing does not depend on the occluders.
+	class DistanceField
+	{
+	public:
+		// the field image always exists (the light sets sample it), false if the shaders are missing
+		bool create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, uint32_t frameCount);
+		void destroy();
+		bool isAvailable() const;
+		vk::DescriptorImageInfo getDistanceInfo() const;
+
+		// 1, 2 or 4: the field is the screen extent divided by it (DISTANCE_FIELD_MAX_SIZE at most)
+		void setScale(uint32_t scale);
+		uint32_t getScale() const;
+
+		// the frame's fence is waited: reads its timestamps and, if enabled, rasterizes the fixtures in the visible rect
+		void update(uint32_t frameIndex, bool enabled, const glm::vec2 &visibleMin, const glm::vec2 &visibleMax, vk::Extent2D screen);
+		// outside of a render pass, before the passes sampling the field
+		void record(vk::CommandBuffer cmd, uint32_t frameIndex);
+
+		// for the shaders: world to field uv (xy min, zw scale), the uv of the used region's far corner, world pixels per texel
+		glm::vec4 getWorldToUV() const;
+		glm::vec2 getUVMax() const;
+		float getTexelSize() const;
+		vk::Extent2D getExtent() const;
+
+		// ms, averaged over the frames since the last setScale, the gpu ones from timestamps (0 without them)
+		struct PassTimes
+		{
+			double		build = 0.0;		// cpu, the occluder triangles
+			double		occupancy = 0.0;
+			double		seeds = 0.0;
+			double		flood = 0.0;
+			double		resolve = 0.0;
+			uint32_t	floodPasses = 0;
+			uint32_t	frames = 0;
+			uint32_t	gpuFrames = 0;		// frames with timestamps read back
+		};
+		PassTimes getTimes() const;
+
+	private:
+		// one per frame in flight, host visible and persistently mapped
+		struct FrameBuffers
+		{
+			vk::Buffer			buffer;
+			vk::DeviceMemory	memory;
+			void				*data = nullptr;
+			vk::DeviceSize		size = 0;
+			bool				timestamps = false;	// written by the last recording of this frame
+		};
+		struct PushConstants
+		{
+			glm::ivec2	size;
+			int32_t		step;
+			uint32_t	pass;		// 0: seeds, 1: flood, 2: resolve
+			float		texelSize;
+		};
+		vk::PhysicalDevice			gpu;
+		vk::Device					device;
+		vk::Image					occupancyImage;
+		vk::DeviceMemory			occupancyImageMem;
+		vk::ImageView				occupancyImageView;
+		vk::Image					seedImages[2];			// rgba16ui: nearest occupied texel, nearest empty texel, ping-pong of the flood
+		vk::DeviceMemory			seedImageMems[2];
+		vk::ImageView				seedImageViews[2];
+		vk::Image					distanceImage;			// r32f, in eGeneral
+		vk::DeviceMemory			distanceImageMem;
+		vk::ImageView				distanceImageView;
+		vk::Sampler					nearestSampler;
+		vk::Sampler					linearSampler;
+		vk::RenderPass				renderPass;
+		vk::Framebuffer				frameBuffer;
+		vk::PipelineLayout			occupancyPipelineLayout;
+		vk::Pipeline				occupancyPipeline;
+		vk::DescriptorSetLayout		floodDescriptorSetLayout;
+		vk::DescriptorPool			floodDescriptorPool;
+		vk::DescriptorSet			floodDescriptorSets[2];	// seeds 0 -> 1 and 1 -> 0
+		vk::PipelineLayout			floodPipelineLayout;
+		vk::Pipeline				floodPipeline;
+		vk::QueryPool				queryPool;
+		double						timestampPeriod = 0.0;	// ns per tick, 0 without timestamps
+		std::vector<FrameBuffers>	frames{};
+		bool						available = false;
+		bool						fieldReady = false;		// the distance image is in eGeneral
+		bool						enabled = false;		// this frame draws the field
+		uint32_t					scale = 2;
+
+		// this frame's field, set by update
+		vk::Extent2D				extent = vk::Extent2D(1, 1);
+		glm::vec2					fieldMin = glm::vec2(0.f);
+		glm::vec2					fieldSize = glm::vec2(1.f);
+
+		// cpu side of the build, kept between the frames
+		std::vector<b2Fixture*>		fixtures{};
+		std::vector<glm::vec2>		vertices{};			// the occluder triangles, in the ndc of the field
+		PassTimes					sums{};
+
+		Helper						helper;
+
+		void createImages();
+		void createRenderPass();
+		void createPipelines(vk::PipelineCache pipelineCache);
+		void build();
+		void resize(FrameBuffers &frame, vk::DeviceSize size);
+		void readTimestamps(uint32_t frameIndex);
+	};
+}
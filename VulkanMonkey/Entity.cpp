@@ -3,6 +3,8 @@
 
 namespace vm {
 	std::vector <Entity*>	Entity::drawList{};
+	// never destroyed, the global entities take themselves out of it when they are destroyed at exit
+	SpatialGrid				&Entity::grid = *new SpatialGrid();
 	Entity::Entity()
 	{
 		rect = Rect();
@@ -13,20 +15,55 @@ namespace vm {
 		angle = 0.0f;
 		timeScale = 1.f;
 	}
+	Entity& Entity::operator=(const Entity &other)
+	{
+		sprite = other.sprite;
+		model = other.model;
+		angle = other.angle;
+		depth = other.depth;
+		rect = other.rect;
+		timeScale = other.timeScale;
+		body = other.body;
+		// the grid keeps the address, not the bounds of what is assigned to it
+		if (grid.contains(this))
+			updateBounds();
+		return *this;
+	}
 	Entity::~Entity()
 	{
+		// the grid keys on the address, a stale one could be reused by the next entity
+		grid.remove(this);
 	}
 	void Entity::update()
 	{
 		if (!sprite) return;
 		sprite->setModelPos(model);
 		sprite->update();
+		updateBounds();
 	}
 	void Entity::draw()
 	{
 		if (!sprite) return;
+		if (!grid.markDrawn(this)) {
+			updateBounds();
+			grid.markDrawn(this);
+		}
 		Entity::drawList.push_back(this);
 	}
+	void Entity::updateBounds()
+	{
+		// the sprite's quad is [-w, w] x [-h, h] before the model matrix
+		const float w = rect.size.x;
+		const float h = rect.size.y;
+		const glm::vec4 corners[] = { { -w, -h, 0.f, 1.f }, { w, -h, 0.f, 1.f }, { w, h, 0.f, 1.f }, { -w, h, 0.f, 1.f } };
+		glm::vec2 min(FLT_MAX), max(-FLT_MAX);
+		for (auto &c : corners) {
+			glm::vec4 p = model * c;
+			min = glm::min(min, glm::vec2(p));
+			max = glm::max(max, glm::vec2(p));
+		}
+		grid.update(this, min, max);
+	}
 	void Entity::setDepth(const float depth)
 	{
 		model = glm::translate(model, glm::vec3(0.0f, 0.0f, depth - this->depth)); // e.g. new depth -1, old depth 1, then move the z coord by -2 so the z falls in the new depth value (-1)
@@ -113,5 +150,8 @@ namespace vm {
 	{ 
 		return model;
 	}
-	void Entity::destroy() {}
+	void Entity::destroy()
+	{
+		grid.remove(this);
+	}
 }
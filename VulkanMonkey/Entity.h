@@ -1,6 +1,7 @@
 #pragma once
 #include "Sprite.h"
 #include "include/Box2D/Box2D.h"
+#include "SpatialGrid.h"
 #define M2P 60.0f
 #define P2M 1/M2P
 
@@ -9,8 +10,11 @@ namespace vm {
 	public:
 		static std::vector<Entity*>		drawList;
 		static std::vector<Entity>		entities;
+		static SpatialGrid				&grid;		// world bounds of the sprites, for the visibility culling
 
 		Entity();
+		Entity(const Entity &other) = default;	// the copy is not in the grid, its next update or draw puts it there
+		Entity& operator=(const Entity &other);
 		~Entity();
 
 	private:
@@ -21,6 +25,8 @@ namespace vm {
 		Rect						rect;
 		double						timeScale;
 
+		void updateBounds();
+
 	public:
 		b2Body						*body;
 
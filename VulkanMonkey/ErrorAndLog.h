@@ -24,6 +24,16 @@
 		os_ << s;									\
 	}
 #endif
+// the results of the benchmarks and the reports, in every build (LOG is for the diagnostics of the debug builds)
+#ifdef _DEBUG
+#define REPORT( s ) LOG( s )
+#else
+#define REPORT( s )								\
+	{												\
+		std::cout << s;								\
+		std::cout.flush();							\
+	}
+#endif
 #define errCheck( x )								\
 	{												\
 		if (x != vk::Result::eSuccess)				\
@@ -0,0 +1,129 @@
+#include "FrameAllocator.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+
+namespace vm {
+	void FrameAllocator::create(vk::DeviceSize frameSize, uint32_t frameCount, vk::BufferUsageFlags usage)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		vk::PhysicalDeviceLimits &limits = rm.getGpuProperties().limits;
+
+		alignment = limits.minUniformBufferOffsetAlignment > 16 ? limits.minUniformBufferOffsetAlignment : 16;
+		if (limits.minStorageBufferOffsetAlignment > alignment)
+			alignment = limits.minStorageBufferOffsetAlignment;
+		atomSize = limits.nonCoherentAtomSize > 0 ? limits.nonCoherentAtomSize : 1;
+		// regions start on an alignment (and flush atom) boundary
+		vk::DeviceSize regionAlignment = alignment > atomSize ? alignment : atomSize;
+		this->frameSize = (frameSize + regionAlignment - 1) / regionAlignment * regionAlignment;
+		this->frameCount = frameCount;
+
+		vk::DeviceSize size = this->frameSize * frameCount;
+		helper.createBuffer(rm.getGpu(), rm.getDevice(), size, usage, vk::MemoryPropertyFlagBits::eHostVisible, buffer, memory);
+
+		// find out if the memory type the buffer ended up in needs explicit flushes
+		vk::MemoryRequirements memRequirements;
+		rm.getDevice().getBufferMemoryRequirements(buffer, &memRequirements);
+		uint32_t memType = helper.findMemoryType(rm.getGpu(), memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible);
+		isCoherent = static_cast<bool>(rm.getGpu().getMemoryProperties().memoryTypes[memType].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+		// persistent mapping of all the regions, the buffer may be a range of a shared block
+		mapped = static_cast<char*>(helper.mapBuffer(rm.getDevice(), buffer));
+		memoryOffset = helper.getBufferMemoryOffset(buffer);
+
+		frameStart = 0;
+		head = 0;
+	}
+
+	void FrameAllocator::destroy()
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		for (auto &r : retired)
+			helper.destroyBuffer(rm.getDevice(), r.buffer, r.memory);
+		retired.clear();
+		if (!buffer)
+			return;
+		helper.destroyBuffer(rm.getDevice(), buffer, memory);
+		buffer = nullptr;
+		memory = nullptr;
+		mapped = nullptr;
+	}
+
+	void FrameAllocator::retire(uint64_t frameNumber)
+	{
+		if (!buffer)
+			return;
+		retired.push_back({ buffer, memory, frameNumber });
+		buffer = nullptr;
+		memory = nullptr;
+		mapped = nullptr;
+	}
+
+	void FrameAllocator::update(uint64_t frameNumber, uint32_t framesInFlight)
+	{
+		// the fence of frame (frameNumber - framesInFlight) is waited, the frames before it are done too
+		ResourceManager &rm = ResourceManager::getInstance();
+		for (auto it = retired.begin(); it != retired.end();) {
+			if (frameNumber < it->frameNumber + framesInFlight) {
+				++it;
+				continue;
+			}
+			helper.destroyBuffer(rm.getDevice(), it->buffer, it->memory);
+			it = retired.erase(it);
+		}
+	}
+
+	void FrameAllocator::beginFrame(uint32_t frameIndex)
+	{
+		// the caller has waited the fence of this frame, so its whole region is free again
+		frameStart = (frameIndex % frameCount) * frameSize;
+		head = 0;
+	}
+
+	bool FrameAllocator::allocate(vk::DeviceSize size, vk::DeviceSize &offset, void **data)
+	{
+		vk::DeviceSize start = (head + alignment - 1) / alignment * alignment;
+		if (!mapped || start + size > frameSize)
+			return false;
+
+		offset = frameStart + start;
+		*data = mapped + offset;
+		head = start + size;
+		return true;
+	}
+
+	void FrameAllocator::flush()
+	{
+		if (isCoherent || head == 0)
+			return;
+
+		// one range for everything written this frame, rounded to the flush atom
+		vk::DeviceSize size = (head + atomSize - 1) / atomSize * atomSize;
+		if (size > frameSize)
+			size = frameSize;
+		auto const range = vk::MappedMemoryRange()
+			.setMemory(memory)
+			.setOffset(memoryOffset + frameStart)
+			.setSize(size);
+		errCheck(ResourceManager::getInstance().getDevice().flushMappedMemoryRanges(1, &range));
+	}
+
+	vk::Buffer& FrameAllocator::getBuffer()
+	{
+		return buffer;
+	}
+
+	vk::DeviceSize FrameAllocator::getFrameSize() const
+	{
+		return frameSize;
+	}
+
+	vk::DeviceSize FrameAllocator::getUsedSize() const
+	{
+		return head;
+	}
+
+	vk::DeviceSize FrameAllocator::getAlignment() const
+	{
+		return alignment;
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+
+namespace vm {
+	// One persistently mapped host visible buffer split in a region per frame in flight.
+	// Every frame resets its region and bump-allocates the transient uniform/instance data
+	// of the sprites that are actually drawn, then flushes the used range once.
+	class FrameAllocator
+	{
+	public:
+		void create(vk::DeviceSize frameSize, uint32_t frameCount, vk::BufferUsageFlags usage);
+		void destroy();
+		// the frames in flight may still read the buffer: it is destroyed by update once they are done, create makes the next one
+		void retire(uint64_t frameNumber);
+		void update(uint64_t frameNumber, uint32_t framesInFlight);
+
+		void beginFrame(uint32_t frameIndex);
+		// offset is from the start of the buffer (usable as a dynamic offset), false if the frame region is full
+		bool allocate(vk::DeviceSize size, vk::DeviceSize &offset, void **data);
+		void flush();
+
+		vk::Buffer& getBuffer();
+		vk::DeviceSize getFrameSize() const;
+		vk::DeviceSize getUsedSize() const; // bytes allocated in the current frame
+		vk::DeviceSize getAlignment() const; // every allocation starts on this, at least min(Uniform|Storage)BufferOffsetAlignment
+
+	private:
+		struct RetiredBuffer
+		{
+			vk::Buffer			buffer;
+			vk::DeviceMemory	memory;
+			uint64_t			frameNumber;	// the first frame not reading it
+		};
+		vk::Buffer				buffer;
+		vk::DeviceMemory		memory;
+		char					*mapped = nullptr;
+		vk::DeviceSize			memoryOffset = 0;	// of the buffer in its memory, the flushed ranges are from there
+		vk::DeviceSize			frameSize = 0;
+		uint32_t				frameCount = 0;
+		vk::DeviceSize			frameStart = 0;
+		vk::DeviceSize			head = 0;			// next free byte, relative to frameStart
+		vk::DeviceSize			alignment = 1;
+		vk::DeviceSize			atomSize = 1;		// nonCoherentAtomSize, for flushing
+		bool					isCoherent = false;
+		std::vector<RetiredBuffer>	retired{};
+		Helper					helper;
+	};
+}
@@ -2,6 +2,11 @@
 #include <sstream>
 #include "ErrorAndLog.h"
 #include "ResourceManager.h"
+#include "MemoryAllocator.h"
+#include <chrono>
+#include <algorithm>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb-master/stb_image_write.h>
 
 namespace vm {
 	Game::Game()
@@ -10,31 +15,81 @@ namespace vm {
 		gameState = GameState::Running;
 		limitedFps = 0;
 		limitedSeconds = 0;
+		headlessFrames = 0;
+		distanceFieldScale = 0;
+		benchmarkZoom = 0;
+		shadowBenchmark = false;
+		assetArchivePath = ASSET_ARCHIVE;
+		worstFrameTime = 0;
+		hitchCount = 0;
+		spriteCount = 500;
 	}
 
 	Game::~Game()
 	{
-		for (auto &s : Sprite::sprites) {
-			delete s;
-			s = nullptr;
-		}
-
-		Sprite::sprites.clear();
+		// every sprite takes itself out of the list
+		while (!Sprite::sprites.empty())
+			delete Sprite::sprites.back();
 	}
 
 	void vm::Game::run()
 	{
+		double const loadStart = glfwGetTime();
+		// before anything is loaded, the shaders and the textures are read from it
+		AssetArchive &assetArchive = ResourceManager::getInstance().assetArchive;
+		if (!assetArchivePath.empty() && assetArchive.open(assetArchivePath)) {
+			REPORT("Assets from " << assetArchivePath.c_str() << " (" << assetArchive.getEntryCount() << " packed, " << assetArchive.getMappedSize() / 1024 << " KB mapped)\n");
+		}
 		load();
 		init();
-		if (!window.getWindow()) {
+		if (!window.getWindow() && !window.isHeadless()) {
 			LOG("window not created\n");
 			exit(-1);
 		}
 		window.getRenderer().pushSpritesToBuffers();
+		if (distanceFieldScale) {
+			window.getRenderer().setShadowMode(ShadowMode::DistanceField);
+			window.getRenderer().setDistanceFieldScale(distanceFieldScale);
+		}
+		if (benchmarkZoom > 0) {
+			Renderer &r = window.getRenderer();
+			r.mainCamera.addZoom(benchmarkZoom - r.mainCamera.getZoom(), r.swapchainExtent.width, r.swapchainExtent.height);
+		}
+		// the scene is on the gpu once pushSpritesToBuffers flushed the uploads
+		double const loadTime = (glfwGetTime() - loadStart) * 1000.0;
+		UploadContext &uploadContext = ResourceManager::getInstance().uploadContext;
+		REPORT("Load time: " << loadTime << " ms, " << uploadContext.getUploadCount() << " uploads in " << uploadContext.getSubmitCount() << " submits" << (uploadContext.usesTransferQueue() ? " (transfer queue)" : "") << (assetArchive.isOpen() ? " (asset archive)" : " (loose files)") << "\n");
+		const TextureCooker &cooker = ResourceManager::getInstance().textureCooker;
+		if (cooker.getLoadCount()) {
+			REPORT("Cooked textures: " << cooker.getLoadCount() << " in " << cooker.getLoadTime() << " ms (" << cooker.getCookCount() << " cooked now in " << cooker.getCookTime() << " ms), " << cooker.getCookedBytes() / 1024 << " KB, " << cooker.getUncompressedBytes() / 1024 << " KB as rgba8\n");
+		}
+		TextureStreamer &streamer = ResourceManager::getInstance().textureStreamer;
+		bool texturesResident = streamer.getPendingCount() == 0;
+		const TextureResidency &residency = ResourceManager::getInstance().textureResidency;
+		vk::DeviceSize residentBytesSum = 0;
+		// the headless frames are split evenly between the phases, the first frames of each are left out
+		const uint32_t phaseFrames = window.isHeadless() && !benchmarkPhases.empty() ? std::max(headlessFrames / static_cast<uint32_t>(benchmarkPhases.size()), 1u) : 0;
+		size_t phase = benchmarkPhases.size();
+		double phaseRecordSum = 0, phaseFrameSum = 0;
+		uint32_t phaseSamples = 0;
+		auto const logPhase = [&]() {
+			if (phase < benchmarkPhases.size()) {
+				REPORT("Benchmark, " << benchmarkPhases[phase].name.c_str() << ": " << phaseSamples << " frames, record: " << (phaseSamples ? phaseRecordSum / phaseSamples : 0.0) << " ms, " << (phaseSamples ? phaseFrameSum * 1000.0 / phaseSamples : 0.0) << " ms per frame\n");
+			}
+		};
 		int frame = 0;
 		delta = 0;
 		double deltaTemp = 1;
-		while (!window.shouldClose()) {
+		auto const loopStart = std::chrono::high_resolution_clock::now();
+		while (window.isHeadless() ? frame < static_cast<int>(headlessFrames) : !window.shouldClose()) {
+
+			if (phaseFrames && frame % phaseFrames == 0 && frame / phaseFrames < benchmarkPhases.size()) {
+				logPhase();
+				phase = frame / phaseFrames;
+				benchmarkPhases[phase].apply(window.getRenderer());
+				phaseRecordSum = phaseFrameSum = 0;
+				phaseSamples = 0;
+			}
 
 			double startTime = glfwGetTime();
 
@@ -61,6 +116,7 @@ namespace vm {
 			if (deltaTemp > 1) {
 				std::stringstream ss;
 				ss << window.getRenderer().getGpuName() << "    Max FPS limit: " << (limitedFps == 0 ? "MAX" : std::to_string((int)limitedFps).c_str()) << "  -  AVRG FPS: " << (int)fps;
+				ss << "  -  Frame time: " << (fps > 0 ? 1000.0 / fps : 0.0) << " ms";
 				window.setWindowTitle(ss.str());
 				deltaTemp = 0;
 			}
@@ -69,15 +125,142 @@ namespace vm {
 
 			double stopTime = glfwGetTime();
 			delta = stopTime - startTime;
+			// the first frame waits for the pipelines and the scene uploads, it is part of the load
+			if (frame > 0) {
+				worstFrameTime = std::max(worstFrameTime, delta);
+				if (delta > HITCH_TIME)
+					++hitchCount;
+			}
+			residentBytesSum += residency.getResidentBytes();
+			if (phaseFrames && frame - phase * phaseFrames >= BENCHMARK_WARMUP_FRAMES) {
+				phaseRecordSum += window.getRenderer().getLastRecordTime();
+				phaseFrameSum += delta;
+				++phaseSamples;
+			}
+			if (!texturesResident && streamer.getPendingCount() == 0) {
+				texturesResident = true;
+				REPORT("Textures resident: " << (glfwGetTime() - loadStart) * 1000.0 << " ms after the start, " << streamer.getResidentCount() << " streamed, decode " << streamer.getDecodeTime() << " ms on the streaming threads\n");
+			}
 
 			// limit fps
 			if (limitedFps > 0 && delta < limitedSeconds) {
 				while (glfwGetTime() - startTime < limitedSeconds) {}
 				delta = glfwGetTime() - startTime;
 			}
+			++frame;
+		}
+
+		if (window.isHeadless()) {
+			std::chrono::duration<double, std::milli> const loopTime = std::chrono::high_resolution_clock::now() - loopStart;
+			Renderer &r = window.getRenderer();
+			REPORT("Headless: " << frame << " frames, " << Sprite::sprites.size() << " sprites, " << (frame > 0 ? loopTime.count() / frame : 0.0) << " ms per frame, record: " << r.getRecordTime() << " ms, descriptor binds: " << r.getDescriptorBindCount() << ", hitches: " << hitchCount << " (worst " << worstFrameTime * 1000.0 << " ms)\n");
+			REPORT("Record: " << r.getRecordTime() << " ms" << (r.getSpriteBatching() ? " (batched)" : "") << (r.getTextureArray() ? " (texture array)" : "") << " (" << r.getRecordThreads() << " threads), sort: " << r.getSortTime() << " ms, " << (r.getGpuCulling() ? "gpu culled: " : "visible: ") << r.getVisibleCount() << " sprites");
+			if (r.getGpuCulling()) {
+				REPORT(", " << r.getIndirectDrawCount() << " indirect draws\n");
+			}
+			else {
+				REPORT(" (culled: " << r.getCulledCount() << (r.getCulling() ? ")\n" : ", off)\n"));
+			}
+			REPORT("Lights: " << r.getLightCount() << " (per tile avg " << r.getAverageLightsPerTile() << ", max " << r.getMaxLightsPerTile() << ", " << r.getLightCullTime() << " ms)" << (r.getDeferredLighting() ? " (deferred)" : ""));
+			if (r.getShadowMode() == ShadowMode::Volumes) {
+				REPORT(", shadows: " << r.getShadowLightCount() << " lights, " << r.getShadowEdgeCount() << " edges, " << r.getShadowBuildTime() << " ms");
+			}
+			REPORT("\n");
+			REPORT("Frames in flight: " << r.getFramesInFlight() << " (wait: " << r.getFenceWaitTime() << " ms, latency: " << r.getFrameLatency() << " ms), pipelines: " << r.getPipelineCreateTime() << " ms, resize: " << r.getResizeTime() << " ms (" << r.getResizeCount() << ")\n");
+			REPORT("Sprite slots: " << ResourceManager::getInstance().spriteStorage.getCapacity() << " (grown " << ResourceManager::getInstance().spriteStorage.getGrowCount() << "x), " << ResourceManager::getInstance().descriptorAllocator.getPoolCount() << " descriptor pools, " << MemoryAllocator::getInstance().getStats().deviceMemoryCount << " device memory allocations\n");
+			REPORT("Streaming: " << (streamer.isEnabled() ? "" : "off, ") << streamer.getPendingCount() << " pending, " << streamer.getResidentCount() << " resident (decode " << streamer.getDecodeTime() << " ms, upload " << streamer.getUpdateTime() << " ms, max " << streamer.getMaxUpdateTime() << " ms)\n");
+			logPhase();
+			std::vector<unsigned char> pixels;
+			if (r.readFrame(pixels)) {
+				const int w = static_cast<int>(r.swapchainExtent.width);
+				const int h = static_cast<int>(r.swapchainExtent.height);
+				stbi_write_png("headless.png", w, h, 4, pixels.data(), w * 4);
+			}
+			if (distanceFieldScale) {
+				const DistanceField::PassTimes t = r.getDistanceFieldTimes();
+				const vk::Extent2D e = r.getDistanceFieldExtent();
+				if (r.getShadowMode() != ShadowMode::DistanceField) {
+					REPORT("Distance field: not available (shaders missing)\n");
+				}
+				else {
+					REPORT("Distance field: " << e.width << "x" << e.height << " (1/" << distanceFieldScale << "), " << t.frames << " frames (" << t.gpuFrames << " timed on the gpu), build: " << t.build << " ms, occupancy: " << t.occupancy << " ms, seeds: " << t.seeds << " ms, flood: " << t.flood << " ms (" << t.floodPasses << " passes), resolve: " << t.resolve << " ms\n");
+				}
+			}
+			REPORT("Texture residency: " << (frame > 0 ? residentBytesSum / frame / 1024 : 0) << " KB per frame on average, peak " << residency.getPeakBytes() / 1024 << " KB, budget " << residency.getBudget() / 1024 << " KB, " << residency.getOverBudgetFrames() << " frames over it, " << residency.getEvictCount() << " evicted, " << residency.getReloadCount() << " reloaded, " << residency.getLowerCount() << " tiers lower, " << residency.getRaiseCount() << " raised, " << ResourceManager::getInstance().descriptorAllocator.getReuseCount() << " descriptor sets reused\n");
+			if (benchmarkZoom > 0) {
+				const ResourceManager &rm = ResourceManager::getInstance();
+				REPORT("Zoom: " << r.mainCamera.getZoom() << ", mips: " << (rm.mipmaps ? "on" : "off") << " (" << uploadContext.getMipBlitCount() << " blitted, " << rm.cpuMipTextures << " made on the cpu, " << rm.mipBytes / 1024 << " KB)\n");
+			}
+			if (shadowBenchmark)
+				r.logShadowBenchmark();
 		}
 	}
 
+	void Game::setHeadless(uint32_t frames)
+	{
+		window.setHeadless(true);
+		headlessFrames = frames;
+	}
+
+	void Game::setDistanceFieldBenchmark(uint32_t scale)
+	{
+		distanceFieldScale = scale;
+	}
+
+	void Game::setZoomBenchmark(float zoom)
+	{
+		benchmarkZoom = zoom;
+	}
+
+	void Game::setMipmaps(bool mipmaps)
+	{
+		ResourceManager::getInstance().mipmaps = mipmaps;
+	}
+
+	void Game::setTextureCooking(bool cooking)
+	{
+		ResourceManager::getInstance().textureCooker.setEnabled(cooking);
+	}
+
+	void Game::setTextureStreaming(bool streaming)
+	{
+		ResourceManager::getInstance().textureStreamer.setEnabled(streaming);
+	}
+
+	void Game::setAssetArchive(const std::string &path)
+	{
+		assetArchivePath = path;
+	}
+
+	void Game::setSpriteCount(uint32_t count)
+	{
+		spriteCount = count;
+	}
+
+	void Game::setBatchingBenchmark(bool enable)
+	{
+		if (!enable)
+			return;
+		benchmarkPhases.push_back({ "batching on", [](Renderer &r) { r.setSpriteBatching(true); } });
+		benchmarkPhases.push_back({ "batching off", [](Renderer &r) { r.setSpriteBatching(false); } });
+	}
+
+	void Game::setRecordThreadsBenchmark(const std::vector<uint32_t> &threadCounts)
+	{
+		for (uint32_t count : threadCounts)
+			benchmarkPhases.push_back({ std::to_string(count) + " record threads", [count](Renderer &r) { r.setRecordThreads(count); } });
+	}
+
+	void Game::setShadowBenchmark(bool enable)
+	{
+		shadowBenchmark = enable;
+	}
+
+	void Game::setTextureBudget(uint32_t megabytes)
+	{
+		ResourceManager::getInstance().textureResidency.setBudget(megabytes * 1024ull * 1024ull);
+	}
+
 	void Game::load()
 	{
 	}
@@ -93,6 +276,7 @@ namespace vm {
 	void vm::Game::draw()
 	{
 		Entity::drawList.clear();
+		Entity::grid.beginFrame();
 	}
 
 	void vm::Game::checkInput(double delta)
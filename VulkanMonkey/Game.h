@@ -2,6 +2,12 @@
 #include "Renderer.h"
 #include "Window.h"
 #include "Light.h"
+#include <deque>
+#include <functional>
+
+#define HITCH_TIME 0.05 // s, a frame longer than this counts as a hitch
+#define BENCHMARK_WARMUP_FRAMES 4 // frames of a benchmark phase left out of its average, the setting settles in them
+
 namespace vm {
 	enum class GameState {
 		Paused,
@@ -15,6 +21,30 @@ namespace vm {
 		~Game();
 
 		void run(); // the game loop
+		// no window, runs the given number of frames offscreen, logs the frame times and saves the last frame
+		void setHeadless(uint32_t frames);
+		// runs with the distance field shadows at the given scale, the headless log gets their pass times
+		void setDistanceFieldBenchmark(uint32_t scale);
+		// starts zoomed out to the given zoom (the camera's is 1.1), the headless log gets the texture mip stats
+		void setZoomBenchmark(float zoom);
+		// off: the textures get level 0 only, to compare the frame times of a zoom benchmark with and without mips
+		void setMipmaps(bool mipmaps);
+		// off: the textures are decoded and uploaded as rgba8 even if the gpu takes bc, to compare the load times and memory
+		void setTextureCooking(bool cooking);
+		// off: the textures are loaded while the sprites are created, to compare the load time and the hitches
+		void setTextureStreaming(bool streaming);
+		// the device memory of the textures with an image of their own, over it the least recently drawn are evicted, 0: no budget
+		void setTextureBudget(uint32_t megabytes);
+		// the packed assets to read instead of the loose files (ASSET_ARCHIVE by default), empty: the loose files
+		void setAssetArchive(const std::string &path);
+		// the sprites the scene is made with (500 by default), load() spreads them over an area growing with their count
+		void setSpriteCount(uint32_t count);
+		// headless: the frames are split between sprite batching on and off, the log gets the average record time of both
+		void setBatchingBenchmark(bool enable);
+		// headless: the frames are split between the record thread counts, the log gets the average record time of each
+		void setRecordThreadsBenchmark(const std::vector<uint32_t> &threadCounts);
+		// headless: the cpu times of the shadow volumes of 20 to 200 lights over the scene are logged after the frames
+		void setShadowBenchmark(bool enable);
 
 	public:
 		virtual void init();
@@ -38,13 +68,28 @@ namespace vm {
 	protected:
 		GameState gameState;
 		Window window;
-		PointLight pointLight[MAX_POINT_LIGHTS]; // must have well defined pointLights here and at the shader, because lights are passed as one big uniform block array in every draw call;
+		std::deque<PointLight> pointLight; // a deque, the lights register their address in PointLight::lightPool
+		uint32_t spriteCount;
 
 	private:
+		// a share of the headless frames run with a setting applied, logged with its average times
+		struct BenchmarkPhase
+		{
+			std::string name;
+			std::function<void(Renderer&)> apply;
+		};
 		double delta;
 		double timeScale;
 		unsigned int limitedFps;
 		double limitedSeconds;
+		uint32_t headlessFrames;
+		uint32_t distanceFieldScale;	// 0: no distance field benchmark
+		float benchmarkZoom;			// 0: no zoom benchmark
+		bool shadowBenchmark;
+		double worstFrameTime;			// s, since the first frame
+		uint32_t hitchCount;			// frames longer than HITCH_TIME
+		std::string assetArchivePath;
+		std::vector<BenchmarkPhase> benchmarkPhases;
 	};
 }
 
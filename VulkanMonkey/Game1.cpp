@@ -1,6 +1,12 @@
 #include "Game1.h"
+#include "MemoryAllocator.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
 #include <chrono>
 #include <random>
+#include <list>
+
+#define BULLET_LIFE 2.0
 
 namespace vm {
 	void windowResizedCallback(GLFWwindow* window, int width, int height);
@@ -10,7 +16,14 @@ namespace vm {
 	Camera *camera;
 	Entity player;
 	Entity lightObj;
-	std::vector<Entity> objects;
+	std::deque<Entity> objects;	// a deque so the entities never move as they are added (the grid and the lights keep their address)
+
+	// sprites created and deleted while the game runs, a list so the entities never move (the grid keeps their address)
+	struct Bullet {
+		Entity	entity;
+		double	life;
+	};
+	std::list<Bullet> bullets;
 
 	void Game1::load()
 	{
@@ -21,7 +34,9 @@ namespace vm {
 		window.setKeyCallback(keysCallback);
 		window.setScrollCallback(scroll_callback);
 
-		const float SCALE = 1.f;
+		// 5 sprites per row of the loop, the area and the walls grow with their count over the 500 by default
+		const int rows = std::max(static_cast<int>(spriteCount / 5), 1);
+		const float SCALE = std::max(rows / 100.f, 1.f);
 
 		auto seed = std::chrono::system_clock::now().time_since_epoch().count();
 		std::default_random_engine gen((unsigned int)seed);
@@ -46,7 +61,7 @@ namespace vm {
 		player.body->SetGravityScale(0.f);
 
 		Rect rect1;
-		for (int i = 0; i < 100 * SCALE; i++) {
+		for (int i = 0; i < rows; i++) {
 			rect1 = { b2Vec2(x(gen), y(gen)), b2Vec2(w(gen), h(gen)) };
 			rect1.size.y = rect1.size.x;
 			objects.push_back(Entity());
@@ -141,6 +156,7 @@ namespace vm {
 		objects.back().body->SetType(b2BodyType::b2_kinematicBody);
 
 
+		pointLight.resize(20);
 		PointLight &light1 = pointLight[1];
 		light1.attachTo(lightObj.getTranslationMat());
 		light1.setLightAlpha(.8f);
@@ -151,7 +167,7 @@ namespace vm {
 		pointLight[0].setLightAlpha(1.f);
 		pointLight[0].setRadius(100.f);
 		pointLight[0].turnOn();
-		for (int i = 2; i < MAX_POINT_LIGHTS; i++) {
+		for (size_t i = 2; i < pointLight.size() && i * 5 < objects.size(); i++) {
 			pointLight[i].attachTo(objects[i*5].getTranslationMat());
 			pointLight[i].setLightAlpha(.6f);
 			pointLight[i].setRadius(20.f);
@@ -168,7 +184,7 @@ namespace vm {
 		// init the main Camera
 		Renderer &r = window.getRenderer();
 		camera = window.getRenderer().getMainCamera();
-		camera->init(r.swapchainExtent.width, r.swapchainExtent.height, r.gpu, r.device, r.gpuProperties);
+		camera->init(r.swapchainExtent.width, r.swapchainExtent.height, r.gpu, r.device, r.gpuProperties, MAX_FRAMES_IN_FLIGHT);
 
 		// init all sprites to the staring position
 		// (this is not necessary unless the object will not get updated later)
@@ -192,14 +208,27 @@ namespace vm {
 		lt.p.x = static_cast<float>(cos(move) * 5.0);
 		lt.p.y = -abs(static_cast<float>(sin(move) * 5.0));
 		lightObj.setTransform(lt);
-		for (int i = 0; i < MAX_POINT_LIGHTS; i++)
-			pointLight[i].update();
+		for (auto &light : pointLight)
+			light.update();
 
 		for (auto &e : objects) {
 			if (e.hasBody()) 
 				e.setTransform(e.body->GetTransform());
 			e.update();
 		}
+		for (auto it = bullets.begin(); it != bullets.end();) {
+			it->life -= delta;
+			if (it->life > 0.0) {
+				it->entity.setTransform(it->entity.body->GetTransform());
+				it->entity.update();
+				++it;
+				continue;
+			}
+			ResourceManager::getInstance().world->DestroyBody(it->entity.body);
+			it->entity.destroy();
+			delete &it->entity.getSprite();
+			it = bullets.erase(it);
+		}
 		if (player.hasBody())
 			player.setTransform(player.body->GetTransform());
 		player.update();
@@ -215,7 +244,52 @@ namespace vm {
 		for (auto &e : objects) {
 			e.draw();
 		}
-		window.getRenderer().summit(true);
+		for (auto &b : bullets) {
+			b.entity.draw();
+		}
+		window.getRenderer().summit();
+	}
+
+	void Game1::addLights(uint32_t count)
+	{
+		if (objects.empty())
+			return;
+		static std::mt19937 rng(7);
+		std::uniform_real_distribution<float> offset(-200.f, 200.f);
+		for (uint32_t i = 0; i < count; i++) {
+			Entity &e = objects[rng() % objects.size()];
+			glm::vec4 pos = e.getTranslationMat()[3];
+			pointLight.emplace_back();
+			PointLight &light = pointLight.back();
+			light.setPos(glm::vec2(pos.x + offset(rng), pos.y + offset(rng)));
+			light.setLightAlpha(.3f);
+			light.setRadius(8.f);
+			light.turnOn();
+		}
+		LOG(pointLight.size() << " point lights\n");
+	}
+
+	void Game1::spawnBullets(uint32_t count)
+	{
+		static std::mt19937 rng(11);
+		std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+		const glm::vec4 pos = player.getTranslationMat()[3];
+		for (uint32_t i = 0; i < count; i++) {
+			const float a = angle(rng);
+			const b2Vec2 dir(cos(a), sin(a));
+			Rect rect{ b2Vec2(pos.x + dir.x * 60.f, pos.y + dir.y * 60.f), b2Vec2(4, 4) };
+
+			bullets.emplace_back();
+			Bullet &b = bullets.back();
+			b.life = BULLET_LIFE;
+			b.entity.setSprite(new Sprite(rect, { "textures/circle.png" })); // a loaded texture, no new dSet
+			b.entity.setDepth(0.1f);
+			b.entity.createBody2D(rect.pos.x, rect.pos.y);
+			b.entity.addCircleShape(rect.size.x);
+			b.entity.body->SetBullet(true);
+			b.entity.body->SetGravityScale(0.f);
+			b.entity.body->SetLinearVelocity(10.f * dir);
+		}
 	}
 
 	void Game1::checkInput(double delta)
@@ -297,6 +371,54 @@ namespace vm {
 		if (key == GLFW_KEY_ESCAPE && action == GLFW_RELEASE)
 			glfwSetWindowShouldClose(window, GLFW_TRUE);
 
+		if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setSpriteBatching(!r.getSpriteBatching());
+		}
+		if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setTextureArray(!r.getTextureArray());
+		}
+		if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setFramesInFlight(r.getFramesInFlight() % MAX_FRAMES_IN_FLIGHT + 1); // 1, 2, 3, 1...
+		}
+		if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setCulling(!r.getCulling());
+		}
+		if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setGpuCulling(!r.getGpuCulling());
+		}
+		if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setRecordThreads(r.getRecordThreads() >= MAX_RECORD_THREADS ? 1 : r.getRecordThreads() * 2); // 1, 2, 4, 8, 1...
+		}
+		if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setDeferredLighting(!r.getDeferredLighting());
+		}
+		if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+			app->addLights(1000);
+		}
+		if (key == GLFW_KEY_X && action == GLFW_PRESS) {
+			app->spawnBullets(500);
+		}
+		if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+			// off -> volumes -> distance field -> off
+			Renderer &r = app->getWindow().getRenderer();
+			const ShadowMode mode = r.getShadowMode();
+			r.setShadowMode(mode == ShadowMode::Off ? ShadowMode::Volumes : mode == ShadowMode::Volumes ? ShadowMode::DistanceField : ShadowMode::Off);
+		}
+		if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+			Renderer &r = app->getWindow().getRenderer();
+			r.setDistanceFieldScale(r.getDistanceFieldScale() >= 4 ? 1 : r.getDistanceFieldScale() * 2);
+		}
+		if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+			MemoryAllocator::getInstance().logStats();
+		}
+
 		if (key == GLFW_KEY_KP_ADD && (action == GLFW_REPEAT || action == GLFW_PRESS)) {
 			app->setMaxFPS(app->getMaxFps() + 30);
 		}
@@ -12,5 +12,7 @@ namespace vm {
 		void update(double delta) override;
 		void draw() override;
 		void checkInput(double delta) override;
+		void addLights(uint32_t count); // small static lights around the objects, for the tiled lighting
+		void spawnBullets(uint32_t count); // shot from the player in every direction, deleted after BULLET_LIFE seconds
 	};
 }
\ No newline at end of file
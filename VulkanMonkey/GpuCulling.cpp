@@ -0,0 +1,234 @@
+#include "GpuCulling.h"
+#include "ResourceManager.h"
+#include "Vertex.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+
+namespace vm {
+	bool GpuCulling::create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, const vk::PhysicalDeviceFeatures &features, uint32_t maxSprites, uint32_t frameCount)
+	{
+		this->gpu = gpu;
+		this->device = device;
+		this->maxSprites = maxSprites > 0 ? maxSprites : 1;
+		multiDrawIndirect = features.multiDrawIndirect == VK_TRUE;
+		// the batches draw their instances from firstInstance, in the shared instance buffer
+		if (!features.drawIndirectFirstInstance) {
+			LOG("drawIndirectFirstInstance is not supported, gpu culling is disabled\n");
+			return false;
+		}
+
+		AssetView code;
+		if (!ResourceManager::getInstance().assetArchive.read("shaders/cullSprites.comp.spv", code)) {
+			LOG("shaders/cullSprites.comp.spv not found, gpu culling is disabled\n");
+			return false;
+		}
+
+		// 0: sprites (frame allocator, dynamic offset), 1: instances, 2: indirect commands
+		vk::DescriptorSetLayoutBinding bindings[3];
+		for (uint32_t i = 0; i < 3; ++i) {
+			bindings[i]
+				.setBinding(i)
+				.setDescriptorCount(1)
+				.setDescriptorType(i == 0 ? vk::DescriptorType::eStorageBufferDynamic : vk::DescriptorType::eStorageBuffer)
+				.setStageFlags(vk::ShaderStageFlagBits::eCompute);
+		}
+		auto const dslci = vk::DescriptorSetLayoutCreateInfo()
+			.setBindingCount(3)
+			.setPBindings(bindings);
+		errCheck(device.createDescriptorSetLayout(&dslci, nullptr, &descriptorSetLayout));
+
+		auto const pushConstantRange = vk::PushConstantRange()
+			.setStageFlags(vk::ShaderStageFlagBits::eCompute)
+			.setOffset(0)
+			.setSize(sizeof(PushConstants));
+		auto const plci = vk::PipelineLayoutCreateInfo()
+			.setSetLayoutCount(1)
+			.setPSetLayouts(&descriptorSetLayout)
+			.setPushConstantRangeCount(1)
+			.setPPushConstantRanges(&pushConstantRange);
+		errCheck(device.createPipelineLayout(&plci, nullptr, &pipelineLayout));
+
+		vk::ShaderModule shaderModule;
+		auto const smci = vk::ShaderModuleCreateInfo()
+			.setCodeSize(code.size())
+			.setPCode(reinterpret_cast<const uint32_t*>(code.data()));
+		errCheck(device.createShaderModule(&smci, nullptr, &shaderModule));
+		auto const cpci = vk::ComputePipelineCreateInfo()
+			.setStage(vk::PipelineShaderStageCreateInfo()
+				.setStage(vk::ShaderStageFlagBits::eCompute)
+				.setModule(shaderModule)
+				.setPName("main"))
+			.setLayout(pipelineLayout);
+		errCheck(device.createComputePipelines(pipelineCache, 1, &cpci, nullptr, &pipeline));
+		device.destroyShaderModule(shaderModule);
+
+		// the outputs stay on the gpu, one set per frame in flight
+		vk::DescriptorPoolSize poolSizes[] = {
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageBufferDynamic).setDescriptorCount(frameCount),
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageBuffer).setDescriptorCount(2 * frameCount) };
+		auto const dpci = vk::DescriptorPoolCreateInfo()
+			.setMaxSets(frameCount)
+			.setPoolSizeCount(2)
+			.setPPoolSizes(poolSizes);
+		errCheck(device.createDescriptorPool(&dpci, nullptr, &descriptorPool));
+
+		descriptorSets.resize(frameCount);
+		std::vector<vk::DescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+		auto const dsai = vk::DescriptorSetAllocateInfo()
+			.setDescriptorPool(descriptorPool)
+			.setDescriptorSetCount(frameCount)
+			.setPSetLayouts(layouts.data());
+		errCheck(device.allocateDescriptorSets(&dsai, descriptorSets.data()));
+
+		instanceBuffers.resize(frameCount);
+		instanceBufferMems.resize(frameCount);
+		indirectBuffers.resize(frameCount);
+		indirectBufferMems.resize(frameCount);
+		spritesBuffers.resize(frameCount);
+		frameMaxSprites.resize(frameCount);
+		for (uint32_t i = 0; i < frameCount; ++i)
+			writeFrame(i, ResourceManager::getInstance().frameAllocator.getBuffer());
+
+		available = true;
+		return true;
+	}
+
+	void GpuCulling::destroy()
+	{
+		if (!available)
+			return;
+		for (size_t i = 0; i < instanceBuffers.size(); ++i) {
+			helper.destroyBuffer(device, instanceBuffers[i], instanceBufferMems[i]);
+			helper.destroyBuffer(device, indirectBuffers[i], indirectBufferMems[i]);
+		}
+		instanceBuffers.clear();
+		instanceBufferMems.clear();
+		indirectBuffers.clear();
+		indirectBufferMems.clear();
+		spritesBuffers.clear();
+		frameMaxSprites.clear();
+		descriptorSets.clear();
+		device.destroyDescriptorPool(descriptorPool);
+		device.destroyPipeline(pipeline);
+		device.destroyPipelineLayout(pipelineLayout);
+		device.destroyDescriptorSetLayout(descriptorSetLayout);
+		available = false;
+	}
+
+	bool GpuCulling::isAvailable() const
+	{
+		return available;
+	}
+
+	bool GpuCulling::hasMultiDrawIndirect() const
+	{
+		return multiDrawIndirect;
+	}
+
+	void GpuCulling::update(uint32_t frameIndex, vk::Buffer spritesBuffer, uint32_t maxSprites)
+	{
+		if (!available)
+			return;
+		this->maxSprites = maxSprites > 0 ? maxSprites : 1;
+		if (spritesBuffers[frameIndex] == spritesBuffer && frameMaxSprites[frameIndex] == this->maxSprites)
+			return;
+		writeFrame(frameIndex, spritesBuffer);
+	}
+
+	void GpuCulling::writeFrame(uint32_t frameIndex, vk::Buffer spritesBuffer)
+	{
+		// only this frame reads its outputs and its set, and it is not in flight
+		if (instanceBuffers[frameIndex])
+			helper.destroyBuffer(device, instanceBuffers[frameIndex], instanceBufferMems[frameIndex]);
+		if (indirectBuffers[frameIndex])
+			helper.destroyBuffer(device, indirectBuffers[frameIndex], indirectBufferMems[frameIndex]);
+		vk::DeviceSize instanceSize = maxSprites * sizeof(InstanceData);
+		vk::DeviceSize indirectSize = maxSprites * sizeof(vk::DrawIndexedIndirectCommand);
+		helper.createBuffer(gpu, device, instanceSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, instanceBuffers[frameIndex], instanceBufferMems[frameIndex]);
+		helper.createBuffer(gpu, device, indirectSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, indirectBuffers[frameIndex], indirectBufferMems[frameIndex]);
+
+		vk::DescriptorBufferInfo bufferInfos[] = {
+			vk::DescriptorBufferInfo().setBuffer(spritesBuffer).setOffset(0).setRange(maxSprites * sizeof(SpriteCullData)),
+			vk::DescriptorBufferInfo().setBuffer(instanceBuffers[frameIndex]).setOffset(0).setRange(instanceSize),
+			vk::DescriptorBufferInfo().setBuffer(indirectBuffers[frameIndex]).setOffset(0).setRange(indirectSize) };
+		vk::WriteDescriptorSet writes[3];
+		for (uint32_t b = 0; b < 3; ++b) {
+			writes[b]
+				.setDstSet(descriptorSets[frameIndex])
+				.setDstBinding(b)
+				.setDescriptorCount(1)
+				.setDescriptorType(b == 0 ? vk::DescriptorType::eStorageBufferDynamic : vk::DescriptorType::eStorageBuffer)
+				.setPBufferInfo(&bufferInfos[b]);
+		}
+		device.updateDescriptorSets(3, writes, 0, nullptr);
+		spritesBuffers[frameIndex] = spritesBuffer;
+		frameMaxSprites[frameIndex] = maxSprites;
+	}
+
+	void GpuCulling::record(vk::CommandBuffer cmd, uint32_t frameIndex, vk::Buffer srcBuffer, vk::DeviceSize spritesOffset,
+		vk::DeviceSize commandsOffset, uint32_t batchCount, const glm::vec4 &viewRect)
+	{
+		// the batch commands with the sprite count of their range, the shader replaces it with the visible ones
+		auto const copyRegion = vk::BufferCopy()
+			.setSrcOffset(commandsOffset)
+			.setDstOffset(0)
+			.setSize(batchCount * sizeof(vk::DrawIndexedIndirectCommand));
+		cmd.copyBuffer(srcBuffer, indirectBuffers[frameIndex], 1, &copyRegion);
+
+		auto const copyBarrier = vk::BufferMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setBuffer(indirectBuffers[frameIndex])
+			.setOffset(0)
+			.setSize(VK_WHOLE_SIZE);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 0, nullptr, 1, &copyBarrier, 0, nullptr);
+
+		const uint32_t dynamicOffset = static_cast<uint32_t>(spritesOffset);
+		PushConstants constants{ viewRect, batchCount };
+		cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &descriptorSets[frameIndex], 1, &dynamicOffset);
+		cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &constants);
+		// a workgroup per batch, in rows of the 65535 workgroups every device takes
+		cmd.dispatch(std::min(batchCount, 65535u), (batchCount + 65534u) / 65535u, 1);
+
+		// the draws read the counted commands and the compacted instances
+		vk::BufferMemoryBarrier barriers[2];
+		barriers[0] = vk::BufferMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setBuffer(indirectBuffers[frameIndex])
+			.setOffset(0)
+			.setSize(VK_WHOLE_SIZE);
+		barriers[1] = vk::BufferMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eVertexAttributeRead)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setBuffer(instanceBuffers[frameIndex])
+			.setOffset(0)
+			.setSize(VK_WHOLE_SIZE);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+			vk::DependencyFlags(), 0, nullptr, 2, barriers, 0, nullptr);
+	}
+
+	vk::Buffer GpuCulling::getInstanceBuffer(uint32_t frameIndex) const
+	{
+		return instanceBuffers[frameIndex];
+	}
+
+	vk::Buffer GpuCulling::getIndirectBuffer(uint32_t frameIndex) const
+	{
+		return indirectBuffers[frameIndex];
+	}
+
+	uint32_t GpuCulling::getMaxSprites() const
+	{
+		return maxSprites;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+#include "glm_.h"
+
+#define CULL_LOCAL_SIZE 64	// local_size_x of shaders/cullSprites.comp
+
+namespace vm {
+	// Culls the drawn sprites against the camera in a compute pass and compacts the visible ones per batch:
+	// every batch is a VkDrawIndexedIndirectCommand over a contiguous range of the sorted sprites, a workgroup
+	// compacts the range in order (a prefix sum per chunk of CULL_LOCAL_SIZE sprites) and writes the instanceCount,
+	// so the render pass draws all the sprites with one indirect draw per batch in the same order every frame.
+	class GpuCulling
+	{
+	public:
+		// false if shaders/cullSprites.comp.spv is missing or the device lacks drawIndirectFirstInstance, maxSprites bounds the sprites (and batches) of a frame
+		bool create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, const vk::PhysicalDeviceFeatures &features, uint32_t maxSprites, uint32_t frameCount);
+		void destroy();
+		bool isAvailable() const;
+		bool hasMultiDrawIndirect() const;
+		// before recording a frame whose fence is waited: a frame whose set was written for another sprites buffer or
+		// maxSprites gets its outputs at the new size and its set written again, the frames in flight keep theirs
+		void update(uint32_t frameIndex, vk::Buffer spritesBuffer, uint32_t maxSprites);
+
+		// outside a render pass: copies the batch commands (instanceCount: the sprites of the batch, from firstInstance)
+		// to the frame's indirect buffer, culls the SpriteCullData of every batch and writes the visible ones to the
+		// frame's instance buffer
+		void record(vk::CommandBuffer cmd, uint32_t frameIndex, vk::Buffer srcBuffer, vk::DeviceSize spritesOffset,
+			vk::DeviceSize commandsOffset, uint32_t batchCount, const glm::vec4 &viewRect);
+
+		vk::Buffer getInstanceBuffer(uint32_t frameIndex) const;	// InstanceData, vertex binding 1
+		vk::Buffer getIndirectBuffer(uint32_t frameIndex) const;	// VkDrawIndexedIndirectCommand per batch
+		uint32_t getMaxSprites() const;
+
+	private:
+		struct PushConstants
+		{
+			glm::vec4	viewRect;		// min xy, max xy
+			uint32_t	batchCount;
+		};
+		vk::PhysicalDevice						gpu;
+		vk::Device								device;
+		vk::DescriptorSetLayout					descriptorSetLayout;
+		vk::DescriptorPool						descriptorPool;
+		vk::PipelineLayout						pipelineLayout;
+		vk::Pipeline							pipeline;
+		std::vector<vk::Buffer>					instanceBuffers{};
+		std::vector<vk::DeviceMemory>			instanceBufferMems{};
+		std::vector<vk::Buffer>					indirectBuffers{};
+		std::vector<vk::DeviceMemory>			indirectBufferMems{};
+		std::vector<vk::DescriptorSet>			descriptorSets{};		// per frame, the sprites binding has a dynamic offset
+		std::vector<vk::Buffer>					spritesBuffers{};		// the sprites buffer of every frame's set
+		std::vector<uint32_t>					frameMaxSprites{};		// and the sprites its outputs are made for
+		uint32_t								maxSprites = 0;
+		bool									available = false;
+		bool									multiDrawIndirect = false;
+		Helper									helper;
+
+		void writeFrame(uint32_t frameIndex, vk::Buffer spritesBuffer);
+	};
+}
@@ -1,8 +1,12 @@
 #pragma once
 #include "glm_.h"
-#include "BufferInfo.h"
 #include <vector>
-#define MAX_POINT_LIGHTS 20
+#define MAX_POINT_LIGHTS 4096	// lights binned in a frame, the rest are not drawn
+#define LIGHT_TILE_SIZE 32		// pixels of a light tile, TILE_SIZE of the fragment shaders
+#define LIGHT_RANGE 16.f		// radius multiple past which a light adds less than 1/256, LIGHT_RANGE of the fragment shaders
+#define MAX_SHADOW_LIGHTS 256	// lights on screen that get a shadow mask in a frame, the rest light through everything
+#define SHADOW_CELL_SIZE 256	// pixels of a light's mask in the shadow atlas, covering its LIGHT_RANGE square
+#define SHADOW_ATLAS_SIZE 4096	// SHADOW_CELL_SIZE * 16, MAX_SHADOW_LIGHTS cells
 
 namespace vm {
 	//Spot,			// cone shape
@@ -12,25 +16,24 @@ namespace vm {
 	//Volume,			// illuminates objects within its volume
 	//Ambient			// light all objects
 
-	// blocks of uniform memory that are passed to shaders must be usually mulitples of 16 bytes
+	// the std430 Light of the fragment shaders, multiple of 16 bytes
 	struct UniformLightObject {
 		glm::vec4 color;		// 16 bytes
 		glm::vec2 position;		// 8
 		float radius;			// 4
-		float on;				// 4
+		float on;				// 4, in the binned copy of the renderer: the shadow cell of the light, -1 without
 	};
 
 	class PointLight 
 	{
-		friend class Renderer;
+		friend class LightCulling;
 	public:
-		static std::vector<PointLight*>		lightPool;
-		static vk::DescriptorSet			descriptorSet;
+		static std::vector<PointLight*>		lightPool;	// every living light, the renderer bins the ones turned on into screen tiles
 		
 		PointLight();
 		~PointLight();
 
-		void update();
+		void update(); // follows the attached matrix
 
 		glm::vec2 getPos() const;
 		void setPos(glm::vec2 position);
@@ -43,16 +46,12 @@ namespace vm {
 		void setRadius(float radius);
 		float getRadius() const;
 
+		PointLight(const PointLight &other);
+		PointLight& operator=(const PointLight &other);
+
 	private:
-		unsigned int			pointLightID;
 		glm::mat4				*attachedMat;
-		void					*_uniformMemory; // pointer to uniform data memory
-		BufferInfo				uloBuffInfo;
 		UniformLightObject		ulo{};
-
-		void setPointerToUniformBufferMem(vk::DeviceMemory &pointLightUniformBuffMem);
-
-		static void createDescriptorSet(const vk::DescriptorPool &descriptorPool);
 	};
 
 	class AmbientLight
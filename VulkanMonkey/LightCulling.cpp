@@ -0,0 +1,251 @@
+#include "LightCulling.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+#include <chrono>
+#include <cmath>
+
+namespace vm {
+	void LightCulling::create(vk::PhysicalDevice gpu, vk::Device device, uint32_t frameCount, const vk::DescriptorImageInfo &shadowMask, const vk::DescriptorImageInfo &distanceField)
+	{
+		this->gpu = gpu;
+		this->device = device;
+		ResourceManager &rm = ResourceManager::getInstance();
+		const vk::DeviceSize minAlignment = rm.getGpuProperties().limits.minStorageBufferOffsetAlignment;
+		if (minAlignment > alignment)
+			alignment = minAlignment;
+
+		vk::DescriptorPoolSize poolSizes[] = {
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageBuffer).setDescriptorCount(3 * frameCount),
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(2 * frameCount) };
+		auto const dpci = vk::DescriptorPoolCreateInfo()
+			.setMaxSets(frameCount)
+			.setPoolSizeCount(2)
+			.setPPoolSizes(poolSizes);
+		errCheck(device.createDescriptorPool(&dpci, nullptr, &descriptorPool));
+
+		frames.resize(frameCount);
+		std::vector<vk::DescriptorSetLayout> layouts(frameCount, rm.pointLightsDescriptorSetLayout);
+		std::vector<vk::DescriptorSet> sets(frameCount);
+		auto const dsai = vk::DescriptorSetAllocateInfo()
+			.setDescriptorPool(descriptorPool)
+			.setDescriptorSetCount(frameCount)
+			.setPSetLayouts(layouts.data());
+		errCheck(device.allocateDescriptorSets(&dsai, sets.data()));
+
+		// a first guess, the buffers grow with the screen and the lights
+		for (uint32_t i = 0; i < frameCount; ++i) {
+			frames[i].descriptorSet = sets[i];
+			resize(frames[i], 64 * 1024);
+
+			vk::WriteDescriptorSet writes[2];
+			writes[0]
+				.setDstSet(sets[i])
+				.setDstBinding(3)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+				.setPImageInfo(&shadowMask);
+			writes[1]
+				.setDstSet(sets[i])
+				.setDstBinding(4)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+				.setPImageInfo(&distanceField);
+			device.updateDescriptorSets(2, writes, 0, nullptr);
+		}
+	}
+
+	void LightCulling::destroy()
+	{
+		for (auto &frame : frames) {
+			if (!frame.buffer)
+				continue;
+			helper.destroyBuffer(device, frame.buffer, frame.memory);
+		}
+		frames.clear();
+		device.destroyDescriptorPool(descriptorPool);
+	}
+
+	void LightCulling::resize(FrameBuffers &frame, vk::DeviceSize size)
+	{
+		if (frame.buffer) {
+			helper.destroyBuffer(device, frame.buffer, frame.memory);
+		}
+		frame.size = size;
+		helper.createBuffer(gpu, device, size, vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, frame.buffer, frame.memory);
+		frame.data = helper.mapBuffer(device, frame.buffer);
+	}
+
+	void LightCulling::writeDescriptorSet(FrameBuffers &frame, vk::DeviceSize lightsSize, vk::DeviceSize tilesOffset, vk::DeviceSize tilesSize, vk::DeviceSize indicesOffset, vk::DeviceSize indicesSize)
+	{
+		vk::DescriptorBufferInfo bufferInfos[] = {
+			vk::DescriptorBufferInfo().setBuffer(frame.buffer).setOffset(0).setRange(lightsSize),
+			vk::DescriptorBufferInfo().setBuffer(frame.buffer).setOffset(tilesOffset).setRange(tilesSize),
+			vk::DescriptorBufferInfo().setBuffer(frame.buffer).setOffset(indicesOffset).setRange(indicesSize) };
+		vk::WriteDescriptorSet writes[3];
+		for (uint32_t b = 0; b < 3; ++b) {
+			writes[b]
+				.setDstSet(frame.descriptorSet)
+				.setDstBinding(b)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+				.setPBufferInfo(&bufferInfos[b]);
+		}
+		device.updateDescriptorSets(3, writes, 0, nullptr);
+	}
+
+	void LightCulling::update(uint32_t frameIndex, const glm::mat4 &viewProj, vk::Extent2D extent, uint32_t shadowCells)
+	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		// the lights that can light anything, packed
+		lights.clear();
+		for (auto light : PointLight::lightPool) {
+			if (light->ulo.on != 1.f || light->ulo.radius <= 0.f)
+				continue;
+			if (lights.size() == MAX_POINT_LIGHTS) {
+				static bool logged = false;
+				if (!logged)
+					LOG("More than MAX_POINT_LIGHTS lights are turned on, the rest are skipped\n");
+				logged = true;
+				break;
+			}
+			lights.push_back(light->ulo);
+		}
+
+		const uint32_t tilesX = (extent.width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE > 0 ? (extent.width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE : 1;
+		const uint32_t tilesY = (extent.height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE > 0 ? (extent.height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE : 1;
+		const uint32_t tileCount = tilesX * tilesY;
+		const uint32_t lightCount = static_cast<uint32_t>(lights.size());
+
+		// the tiles under the square the light reaches, counted per tile first
+		lightTiles.resize(lightCount);
+		tileRanges.assign(tileCount * 2, 0);
+		const glm::vec2 screen(static_cast<float>(extent.width), static_cast<float>(extent.height));
+		for (uint32_t i = 0; i < lightCount; ++i) {
+			const float range = lights[i].radius * LIGHT_RANGE;
+			const glm::vec4 a = viewProj * glm::vec4(lights[i].position - range, 0.f, 1.f);
+			const glm::vec4 b = viewProj * glm::vec4(lights[i].position + range, 0.f, 1.f);
+			const glm::vec2 pa = (glm::vec2(a) * 0.5f + 0.5f) * screen;
+			const glm::vec2 pb = (glm::vec2(b) * 0.5f + 0.5f) * screen;
+			const glm::vec2 pMin = glm::min(pa, pb);
+			const glm::vec2 pMax = glm::max(pa, pb);
+			if (pMax.x < 0.f || pMax.y < 0.f || pMin.x >= screen.x || pMin.y >= screen.y) {
+				lightTiles[i] = glm::uvec4(0);
+				continue;
+			}
+			const glm::uvec4 rect(
+				static_cast<uint32_t>(std::floor(glm::max(pMin.x, 0.f) / LIGHT_TILE_SIZE)),
+				static_cast<uint32_t>(std::floor(glm::max(pMin.y, 0.f) / LIGHT_TILE_SIZE)),
+				glm::min(static_cast<uint32_t>(std::floor(pMax.x / LIGHT_TILE_SIZE)) + 1, tilesX),
+				glm::min(static_cast<uint32_t>(std::floor(pMax.y / LIGHT_TILE_SIZE)) + 1, tilesY));
+			lightTiles[i] = rect;
+			for (uint32_t y = rect.y; y < rect.w; ++y) {
+				for (uint32_t x = rect.x; x < rect.z; ++x)
+					++tileRanges[(y * tilesX + x) * 2 + 1];
+			}
+		}
+
+		// the shadow cells go to the lights on screen, the fragment shaders find theirs in the on field
+		shadowLights.clear();
+		for (uint32_t i = 0; i < lightCount; ++i) {
+			const bool onScreen = lightTiles[i].z > lightTiles[i].x;
+			if (onScreen && shadowLights.size() < shadowCells) {
+				lights[i].on = static_cast<float>(shadowLights.size());
+				shadowLights.push_back(i);
+			}
+			else
+				lights[i].on = -1.f;
+		}
+
+		// offsets from the counts, then the counts are filled again with the indices
+		uint32_t indexCount = 0;
+		maxLightsPerTile = 0;
+		for (uint32_t t = 0; t < tileCount; ++t) {
+			const uint32_t count = tileRanges[t * 2 + 1];
+			if (count > maxLightsPerTile)
+				maxLightsPerTile = count;
+			tileRanges[t * 2] = indexCount;
+			tileRanges[t * 2 + 1] = 0;
+			indexCount += count;
+		}
+		averageLightsPerTile = static_cast<float>(indexCount) / tileCount;
+		lightIndices.resize(indexCount);
+		for (uint32_t i = 0; i < lightCount; ++i) {
+			const glm::uvec4 &rect = lightTiles[i];
+			for (uint32_t y = rect.y; y < rect.w; ++y) {
+				for (uint32_t x = rect.x; x < rect.z; ++x) {
+					uint32_t *tile = &tileRanges[(y * tilesX + x) * 2];
+					lightIndices[tile[0] + tile[1]++] = i;
+				}
+			}
+		}
+
+		// lights | header, tiles | indices, empty ranges still get an element so the descriptors stay valid
+		auto alignUp = [this](vk::DeviceSize size) { return (size + alignment - 1) / alignment * alignment; };
+		const vk::DeviceSize lightsSize = (lightCount > 0 ? lightCount : 1) * sizeof(UniformLightObject);
+		const vk::DeviceSize tilesOffset = alignUp(lightsSize);
+		const vk::DeviceSize tilesSize = sizeof(TileHeader) + tileCount * 2 * sizeof(uint32_t);
+		const vk::DeviceSize indicesOffset = alignUp(tilesOffset + tilesSize);
+		const vk::DeviceSize indicesSize = (indexCount > 0 ? indexCount : 1) * sizeof(uint32_t);
+
+		FrameBuffers &frame = frames[frameIndex];
+		if (indicesOffset + indicesSize > frame.size)
+			resize(frame, (indicesOffset + indicesSize) * 2);
+		writeDescriptorSet(frame, lightsSize, tilesOffset, tilesSize, indicesOffset, indicesSize);
+
+		char *data = static_cast<char*>(frame.data);
+		memcpy(data, lights.data(), lightCount * sizeof(UniformLightObject));
+		header.tilesX = tilesX;
+		header.tilesY = tilesY;
+		memcpy(data + tilesOffset, &header, sizeof(TileHeader));
+		memcpy(data + tilesOffset + sizeof(TileHeader), tileRanges.data(), tileRanges.size() * sizeof(uint32_t));
+		memcpy(data + indicesOffset, lightIndices.data(), indexCount * sizeof(uint32_t));
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		cullTime = time.count();
+	}
+
+	vk::DescriptorSet LightCulling::getDescriptorSet(uint32_t frameIndex) const
+	{
+		return frames[frameIndex].descriptorSet;
+	}
+
+	void LightCulling::setDistanceField(bool enabled, const glm::vec4 &worldToUV, const glm::vec2 &uvMax, float texelSize)
+	{
+		header.distanceField = enabled ? 1 : 0;
+		header.fieldRect = worldToUV;
+		header.fieldUVMax = uvMax;
+		header.fieldTexel = texelSize;
+	}
+
+	const std::vector<UniformLightObject>& LightCulling::getLights() const
+	{
+		return lights;
+	}
+
+	const std::vector<uint32_t>& LightCulling::getShadowLights() const
+	{
+		return shadowLights;
+	}
+
+	uint32_t LightCulling::getLightCount() const
+	{
+		return static_cast<uint32_t>(lights.size());
+	}
+
+	uint32_t LightCulling::getMaxLightsPerTile() const
+	{
+		return maxLightsPerTile;
+	}
+
+	float LightCulling::getAverageLightsPerTile() const
+	{
+		return averageLightsPerTile;
+	}
+
+	double LightCulling::getCullTime() const
+	{
+		return cullTime;
+	}
+}
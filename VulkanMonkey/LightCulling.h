@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+#include "glm_.h"
+#include "Light.h"
+
+namespace vm {
+	// Bins the point lights that are turned on into LIGHT_TILE_SIZE screen tiles on the cpu, every frame.
+	// The fragment shaders read their tile's light index list (set 2) and shade only the lights touching it,
+	// so the cost follows the lights per tile instead of the lights in the scene.
+	class LightCulling
+	{
+	public:
+		// shadowMask and distanceField are the bindings 3 and 4 of every set, they do not change
+		void create(vk::PhysicalDevice gpu, vk::Device device, uint32_t frameCount, const vk::DescriptorImageInfo &shadowMask, const vk::DescriptorImageInfo &distanceField);
+		void destroy();
+
+		// the frame's fence is waited: its buffers are rewritten (and grown if needed).
+		// the first shadowCells lights on screen get a shadow cell, in the order of the light pool
+		void update(uint32_t frameIndex, const glm::mat4 &viewProj, vk::Extent2D extent, uint32_t shadowCells);
+		vk::DescriptorSet getDescriptorSet(uint32_t frameIndex) const;
+		// the shaders trace the lights in the distance field instead of the shadow masks, from the next update
+		void setDistanceField(bool enabled, const glm::vec4 &worldToUV, const glm::vec2 &uvMax, float texelSize);
+		const std::vector<UniformLightObject>& getLights() const;	// binned in the last update
+		const std::vector<uint32_t>& getShadowLights() const;		// the lights of the shadow cells, cell i is getLights()[getShadowLights()[i]]
+
+		uint32_t getLightCount() const;			// lights turned on and binned in the last update
+		uint32_t getMaxLightsPerTile() const;
+		float getAverageLightsPerTile() const;
+		double getCullTime() const;				// ms, the last update
+
+	private:
+		// the Tiles block of the fragment shaders before the tile ranges, std430
+		struct TileHeader
+		{
+			uint32_t	tilesX = 0;
+			uint32_t	tilesY = 0;
+			uint32_t	distanceField = 0;
+			uint32_t	pad0 = 0;
+			glm::vec4	fieldRect = glm::vec4(0.f);		// world to field uv, xy min, zw scale
+			glm::vec2	fieldUVMax = glm::vec2(0.f);
+			float		fieldTexel = 1.f;				// world pixels per texel
+			float		pad1 = 0.f;
+		};
+		// one per frame in flight, host visible and persistently mapped
+		struct FrameBuffers
+		{
+			vk::Buffer			buffer;			// lights | tile header and (offset, count) per tile | light indices
+			vk::DeviceMemory	memory;
+			void				*data = nullptr;
+			vk::DeviceSize		size = 0;
+			vk::DescriptorSet	descriptorSet;
+		};
+		vk::PhysicalDevice			gpu;
+		vk::Device					device;
+		vk::DescriptorPool			descriptorPool;
+		std::vector<FrameBuffers>	frames{};
+		vk::DeviceSize				alignment = 16;	// minStorageBufferOffsetAlignment between the three ranges
+
+		// cpu side of the binning, kept between the frames
+		std::vector<UniformLightObject>	lights{};
+		std::vector<glm::uvec4>			lightTiles{};	// the tile rect of every light, max exclusive
+		std::vector<uint32_t>			tileRanges{};	// (offset, count) per tile
+		std::vector<uint32_t>			lightIndices{};
+		std::vector<uint32_t>			shadowLights{};
+		TileHeader						header{};
+
+		uint32_t		maxLightsPerTile = 0;
+		float			averageLightsPerTile = 0.f;
+		double			cullTime = 0.0;
+		Helper			helper;
+
+		void resize(FrameBuffers &frame, vk::DeviceSize size);
+		void writeDescriptorSet(FrameBuffers &frame, vk::DeviceSize lightsSize, vk::DeviceSize tilesOffset, vk::DeviceSize tilesSize, vk::DeviceSize indicesOffset, vk::DeviceSize indicesSize);
+	};
+}
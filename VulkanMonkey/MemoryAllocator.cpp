@@ -0,0 +1,261 @@
+#include "MemoryAllocator.h"
+#include "ErrorAndLog.h"
+
+namespace vm {
+	BuddyAllocator::BuddyAllocator(uint64_t size, uint64_t minBlockSize) : size(size), minBlockSize(minBlockSize)
+	{
+		maxOrder = 0;
+		while ((minBlockSize << maxOrder) < size)
+			++maxOrder;
+		freeBlocks.resize(maxOrder + 1);
+		freeBlocks[maxOrder].insert(0);
+	}
+
+	bool BuddyAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t &offset)
+	{
+		// blocks of an order are aligned to their own size, so the alignment is just a minimum block size
+		uint64_t needed = size > alignment ? size : alignment;
+		uint32_t order = 0;
+		while ((minBlockSize << order) < needed)
+			++order;
+		if (order > maxOrder)
+			return false;
+
+		uint32_t freeOrder = order;
+		while (freeOrder <= maxOrder && freeBlocks[freeOrder].empty())
+			++freeOrder;
+		if (freeOrder > maxOrder)
+			return false;
+
+		offset = *freeBlocks[freeOrder].begin();
+		freeBlocks[freeOrder].erase(freeBlocks[freeOrder].begin());
+
+		// split down to the wanted order, the upper halves become free buddies
+		while (freeOrder > order) {
+			--freeOrder;
+			freeBlocks[freeOrder].insert(offset + (minBlockSize << freeOrder));
+		}
+
+		usedBlocks[offset] = { order, size };
+		usedSize += minBlockSize << order;
+		requestedSize += size;
+		return true;
+	}
+
+	void BuddyAllocator::free(uint64_t offset)
+	{
+		auto it = usedBlocks.find(offset);
+		if (it == usedBlocks.end())
+			return;
+		uint32_t order = it->second.first;
+		usedSize -= minBlockSize << order;
+		requestedSize -= it->second.second;
+		usedBlocks.erase(it);
+
+		// merge with the buddy as long as it is free too
+		while (order < maxOrder) {
+			uint64_t buddy = offset ^ (minBlockSize << order);
+			auto buddyIt = freeBlocks[order].find(buddy);
+			if (buddyIt == freeBlocks[order].end())
+				break;
+			freeBlocks[order].erase(buddyIt);
+			offset = offset < buddy ? offset : buddy;
+			++order;
+		}
+		freeBlocks[order].insert(offset);
+	}
+
+	uint64_t BuddyAllocator::getSize() const
+	{
+		return size;
+	}
+
+	uint64_t BuddyAllocator::getUsedSize() const
+	{
+		return usedSize;
+	}
+
+	uint64_t BuddyAllocator::getRequestedSize() const
+	{
+		return requestedSize;
+	}
+
+	uint64_t BuddyAllocator::getLargestFreeBlock() const
+	{
+		for (uint32_t order = maxOrder + 1; order-- > 0;) {
+			if (!freeBlocks[order].empty())
+				return minBlockSize << order;
+		}
+		return 0;
+	}
+
+	float BuddyAllocator::getFragmentation() const
+	{
+		const uint64_t freeSize = size - usedSize;
+		return freeSize > 0 ? 1.f - static_cast<float>(getLargestFreeBlock()) / static_cast<float>(freeSize) : 0.f;
+	}
+
+	uint32_t BuddyAllocator::getAllocationCount() const
+	{
+		return static_cast<uint32_t>(usedBlocks.size());
+	}
+
+	bool BuddyAllocator::isEmpty() const
+	{
+		return usedBlocks.empty();
+	}
+
+	void MemoryAllocator::allocate(vk::Device device, const vk::MemoryRequirements &memRequirements, uint32_t memoryTypeIndex,
+		ResourceType type, uint64_t handle, vk::DeviceMemory &memory, vk::DeviceSize &offset)
+	{
+		const std::pair<bool, uint64_t> key = { type != ResourceType::Buffer, handle };
+
+		if (memRequirements.size <= blockSize / 2) {
+			auto &blocks = pools[poolKey(memoryTypeIndex, type)];
+			for (auto &block : blocks) {
+				if (block->buddy.allocate(memRequirements.size, memRequirements.alignment, offset)) {
+					memory = block->memory;
+					allocations[key] = { block.get(), block->memory, offset, memRequirements.size, nullptr };
+					return;
+				}
+			}
+
+			// no room, a new block for this memory type
+			auto const allocInfo = vk::MemoryAllocateInfo()
+				.setAllocationSize(blockSize)
+				.setMemoryTypeIndex(memoryTypeIndex);
+			vk::DeviceMemory blockMemory;
+			if (device.allocateMemory(&allocInfo, nullptr, &blockMemory) == vk::Result::eSuccess) {
+				blocks.push_back(std::make_unique<Block>(blockMemory, blockSize, minBlockSize));
+				Block *block = blocks.back().get();
+				block->buddy.allocate(memRequirements.size, memRequirements.alignment, offset);
+				memory = block->memory;
+				allocations[key] = { block, block->memory, offset, memRequirements.size, nullptr };
+				return;
+			}
+			LOG("Memory block allocation failed, falling back to a dedicated allocation\n");
+		}
+
+		auto const allocInfo = vk::MemoryAllocateInfo()
+			.setAllocationSize(memRequirements.size)
+			.setMemoryTypeIndex(memoryTypeIndex);
+		errCheck(device.allocateMemory(&allocInfo, nullptr, &memory));
+		offset = 0;
+		allocations[key] = { nullptr, memory, 0, memRequirements.size, nullptr };
+		++dedicatedCount;
+		dedicatedBytes += memRequirements.size;
+	}
+
+	void MemoryAllocator::free(vk::Device device, ResourceType type, uint64_t handle, vk::DeviceMemory memory)
+	{
+		auto it = allocations.find({ type != ResourceType::Buffer, handle });
+		if (it == allocations.end()) {
+			device.freeMemory(memory);
+			return;
+		}
+
+		Allocation allocation = it->second;
+		allocations.erase(it);
+		if (!allocation.block) {
+			device.freeMemory(memory);
+			--dedicatedCount;
+			dedicatedBytes -= allocation.size;
+			return;
+		}
+
+		allocation.block->buddy.free(allocation.offset);
+
+		// keep one empty block per pool around, so a load/unload cycle does not hit the driver every time
+		if (allocation.block->buddy.isEmpty()) {
+			for (auto &pool : pools) {
+				auto &blocks = pool.second;
+				for (auto blockIt = blocks.begin(); blockIt != blocks.end(); ++blockIt) {
+					if (blockIt->get() != allocation.block)
+						continue;
+					if (blocks.size() > 1) {
+						device.freeMemory((*blockIt)->memory);
+						blocks.erase(blockIt);
+					}
+					return;
+				}
+			}
+		}
+	}
+
+	void *MemoryAllocator::map(vk::Device device, ResourceType type, uint64_t handle)
+	{
+		auto it = allocations.find({ type != ResourceType::Buffer, handle });
+		if (it == allocations.end()) {
+			LOG("Mapping a resource not allocated by the memory allocator\n");
+			return nullptr;
+		}
+		Allocation &allocation = it->second;
+		if (!allocation.block) {
+			if (!allocation.mapped)
+				errCheck(device.mapMemory(allocation.memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &allocation.mapped));
+			return allocation.mapped;
+		}
+		Block *block = allocation.block;
+		if (!block->mapped)
+			errCheck(device.mapMemory(block->memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &block->mapped));
+		return static_cast<char*>(block->mapped) + allocation.offset;
+	}
+
+	vk::DeviceSize MemoryAllocator::getOffset(ResourceType type, uint64_t handle) const
+	{
+		auto it = allocations.find({ type != ResourceType::Buffer, handle });
+		return it != allocations.end() ? it->second.offset : 0;
+	}
+
+	void MemoryAllocator::destroy(vk::Device device)
+	{
+		if (!allocations.empty())
+			LOG(allocations.size() << " memory allocations are still alive at destroy\n");
+		for (auto &pool : pools) {
+			for (auto &block : pool.second)
+				device.freeMemory(block->memory);
+		}
+		pools.clear();
+		allocations.clear();
+		dedicatedCount = 0;
+		dedicatedBytes = 0;
+	}
+
+	uint32_t MemoryAllocator::poolKey(uint32_t memoryTypeIndex, ResourceType type)
+	{
+		return memoryTypeIndex << 1 | (type == ResourceType::OptimalImage ? 1 : 0);
+	}
+
+	MemoryStats MemoryAllocator::getStats() const
+	{
+		MemoryStats stats{};
+		for (auto &pool : pools) {
+			for (auto &block : pool.second) {
+				const BuddyAllocator &buddy = block->buddy;
+				++stats.blockCount;
+				stats.subAllocationCount += buddy.getAllocationCount();
+				stats.blockBytes += buddy.getSize();
+				stats.usedBytes += buddy.getUsedSize();
+				stats.requestedBytes += buddy.getRequestedSize();
+				stats.blocks.push_back({ pool.first >> 1, (pool.first & 1) != 0, buddy.getAllocationCount(), buddy.getUsedSize(), buddy.getLargestFreeBlock(), buddy.getFragmentation() });
+				if (buddy.getFragmentation() > stats.fragmentation)
+					stats.fragmentation = buddy.getFragmentation();
+			}
+		}
+		stats.dedicatedCount = dedicatedCount;
+		stats.dedicatedBytes = dedicatedBytes;
+		stats.requestedBytes += dedicatedBytes;
+		stats.deviceMemoryCount = stats.blockCount + dedicatedCount;
+		return stats;
+	}
+
+	void MemoryAllocator::logStats() const
+	{
+		MemoryStats stats = getStats();
+		REPORT("Device memory: " << stats.deviceMemoryCount << " allocations (" << stats.blockCount << " blocks, " << stats.dedicatedCount << " dedicated)\n");
+		REPORT("  sub-allocations: " << stats.subAllocationCount << ", " << stats.usedBytes / 1024 << " KB used of " << stats.blockBytes / 1024 << " KB in blocks\n");
+		REPORT("  requested: " << stats.requestedBytes / 1024 << " KB, dedicated: " << stats.dedicatedBytes / 1024 << " KB, fragmentation: " << stats.fragmentation * 100.f << "% at worst\n");
+		for (auto &b : stats.blocks)
+			REPORT("  block of type " << b.memoryType << (b.optimal ? " (optimal images)" : "") << ": " << b.subAllocationCount << " sub-allocations, " << b.usedBytes / 1024 << " KB used, largest free " << b.largestFreeBlock / 1024 << " KB, fragmentation: " << b.fragmentation * 100.f << "%\n");
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <map>
+#include <set>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "Vulkan_.h"
+
+#define MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)	// of the pooled blocks, the resources over half of it are dedicated
+#define MEMORY_MIN_BLOCK_SIZE 256ull				// the smallest range of a block, no flush atom is bigger
+
+namespace vm {
+	// Binary buddy scheme over a [0, size) range, size and minBlockSize powers of two.
+	// Knows nothing about vulkan, so it can be driven on the cpu alone.
+	class BuddyAllocator
+	{
+	public:
+		BuddyAllocator(uint64_t size, uint64_t minBlockSize);
+
+		// offset is aligned to the alignment (power of two), false if there is no free block big enough
+		bool allocate(uint64_t size, uint64_t alignment, uint64_t &offset);
+		void free(uint64_t offset);
+
+		uint64_t getSize() const;
+		uint64_t getUsedSize() const;		// bytes of the handed out blocks, padding included
+		uint64_t getRequestedSize() const;	// bytes actually asked for
+		uint64_t getLargestFreeBlock() const;
+		float getFragmentation() const;		// 1 - largest free block / free bytes
+		uint32_t getAllocationCount() const;
+		bool isEmpty() const;
+
+	private:
+		uint64_t size;
+		uint64_t minBlockSize;
+		uint32_t maxOrder;								// order of the whole range, block size = minBlockSize << order
+		std::vector<std::set<uint64_t>> freeBlocks;		// free block offsets per order, lowest offset first
+		std::unordered_map<uint64_t, std::pair<uint32_t, uint64_t>> usedBlocks; // offset -> (order, requested size)
+		uint64_t usedSize = 0;
+		uint64_t requestedSize = 0;
+	};
+
+	enum class ResourceType
+	{
+		Buffer,
+		LinearImage,
+		OptimalImage
+	};
+
+	// a resource never spans two blocks, so the free space is only useful block by block
+	struct BlockStats
+	{
+		uint32_t		memoryType;
+		bool			optimal;				// the block of the optimal images of the type
+		uint32_t		subAllocationCount;
+		vk::DeviceSize	usedBytes;
+		vk::DeviceSize	largestFreeBlock;
+		float			fragmentation;			// 1 - largest free block / free bytes of the block
+	};
+
+	struct MemoryStats
+	{
+		uint32_t		deviceMemoryCount;		// live vkAllocateMemory allocations (blocks + dedicated)
+		uint32_t		blockCount;
+		uint32_t		subAllocationCount;
+		uint32_t		dedicatedCount;
+		vk::DeviceSize	blockBytes;				// bytes reserved by the blocks
+		vk::DeviceSize	usedBytes;				// bytes of the blocks handed out
+		vk::DeviceSize	requestedBytes;			// bytes the resources asked for
+		vk::DeviceSize	dedicatedBytes;
+		float			fragmentation;			// the highest of the blocks
+		std::vector<BlockStats>	blocks;
+	};
+
+	// Hands out sub-ranges of big per memory type blocks, host visible memory included.
+	// Buffers and linear images never share a block with optimal images, so bufferImageGranularity
+	// can not be violated. Resources too big for a block keep a dedicated allocation, tracked here
+	// too so every free goes through the allocator. A memory object can only be mapped once, so the
+	// mappings go through map: a block is mapped whole the first time one of its resources is.
+	class MemoryAllocator //MemoryAllocator &ma = MemoryAllocator::getInstance();
+	{
+	public:
+		static MemoryAllocator& getInstance() {
+			static MemoryAllocator singleton;
+			return singleton;
+		}
+
+		// memory and offset are the ones to bind the resource with
+		void allocate(vk::Device device, const vk::MemoryRequirements &memRequirements, uint32_t memoryTypeIndex,
+			ResourceType type, uint64_t handle, vk::DeviceMemory &memory, vk::DeviceSize &offset);
+		// memory is freed directly if the handle was not allocated here
+		void free(vk::Device device, ResourceType type, uint64_t handle, vk::DeviceMemory memory);
+		// the first byte of the resource, host visible, mapped until the resource is freed
+		void *map(vk::Device device, ResourceType type, uint64_t handle);
+		// of the resource in its memory, for the flushes of non coherent memory
+		vk::DeviceSize getOffset(ResourceType type, uint64_t handle) const;
+		// frees all the blocks, resources must be destroyed already
+		void destroy(vk::Device device);
+
+		MemoryStats getStats() const;
+		void logStats() const;
+
+		// the blocks a resource of the type can share: buffers and linear images never with optimal images
+		static uint32_t poolKey(uint32_t memoryTypeIndex, ResourceType type);
+
+	private:
+		struct Block
+		{
+			vk::DeviceMemory	memory;
+			BuddyAllocator		buddy;
+			void				*mapped = nullptr;	// the whole block, freeing the memory unmaps it
+			Block(vk::DeviceMemory memory, vk::DeviceSize size, vk::DeviceSize minBlockSize) : memory(memory), buddy(size, minBlockSize) {}
+		};
+		struct Allocation
+		{
+			Block				*block;			// nullptr for dedicated
+			vk::DeviceMemory	memory;
+			vk::DeviceSize		offset;
+			vk::DeviceSize		size;
+			void				*mapped;		// dedicated only
+		};
+
+		std::map<uint32_t, std::vector<std::unique_ptr<Block>>> pools;	// (memory type << 1 | optimal) -> blocks
+		std::map<std::pair<bool, uint64_t>, Allocation> allocations;	// (is image, handle) -> allocation
+		uint32_t dedicatedCount = 0;
+		vk::DeviceSize dedicatedBytes = 0;
+
+		vk::DeviceSize blockSize = MEMORY_BLOCK_SIZE;
+		vk::DeviceSize minBlockSize = MEMORY_MIN_BLOCK_SIZE;
+
+		MemoryAllocator() {}; // ctor hidden
+		MemoryAllocator(MemoryAllocator const&) = delete; // no copies of the singleton
+		MemoryAllocator& operator=(MemoryAllocator const&) = delete;
+		~MemoryAllocator() {}; // dtor hidden
+	};
+}
@@ -0,0 +1,172 @@
+#include "RenderQueue.h"
+#include "Entity.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <random>
+
+namespace vm {
+	uint64_t RenderQueue::makeKey(float depth, bool opaque, uint32_t pipeline, uint32_t texture)
+	{
+		// the float bits flipped so they sort as unsigned ints: negatives reversed, positives above them
+		uint32_t depthBits;
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+		depthBits = (depthBits & 0x80000000u) ? ~depthBits : (depthBits | 0x80000000u);
+		if (opaque)
+			depthBits = ~depthBits; // front to back
+		return static_cast<uint64_t>(opaque ? 0u : 1u) << 63 | static_cast<uint64_t>(depthBits) << 31 | static_cast<uint64_t>(pipeline & 0xFu) << 27 | (texture & 0x07FFFFFFu);
+	}
+
+	void RenderQueue::sort(std::vector<Entity*> &list)
+	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		const uint32_t count = static_cast<uint32_t>(list.size());
+		skippedPasses = 0;
+		coherent = false;
+
+		// same entities in the same order as last frame, build the keys in last frame's sorted order
+		const bool reuseOrder = count > 0 && list == lastList;
+		if (!reuseOrder) {
+			lastList = list;
+			lastOrder.resize(count);
+			for (uint32_t i = 0; i < count; ++i)
+				lastOrder[i] = i;
+		}
+
+		items.resize(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			Entity *entity = list[lastOrder[i]];
+			const bool sprite = entity->hasSprite();
+			items[i].key = makeKey(entity->getDepth(), sprite && entity->getSprite().isOpaque(), sprite ? PIPELINE_SPRITE : PIPELINE_NONE, sprite ? entity->getSprite().getTextureIndex() : 0);
+			items[i].index = lastOrder[i];
+		}
+
+		// the keys rarely change from a frame to the next, a linear check is enough most of the time
+		coherent = reuseOrder;
+		for (uint32_t i = 1; i < count && coherent; ++i)
+			coherent = items[i - 1].key <= items[i].key;
+		if (!coherent && count > 1)
+			skippedPasses = radixSort(items, scratch);
+
+		sorted.resize(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			sorted[i] = list[items[i].index];
+			lastOrder[i] = items[i].index;
+		}
+		list.swap(sorted);
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		sortTime = time.count();
+	}
+
+	uint32_t RenderQueue::radixSort(std::vector<Item> &items, std::vector<Item> &scratch)
+	{
+		const size_t count = items.size();
+		if (count < 2)
+			return 8;
+		scratch.resize(count);
+
+		// all the histograms in one read of the keys
+		std::vector<uint32_t> histograms(8 * 256, 0);
+		for (auto &item : items) {
+			for (uint32_t pass = 0; pass < 8; ++pass)
+				++histograms[pass * 256 + ((item.key >> (pass * 8)) & 0xFF)];
+		}
+
+		uint32_t skipped = 0;
+		Item *src = items.data();
+		Item *dst = scratch.data();
+		for (uint32_t pass = 0; pass < 8; ++pass) {
+			uint32_t *histogram = &histograms[pass * 256];
+
+			// a digit shared by every key does not move anything (the texture or depth bits of a small scene)
+			if (histogram[(src[0].key >> (pass * 8)) & 0xFF] == count) {
+				++skipped;
+				continue;
+			}
+
+			uint32_t offset = 0;
+			for (uint32_t d = 0; d < 256; ++d) {
+				const uint32_t n = histogram[d];
+				histogram[d] = offset;
+				offset += n;
+			}
+			for (size_t i = 0; i < count; ++i)
+				dst[histogram[(src[i].key >> (pass * 8)) & 0xFF]++] = src[i];
+			std::swap(src, dst);
+		}
+		if (src != items.data())
+			items.swap(scratch);
+		return skipped;
+	}
+
+	double RenderQueue::getSortTime() const
+	{
+		return sortTime;
+	}
+
+	uint32_t RenderQueue::getSkippedPasses() const
+	{
+		return skippedPasses;
+	}
+
+	bool RenderQueue::wasCoherent() const
+	{
+		return coherent;
+	}
+
+	void RenderQueue::benchmark()
+	{
+		// stand-ins for the entities, allocated one by one and shuffled like the real ones end up in memory
+		struct Drawable
+		{
+			float		depth;
+			uint32_t	texture;
+			char		rest[120];	// the other members of an entity, so the pointers land on cold lines
+		};
+
+		std::mt19937 rng(42);
+		for (uint32_t count = 1000; count <= 1000000; count *= 10) {
+			std::vector<std::unique_ptr<Drawable>> drawables(count);
+			std::vector<Drawable*> pointers(count);
+			for (uint32_t i = 0; i < count; ++i) {
+				drawables[i] = std::make_unique<Drawable>();
+				drawables[i]->depth = static_cast<float>(rng() % 16) * 0.1f;
+				drawables[i]->texture = rng() % 64;
+				pointers[i] = drawables[i].get();
+			}
+			std::shuffle(pointers.begin(), pointers.end(), rng);
+			std::vector<Drawable*> shuffled = pointers;
+
+			auto startTime = std::chrono::high_resolution_clock::now();
+			std::sort(pointers.begin(), pointers.end(), [](Drawable *a, Drawable *b) -> bool {
+				if (a->depth != b->depth)
+					return a->depth < b->depth;
+				return a->texture < b->texture;
+			});
+			std::chrono::duration<double, std::milli> stdSortTime = std::chrono::high_resolution_clock::now() - startTime;
+
+			startTime = std::chrono::high_resolution_clock::now();
+			std::vector<Item> items(count), scratch;
+			for (uint32_t i = 0; i < count; ++i) {
+				items[i].key = makeKey(shuffled[i]->depth, false, PIPELINE_SPRITE, shuffled[i]->texture);
+				items[i].index = i;
+			}
+			const uint32_t skipped = radixSort(items, scratch);
+			std::chrono::duration<double, std::milli> radixTime = std::chrono::high_resolution_clock::now() - startTime;
+
+			// the same order, else the radix sort is broken
+			bool same = true;
+			for (uint32_t i = 0; i < count && same; ++i) {
+				Drawable *d = shuffled[items[i].index];
+				same = d->depth == pointers[i]->depth && d->texture == pointers[i]->texture;
+			}
+
+			REPORT("Sort " << count << " entries: std::sort " << stdSortTime.count() << " ms, radix " << radixTime.count() << " ms (" << skipped << "/8 passes skipped)"
+				<< (same ? "" : " ORDER MISMATCH") << "\n");
+		}
+	}
+}
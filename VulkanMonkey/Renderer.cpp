@@ -1,4 +1,5 @@
 #include "Renderer.h"
+#include "MemoryAllocator.h"
 #include "ErrorAndLog.h"
 #include <chrono>
 #include <random>
@@ -9,6 +10,15 @@
 namespace vm {
 
 	Renderer::Renderer(GLFWwindow * _window) : window(_window)
+	{
+		init();
+	}
+	Renderer::Renderer(uint32_t width, uint32_t height) : window(nullptr), headless(true)
+	{
+		swapchainExtent = vk::Extent2D(width, height);
+		init();
+	}
+	void Renderer::init()
 	{
 		allocateConsole();
 
@@ -23,35 +33,59 @@ namespace vm {
 		createImageViews();
 
 		createCommandPool();
+		createFrames();
 
 		createRenderPass();
 		createDepthResources();
 		createFrameBuffers();
 
-		createCommandBuffers();
-
 		//init ResourceManager
 		ResourceManager::getInstance().init(gpu, device, commandPool, graphicsQueue, gpuProperties, swapchainExtent);
 
+		// the loading that follows records its copies here, they are submitted together
+		VulkanQueueFamily queueFamily;
+		queueFamily.findQueueFamilies(gpu, surface);
+		ResourceManager::getInstance().uploadContext.create(gpu, device, queueFamily.graphicsFamilyId, graphicsQueue, queueFamily.transferFamilyId, transferQueue);
+
+		// the textures are read and decoded on these threads from now on
+		const uint32_t streamingCores = std::thread::hardware_concurrency();
+		ResourceManager::getInstance().textureStreamer.create(streamingCores > 1 ? std::min(streamingCores - 1, (uint32_t)STREAMING_THREADS) : 1);
+
 		createDescriptorSetLayout();
+		createPipelineCache();
+		createDeferredLighting();
+		deferredTargets = deferredLighting.createTargets(swapchainExtent, swapchainImageViews, depthImageView);
 		createGraphicsPipeline();
 
+		// the calling thread records a slice too
+		recordThreadPool.create(MAX_RECORD_THREADS - 1);
+		uint32_t cores = std::thread::hardware_concurrency();
+		setRecordThreads(cores > 0 ? cores : 1);
 	}
 	Renderer::~Renderer()
 	{
 		device.waitIdle();
-		destroySemaphores();
+		destroyRetiredSwapchains(true);
+		recordThreadPool.destroy();
+		ResourceManager::getInstance().textureStreamer.destroy();
+		ResourceManager::getInstance().textureResidency.destroy();
+		destroyFrames();
+		ResourceManager::getInstance().uploadContext.destroy();
 
 		destroyDescriptorPool(); // Descriptor sets are destroyed when destroying the descriptor pool
 		destroyTextures();
+		gpuCulling.destroy();
 		destroyUniformBuffers();
 
 		destroyIndexBuffers();
 		destroyVertexBuffers();
 
 		destroyGraphicsPipeline();
+		deferredLighting.destroy();
+		destroyPipelineCache();
 		destroyDescriptorSetLayout();
 
+		deferredLighting.destroyTargets(deferredTargets);
 		destroyFrameBuffers();
 		destroyDepthResources();
 		destroyRenderPass();
@@ -60,17 +94,22 @@ namespace vm {
 		destroyImageViews();
 		destroySwapchain();
 
+		MemoryAllocator::getInstance().destroy(device); // every buffer and image is destroyed by now
+
 		destroyLogicalDevice();
 		destroySurface();
 		destroyInstance();
 
-		freeConsole();
+		if (!headless)
+			freeConsole(); // do not wait for a key press in automated runs
 	}
 	void Renderer::enableLayersAndExtensions()
 	{
-		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
-		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
-		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+		if (!headless) {
+			instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+			instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+			deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+		}
 
 #ifdef _DEBUG
 		instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
@@ -156,9 +195,13 @@ namespace vm {
 			if (properties[i].queueFlags & vk::QueueFlagBits::eGraphics) {
 				graphicsFamilyId = i;
 			}
-			// find present queue family index
+			// find present queue family index, without a surface (headless) nothing is presented
 			vk::Bool32 presentSupport = false;
-			errCheck(gpu.getSurfaceSupportKHR(i, surface, &presentSupport));
+			if (surface) {
+				errCheck(gpu.getSurfaceSupportKHR(i, surface, &presentSupport));
+			}
+			else
+				presentSupport = (properties[i].queueFlags & vk::QueueFlagBits::eGraphics) ? VK_TRUE : VK_FALSE;
 			if (properties[i].queueCount > 0 && presentSupport) {
 				presentFamilyId = i;
 			}
@@ -167,20 +210,38 @@ namespace vm {
 				break;
 			}
 		}
+
+		// prefer a family made for transfers (dma engine), graphics families can transfer too
+		transferFamilyId = graphicsFamilyId;
+		for (uint32_t i = 0; i < familyCount; ++i) {
+			vk::QueueFlags flags = properties[i].queueFlags;
+			if (properties[i].queueCount > 0 && (flags & vk::QueueFlagBits::eTransfer) &&
+				!(flags & vk::QueueFlagBits::eGraphics) && !(flags & vk::QueueFlagBits::eCompute)) {
+				transferFamilyId = i;
+				break;
+			}
+		}
 	}
 	void Renderer::createLogicalDevice()
 	{
 		VulkanQueueFamily queueFamily;
 		queueFamily.findQueueFamilies(gpu, surface);
 		float priorities[]{ 1.0f }; // range : [0.0, 1.0]
-		auto const queueCreateInfo = vk::DeviceQueueCreateInfo()
+		std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos{};
+		queueCreateInfos.push_back(vk::DeviceQueueCreateInfo()
 			.setQueueFamilyIndex(queueFamily.graphicsFamilyId)
 			.setQueueCount(1)
-			.setPQueuePriorities(priorities);
+			.setPQueuePriorities(priorities));
+		if (queueFamily.transferFamilyId != queueFamily.graphicsFamilyId) {
+			queueCreateInfos.push_back(vk::DeviceQueueCreateInfo()
+				.setQueueFamilyIndex(queueFamily.transferFamilyId)
+				.setQueueCount(1)
+				.setPQueuePriorities(priorities));
+		}
 
 		auto const deviceCreateInfo = vk::DeviceCreateInfo()
-			.setQueueCreateInfoCount(1)
-			.setPQueueCreateInfos(&queueCreateInfo)
+			.setQueueCreateInfoCount((uint32_t)queueCreateInfos.size())
+			.setPQueueCreateInfos(queueCreateInfos.data())
 			.setEnabledLayerCount((uint32_t)deviceLayers.size())
 			.setPpEnabledLayerNames(deviceLayers.data())
 			.setEnabledExtensionCount((uint32_t)deviceExtensions.size())
@@ -192,6 +253,7 @@ namespace vm {
 		//get the graphics queue handler
 		graphicsQueue = device.getQueue(queueFamily.graphicsFamilyId, 0);
 		presentQueue = device.getQueue(queueFamily.presentFamilyId, 0);
+		transferQueue = device.getQueue(queueFamily.transferFamilyId, 0);
 
 		uint32_t count = 0;
 		errCheck(gpu.enumerateDeviceExtensionProperties(nullptr, &count, nullptr));
@@ -204,16 +266,33 @@ namespace vm {
 	}
 	void Renderer::createSurface()
 	{
+		if (headless)
+			return;
 		VkSurfaceKHR surf;
 		glfwCreateWindowSurface(instance, window, nullptr, &surf);
 		surface = surf;
 	}
 	void Renderer::destroySurface()
 	{
-		instance.destroySurfaceKHR(surface);
+		if (surface)
+			instance.destroySurfaceKHR(surface);
 	}
 	void Renderer::createSwapchain()
 	{
+		if (headless) {
+			// an image per frame in flight, transfer source so the frames can be read back
+			surfaceFormatKHR.format = vk::Format::eR8G8B8A8Unorm;
+			surfaceFormatKHR.colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+			swapchainImageCount = MAX_FRAMES_IN_FLIGHT;
+			swapchainImages.resize(swapchainImageCount);
+			offscreenImageMems.resize(swapchainImageCount);
+			for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+				helper.createImage(gpu, device, swapchainExtent.width, swapchainExtent.height, surfaceFormatKHR.format, vk::ImageTiling::eOptimal,
+					vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal, swapchainImages[i], offscreenImageMems[i]);
+			}
+			return;
+		}
+
 		SwapchainInfo swapchainInfo;
 		swapchainInfo.querySwapChainSupport(gpu, surface);
 
@@ -249,8 +328,7 @@ namespace vm {
 		vk::SwapchainKHR newSwapchain;//changes
 		errCheck(device.createSwapchainKHR(&swapchainCreateInfo, nullptr, &newSwapchain));//changes
 
-		if (swapchain)//changes
-			device.destroySwapchainKHR(swapchain);//changes
+		// the old one is retired by reInitSwapchain, frames in flight may still present to it
 		swapchain = newSwapchain;//changes
 
 								 // get the handlers
@@ -260,6 +338,13 @@ namespace vm {
 	}
 	void Renderer::destroySwapchain()
 	{
+		if (headless) {
+			for (uint32_t i = 0; i < swapchainImages.size(); ++i)
+				helper.destroyImage(device, swapchainImages[i], offscreenImageMems[i]);
+			swapchainImages.clear();
+			offscreenImageMems.clear();
+			return;
+		}
 		device.destroySwapchainKHR(swapchain, nullptr);
 	}
 	void Renderer::createImageViews()
@@ -293,33 +378,178 @@ namespace vm {
 	void Renderer::destroyTextures()
 	{
 		for (auto &t : ResourceManager::getInstance().textures) {
+			if (!t.second.atlasPage.empty() || !t.second.resident)
+				continue; // the image and the view belong to the page (or to the streaming placeholder)
 			helper.destroyImage(device, t.second.image, t.second.imageMem);
 			device.destroyImageView(t.second.imageView);
 		}
 		device.destroySampler(ResourceManager::getInstance().spriteSampler);
 	}
+	void Renderer::createTextureAtlas()
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		TextureAtlas &atlas = rm.textureAtlas;
+		if (atlas.isPacked())
+			return;
+		rm.textureStreamer.finishAtlasImages(atlas);
+		atlas.pack();
+
+		// one image per page, uploaded with the rest of the scene
+		for (uint32_t p = 0; p < atlas.getPageCount(); ++p) {
+			std::string pageName = "atlas page " + std::to_string(p);
+			Texture &page = rm.textures[pageName];
+			page.name = pageName;
+			std::vector<unsigned char> pixels = atlas.getPagePixels(p);
+			helper.createImage(gpu, device, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+				vk::MemoryPropertyFlagBits::eDeviceLocal, page.image, page.imageMem);
+			rm.uploadContext.uploadImage(pixels.data(), pixels.size(), page.image, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+			helper.createImageView(device, page.image, vk::Format::eR8G8B8A8Unorm, page.imageView);
+		}
+
+		// the packed textures point to their page, an animation frame is just an other uv rect of the same image
+		for (auto &t : rm.textures) {
+			if (!atlas.contains(t.first))
+				continue;
+			Texture &page = rm.textures["atlas page " + std::to_string(atlas.getPage(t.first))];
+			t.second.image = page.image;
+			t.second.imageView = page.imageView;
+			t.second.imageMem = nullptr;
+			t.second.uvRect = atlas.getUVRect(t.first);
+			t.second.atlasPage = page.name;
+			t.second.opaque = atlas.isOpaque(t.first);
+		}
+
+		// texture array slots for the images only, the packed textures share the slot of their page
+		uint32_t index = 0;
+		for (auto &t : rm.textures) {
+			if (t.second.atlasPage.empty())
+				t.second.index = index++;
+		}
+		for (auto &t : rm.textures) {
+			if (!t.second.atlasPage.empty())
+				t.second.index = rm.textures[t.second.atlasPage].index;
+		}
+
+		// the sprites keep copies of their textures
+		for (auto &s : Sprite::sprites) {
+			for (auto &t : s->textures)
+				t = rm.textures[t.name];
+		}
+		atlas.clear();
+
+		LOG("Texture atlas: " << atlas.getPageCount() << " pages, packed in " << atlas.getPackTime() << " ms, " << index << " images for " << rm.textures.size() - atlas.getPageCount() << " textures\n");
+	}
+	void Renderer::streamTextures()
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		std::vector<std::string> changed;
+		rm.descriptorAllocator.update(frameNumber, framesInFlight);
+		rm.textureResidency.update(frameNumber, framesInFlight, changed);
+		rm.textureStreamer.update(changed);
+		if (changed.empty())
+			return;
+
+		// the fence of their upload is signalled, their images are ready for this frame.
+		// the old dSet may be in use by the frames in flight, a new one is written for the texture and the old one retired.
+		// the evicted ones share one dSet of the placeholder, it is never retired
+		for (auto &name : changed) {
+			const Texture &tex = rm.textures[name];
+			if (!tex.resident && !placeholderDescriptorSet)
+				placeholderDescriptorSet = Sprite::createTextureDescriptorSet(tex);
+			auto shared = rm.textureDescriptorSets.find(name);
+			if (shared != rm.textureDescriptorSets.end()) {
+				if (shared->second != placeholderDescriptorSet)
+					rm.descriptorAllocator.retire(rm.spritesDescriptorSetLayout, shared->second, frameNumber);
+				shared->second = tex.resident ? Sprite::createTextureDescriptorSet(tex) : placeholderDescriptorSet;
+			}
+			for (auto &s : Sprite::sprites) {
+				for (size_t i = 0; i < s->textures.size(); ++i) {
+					if (s->textures[i].name != name)
+						continue;
+					s->textures[i] = tex;
+					if (shared != rm.textureDescriptorSets.end() && i < s->descriptorSets.size())
+						s->descriptorSets[i] = shared->second;
+				}
+			}
+		}
+		textureArrayStale = true;
+	}
 	void Renderer::reInitSwapchain()
 	{
-		if (device)
-			device.waitIdle();
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
 		if (!swapchain)
 			return;
 
-		destroyDepthResources();
-		destroyFrameBuffers();
-		device.freeCommandBuffers(commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-		destroyGraphicsPipeline();
-		destroyRenderPass();
-		destroyImageViews();
-
-		createSwapchain();
+		// the frames in flight keep rendering with the old resources, they are destroyed when these frames are done
+		RetiredSwapchain retired;
+		retired.swapchain = swapchain;
+		retired.imageViews = std::move(swapchainImageViews);
+		retired.frameBuffers = std::move(swapchainFrameBuffers);
+		retired.depthImage = depthImage;
+		retired.depthImageMemory = depthImageMemory;
+		retired.depthImageView = depthImageView;
+		retired.deferredTargets = deferredTargets;
+		retired.frameNumber = frameNumber;
+		retiredSwapchains.push_back(retired);
+		swapchainImageViews.clear();
+		swapchainFrameBuffers.clear();
+
+		const vk::Format oldFormat = surfaceFormatKHR.format;
+		createSwapchain();			// the old swapchain is passed as oldSwapchain
 		createImageViews();			// swapchain image update
-		createRenderPass();			// swapchain image format update
-		createGraphicsPipeline();	// viewport scissor update
+
+		// viewport and scissor are dynamic, the pipelines only depend on the render pass (the swapchain format),
+		// a format change is rare enough to just wait for the gpu
+		if (surfaceFormatKHR.format != oldFormat) {
+			device.waitIdle();
+			destroyRetiredSwapchains(true);
+			destroyGraphicsPipeline();
+			deferredLighting.destroy();
+			destroyRenderPass();
+			createRenderPass();
+			createDeferredLighting();
+			createGraphicsPipeline();
+		}
 		createDepthResources();		// match the new color attachment resolution
 		createFrameBuffers();		// swapchain image update
-		createCommandBuffers();		// swapchain image update
-		recordSimultaneousUseCommandBuffers();
+		deferredTargets = deferredLighting.createTargets(swapchainExtent, swapchainImageViews, depthImageView);
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		resizeTime = time.count();
+		++resizeCount;
+		LOG("Swapchain recreated in " << resizeTime << " ms (" << swapchainExtent.width << "x" << swapchainExtent.height << ")\n");
+	}
+	void Renderer::destroyRetiredSwapchains(bool all)
+	{
+		// summit waited the fence of frame (frameNumber - framesInFlight), the frames before it are done too
+		for (auto it = retiredSwapchains.begin(); it != retiredSwapchains.end();) {
+			if (!all && frameNumber < it->frameNumber + framesInFlight) {
+				++it;
+				continue;
+			}
+			for (auto fb : it->frameBuffers)
+				device.destroyFramebuffer(fb);
+			for (auto view : it->imageViews)
+				device.destroyImageView(view);
+			device.destroyImageView(it->depthImageView);
+			helper.destroyImage(device, it->depthImage, it->depthImageMemory);
+			deferredLighting.destroyTargets(it->deferredTargets);
+			device.destroySwapchainKHR(it->swapchain);
+			it = retiredSwapchains.erase(it);
+		}
+	}
+	uint32_t Renderer::getResizeCount() const
+	{
+		return resizeCount;
+	}
+	double Renderer::getPipelineCreateTime() const
+	{
+		return pipelineCreateTime;
+	}
+	double Renderer::getResizeTime() const
+	{
+		return resizeTime;
 	}
 	std::string Renderer::getGpuName() const
 	{
@@ -333,7 +563,7 @@ namespace vm {
 			.setLoadOp(vk::AttachmentLoadOp::eClear)
 			.setStoreOp(vk::AttachmentStoreOp::eStore)
 			.setInitialLayout(vk::ImageLayout::eUndefined)
-			.setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
+			.setFinalLayout(headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR);
 
 		auto const car = vk::AttachmentReference() // color attachment ref
 			.setAttachment(0)
@@ -359,13 +589,25 @@ namespace vm {
 			.setPColorAttachments(&car)
 			.setPDepthStencilAttachment(&depthAttachmentRef);
 
+		// with multiple frames in flight the next frame can start while the previous one still writes
+		// the (shared) depth attachment, so wait for the previous attachment writes before clearing
+		auto const dependency = vk::SubpassDependency()
+			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+			.setDstSubpass(0)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests)
+			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests)
+			.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+
 		std::array<vk::AttachmentDescription, 2> attachments = { cad, depthAttachment };
 
 		auto const rpci = vk::RenderPassCreateInfo()
 			.setAttachmentCount(static_cast<uint32_t>(attachments.size()))
 			.setPAttachments(attachments.data())
 			.setSubpassCount(1)
-			.setPSubpasses(&sd);
+			.setPSubpasses(&sd)
+			.setDependencyCount(1)
+			.setPDependencies(&dependency);
 
 		errCheck(device.createRenderPass(&rpci, nullptr, &renderPass));
 	}
@@ -373,6 +615,13 @@ namespace vm {
 	{
 		device.destroyRenderPass(renderPass);
 	}
+	void Renderer::createDeferredLighting()
+	{
+		// same attachments as renderPass, plus albedo and lights (optional, without its shaders it stays off)
+		// (the size dependent targets are made with the frame buffers)
+		deferredLighting.create(gpu, device, pipelineCache, surfaceFormatKHR.format, helper.findDepthFormat(gpu),
+			headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR);
+	}
 	void Renderer::createFrameBuffers()
 	{
 		swapchainFrameBuffers.resize(swapchainImageViews.size());
@@ -397,85 +646,32 @@ namespace vm {
 	}
 	void Renderer::createVertexBuffers()
 	{
-		if (Sprite::sprites.size() > 0) {
-			ResourceManager &rm = ResourceManager::getInstance();
-
-			// SPRITES VERTEX BUFFER
-			// local device buffer (GPU mem : CPU not accessible)
-			vk::DeviceSize vBufSize = Sprite::sprites.size() * sizeof(Vertex) * 4;
-			helper.createBuffer(gpu, device, vBufSize,
-				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-				vk::MemoryPropertyFlagBits::eDeviceLocal,
-				rm.spritesVertexBuffer, rm.spritesVertexBufferMem);
-
-			std::vector<Vertex> verts{};
-			for (auto &s : Sprite::sprites) {
-				verts.push_back(s->vertices[0]);
-				verts.push_back(s->vertices[1]);
-				verts.push_back(s->vertices[2]);
-				verts.push_back(s->vertices[3]);
-			}
-			// staging buffer (GPU mem : CPU accessible)
-			vk::Buffer stagingBuffer;
-			vk::DeviceMemory stagingBufferMemory;
-			helper.createBuffer(gpu, device, vBufSize,
-				vk::BufferUsageFlagBits::eTransferSrc,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-				stagingBuffer, stagingBufferMemory);
-
-			// get a pointer to the staging buffer memory and copy the (CPU) data in it
-			void * data;
-			auto const offset = vk::DeviceSize();
-			auto const memFlags = vk::MemoryMapFlags(); //0
-			device.mapMemory(stagingBufferMemory, offset, vBufSize, memFlags, &data);
-			memcpy(data, verts.data(), (size_t)vBufSize);
-			device.unmapMemory(stagingBufferMemory);
-
-			// copy staging buffer to local buffer
-			helper.copyBuffer(device, commandPool, graphicsQueue, &stagingBuffer, &rm.spritesVertexBuffer, &vBufSize);
-			helper.destroyBuffer(device, stagingBuffer, stagingBufferMemory);
-		}
+		// SPRITES VERTEX BUFFER
+		// local device buffer (GPU mem : CPU not accessible), grows with the sprites created later on
+		ResourceManager::getInstance().spriteStorage.create(gpu, device);
 	}
 	void Renderer::destroyVertexBuffers()
 	{
 		ResourceManager &rm = ResourceManager::getInstance();
 		for (auto &x : rm.userShapedBuffers)
 			helper.destroyBuffer(device, x.vertexBuffer, x.vertexBufferMem);
-		helper.destroyBuffer(device, rm.spritesVertexBuffer, rm.spritesVertexBufferMem);
+		rm.spriteStorage.destroy();
 	}
 	void Renderer::createIndexBuffers()
 	{
-		if (Sprite::sprites.size() > 0) {
-			ResourceManager &rm = ResourceManager::getInstance();
-
-			// SPRITES INDEX BUFFER
-			// local device buffer (GPU mem : CPU not accessible)
-			vk::DeviceSize iBufSize = sizeof(uint32_t) * 6;
-			helper.createBuffer(gpu, device, iBufSize,
-				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-				vk::MemoryPropertyFlagBits::eDeviceLocal,
-				rm.spritesIndexBuffer, rm.spritesIndexBufferMem);
-
-			// staging buffer (GPU mem : CPU accessible)
-			vk::Buffer stagingBuffer;
-			vk::DeviceMemory stagingBufferMemory;
-			helper.createBuffer(gpu, device, iBufSize,
-				vk::BufferUsageFlagBits::eTransferSrc,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-				stagingBuffer, stagingBufferMemory);
-
-			// get a pointer to the staging buffer memory and copy the (CPU) data in it
-			void * data;
-			auto const offset = vk::DeviceSize();
-			auto const memFlags = vk::MemoryMapFlags(); //0
-			device.mapMemory(stagingBufferMemory, offset, iBufSize, memFlags, &data);
-			memcpy(data, Sprite::sprites[0]->indices.data(), (size_t)iBufSize);
-			device.unmapMemory(stagingBufferMemory);
-
-			// copy staging buffer to local buffer
-			helper.copyBuffer(device, commandPool, graphicsQueue, &stagingBuffer, &rm.spritesIndexBuffer, &iBufSize);
-			helper.destroyBuffer(device, stagingBuffer, stagingBufferMemory);
-		}
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		// SPRITES INDEX BUFFER
+		// local device buffer (GPU mem : CPU not accessible), the same 6 indices for every quad
+		const uint32_t indices[] = { 0, 1, 2, 2, 3, 0 };
+		vk::DeviceSize iBufSize = sizeof(indices);
+		helper.createBuffer(gpu, device, iBufSize,
+			vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			rm.spritesIndexBuffer, rm.spritesIndexBufferMem);
+
+		// staged and copied with the rest of the uploads
+		rm.uploadContext.uploadBuffer(indices, iBufSize, rm.spritesIndexBuffer, vk::AccessFlagBits::eIndexRead, vk::PipelineStageFlagBits::eVertexInput);
 	}
 	void Renderer::destroyIndexBuffers()
 	{
@@ -486,57 +682,85 @@ namespace vm {
 	}
 	void Renderer::createUniformBuffers()
 	{
-		if (Sprite::sprites.size() > 0) {
-			//SPRITES UNIFORM BUFFER
-			ResourceManager &rm = ResourceManager::getInstance();
-			std::vector<UniformBufferObject> ubos;
-			for (auto &s : Sprite::sprites) {
-				ubos.push_back(s->ubo);
-			}
-			vk::DeviceSize uniSize = Sprite::sprites.size() * Sprite::sprites[0]->uBuffInfo.size;
-			helper.createBuffer(gpu, device, uniSize,
-				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eUniformBuffer,
-				vk::MemoryPropertyFlagBits::eHostVisible,
-				rm.spritesUniformBuffer, rm.spritesUniformBufferMem);
-
-			// get the pointers to the later one big uniform mapped memory to avoid mapping-unmpapping each sprite,
-			// persistent mapping gives a good boost if there are multiple sprites
-			for (auto &s : Sprite::sprites)
-				s->setPointerToUniformBufferMem(rm.spritesUniformBufferMem);
-
-			// persistent mapping
-			errCheck(device.mapMemory(rm.spritesUniformBufferMem, vk::DeviceSize(), uniSize, vk::MemoryMapFlags(), &rm.spritesUniformData));
-			memcpy(rm.spritesUniformData, ubos.data(), uniSize);
+		{
+			//SPRITES UNIFORM AND INSTANCE DATA
+			size_t slots = Sprite::sprites.size() > Entity::drawList.size() ? Sprite::sprites.size() : Entity::drawList.size();
+			createSpriteFrameAllocator(slots > 0 ? slots : 1);
 		}
 		{
-			//LIGHTS UNIFORM BUFFER
-			ResourceManager &rm = ResourceManager::getInstance();
-
-			std::vector<UniformLightObject> ulos;
-			for (auto i = 0; i < MAX_POINT_LIGHTS; i++)
-				ulos.push_back(PointLight::lightPool[i]->ulo);
-
-			vk::DeviceSize uniSize = MAX_POINT_LIGHTS * sizeof(UniformLightObject); // TODO: check for alignmens
-			helper.createBuffer(gpu, device, uniSize,
-				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eUniformBuffer,
-				vk::MemoryPropertyFlagBits::eHostVisible,
-				rm.pointLightsUniformBuffer, rm.pointLightsUniformBufferMem);
-
-			// get the pointers to the later one big uniform mapped memory to avoid mapping-unmpapping each light,
-			// persistent mapping gives a good boost if there are multiple lights
-			for (auto i = 0; i < MAX_POINT_LIGHTS; i++)
-				PointLight::lightPool[i]->setPointerToUniformBufferMem(rm.pointLightsUniformBufferMem);
-
-			// persistent mapping
-			errCheck(device.mapMemory(rm.pointLightsUniformBufferMem, vk::DeviceSize(), uniSize, vk::MemoryMapFlags(), &rm.pointLightsUniformData));
-			memcpy(rm.pointLightsUniformData, ulos.data(), uniSize);
+			//LIGHTS AND LIGHT TILES, rewritten every frame, and the shadow masks and distance field they sample
+			shadowCasting.create(gpu, device, pipelineCache, MAX_FRAMES_IN_FLIGHT);
+			distanceField.create(gpu, device, pipelineCache, MAX_FRAMES_IN_FLIGHT);
+			lightCulling.create(gpu, device, MAX_FRAMES_IN_FLIGHT, shadowCasting.getMaskInfo(), distanceField.getDistanceInfo());
 		}
 	}
+	void Renderer::createSpriteFrameAllocator(size_t slots)
+	{
+		// no fixed slot per sprite, every frame allocates the ubos (or the instances if batched) of the drawn sprites only.
+		// a region is big enough for the given sprites to be drawn once, with their ubos aligned to minUniformBufferOffsetAlignment
+		ResourceManager &rm = ResourceManager::getInstance();
+		vk::DeviceSize align = gpuProperties.limits.minUniformBufferOffsetAlignment > 16 ? gpuProperties.limits.minUniformBufferOffsetAlignment : 16;
+		if (gpuProperties.limits.minStorageBufferOffsetAlignment > align)
+			align = gpuProperties.limits.minStorageBufferOffsetAlignment;
+		vk::DeviceSize uboStride = (sizeof(UniformBufferObject) + align - 1) / align * align;
+		if (uboStride < sizeof(InstanceData))
+			uboStride = sizeof(InstanceData);
+		// every entity of the drawList gets a slot, so the recording threads can fill their slices without locking
+		// the gpu culling reads the sprites as a storage buffer and copies its initial indirect commands (a batch per sprite at most) from here
+		vk::DeviceSize frameSize = (slots + 1) * uboStride + (slots + 1) * sizeof(vk::DrawIndexedIndirectCommand) + align;
+		rm.frameAllocator.create(frameSize, MAX_FRAMES_IN_FLIGHT, vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eVertexBuffer |
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+		spriteSlots = slots;
+	}
+	void Renderer::growSpriteSlots(size_t slots)
+	{
+		// the frame allocator holds no data between the frames, so a bigger one is created instead of copied.
+		// the frames in flight keep the old buffer and the dSets pointing at it, it is destroyed once they are done
+		auto const startTime = std::chrono::high_resolution_clock::now();
+		ResourceManager &rm = ResourceManager::getInstance();
+		rm.frameAllocator.retire(frameNumber);
+		createSpriteFrameAllocator(slots);
+
+		// the texture dSets are shared by all the frames: a new one is written for every texture (and the placeholder)
+		// and the old one retired, like a streamed texture. the gpu culling sets are per frame, they follow in update
+		std::map<VkDescriptorSet, vk::DescriptorSet> replaced;
+		vk::DescriptorSet placeholder;
+		for (auto &d : rm.textureDescriptorSets) {
+			const Texture &tex = rm.textures[d.first];
+			if (d.second == placeholderDescriptorSet) {
+				if (!placeholder)
+					placeholder = Sprite::createTextureDescriptorSet(tex);
+				d.second = placeholder;
+				continue;
+			}
+			rm.descriptorAllocator.retire(rm.spritesDescriptorSetLayout, d.second, frameNumber);
+			vk::DescriptorSet &set = replaced[static_cast<VkDescriptorSet>(d.second)];
+			set = Sprite::createTextureDescriptorSet(tex);
+			d.second = set;
+		}
+		if (placeholderDescriptorSet) {
+			rm.descriptorAllocator.retire(rm.spritesDescriptorSetLayout, placeholderDescriptorSet, frameNumber);
+			replaced[static_cast<VkDescriptorSet>(placeholderDescriptorSet)] = placeholder;
+		}
+		placeholderDescriptorSet = placeholder;
+		for (auto &s : Sprite::sprites) {
+			for (auto &set : s->descriptorSets) {
+				auto it = replaced.find(static_cast<VkDescriptorSet>(set));
+				if (it != replaced.end())
+					set = it->second;
+			}
+		}
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		LOG("Sprite slots grown to " << slots << " in " << time.count() << " ms\n");
+	}
 	void Renderer::destroyUniformBuffers()
 	{
 		helper.destroyBuffer(device, mainCamera.getUniformBuffer(), mainCamera.getUniformBufferMem());
-		helper.destroyBuffer(device, ResourceManager::getInstance().spritesUniformBuffer, ResourceManager::getInstance().spritesUniformBufferMem);
-		helper.destroyBuffer(device, ResourceManager::getInstance().pointLightsUniformBuffer, ResourceManager::getInstance().pointLightsUniformBufferMem);
+		ResourceManager::getInstance().frameAllocator.destroy();
+		lightCulling.destroy();
+		shadowCasting.destroy();
+		distanceField.destroy();
 	}
 	void Renderer::createCommandPool()
 	{
@@ -548,21 +772,6 @@ namespace vm {
 			.setFlags(vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
 		errCheck(device.createCommandPool(&cpci, nullptr, &commandPool));
 	}
-	void Renderer::createCommandBuffers()
-	{
-		commandBuffers.resize(swapchainFrameBuffers.size());
-		auto const cbai = vk::CommandBufferAllocateInfo()
-			.setCommandPool(commandPool)
-			.setLevel(vk::CommandBufferLevel::ePrimary)
-			.setCommandBufferCount((uint32_t)(commandBuffers.size()));
-		errCheck(device.allocateCommandBuffers(&cbai, commandBuffers.data()));
-
-		auto const dcbai = vk::CommandBufferAllocateInfo()
-			.setCommandPool(commandPool)
-			.setLevel(vk::CommandBufferLevel::ePrimary)
-			.setCommandBufferCount(1);
-		errCheck(device.allocateCommandBuffers(&dcbai, &dynamicCmdBuffer));
-	}
 	void Renderer::destroyCommandPool()
 	{
 		device.destroyCommandPool(commandPool);
@@ -574,60 +783,84 @@ namespace vm {
 			vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment,
 			vk::MemoryPropertyFlagBits::eDeviceLocal, depthImage, depthImageMemory);
 		helper.createImageView(device, depthImage, depthFormat, depthImageView, vk::ImageAspectFlagBits::eDepth);
-		helper.transitionImageLayout(device, commandPool, graphicsQueue, depthImage,
-			vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal, depthFormat);
+		// no layout transition, the render pass clears it from eUndefined (and a submit here would wait for the frames in flight)
 
 	}
 	void Renderer::destroyDepthResources()
 	{
 		device.destroyImageView(depthImageView);
-		device.destroyImage(depthImage);
-		device.freeMemory(depthImageMemory);
+		helper.destroyImage(device, depthImage, depthImageMemory);
 	}
 	void Renderer::createDescriptorPool()
 	{
-		std::vector<vk::DescriptorPoolSize> descriptorPoolSizes = {};
-
-		// for mvp uniform
-		descriptorPoolSizes.push_back(vk::DescriptorPoolSize()
-			.setType(vk::DescriptorType::eUniformBufferDynamic)				//descriptor type
-			.setDescriptorCount((uint32_t)Sprite::sprites.size() + 50));		//descriptor count
-
-		// for texture
-		descriptorPoolSizes.push_back(vk::DescriptorPoolSize()
-			.setType(vk::DescriptorType::eCombinedImageSampler)				//descriptor type
-			.setDescriptorCount((uint32_t)Sprite::sprites.size() + 50));		//descriptor count
-
-		// for pointLights
-		descriptorPoolSizes.push_back(vk::DescriptorPoolSize()
-			.setType(vk::DescriptorType::eUniformBuffer)					//descriptor type
-			.setDescriptorCount(1));										//descriptor count
-
-		// for camera
-		descriptorPoolSizes.push_back(vk::DescriptorPoolSize()
+		// the camera's dSets, one per frame in flight, the sprites and the texture array allocate theirs as they come (the lights have their own pool)
+		auto const poolSize = vk::DescriptorPoolSize()
 			.setType(vk::DescriptorType::eUniformBuffer)			//descriptor type
-			.setDescriptorCount(1));								//descriptor count
-
+			.setDescriptorCount(MAX_FRAMES_IN_FLIGHT);				//descriptor count
 		auto const createInfo = vk::DescriptorPoolCreateInfo()
-			.setPoolSizeCount((uint32_t)descriptorPoolSizes.size())
-			.setPPoolSizes(descriptorPoolSizes.data())
-			.setMaxSets((uint32_t)Sprite::sprites.size() + 50);
-
+			.setPoolSizeCount(1)
+			.setPPoolSizes(&poolSize)
+			.setMaxSets(MAX_FRAMES_IN_FLIGHT);
 		errCheck(device.createDescriptorPool(&createInfo, nullptr, &descriptorPool));
+
+		// sprites with the same texture share a dSet, so the first pool is sized for the loaded textures
+		ResourceManager &rm = ResourceManager::getInstance();
+		rm.descriptorAllocator.create(device, rm.textures.size() > 0 ? (uint32_t)rm.textures.size() : 1);
 	}
 	void Renderer::destroyDescriptorPool()
 	{
 		device.destroyDescriptorPool(descriptorPool);
+		ResourceManager &rm = ResourceManager::getInstance();
+		rm.descriptorAllocator.destroy();
+		rm.textureDescriptorSets.clear();
+		rm.texturesDescriptorSet = nullptr;
+		placeholderDescriptorSet = nullptr;
 	}
 	void Renderer::createDescriptorSets()
 	{
 		mainCamera.createDescriptorSet(descriptorPool);
 
 		for (auto &s : Sprite::sprites) 
-			s->createDescriptorSets(descriptorPool);
-
-		PointLight::createDescriptorSet(descriptorPool);
+			s->createDescriptorSets();
 
+		writeTextureArray();
+	}
+	void Renderer::writeTextureArray()
+	{
+		// texture array, every slot must be written so the unused ones repeat the first texture.
+		// a set in use can't be written, so the textures loaded later get a new set (the old one is retired)
+		ResourceManager &rm = ResourceManager::getInstance();
+		textureArrayTextures = rm.textures.size();
+		textureArrayStale = false;
+		if (rm.textures.empty())
+			return;
+		rm.descriptorAllocator.retire(rm.texturesDescriptorSetLayout, rm.texturesDescriptorSet, frameNumber);
+		rm.texturesDescriptorSet = rm.descriptorAllocator.allocate(rm.texturesDescriptorSetLayout, {
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(rm.textureArraySize) });
+
+		std::vector<vk::DescriptorImageInfo> imageInfos(rm.textureArraySize, vk::DescriptorImageInfo()
+			.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+			.setImageView(rm.textures.begin()->second.imageView));
+		for (auto &t : rm.textures) {
+			if (t.second.index < rm.textureArraySize)
+				imageInfos[t.second.index].setImageView(t.second.imageView);
+		}
+		rm.textureSlotCount = 0;
+		for (auto &t : rm.textures) {
+			if (t.second.index + 1 > rm.textureSlotCount)
+				rm.textureSlotCount = t.second.index + 1;
+		}
+		if (rm.textureSlotCount > rm.textureArraySize)
+			LOG(rm.textureSlotCount << " textures do not fit in the texture array (" << rm.textureArraySize << "), texture array is disabled\n");
+
+		auto const writeDset = vk::WriteDescriptorSet()
+			.setDstSet(rm.texturesDescriptorSet)							//descriptor set
+			.setDstBinding(0)												//binding number in shader
+			.setDstArrayElement(0)											//start element in array
+			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)	//descriptor type
+			.setDescriptorCount(rm.textureArraySize)						//descriptor count
+			.setPImageInfo(imageInfos.data());
+		device.updateDescriptorSets(1, &writeDset, 0, nullptr);
 	}
 	void Renderer::createDescriptorSetLayout()
 	{
@@ -638,21 +871,65 @@ namespace vm {
 		ResourceManager::getInstance().setUpCameraDescriptorSetLayout();
 		// point light descriptionSetLayout
 		ResourceManager::getInstance().setUpPointLightsDescriptorSetLayout();
+		// texture array descriptionSetLayout
+		ResourceManager::getInstance().setUpTexturesDescriptorSetLayout();
 	}
 	void Renderer::destroyDescriptorSetLayout()
 	{
 		device.destroyDescriptorSetLayout(ResourceManager::getInstance().spritesDescriptorSetLayout);
 		device.destroyDescriptorSetLayout(ResourceManager::getInstance().cameraDescriptorSetLayout);
 		device.destroyDescriptorSetLayout(ResourceManager::getInstance().pointLightsDescriptorSetLayout);
+		device.destroyDescriptorSetLayout(ResourceManager::getInstance().texturesDescriptorSetLayout);
+	}
+	void Renderer::createPipelineCache()
+	{
+		// the driver checks the header too, but some drivers do not like a cache of an other gpu at all
+		std::vector<char> cacheData;
+		if (std::ifstream(PIPELINE_CACHE_FILE).good()) {
+			cacheData = readFile(PIPELINE_CACHE_FILE);
+			const size_t headerSize = 16 + VK_UUID_SIZE;
+			uint32_t header[4] = {};
+			if (cacheData.size() >= headerSize)
+				memcpy(header, cacheData.data(), sizeof(header));
+			if (cacheData.size() < headerSize ||
+				header[1] != static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne) ||
+				header[2] != gpuProperties.vendorID ||
+				header[3] != gpuProperties.deviceID ||
+				memcmp(cacheData.data() + 16, gpuProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+				LOG(PIPELINE_CACHE_FILE << " is from an other gpu or driver, starting with an empty cache\n");
+				cacheData.clear();
+			}
+		}
+
+		auto const pcci = vk::PipelineCacheCreateInfo()
+			.setInitialDataSize(cacheData.size())
+			.setPInitialData(cacheData.empty() ? nullptr : cacheData.data());
+		errCheck(device.createPipelineCache(&pcci, nullptr, &pipelineCache));
+	}
+	void Renderer::destroyPipelineCache()
+	{
+		// save what was compiled, for the next run
+		size_t size = 0;
+		errCheck(device.getPipelineCacheData(pipelineCache, &size, nullptr));
+		std::vector<char> cacheData(size);
+		errCheck(device.getPipelineCacheData(pipelineCache, &size, cacheData.data()));
+		std::ofstream file(PIPELINE_CACHE_FILE, std::ios::binary | std::ios::trunc);
+		if (file.is_open())
+			file.write(cacheData.data(), size);
+
+		device.destroyPipelineCache(pipelineCache);
 	}
 	void Renderer::createGraphicsPipeline()
 	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
 		vk::ShaderModule vShaderMod; //dont forget to destroy this
 		vk::ShaderModule fShaderMod; //dont forget to destroy this
 
 		{
-			auto vertShaderCode = readFile("shaders/shader.vert.spv");
-			auto fragShaderCode = readFile("shaders/shader.frag.spv");
+			AssetView vertShaderCode, fragShaderCode;
+			ResourceManager::getInstance().assetArchive.read("shaders/shader.vert.spv", vertShaderCode);
+			ResourceManager::getInstance().assetArchive.read("shaders/shader.frag.spv", fragShaderCode);
 			//std::cout << "\t\tShaders loaded: Size {" << vertShaderCode.size() << ", " << fragShaderCode.size() << "}\n";
 
 			createShaderModule(vertShaderCode, vShaderMod);
@@ -671,8 +948,8 @@ namespace vm {
 		vk::PipelineShaderStageCreateInfo shaderStages[] = { vssi, fssi }; //shader stages holder
 
 																		   //1. Vertex input stage [Fixed]
-		auto bindingDiscription = Vertex::getBindingDescription();
-		auto attributeDescriptions = Vertex::getAttributeDescription();
+		auto bindingDiscription = SpriteVertex::getBindingDescription();
+		auto attributeDescriptions = SpriteVertex::getAttributeDescription();
 		auto visci = vk::PipelineVertexInputStateCreateInfo()
 			.setVertexBindingDescriptionCount(1)
 			.setPVertexBindingDescriptions(&bindingDiscription)
@@ -690,22 +967,17 @@ namespace vm {
 
 		//5. Geometry shader stage [Programmable] : optional
 
-		//6-1. Viewports and scissors [Fixed]
-		auto viewport = vk::Viewport() //region of the frambuffer
-			.setX(0.0f)
-			.setY(0.0f)
-			.setWidth((float)swapchainExtent.width)
-			.setHeight((float)swapchainExtent.height)
-			.setMinDepth(-1.0f)
-			.setMaxDepth(1.0f);
-		auto scissor = vk::Rect2D()
-			.setOffset({ 0, 0 }) //vk::Offset2D() constructor also auto sets to {0, 0}
-			.setExtent(swapchainExtent);
+		//6-1. Viewports and scissors [Dynamic]
+		// set while recording (recordDrawRange), so a resize does not rebuild the pipelines
 		auto viewportState = vk::PipelineViewportStateCreateInfo()
 			.setViewportCount(1)
-			.setPViewports(&viewport)
+			.setPViewports(nullptr)
 			.setScissorCount(1)
-			.setPScissors(&scissor);
+			.setPScissors(nullptr);
+		vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+		auto dynamicState = vk::PipelineDynamicStateCreateInfo()
+			.setDynamicStateCount(2)
+			.setPDynamicStates(dynamicStates);
 
 		//6-2. Rasterizer stage [Fixed]
 		auto rasterizer = vk::PipelineRasterizationStateCreateInfo()
@@ -752,7 +1024,7 @@ namespace vm {
 				vk::ColorComponentFlagBits::eB |
 				vk::ColorComponentFlagBits::eA)
 			.setBlendEnable(VK_TRUE)
-			.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+			.setSrcColorBlendFactor(vk::BlendFactor::eOne) // the textures and so the shaders' colors are premultiplied
 			.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
 			.setColorBlendOp(vk::BlendOp::eAdd)
 			.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
@@ -785,6 +1057,34 @@ namespace vm {
 		//device.createPipelineLayout(&plci, nullptr, &pipelineLayout);
 		errCheck(device.createPipelineLayout(&plci, nullptr, &pipelineLayout));
 
+		// the same pipelines for subpass 0 of the deferred render pass, unlit, and the alpha adds up to the coverage
+		pipelineAlbedo = nullptr;
+		pipelineInstancedAlbedo = nullptr;
+		pipelineTextureArrayAlbedo = nullptr;
+		auto albedoAttachment = colorAttachment;
+		albedoAttachment
+			.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+			.setDstAlphaBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha);
+		auto albedoBlending = colorBlending;
+		albedoBlending.setPAttachments(&albedoAttachment);
+		auto createAlbedoPipeline = [&](const vk::GraphicsPipelineCreateInfo &forward, const std::string &fragShader, vk::Pipeline &albedoPipeline) {
+			AssetView code;
+			if (!deferredLighting.isAvailable() || !ResourceManager::getInstance().assetArchive.read(fragShader, code))
+				return;
+			vk::ShaderModule fAlbedoShaderMod;
+			createShaderModule(code, fAlbedoShaderMod);
+			vk::PipelineShaderStageCreateInfo albedoStages[] = { forward.pStages[0], forward.pStages[1] };
+			albedoStages[1].setModule(fAlbedoShaderMod);
+			auto albedoGpci = forward;
+			albedoGpci
+				.setPStages(albedoStages)
+				.setPColorBlendState(&albedoBlending)
+				.setRenderPass(deferredLighting.getRenderPass())
+				.setSubpass(0);
+			errCheck(device.createGraphicsPipelines(pipelineCache, 1, &albedoGpci, nullptr, &albedoPipeline));
+			device.destroyShaderModule(fAlbedoShaderMod);
+		};
+
 		auto gpci = vk::GraphicsPipelineCreateInfo()
 			.setStageCount(2)
 			.setPStages(shaderStages)
@@ -795,23 +1095,116 @@ namespace vm {
 			.setPMultisampleState(&multisampling)
 			.setPDepthStencilState(&depthStencil) // optional
 			.setPColorBlendState(&colorBlending)
-			.setPDynamicState(nullptr) // optional
+			.setPDynamicState(&dynamicState)
 			.setLayout(pipelineLayout)
 			.setRenderPass(renderPass)
 			.setSubpass(0)
 			.setBasePipelineHandle(nullptr) // deriving from an existing pipeline
 			.setBasePipelineIndex(-1); // optional
 		;
-		errCheck(device.createGraphicsPipelines(nullptr, 1, &gpci, nullptr, &pipeline));
+		errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &pipeline));
+		createAlbedoPipeline(gpci, "shaders/shaderAlbedo.frag.spv", pipelineAlbedo);
+
+		// Instanced pipeline, the model matrix is a per instance vertex attribute (binding 1) instead of the dynamic uniform
+		// (optional, without the compiled shader the sprites are drawn one by one)
+		AssetView instancedCode;
+		if (ResourceManager::getInstance().assetArchive.read("shaders/shaderInstanced.vert.spv", instancedCode)) {
+			vk::ShaderModule vInstShaderMod;
+			createShaderModule(instancedCode, vInstShaderMod);
+			shaderStages[0].setModule(vInstShaderMod);
+
+			auto instBindingDiscription = InstanceData::getBindingDescription();
+			auto instAttributeDescriptions = InstanceData::getAttributeDescription();
+			vk::VertexInputBindingDescription bindings[] = { bindingDiscription, instBindingDiscription };
+			std::vector<vk::VertexInputAttributeDescription> attributes(attributeDescriptions.begin(), attributeDescriptions.end());
+			attributes.insert(attributes.end(), instAttributeDescriptions.begin(), instAttributeDescriptions.end());
+			visci
+				.setVertexBindingDescriptionCount(2)
+				.setPVertexBindingDescriptions(bindings)
+				.setVertexAttributeDescriptionCount((uint32_t)attributes.size())
+				.setPVertexAttributeDescriptions(attributes.data());
+
+			errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &pipelineInstanced));
+			createAlbedoPipeline(gpci, "shaders/shaderAlbedo.frag.spv", pipelineInstancedAlbedo);
+			device.destroyShaderModule(vInstShaderMod);
+
+			// Texture array pipeline, same vertex input, set 0 is the texture array instead of the sprite dSet.
+			// The index must be dynamically uniform without descriptor indexing, so the draws still break on texture changes
+			pipelineTextureArray = nullptr;
+			pipelineLayoutTextureArray = nullptr;
+			AssetView arrayVertCode, arrayFragCode;
+			if (gpuFeatures.shaderSampledImageArrayDynamicIndexing &&
+				ResourceManager::getInstance().assetArchive.read("shaders/shaderTextureArray.vert.spv", arrayVertCode) &&
+				ResourceManager::getInstance().assetArchive.read("shaders/shaderTextureArray.frag.spv", arrayFragCode)) {
+				vk::ShaderModule vArrShaderMod, fArrShaderMod;
+				createShaderModule(arrayVertCode, vArrShaderMod);
+				createShaderModule(arrayFragCode, fArrShaderMod);
+
+				// the array size of the shader is a specialization constant (constant_id = 0)
+				uint32_t textureArraySize = ResourceManager::getInstance().textureArraySize;
+				auto const specializationEntry = vk::SpecializationMapEntry()
+					.setConstantID(0)
+					.setOffset(0)
+					.setSize(sizeof(uint32_t));
+				auto const specializationInfo = vk::SpecializationInfo()
+					.setMapEntryCount(1)
+					.setPMapEntries(&specializationEntry)
+					.setDataSize(sizeof(uint32_t))
+					.setPData(&textureArraySize);
+				vk::PipelineShaderStageCreateInfo arrShaderStages[] = { vssi, fssi };
+				arrShaderStages[0].setModule(vArrShaderMod);
+				arrShaderStages[1].setModule(fArrShaderMod).setPSpecializationInfo(&specializationInfo);
+
+				// the push constant range must match the one of pipelineLayout, the ambient color is pushed once for both
+				vk::DescriptorSetLayout arrDescSetLayouts[] = {	ResourceManager::getInstance().texturesDescriptorSetLayout,
+																ResourceManager::getInstance().cameraDescriptorSetLayout,
+																ResourceManager::getInstance().pointLightsDescriptorSetLayout };
+				plci.setPSetLayouts(arrDescSetLayouts);
+				errCheck(device.createPipelineLayout(&plci, nullptr, &pipelineLayoutTextureArray));
+
+				gpci
+					.setPStages(arrShaderStages)
+					.setLayout(pipelineLayoutTextureArray);
+				errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &pipelineTextureArray));
+				createAlbedoPipeline(gpci, "shaders/shaderTextureArrayAlbedo.frag.spv", pipelineTextureArrayAlbedo);
+				device.destroyShaderModule(vArrShaderMod);
+				device.destroyShaderModule(fArrShaderMod);
+			}
+			else {
+				LOG("texture array shaders not found or no dynamic indexing of sampler arrays, texture array is disabled\n");
+			}
+		}
+		else {
+			pipelineInstanced = nullptr;
+			pipelineTextureArray = nullptr;
+			pipelineLayoutTextureArray = nullptr;
+			LOG("shaders/shaderInstanced.vert.spv not found, sprite batching is disabled\n");
+		}
 
 		//	Destroy shader modules after graphics pipeline creation
 		device.destroyShaderModule(fShaderMod);
 		device.destroyShaderModule(vShaderMod);
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		pipelineCreateTime = time.count();
+		LOG("Graphics pipelines created in " << pipelineCreateTime << " ms\n");
 	}
 	void Renderer::destroyGraphicsPipeline()
 	{
 		device.destroyPipelineLayout(pipelineLayout);
 		device.destroyPipeline(pipeline);
+		if (pipelineInstanced)
+			device.destroyPipeline(pipelineInstanced);
+		if (pipelineTextureArray) {
+			device.destroyPipeline(pipelineTextureArray);
+			device.destroyPipelineLayout(pipelineLayoutTextureArray);
+		}
+		if (pipelineAlbedo)
+			device.destroyPipeline(pipelineAlbedo);
+		if (pipelineInstancedAlbedo)
+			device.destroyPipeline(pipelineInstancedAlbedo);
+		if (pipelineTextureArrayAlbedo)
+			device.destroyPipeline(pipelineTextureArrayAlbedo);
 	}
 	std::vector<char> Renderer::readFile(const std::string& filename) {
 		std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -826,33 +1219,110 @@ namespace vm {
 
 		return buffer;
 	}
-	void Renderer::createShaderModule(const std::vector<char>& code, vk::ShaderModule & shaderModule)
+	void Renderer::createShaderModule(const AssetView& code, vk::ShaderModule & shaderModule)
 	{
 		auto const smci = vk::ShaderModuleCreateInfo()
 			.setCodeSize(code.size())
 			.setPCode(reinterpret_cast<const uint32_t*>(code.data()));
 		errCheck(device.createShaderModule(&smci, nullptr, &shaderModule));
 	}
-	void Renderer::createSemaphores()
+	void Renderer::createFrames()
 	{
-		auto const si = vk::SemaphoreCreateInfo();
-		errCheck(device.createSemaphore(&si, nullptr, &semaphore_Image_Available));
-		errCheck(device.createSemaphore(&si, nullptr, &semaphore_Render_Finished));
+		VulkanQueueFamily qi;
+		qi.findQueueFamilies(gpu, surface);
+
+		frames.resize(framesInFlight);
+		for (uint32_t i = 0; i < framesInFlight; ++i) {
+			FrameData &frame = frames[i];
+
+			// a pool per frame, so the whole frame can be reset at once when its fence is signaled
+			auto const cpci = vk::CommandPoolCreateInfo()
+				.setQueueFamilyIndex(qi.graphicsFamilyId)
+				.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+			errCheck(device.createCommandPool(&cpci, nullptr, &frame.commandPool));
+
+			auto const cbai = vk::CommandBufferAllocateInfo()
+				.setCommandPool(frame.commandPool)
+				.setLevel(vk::CommandBufferLevel::ePrimary)
+				.setCommandBufferCount(1);
+			errCheck(device.allocateCommandBuffers(&cbai, &frame.commandBuffer));
+
+			for (uint32_t t = 0; t < MAX_RECORD_THREADS; ++t) {
+				errCheck(device.createCommandPool(&cpci, nullptr, &frame.threadCommandPools[t]));
+				auto const scbai = vk::CommandBufferAllocateInfo()
+					.setCommandPool(frame.threadCommandPools[t])
+					.setLevel(vk::CommandBufferLevel::eSecondary)
+					.setCommandBufferCount(1);
+				errCheck(device.allocateCommandBuffers(&scbai, &frame.secondaryCommandBuffers[t]));
+			}
+
+			// signaled, so the first wait on every frame returns immediately
+			auto const fci = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
+			errCheck(device.createFence(&fci, nullptr, &frame.fence));
+
+			auto const si = vk::SemaphoreCreateInfo();
+			errCheck(device.createSemaphore(&si, nullptr, &frame.semaphore_Image_Available));
+			errCheck(device.createSemaphore(&si, nullptr, &frame.semaphore_Render_Finished));
+
+			frame.submitTime = 0.0;
+			frame.submitted = false;
+		}
+		currentFrame = 0;
 	}
-	void Renderer::destroySemaphores()
+	void Renderer::destroyFrames()
 	{
-		device.destroySemaphore(semaphore_Image_Available);
-		device.destroySemaphore(semaphore_Render_Finished);
+		for (auto &frame : frames) {
+			device.destroySemaphore(frame.semaphore_Image_Available);
+			device.destroySemaphore(frame.semaphore_Render_Finished);
+			device.destroyFence(frame.fence);
+			device.destroyCommandPool(frame.commandPool); // cmd buffer is auto destroyed with cmd pool
+			for (auto &pool : frame.threadCommandPools)
+				device.destroyCommandPool(pool);
+		}
+		frames.clear();
 	}
-	void Renderer::createFence()
+	void Renderer::setFramesInFlight(uint32_t count)
 	{
-		auto const fci = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
-		errCheck(device.createFence(&fci, nullptr, &fence));
+		if (count < 1)
+			count = 1;
+		if (count > MAX_FRAMES_IN_FLIGHT)
+			count = MAX_FRAMES_IN_FLIGHT;
+		if (count == framesInFlight)
+			return;
 
+		device.waitIdle();
+		destroyRetiredSwapchains(true);
+		destroyFrames();
+		framesInFlight = count;
+		createFrames();
+		fenceWaitTime = 0.0;
+		frameLatency = 0.0;
+	}
+	void Renderer::setRecordThreads(uint32_t count)
+	{
+		if (count < 1)
+			count = 1;
+		if (count > MAX_RECORD_THREADS)
+			count = MAX_RECORD_THREADS;
+		recordThreads = count;
+		recordTime = 0.0;
+		LOG("Record threads: " << recordThreads << "\n");
+	}
+	uint32_t Renderer::getRecordThreads() const
+	{
+		return recordThreads;
+	}
+	uint32_t Renderer::getFramesInFlight() const
+	{
+		return framesInFlight;
 	}
-	void Renderer::destroyFence()
+	double Renderer::getFenceWaitTime() const
 	{
-		device.destroyFence(fence);
+		return fenceWaitTime;
+	}
+	double Renderer::getFrameLatency() const
+	{
+		return frameLatency;
 	}
 #ifdef _DEBUG
 	VKAPI_ATTR VkBool32 VKAPI_CALL Renderer::VulkanDebugCallBack(
@@ -1012,15 +1482,33 @@ namespace vm {
 	{
 		return capabilities.currentExtent;
 	}
-	void Renderer::summit(bool useDynamicCmdBuffer)
+	void Renderer::summit()
 	{
+		FrameData &frame = frames[currentFrame];
+
+		// resources loaded after the scene was pushed, not waited: the graphics queue runs their copies before this frame
+		streamTextures();
+		ResourceManager::getInstance().uploadContext.submit();
+
+		// 0. Wait until the gpu is done with the last submit of this frame slot,
+		// the other frames in flight can still be executing
+		auto const waitStart = std::chrono::high_resolution_clock::now();
+		errCheck(device.waitForFences(1, &frame.fence, VK_TRUE, UINT64_MAX));
+		auto const waitEnd = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double, std::milli> const waitTime = waitEnd - waitStart;
+		fenceWaitTime = fenceWaitTime * 0.95 + waitTime.count() * 0.05;
+		if (frame.submitted) {
+			std::chrono::duration<double, std::milli> const now = waitEnd.time_since_epoch();
+			frameLatency = frameLatency * 0.95 + (now.count() - frame.submitTime) * 0.05;
+		}
+		if (!retiredSwapchains.empty())
+			destroyRetiredSwapchains(false);
 
-		//presentQueue.waitIdle();
-		//recordSimultaneousUseCommandBuffers();
 		// 1. Acquiring an image from the swapchain
 		//(this image is attached in the framebuffer)
-		uint32_t imageIndex;
-		vk::Result res = device.acquireNextImageKHR(swapchain, UINT64_MAX, semaphore_Image_Available, nullptr, &imageIndex);
+		// headless, every frame slot has its own offscreen image, free since the fence is waited
+		uint32_t imageIndex = currentFrame;
+		vk::Result res = headless ? vk::Result::eSuccess : device.acquireNextImageKHR(swapchain, UINT64_MAX, frame.semaphore_Image_Available, nullptr, &imageIndex);
 		if (res != vk::Result::eSuccess) {
 			if (res == vk::Result::eErrorOutOfDateKHR) {
 				reInitSwapchain();
@@ -1030,28 +1518,37 @@ namespace vm {
 				exit(-1);
 			}
 		}
-		vk::CommandBuffer* cmdBuffer;
-		if (useDynamicCmdBuffer) {
-			recordOneTimeSubmitCommandBuffer(imageIndex);
-			cmdBuffer = &dynamicCmdBuffer;
-		}
-		else {
-			cmdBuffer = &commandBuffers[imageIndex];
-		}
+		// reset only when there will be a submit to signal it again
+		errCheck(device.resetFences(1, &frame.fence));
+
+		device.resetCommandPool(frame.commandPool, vk::CommandPoolResetFlags());
+		recordOneTimeSubmitCommandBuffer(frame, imageIndex);
 
 		// 2. Submitting the command buffer to the graphics queue
-		vk::Semaphore waitSemaphores[] = { semaphore_Image_Available };
-		vk::Semaphore signalSemaphores[] = { semaphore_Render_Finished };
+		vk::Semaphore waitSemaphores[] = { frame.semaphore_Image_Available };
+		vk::Semaphore signalSemaphores[] = { frame.semaphore_Render_Finished };
 		vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
 		auto const si = vk::SubmitInfo()
-			.setWaitSemaphoreCount(1)
+			.setWaitSemaphoreCount(headless ? 0 : 1)
 			.setPWaitSemaphores(waitSemaphores)
 			.setPWaitDstStageMask(waitStages)
 			.setCommandBufferCount(1)
-			.setPCommandBuffers(cmdBuffer)
-			.setSignalSemaphoreCount(1)
+			.setPCommandBuffers(&frame.commandBuffer)
+			.setSignalSemaphoreCount(headless ? 0 : 1)
 			.setPSignalSemaphores(signalSemaphores);
-		errCheck(graphicsQueue.submit(1, &si, nullptr));
+		errCheck(graphicsQueue.submit(1, &si, frame.fence));
+		std::chrono::duration<double, std::milli> const submitTime = std::chrono::high_resolution_clock::now().time_since_epoch();
+		frame.submitTime = submitTime.count();
+		frame.submitted = true;
+
+		// next frame slot, the cpu can go on while the gpu works on this one
+		currentFrame = (currentFrame + 1) % framesInFlight;
+		++frameNumber;
+		lastImageIndex = imageIndex;
+
+		// nothing to present
+		if (headless)
+			return;
 
 		// 3. Return the image to the swapchain for presentation
 		auto const pi = vk::PresentInfoKHR()
@@ -1071,148 +1568,612 @@ namespace vm {
 			}
 		}
 	}
+	bool Renderer::isHeadless() const
+	{
+		return headless;
+	}
+	bool Renderer::readFrame(std::vector<unsigned char> &pixels)
+	{
+		// swapchain images are not transfer sources
+		if (!headless || lastImageIndex >= swapchainImages.size())
+			return false;
+
+		device.waitIdle();
+
+		vk::DeviceSize size = swapchainExtent.width * swapchainExtent.height * 4;
+		vk::Buffer buffer;
+		vk::DeviceMemory bufferMem;
+		helper.createBuffer(gpu, device, size, vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, buffer, bufferMem);
+
+		// the render pass left the image in eTransferSrcOptimal
+		vk::CommandBuffer cmd = helper.beginSingleCommandBuffer(device, commandPool);
+		auto const region = vk::BufferImageCopy()
+			.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+			.setImageExtent(vk::Extent3D(swapchainExtent.width, swapchainExtent.height, 1));
+		cmd.copyImageToBuffer(swapchainImages[lastImageIndex], vk::ImageLayout::eTransferSrcOptimal, buffer, 1, &region);
+		helper.endSingleCommandBuffer(device, commandPool, graphicsQueue, cmd);
+
+		pixels.resize(static_cast<size_t>(size));
+		memcpy(pixels.data(), helper.mapBuffer(device, buffer), static_cast<size_t>(size));
+
+		helper.destroyBuffer(device, buffer, bufferMem);
+		return true;
+	}
 	void Renderer::pushSpritesToBuffers()
 	{
+		createTextureAtlas();
+
 		createVertexBuffers();
 		createIndexBuffers();
 
 		createUniformBuffers();
+		gpuCulling.create(gpu, device, pipelineCache, gpuFeatures, static_cast<uint32_t>(spriteSlots), MAX_FRAMES_IN_FLIGHT);
 
 		createDescriptorPool();
 		createDescriptorSets();
 
-		createSemaphores();
-
-		recordSimultaneousUseCommandBuffers();
+		// every texture and buffer of the scene in one submission
+		ResourceManager::getInstance().uploadContext.flush();
+	}
+	void Renderer::setSpriteBatching(bool enable)
+	{
+		spriteBatching = enable;
+	}
+	bool Renderer::getSpriteBatching() const
+	{
+		return spriteBatching && pipelineInstanced && (!getDeferredLighting() || pipelineInstancedAlbedo);
+	}
+	double Renderer::getRecordTime() const
+	{
+		return recordTime;
+	}
+	double Renderer::getLastRecordTime() const
+	{
+		return lastRecordTime;
 	}
-	// TODO needs reword, Entity::entities is not working atm
-	void Renderer::recordSimultaneousUseCommandBuffers()
+	void Renderer::setTextureArray(bool enable)
+	{
+		textureArray = enable;
+	}
+	bool Renderer::getTextureArray() const
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		return textureArray && getSpriteBatching() && pipelineTextureArray && rm.texturesDescriptorSet && rm.textureSlotCount <= rm.textureArraySize &&
+			(!getDeferredLighting() || pipelineTextureArrayAlbedo);
+	}
+	uint32_t Renderer::getDescriptorBindCount() const
+	{
+		return descriptorBinds;
+	}
+	void Renderer::recordOneTimeSubmitCommandBuffer(FrameData &frame, uint32_t imageIndex)
 	{
 		//	Begin Command Buffer
 		//	|	Begin Render Pass
-		//	|	|	Bind GraphicsPipeline
+		//	|	|	Execute the secondary command buffers (or record inline with one thread)
+		//	|	|	|	Bind GraphicsPipeline
 		//	|	|	|	Draw
 		//	|	End Render Pass
 		//	End Command Buffer
 
-		for (size_t i = 0; i < commandBuffers.size(); ++i) {
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		// sprites created since the last frame: more slots in the frame allocator if the drawList outgrew it,
+		// the texture array with their textures, and a bigger vertex buffer if their quads do not fit
+		const size_t neededSlots = Sprite::sprites.size() > Entity::drawList.size() ? Sprite::sprites.size() : Entity::drawList.size();
+		if (neededSlots > spriteSlots)
+			growSpriteSlots(neededSlots > spriteSlots * 2 ? neededSlots : spriteSlots * 2);
+		if (rm.textures.size() != textureArrayTextures || textureArrayStale)
+			writeTextureArray();
+		rm.spriteStorage.update(frameNumber, framesInFlight);
+		rm.frameAllocator.update(frameNumber, framesInFlight);
+
+		// this frame's fence is waited, so its region of the transient uniforms, its camera slice and its gpu culling set can be reused
+		rm.frameAllocator.beginFrame(currentFrame);
+		gpuCulling.update(currentFrame, rm.frameAllocator.getBuffer(), static_cast<uint32_t>(spriteSlots));
+		mainCamera.write(currentFrame);
+		descriptorBinds = 0;
+
+		// the occluders of the visible rect in the distance field, or the shadow volumes of the first lights on screen,
+		// and the lights on screen binned in tiles, for the fragment shaders of this frame
+		const ShadowMode shadowModeFrame = getShadowMode();
+		glm::vec2 visibleMin, visibleMax;
+		mainCamera.getVisibleRect(visibleMin, visibleMax);
+		distanceField.update(currentFrame, shadowModeFrame == ShadowMode::DistanceField, visibleMin, visibleMax, swapchainExtent);
+		lightCulling.setDistanceField(shadowModeFrame == ShadowMode::DistanceField, distanceField.getWorldToUV(), distanceField.getUVMax(), distanceField.getTexelSize());
+		lightCulling.update(currentFrame, mainCamera.UCBO.proj * mainCamera.UCBO.camPos, swapchainExtent, shadowModeFrame == ShadowMode::Volumes ? MAX_SHADOW_LIGHTS : 0);
+		shadowCasting.update(currentFrame, lightCulling.getLights(), lightCulling.getShadowLights());
+
+		deferredFrame = getDeferredLighting();
+		const bool batching = getSpriteBatching();
+		const bool useTextureArray = getTextureArray();
+		if (getGpuCulling() && prepareGpuCulledSprites()) {
 			auto const beginInfo = vk::CommandBufferBeginInfo()
-				.setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse)
+				.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
 				.setPInheritanceInfo(nullptr);
-			errCheck(commandBuffers[i].begin(&beginInfo));
-			// Render Pass
-			{
-				std::array<vk::ClearValue, 2> clearValues = {};
-				clearValues[0].setColor(vk::ClearColorValue().setFloat32({ 0.05f, 0.05f, 0.05f, 1.f }));
-				clearValues[1].setDepthStencil({ 1.0f, 0 });
-
-				auto const renderPassInfo = vk::RenderPassBeginInfo()
-					.setRenderPass(renderPass)
-					.setFramebuffer(swapchainFrameBuffers[i])
-					.setRenderArea({ { 0, 0 }, swapchainExtent })
-					.setClearValueCount((uint32_t)clearValues.size())
-					.setPClearValues(clearValues.data());
-
-				commandBuffers[i].beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
-
-				// push constants
-				commandBuffers[i].pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, static_cast<uint32_t>(sizeof(AmbientLight::color)), &AmbientLight::color);
-
-				commandBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-
-				if (Sprite::sprites.size() > 0) {
-					
-					// ----------DRAW SPRITES----------
-					//binding the vertex buffer
-					const vk::DeviceSize offsets[] = { 0 };
-					commandBuffers[i].bindVertexBuffers(0, 1, &ResourceManager::getInstance().spritesVertexBuffer, offsets);
-					//binding the index buffer
-					commandBuffers[i].bindIndexBuffer(ResourceManager::getInstance().spritesIndexBuffer, 0, vk::IndexType::eUint32);
-
-					for (auto &s : Sprite::sprites) {
-
-						if (!s) continue;
-
-						// bind descriptor sets
-						const vk::DescriptorSet dSets[] = { *s->descriptorSet, mainCamera.getDescriptorSet(), PointLight::descriptorSet };
-						const uint32_t dOffsets[] = { static_cast<uint32_t>(s->uBuffInfo.offset), 0, 0 };
-
-						commandBuffers[i].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 3, dSets, 1, dOffsets);
-
-						//drawing indexed
-						commandBuffers[i].drawIndexed(6, 1, 0, s->getSpriteID() * 4, 0); // 6 indices for every 4 vertices in vBuffer (1 rect)
-					}
-					// --------------------------------
-				}
-				commandBuffers[i].endRenderPass();
-			}
-			commandBuffers[i].end();
+			errCheck(frame.commandBuffer.begin(&beginInfo));
+
+			// the compute pass fills the indirect commands and the instances before the render pass reads them
+			glm::vec2 min, max;
+			mainCamera.getVisibleRect(min, max);
+			gpuCulling.record(frame.commandBuffer, currentFrame, rm.frameAllocator.getBuffer(), gpuSpritesOffset,
+				gpuCommandsOffset, indirectDrawCount, glm::vec4(min, max));
+
+			beginFramePass(frame, imageIndex, vk::SubpassContents::eInline);
+			recordGpuCulledSprites(frame.commandBuffer);
+			endFramePass(frame);
+			frame.commandBuffer.end();
+
+			rm.frameAllocator.flush();
+			std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+			lastRecordTime = time.count();
+			recordTime = recordTime * 0.95 + lastRecordTime * 0.05;
+			return;
+		}
+		indirectDrawCount = 0;
+		cullDrawList();
+		sortDrawList();
+		// the textures of the visible sprites are the recently used ones, the others can be evicted
+		for (auto entity : Entity::drawList) {
+			if (entity->hasSprite())
+				rm.textureResidency.markUsed(entity->getSprite().getActiveTexture(), frameNumber);
 		}
-	}
-	void Renderer::recordOneTimeSubmitCommandBuffer(uint32_t imageIndex)
-	{
-		//	Begin Command Buffer
-		//	|	Begin Render Pass
-		//	|	|	Bind GraphicsPipeline
-		//	|	|	|	Draw
-		//	|	End Render Pass
-		//	End Command Buffer
+
+		// the ubos (or instances) of the whole drawList in one allocation, drawList[i] uses the slot i,
+		// so every thread writes its own slice of it
+		const size_t drawCount = Entity::drawList.size();
+		const vk::DeviceSize align = rm.frameAllocator.getAlignment();
+		const vk::DeviceSize slotSize = batching ? sizeof(InstanceData) : (sizeof(UniformBufferObject) + align - 1) / align * align;
+		vk::DeviceSize transientOffset = 0;
+		void *transientData = nullptr;
+		bool draw = drawCount > 0;
+		if (draw && !rm.frameAllocator.allocate(drawCount * slotSize, transientOffset, &transientData)) {
+			LOG("Frame allocator is full, sprites are skipped\n");
+			draw = false;
+		}
+
+		// small lists are not worth the secondary command buffers
+		uint32_t threadCount = static_cast<uint32_t>((drawCount + MIN_DRAWS_PER_THREAD - 1) / MIN_DRAWS_PER_THREAD);
+		if (threadCount > recordThreads)
+			threadCount = recordThreads;
+		if (!draw)
+			threadCount = 1;
 
 		auto const dbeginInfo = vk::CommandBufferBeginInfo()
 			.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
 			.setPInheritanceInfo(nullptr);
-		errCheck(dynamicCmdBuffer.begin(&dbeginInfo));
+		errCheck(frame.commandBuffer.begin(&dbeginInfo));
 		// Render Pass
 		{
-			std::array<vk::ClearValue, 2> clearValues = {};
-			clearValues[0].setColor(vk::ClearColorValue().setFloat32({ 0.05f, 0.05f, 0.05f, 1.f }));
-			clearValues[1].setDepthStencil({ 1.0f, 0 });
+			if (threadCount > 1) {
+				beginFramePass(frame, imageIndex, vk::SubpassContents::eSecondaryCommandBuffers);
+
+				std::array<uint32_t, MAX_RECORD_THREADS> threadBinds{};
+				auto const inheritanceInfo = vk::CommandBufferInheritanceInfo()
+					.setRenderPass(deferredFrame ? deferredLighting.getRenderPass() : renderPass)
+					.setSubpass(0)
+					.setFramebuffer(deferredFrame ? deferredTargets.frameBuffers[imageIndex] : swapchainFrameBuffers[imageIndex]);
+
+				recordThreadPool.run(threadCount, [&](uint32_t t) {
+					// contiguous slices executed in order keep the depth sorted order of the drawList
+					const size_t first = drawCount * t / threadCount;
+					const size_t last = drawCount * (t + 1) / threadCount;
+
+					device.resetCommandPool(frame.threadCommandPools[t], vk::CommandPoolResetFlags());
+					vk::CommandBuffer &cmdBuffer = frame.secondaryCommandBuffers[t];
+					auto const sbeginInfo = vk::CommandBufferBeginInfo()
+						.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue)
+						.setPInheritanceInfo(&inheritanceInfo);
+					errCheck(cmdBuffer.begin(&sbeginInfo));
+					recordDrawRange(cmdBuffer, first, last, batching, useTextureArray, transientOffset, static_cast<char*>(transientData), threadBinds[t]);
+					cmdBuffer.end();
+				});
+
+				frame.commandBuffer.executeCommands(threadCount, frame.secondaryCommandBuffers.data());
+				for (uint32_t t = 0; t < threadCount; ++t)
+					descriptorBinds += threadBinds[t];
+			}
+			else {
+				beginFramePass(frame, imageIndex, vk::SubpassContents::eInline);
+				if (draw)
+					recordDrawRange(frame.commandBuffer, 0, drawCount, batching, useTextureArray, transientOffset, static_cast<char*>(transientData), descriptorBinds);
+			}
 
-			auto const renderPassInfo = vk::RenderPassBeginInfo()
-				.setRenderPass(renderPass)
-				.setFramebuffer(swapchainFrameBuffers[imageIndex])
-				.setRenderArea({ { 0, 0 }, swapchainExtent })
-				.setClearValueCount((uint32_t)clearValues.size())
-				.setPClearValues(clearValues.data());
+			endFramePass(frame);
+		}
+		frame.commandBuffer.end();
 
-			dynamicCmdBuffer.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+		// all the transient data of the frame are written, make them visible to the gpu in one go
+		rm.frameAllocator.flush();
 
-			// push constants
-			dynamicCmdBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, static_cast<uint32_t>(sizeof(AmbientLight::color)), &AmbientLight::color);
+		// smooth the record time over the last frames
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		lastRecordTime = time.count();
+		recordTime = recordTime * 0.95 + lastRecordTime * 0.05;
+	}
+	void Renderer::beginFramePass(FrameData &frame, uint32_t imageIndex, vk::SubpassContents contents)
+	{
+		// the quads of the new sprites, and the shadow masks (or the distance field) in their own passes first
+		ResourceManager::getInstance().spriteStorage.record(frame.commandBuffer);
+		shadowCasting.record(frame.commandBuffer, currentFrame);
+		distanceField.record(frame.commandBuffer, currentFrame);
+
+		// color, depth, and for the deferred pass albedo and lights, that start empty
+		std::array<vk::ClearValue, 4> clearValues = {};
+		clearValues[0].setColor(vk::ClearColorValue().setFloat32({ 0.05f, 0.05f, 0.05f, 1.f }));
+		clearValues[1].setDepthStencil({ 1.0f, 0 });
+		clearValues[2].setColor(vk::ClearColorValue().setFloat32({ 0.f, 0.f, 0.f, 0.f }));
+		clearValues[3].setColor(vk::ClearColorValue().setFloat32({ 0.f, 0.f, 0.f, 0.f }));
+
+		auto const renderPassInfo = vk::RenderPassBeginInfo()
+			.setRenderPass(deferredFrame ? deferredLighting.getRenderPass() : renderPass)
+			.setFramebuffer(deferredFrame ? deferredTargets.frameBuffers[imageIndex] : swapchainFrameBuffers[imageIndex])
+			.setRenderArea({ { 0, 0 }, swapchainExtent })
+			.setClearValueCount(deferredFrame ? 4 : 2)
+			.setPClearValues(clearValues.data());
+		frame.commandBuffer.beginRenderPass(&renderPassInfo, contents);
+	}
+	void Renderer::endFramePass(FrameData &frame)
+	{
+		if (deferredFrame)
+			deferredLighting.recordLighting(frame.commandBuffer, deferredTargets, swapchainExtent, mainCamera.getDescriptorSet(currentFrame),
+				lightCulling.getDescriptorSet(currentFrame), lightCulling.getLightCount(), AmbientLight::color);
+		frame.commandBuffer.endRenderPass();
+	}
+	void Renderer::setDeferredLighting(bool enable)
+	{
+		deferred = enable;
+	}
+	bool Renderer::getDeferredLighting() const
+	{
+		return deferred && deferredLighting.isAvailable() && deferredTargets.albedoImage && pipelineAlbedo;
+	}
+	bool Renderer::prepareGpuCulledSprites()
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
 
-			dynamicCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+		// no cpu culling, the compute pass tests every drawn sprite
+		const uint32_t drawn = static_cast<uint32_t>(Entity::drawList.size());
+		visibleCount = drawn;
+		culledCount = 0;
+		if (drawn == 0 || drawn > gpuCulling.getMaxSprites())
+			return false;
+
+		void *spritesData;
+		if (!rm.frameAllocator.allocate(drawn * sizeof(SpriteCullData), gpuSpritesOffset, &spritesData)) {
+			LOG("Frame allocator is full, gpu culling is skipped\n");
+			return false;
+		}
 
-			if (Entity::drawList.size() > 0) {
+		// the radix sort keys put the sprites of a (depth, texture slot) next to each other, a batch is a run of them
+		sortDrawList();
+		SpriteCullData *sprites = static_cast<SpriteCullData*>(spritesData);
+		gpuBatches.clear();
+		gpuSpriteCount = 0;
+		float batchDepth = 0.f;
+		uint32_t batchTexture = 0;
+		for (auto entity : Entity::drawList) {
+			if (!entity->hasSprite())
+				continue;
+			Sprite &sprite = entity->getSprite();
+			rm.textureResidency.markUsed(sprite.getActiveTexture(), frameNumber);
+			const uint32_t texture = sprite.getTextureIndex();
+			if (gpuBatches.empty() || entity->getDepth() != batchDepth || texture != batchTexture) {
+				gpuBatches.push_back(vk::DrawIndexedIndirectCommand(6, 0, 0, unitQuadFirstVertex, gpuSpriteCount));
+				batchDepth = entity->getDepth();
+				batchTexture = texture;
+			}
+			++gpuBatches.back().instanceCount;
 
-				// sort the drawList from the lowest depth value, for alpha blending and depth tests purpose
-				std::sort(Entity::drawList.begin(), Entity::drawList.end(), [](Entity* a, Entity* b) -> bool { return a->getDepth() < b->getDepth(); });
+			SpriteCullData &s = sprites[gpuSpriteCount++];
+			s.model = glm::scale(sprite.ubo.model, glm::vec3(sprite.rect.size.x, sprite.rect.size.y, 1.0f));
+			s.uvRect = sprite.getActiveTexture().uvRect;
+			s.textureIndex = texture;
+		}
+		if (gpuSpriteCount == 0)
+			return false;
 
-				// ----------DRAW SPRITES----------
-				//binding the vertex buffer
-				const vk::DeviceSize offsets[] = { 0 };
-				dynamicCmdBuffer.bindVertexBuffers(0, 1, &ResourceManager::getInstance().spritesVertexBuffer, offsets);
-				//binding the index buffer
-				dynamicCmdBuffer.bindIndexBuffer(ResourceManager::getInstance().spritesIndexBuffer, 0, vk::IndexType::eUint32);
+		void *commandsData;
+		if (!rm.frameAllocator.allocate(gpuBatches.size() * sizeof(vk::DrawIndexedIndirectCommand), gpuCommandsOffset, &commandsData)) {
+			LOG("Frame allocator is full, gpu culling is skipped\n");
+			return false;
+		}
+		memcpy(commandsData, gpuBatches.data(), gpuBatches.size() * sizeof(vk::DrawIndexedIndirectCommand));
+		indirectDrawCount = static_cast<uint32_t>(gpuBatches.size());
+		return true;
+	}
+	void Renderer::recordGpuCulledSprites(vk::CommandBuffer &cmdBuffer)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
 
-				for (auto &entity : Entity::drawList) {
+		auto const viewport = vk::Viewport()
+			.setX(0.0f)
+			.setY(0.0f)
+			.setWidth((float)swapchainExtent.width)
+			.setHeight((float)swapchainExtent.height)
+			.setMinDepth(-1.0f)
+			.setMaxDepth(1.0f);
+		auto const scissor = vk::Rect2D()
+			.setOffset({ 0, 0 })
+			.setExtent(swapchainExtent);
+		cmdBuffer.setViewport(0, 1, &viewport);
+		cmdBuffer.setScissor(0, 1, &scissor);
+		cmdBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, static_cast<uint32_t>(sizeof(AmbientLight::color)), &AmbientLight::color);
+
+		// the unit quad, and the instances written by the compute pass
+		const vk::DeviceSize offsets[] = { 0 };
+		vk::Buffer vertexBuffer = rm.spriteStorage.getVertexBuffer();
+		cmdBuffer.bindVertexBuffers(0, 1, &vertexBuffer, offsets);
+		vk::Buffer instanceBuffer = gpuCulling.getInstanceBuffer(currentFrame);
+		cmdBuffer.bindVertexBuffers(1, 1, &instanceBuffer, offsets);
+		cmdBuffer.bindIndexBuffer(rm.spritesIndexBuffer, 0, vk::IndexType::eUint32);
+
+		// the culled batches are still drawn, with 0 instances (no vkCmdDrawIndexedIndirectCount in vulkan 1.0)
+		vk::Buffer indirectBuffer = gpuCulling.getIndirectBuffer(currentFrame);
+		const uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, deferredFrame ? pipelineTextureArrayAlbedo : pipelineTextureArray);
+		const vk::DescriptorSet dSets[] = { rm.texturesDescriptorSet, mainCamera.getDescriptorSet(currentFrame), lightCulling.getDescriptorSet(currentFrame) };
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayoutTextureArray, 0, 3, dSets, 0, nullptr);
+		++descriptorBinds;
+		// one call for the whole frame if the device can
+		if (gpuCulling.hasMultiDrawIndirect() && indirectDrawCount <= gpuProperties.limits.maxDrawIndirectCount)
+			cmdBuffer.drawIndexedIndirect(indirectBuffer, 0, indirectDrawCount, stride);
+		else {
+			for (uint32_t i = 0; i < indirectDrawCount; ++i)
+				cmdBuffer.drawIndexedIndirect(indirectBuffer, i * stride, 1, stride);
+		}
+	}
+	void Renderer::setGpuCulling(bool enable)
+	{
+		gpuCullingEnabled = enable;
+	}
+	bool Renderer::getGpuCulling() const
+	{
+		return gpuCullingEnabled && gpuCulling.isAvailable() && getTextureArray();
+	}
+	uint32_t Renderer::getIndirectDrawCount() const
+	{
+		return indirectDrawCount;
+	}
+	void Renderer::cullDrawList()
+	{
+		const uint32_t drawn = static_cast<uint32_t>(Entity::drawList.size());
+		if (!culling || drawn == 0) {
+			visibleCount = drawn;
+			culledCount = 0;
+			return;
+		}
 
-					if (!entity->hasSprite())
-						continue;
+		// only the grid cells under the camera are visited, the off screen sprites are never sorted or recorded
+		glm::vec2 min, max;
+		mainCamera.getVisibleRect(min, max);
+		visibleList.clear();
+		Entity::grid.query(min, max, visibleList);
+		Entity::drawList.swap(visibleList);
+
+		visibleCount = static_cast<uint32_t>(Entity::drawList.size());
+		culledCount = drawn > visibleCount ? drawn - visibleCount : 0;
+	}
+	void Renderer::setCulling(bool enable)
+	{
+		culling = enable;
+	}
+	bool Renderer::getCulling() const
+	{
+		return culling;
+	}
+	uint32_t Renderer::getVisibleCount() const
+	{
+		return visibleCount;
+	}
+	uint32_t Renderer::getCulledCount() const
+	{
+		return culledCount;
+	}
+	uint32_t Renderer::getLightCount() const
+	{
+		return lightCulling.getLightCount();
+	}
+	uint32_t Renderer::getMaxLightsPerTile() const
+	{
+		return lightCulling.getMaxLightsPerTile();
+	}
+	float Renderer::getAverageLightsPerTile() const
+	{
+		return lightCulling.getAverageLightsPerTile();
+	}
+	double Renderer::getLightCullTime() const
+	{
+		return lightCulling.getCullTime();
+	}
+	void Renderer::setShadowMode(ShadowMode mode)
+	{
+		shadowMode = mode;
+	}
+	ShadowMode Renderer::getShadowMode() const
+	{
+		if ((shadowMode == ShadowMode::Volumes && !shadowCasting.isAvailable()) || (shadowMode == ShadowMode::DistanceField && !distanceField.isAvailable()))
+			return ShadowMode::Off;
+		return shadowMode;
+	}
+	uint32_t Renderer::getShadowLightCount() const
+	{
+		return shadowCasting.getShadowLightCount();
+	}
+	uint32_t Renderer::getShadowEdgeCount() const
+	{
+		return shadowCasting.getEdgeCount();
+	}
+	double Renderer::getShadowBuildTime() const
+	{
+		return shadowCasting.getBuildTime();
+	}
+	void Renderer::logShadowBenchmark()
+	{
+		shadowCasting.benchmark();
+	}
+	void Renderer::setDistanceFieldScale(uint32_t scale)
+	{
+		distanceField.setScale(scale);
+	}
+	uint32_t Renderer::getDistanceFieldScale() const
+	{
+		return distanceField.getScale();
+	}
+	vk::Extent2D Renderer::getDistanceFieldExtent() const
+	{
+		return distanceField.getExtent();
+	}
+	DistanceField::PassTimes Renderer::getDistanceFieldTimes() const
+	{
+		return distanceField.getTimes();
+	}
+	void Renderer::sortDrawList()
+	{
+		// the opaque sprites front to back then the blended ones back to front, then pipeline and texture so the batches get as big as possible
+		renderQueue.sort(Entity::drawList);
+	}
+	double Renderer::getSortTime() const
+	{
+		return renderQueue.getSortTime();
+	}
+	void Renderer::recordDrawRange(vk::CommandBuffer &cmdBuffer, size_t first, size_t last, bool batching, bool useTextureArray, vk::DeviceSize transientOffset, char *transientData, uint32_t &binds)
+	{
+		if (first >= last)
+			return;
+
+		// a secondary command buffer inherits no state, everything is set again
+		auto const viewport = vk::Viewport() //region of the frambuffer
+			.setX(0.0f)
+			.setY(0.0f)
+			.setWidth((float)swapchainExtent.width)
+			.setHeight((float)swapchainExtent.height)
+			.setMinDepth(-1.0f)
+			.setMaxDepth(1.0f);
+		auto const scissor = vk::Rect2D()
+			.setOffset({ 0, 0 })
+			.setExtent(swapchainExtent);
+		cmdBuffer.setViewport(0, 1, &viewport);
+		cmdBuffer.setScissor(0, 1, &scissor);
+
+		// push constants
+		cmdBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, static_cast<uint32_t>(sizeof(AmbientLight::color)), &AmbientLight::color);
+
+		// ----------DRAW SPRITES----------
+		//binding the vertex buffer
+		const vk::DeviceSize offsets[] = { 0 };
+		vk::Buffer vertexBuffer = ResourceManager::getInstance().spriteStorage.getVertexBuffer();
+		cmdBuffer.bindVertexBuffers(0, 1, &vertexBuffer, offsets);
+		//binding the index buffer
+		cmdBuffer.bindIndexBuffer(ResourceManager::getInstance().spritesIndexBuffer, 0, vk::IndexType::eUint32);
+
+		if (batching)
+			recordSpriteBatches(cmdBuffer, first, last, useTextureArray, transientOffset, reinterpret_cast<InstanceData*>(transientData), binds);
+		else
+			recordSprites(cmdBuffer, first, last, transientOffset, transientData, binds);
+		// --------------------------------
+	}
+	void Renderer::recordSprites(vk::CommandBuffer &cmdBuffer, size_t first, size_t last, vk::DeviceSize uboOffset, char *uboData, uint32_t &binds)
+	{
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, deferredFrame ? pipelineAlbedo : pipeline);
+
+		const vk::DeviceSize align = ResourceManager::getInstance().frameAllocator.getAlignment();
+		const vk::DeviceSize uboStride = (sizeof(UniformBufferObject) + align - 1) / align * align;
+
+		for (size_t i = first; i < last; ++i) {
+
+			Entity *entity = Entity::drawList[i];
+			if (!entity->hasSprite())
+				continue;
 
-					// bind descriptor sets
-					const vk::DescriptorSet dSets[] = { *entity->getSprite().descriptorSet, mainCamera.getDescriptorSet(), PointLight::descriptorSet };
-					const uint32_t dOffsets[] = { static_cast<uint32_t>(entity->getSprite().uBuffInfo.offset), 0, 0 };
+			// copy the ubo of the sprite in its slot of this frame's region
+			Sprite &sprite = entity->getSprite();
+			sprite.uBuffInfo.offset = uboOffset + i * uboStride;
+			sprite.ubo.uvRect = sprite.getActiveTexture().uvRect;
+			memcpy(uboData + i * uboStride, &sprite.ubo, sizeof(UniformBufferObject));
 
-					dynamicCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 3, dSets, 1, dOffsets);
+			// bind descriptor sets
+			const vk::DescriptorSet dSets[] = { *sprite.descriptorSet, mainCamera.getDescriptorSet(currentFrame), lightCulling.getDescriptorSet(currentFrame) };
+			const uint32_t dOffsets[] = { static_cast<uint32_t>(sprite.uBuffInfo.offset), 0, 0 };
 
-					//drawing indexed
-					dynamicCmdBuffer.drawIndexed(6, 1, 0, entity->getSprite().getSpriteID() * 4, 0); // 6 indices for every 4 vertices in vBuffer (1 rect)
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 3, dSets, 1, dOffsets);
+			++binds;
+
+			//drawing indexed
+			cmdBuffer.drawIndexed(6, 1, 0, sprite.getSpriteID() * 4, 0); // 6 indices for every 4 vertices in vBuffer (1 rect)
+		}
+	}
+	void Renderer::recordSpriteBatches(vk::CommandBuffer &cmdBuffer, size_t first, size_t last, bool useTextureArray, vk::DeviceSize instanceOffset, InstanceData *instances, uint32_t &binds)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		if (deferredFrame)
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, useTextureArray ? pipelineTextureArrayAlbedo : pipelineInstancedAlbedo);
+		else
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, useTextureArray ? pipelineTextureArray : pipelineInstanced);
+
+		const vk::DeviceSize offsets[] = { instanceOffset };
+		cmdBuffer.bindVertexBuffers(1, 1, &rm.frameAllocator.getBuffer(), offsets);
+
+		if (useTextureArray) {
+			// texture array, camera and lights, the only bind of the slice
+			const vk::DescriptorSet dSets[] = { rm.texturesDescriptorSet, mainCamera.getDescriptorSet(currentFrame), lightCulling.getDescriptorSet(currentFrame) };
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayoutTextureArray, 0, 3, dSets, 0, nullptr);
+		}
+		else {
+			// camera and lights are the same for all the batches
+			const vk::DescriptorSet dSets[] = { mainCamera.getDescriptorSet(currentFrame), lightCulling.getDescriptorSet(currentFrame) };
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 1, 2, dSets, 0, nullptr);
+		}
+		++binds;
+
+		// the instances of the slice are packed from its first slot, a batch never crosses slices
+		uint32_t instanceCount = static_cast<uint32_t>(first);
+		uint32_t firstInstance = instanceCount;
+		vk::DescriptorSet batchDSet;
+		uint32_t batchTexture = 0;
+
+		for (size_t i = first; i < last; ++i) {
+
+			Entity *entity = Entity::drawList[i];
+			if (!entity->hasSprite())
+				continue;
+
+			Sprite &sprite = entity->getSprite();
+			const uint32_t textureIndex = sprite.getTextureIndex();
+
+			// a texture change closes the running batch
+			if (instanceCount > firstInstance) {
+				if (useTextureArray && textureIndex != batchTexture) {
+					cmdBuffer.drawIndexed(6, instanceCount - firstInstance, 0, unitQuadFirstVertex, firstInstance);
+					firstInstance = instanceCount;
+				}
+				else if (!useTextureArray && *sprite.descriptorSet != batchDSet) {
+					const uint32_t dOffsets[] = { 0 };
+					cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &batchDSet, 1, dOffsets);
+					++binds;
+					cmdBuffer.drawIndexed(6, instanceCount - firstInstance, 0, unitQuadFirstVertex, firstInstance);
+					firstInstance = instanceCount;
 				}
-				// --------------------------------
 			}
-
-			dynamicCmdBuffer.endRenderPass();
+			batchDSet = *sprite.descriptorSet;
+			batchTexture = textureIndex;
+
+			// the unit quad is scaled to the sprite's rect, so every sprite can share the same 4 vertices
+			instances[instanceCount].model = glm::scale(sprite.ubo.model, glm::vec3(sprite.rect.size.x, sprite.rect.size.y, 1.0f));
+			instances[instanceCount].textureIndex = textureIndex;
+			instances[instanceCount].uvRect = sprite.getActiveTexture().uvRect;
+			++instanceCount;
+		}
+		if (instanceCount > firstInstance) {
+			if (!useTextureArray) {
+				const uint32_t dOffsets[] = { 0 };
+				cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &batchDSet, 1, dOffsets);
+				++binds;
+			}
+			cmdBuffer.drawIndexed(6, instanceCount - firstInstance, 0, unitQuadFirstVertex, firstInstance);
 		}
-		dynamicCmdBuffer.end();
 	}
 }
\ No newline at end of file
@@ -5,17 +5,63 @@
 #include "Entity.h"
 #include "Camera.h"
 #include <fstream>
+#include <map>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW\glfw3.h>
 #include <GLFW\glfw3native.h>
 #include "Light.h"
+#include "ThreadPool.h"
+#include "GpuCulling.h"
+#include "RenderQueue.h"
+#include "LightCulling.h"
+#include "DeferredLighting.h"
+#include "ShadowCasting.h"
+#include "DistanceField.h"
+
+#define MAX_FRAMES_IN_FLIGHT 3
+#define MAX_RECORD_THREADS 8
+#define PIPELINE_CACHE_FILE "pipeline.cache"
+#define MIN_DRAWS_PER_THREAD 64	// smaller slices cost more in secondary cmd buffer overhead than they save
 
 namespace vm {
+	// everything a frame needs while the cpu records the next ones
+	struct FrameData {
+		vk::CommandPool		commandPool;
+		vk::CommandBuffer	commandBuffer;				// one time summit command buffer
+		std::array<vk::CommandPool, MAX_RECORD_THREADS>		threadCommandPools;			// a pool per recording thread, pools are not thread safe
+		std::array<vk::CommandBuffer, MAX_RECORD_THREADS>	secondaryCommandBuffers;	// a slice of the drawList each, executed in order
+		vk::Fence			fence;						// signaled when the gpu is done with this frame
+		vk::Semaphore		semaphore_Image_Available;
+		vk::Semaphore		semaphore_Render_Finished;
+		double				submitTime;					// for the frame latency
+		bool				submitted;
+	};
+
+	// how the box2d fixtures block the lights
+	enum class ShadowMode {
+		Off,
+		Volumes,		// ShadowCasting: hard, geometry per light
+		DistanceField	// DistanceField: soft, traced in a field of the occluders
+	};
+
+	// what an old swapchain leaves behind, destroyed once the frames recorded with it are done
+	struct RetiredSwapchain {
+		vk::SwapchainKHR				swapchain;
+		std::vector<vk::ImageView>		imageViews;
+		std::vector<vk::Framebuffer>	frameBuffers;
+		vk::Image						depthImage;
+		vk::DeviceMemory				depthImageMemory;
+		vk::ImageView					depthImageView;
+		DeferredTargets					deferredTargets;
+		uint64_t						frameNumber;	// the first frame recorded with the new swapchain
+	};
+
 	class VulkanQueueFamily
 	{
 	public:
 		uint32_t graphicsFamilyId = -1;
 		uint32_t presentFamilyId = -1;
+		uint32_t transferFamilyId = -1;		// a transfer only family if there is one, else the graphics family
 		void findQueueFamilies(vk::PhysicalDevice gpu, vk::SurfaceKHR surface);
 		bool isComplete() {
 			return (graphicsFamilyId >= 0 && presentFamilyId >= 0);
@@ -38,16 +84,82 @@ namespace vm {
 		friend struct Camera;
 	public:
 		Renderer(GLFWwindow * _window);
+		// headless, no window, surface or swapchain: the frames are rendered in offscreen images
+		Renderer(uint32_t width, uint32_t height);
 		~Renderer();
 
 		// draw
-		void summit(bool useDynamicCmdBuffer = true);
+		void summit();
+
+		bool isHeadless() const;
+		// copies the last summited frame (rgba8, top row first) to the host, headless only
+		bool readFrame(std::vector<unsigned char> &pixels);
 
 		// scene
 		void pushSpritesToBuffers(); // after the scene is made, all sprites created are auto pushed in a big buffer
 
+		// batching groups the sorted drawList by texture and draws every group with one instanced draw call
+		void setSpriteBatching(bool enable);
+		bool getSpriteBatching() const;
+		double getRecordTime() const; // average cpu time (ms) of recording the dynamic command buffer
+		double getLastRecordTime() const; // ms, the last frame's alone, for the benchmarks to average themselves
+		double getSortTime() const; // ms, the radix sort of the last drawList
+
+		// batches sample one array with every texture, the descriptor sets are bound once per frame
+		void setTextureArray(bool enable);
+		bool getTextureArray() const;
+		uint32_t getDescriptorBindCount() const; // vkCmdBindDescriptorSets calls of the last recorded frame
+
+		// the drawList is cut down to the sprites on screen (Entity::grid against the camera) before the sort
+		void setCulling(bool enable);
+		bool getCulling() const;
+		uint32_t getVisibleCount() const;	// sprites of the last frame that were recorded
+		uint32_t getCulledCount() const;	// sprites of the last frame that were off screen
+
+		// batched sprites are culled by a compute pass and drawn with indirect draws, no cpu culling or threads.
+		// with the texture array only, so a batch is a (depth, texture slot) run of the sorted drawList
+		void setGpuCulling(bool enable);
+		bool getGpuCulling() const;
+		uint32_t getIndirectDrawCount() const;	// indirect commands of the last frame, one per (depth, texture) batch
+
+		// point lights binned in screen tiles every frame, the fragment shaders only shade their tile's lights
+		uint32_t getLightCount() const;
+		uint32_t getMaxLightsPerTile() const;
+		float getAverageLightsPerTile() const;
+		double getLightCullTime() const; // ms
+
+		// the box2d fixtures cast shadows, from the first MAX_SHADOW_LIGHTS lights on screen with volumes
+		void setShadowMode(ShadowMode mode);
+		ShadowMode getShadowMode() const; // Off if the shaders of the mode are missing
+		uint32_t getShadowLightCount() const;
+		uint32_t getShadowEdgeCount() const;
+		double getShadowBuildTime() const; // ms, the cpu part
+		void logShadowBenchmark(); // cpu time of the shadow volumes of 20 to 200 lights
+		// the distance field is the screen extent divided by the scale (1, 2 or 4)
+		void setDistanceFieldScale(uint32_t scale);
+		uint32_t getDistanceFieldScale() const;
+		vk::Extent2D getDistanceFieldExtent() const;
+		DistanceField::PassTimes getDistanceFieldTimes() const;
+
+		// the sprites write their albedo, the lights are added as quads of their reach and composited with the ambient
+		void setDeferredLighting(bool enable);
+		bool getDeferredLighting() const;
+
+		// threads recording the drawList in secondary command buffers [1, MAX_RECORD_THREADS]
+		void setRecordThreads(uint32_t count);
+		uint32_t getRecordThreads() const;
+
+		// how many frames the cpu can record ahead of the gpu [1, MAX_FRAMES_IN_FLIGHT]
+		void setFramesInFlight(uint32_t count);
+		uint32_t getFramesInFlight() const;
+		double getFenceWaitTime() const;	// average cpu time (ms) waiting for a frame slot to be free
+		double getFrameLatency() const;		// average time (ms) from submit to the frame's fence being seen signaled
+
 		//for resize mainly
 		void reInitSwapchain();
+		double getPipelineCreateTime() const;	// ms, all the graphics pipelines at startup
+		double getResizeTime() const;			// ms, the last reInitSwapchain
+		uint32_t getResizeCount() const;
 
 		//get gpu name
 		std::string getGpuName() const;
@@ -61,6 +173,8 @@ namespace vm {
 
 	private:
 		GLFWwindow * window;
+		bool headless = false;
+		void init();
 
 		// instance
 		vk::Instance instance;
@@ -82,6 +196,7 @@ namespace vm {
 	private:
 		vk::Queue graphicsQueue;
 		vk::Queue presentQueue;
+		vk::Queue transferQueue;
 		void createLogicalDevice();
 		void destroyLogicalDevice();
 
@@ -99,12 +214,22 @@ namespace vm {
 		uint32_t swapchainImageCount;
 		std::vector<vk::Image> swapchainImages{};
 		std::vector<vk::ImageView> swapchainImageViews{};
+		std::vector<vk::DeviceMemory> offscreenImageMems{};		// headless, the "swapchain" images are ours
+		uint32_t lastImageIndex = UINT32_MAX;					// the image of the last summit, for readFrame
 		void createSwapchain();
 		void destroySwapchain();
 		void createImageViews();
 		void destroyImageViews();
 
+		// deferred destruction of the old swapchains, no device wide wait on resize
+		std::vector<RetiredSwapchain> retiredSwapchains{};
+		uint64_t frameNumber = 0;	// summited frames
+		uint32_t resizeCount = 0;
+		void destroyRetiredSwapchains(bool all);
+
 		//textures
+		void createTextureAtlas();
+		void streamTextures();	// the textures evicted and the ones the streaming threads loaded, before the frame's uploads are flushed
 		void destroyTextures();
 
 		// render pass
@@ -114,8 +239,6 @@ namespace vm {
 
 		// buffers
 		std::vector<vk::Framebuffer> swapchainFrameBuffers{};	// frame buffers
-		std::vector<vk::CommandBuffer> commandBuffers{};		// command buffers
-		vk::CommandBuffer dynamicCmdBuffer;						// one time summit command buffer
 		vk::Image depthImage;									// depth image
 		vk::DeviceMemory depthImageMemory;
 		vk::ImageView depthImageView;
@@ -127,42 +250,110 @@ namespace vm {
 		void createIndexBuffers();
 		void destroyIndexBuffers();
 		void createCommandPool();
-		void createCommandBuffers();
 		void destroyCommandPool();
-		void recordOneTimeSubmitCommandBuffer(uint32_t imageIndex);
-		void recordSimultaneousUseCommandBuffers();
+		void recordOneTimeSubmitCommandBuffer(FrameData &frame, uint32_t imageIndex);
+		void beginFramePass(FrameData &frame, uint32_t imageIndex, vk::SubpassContents contents);
+		void endFramePass(FrameData &frame);
+		void cullDrawList();
+		void sortDrawList();
+		// [first, last) of the sorted drawList, the transient data of drawList[i] are in the slot i of the frame's allocation
+		void recordDrawRange(vk::CommandBuffer &cmdBuffer, size_t first, size_t last, bool batching, bool useTextureArray, vk::DeviceSize transientOffset, char *transientData, uint32_t &binds);
+		void recordSpriteBatches(vk::CommandBuffer &cmdBuffer, size_t first, size_t last, bool useTextureArray, vk::DeviceSize instanceOffset, InstanceData *instances, uint32_t &binds);
+		void recordSprites(vk::CommandBuffer &cmdBuffer, size_t first, size_t last, vk::DeviceSize uboOffset, char *uboData, uint32_t &binds);
+		bool prepareGpuCulledSprites();
+		void recordGpuCulledSprites(vk::CommandBuffer &cmdBuffer);
 		void createUniformBuffers();
 		void destroyUniformBuffers();
+		// the frame allocator and the gpu culling sized for the given sprites drawn in a frame
+		size_t spriteSlots = 0;
+		void createSpriteFrameAllocator(size_t slots);
+		void growSpriteSlots(size_t slots);
 		void createDepthResources();
 		void destroyDepthResources();
 
 		// descriptors
-		vk::DescriptorPool descriptorPool;
+		vk::DescriptorPool descriptorPool;		// the camera's, the rest come from ResourceManager::descriptorAllocator
 		void createDescriptorSetLayout();
 		void destroyDescriptorSetLayout();
 		void createDescriptorPool();
 		void destroyDescriptorPool();
 		void createDescriptorSets();
+		size_t textureArrayTextures = 0;		// rm.textures when the texture array was written
+		bool textureArrayStale = false;			// a streamed texture replaced its placeholder (or an evicted one went back to it) since
+		vk::DescriptorSet placeholderDescriptorSet;	// shared by the evicted textures
+		void writeTextureArray();
 
 		// pipeline
+		vk::PipelineCache pipelineCache;	// saved to PIPELINE_CACHE_FILE, so the next runs skip most of the shader compiling
+		double pipelineCreateTime = 0.0;
+		double resizeTime = 0.0;
+		void createPipelineCache();
+		void destroyPipelineCache();
 		vk::Pipeline pipeline;
 		vk::PipelineLayout pipelineLayout;
+		vk::Pipeline pipelineInstanced;		// same as pipeline, but the model matrix comes per instance
+		vk::Pipeline pipelineTextureArray;	// instanced, the texture comes from the texture array by a per instance index
+		vk::PipelineLayout pipelineLayoutTextureArray;
 		vk::Pipeline pipelineLines;
 		vk::PipelineLayout pipelineLayoutLines;
 		void createGraphicsPipeline();
 		void destroyGraphicsPipeline();
-		void createShaderModule(const std::vector<char>& code, vk::ShaderModule& shaderModule);
-
-		// semaphores
-		vk::Semaphore semaphore_Image_Available;
-		vk::Semaphore semaphore_Render_Finished;
-		void createSemaphores();
-		void destroySemaphores();
-
-		// fences
-		vk::Fence fence;
-		void createFence();
-		void destroyFence();
+		void createShaderModule(const AssetView& code, vk::ShaderModule& shaderModule);	// spir-v, in place in the asset archive or read from the file
+
+		// sprite batching
+		bool spriteBatching = true;
+		uint32_t unitQuadFirstVertex = 0;	// the vertex offset of the unit quad used by the instanced draws, slot 0 of the sprite storage
+		bool textureArray = true;
+		uint32_t descriptorBinds = 0;
+		double recordTime = 0.0;
+		double lastRecordTime = 0.0;
+
+		// tiled lights
+		LightCulling lightCulling;
+		ShadowCasting shadowCasting;
+		DistanceField distanceField;
+		ShadowMode shadowMode = ShadowMode::Volumes;
+
+		// deferred lighting, its render pass replaces renderPass when on
+		DeferredLighting deferredLighting;
+		DeferredTargets deferredTargets;
+		bool deferred = false;
+		bool deferredFrame = false;				// the frame being recorded uses the deferred render pass
+		vk::Pipeline pipelineAlbedo;			// pipeline, pipelineInstanced and pipelineTextureArray for its subpass 0
+		vk::Pipeline pipelineInstancedAlbedo;
+		vk::Pipeline pipelineTextureArrayAlbedo;
+		void createDeferredLighting();
+
+		// sort keys of the drawList
+		RenderQueue renderQueue;
+
+		// visibility culling
+		bool culling = true;
+		uint32_t visibleCount = 0;
+		uint32_t culledCount = 0;
+		std::vector<Entity*> visibleList{};
+
+		// gpu culling
+		GpuCulling gpuCulling;
+		bool gpuCullingEnabled = false;
+		uint32_t gpuSpriteCount = 0;
+		vk::DeviceSize gpuSpritesOffset = 0;
+		vk::DeviceSize gpuCommandsOffset = 0;
+		std::vector<vk::DrawIndexedIndirectCommand> gpuBatches{};	// of the last frame, instanceCount: its sprites
+		uint32_t indirectDrawCount = 0;
+
+		// multi-threaded recording
+		ThreadPool recordThreadPool;
+		uint32_t recordThreads = 1;
+
+		// frames in flight (fences, semaphores, cmd pools)
+		std::vector<FrameData> frames{};
+		uint32_t framesInFlight = 2;
+		uint32_t currentFrame = 0;
+		double fenceWaitTime = 0.0;
+		double frameLatency = 0.0;
+		void createFrames();
+		void destroyFrames();
 
 		std::vector<const char*> instanceLayers{};
 		std::vector<const char*> instanceExtensions{};
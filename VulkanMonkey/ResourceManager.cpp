@@ -61,17 +61,54 @@ namespace vm {
 			LOG("******Init resource manager first******\n");
 			exit(-1);
 		}
-		auto const pLightDSLB = vk::DescriptorSetLayoutBinding()
-			.setBinding(0) // binding number in shader stages (the set = 2 binding = 0)
-			.setDescriptorCount(1) // number of descriptors contained
-			.setDescriptorType(vk::DescriptorType::eUniformBuffer)
-			.setStageFlags(vk::ShaderStageFlagBits::eFragment); // which pipeline shader stages can access
+		// set = 2, binding 0: lights, 1: (offset, count) per screen tile, 2: light indices of the tiles, 3: shadow masks, 4: distance field
+		vk::DescriptorSetLayoutBinding pLightDSLB[5];
+		for (uint32_t i = 0; i < 3; ++i) {
+			pLightDSLB[i]
+				.setBinding(i) // binding number in shader stages
+				.setDescriptorCount(1) // number of descriptors contained
+				.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+				.setStageFlags(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment); // the deferred light quads read the lights in the vertex shader
+		}
+		for (uint32_t i = 3; i < 5; ++i) {
+			pLightDSLB[i]
+				.setBinding(i)
+				.setDescriptorCount(1)
+				.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+				.setStageFlags(vk::ShaderStageFlagBits::eFragment);
+		}
 		auto const pLightCreateInfo = vk::DescriptorSetLayoutCreateInfo()
-			.setBindingCount(1)
-			.setPBindings(&pLightDSLB);
+			.setBindingCount(5)
+			.setPBindings(pLightDSLB);
 		errCheck(pDevice.createDescriptorSetLayout(&pLightCreateInfo, nullptr, &pointLightsDescriptorSetLayout));
 	}
 
+	void ResourceManager::setUpTexturesDescriptorSetLayout()
+	{
+		if (!resourceManagerInitialized) {
+			LOG("******Init resource manager first******\n");
+			exit(-1);
+		}
+		// the fragment stage of the texture array pipeline samples the shadow masks and the distance field too
+		textureArraySize = MAX_TEXTURES;
+		if (pGpuProperties.limits.maxPerStageDescriptorSamplers - 2 < textureArraySize)
+			textureArraySize = pGpuProperties.limits.maxPerStageDescriptorSamplers - 2;
+		if (pGpuProperties.limits.maxPerStageDescriptorSampledImages - 2 < textureArraySize)
+			textureArraySize = pGpuProperties.limits.maxPerStageDescriptorSampledImages - 2;
+
+		std::vector<vk::Sampler> samplers(textureArraySize, spriteSampler);
+		auto const texturesDSLB = vk::DescriptorSetLayoutBinding()
+			.setBinding(0) // binding number in shader stages (the set = 0 binding = 0)
+			.setDescriptorCount(textureArraySize) // number of descriptors contained
+			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+			.setPImmutableSamplers(samplers.data())
+			.setStageFlags(vk::ShaderStageFlagBits::eFragment); // which pipeline shader stages can access
+		auto const texturesCreateInfo = vk::DescriptorSetLayoutCreateInfo()
+			.setBindingCount(1)
+			.setPBindings(&texturesDSLB);
+		errCheck(pDevice.createDescriptorSetLayout(&texturesCreateInfo, nullptr, &texturesDescriptorSetLayout));
+	}
+
 	int ResourceManager::createUserDefinedBuffers(Rect &rect, bool reverseY) {
 		if (!resourceManagerInitialized) {
 			LOG("******Init resource manager first******\n");
@@ -91,24 +128,24 @@ namespace vm {
 			if (!userShapedBuffers[i].occupied) {
 				if (reverseY) {
 					userShapedBuffers[i].vertices = {
-						{ { x-w, y-h, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 1.0f } },
-						{ { x+w, y-h, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 1.0f, 1.0f } },
-						{ { x+w, y+h, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f } },
-						{ { x-w, y+h, 0.0f },{ 1.0f, 1.0f, 1.0f },{ 0.0f, 0.0f } }
+						SpriteVertex({ x-w, y-h }, packUnorm16({ 0.0f, 1.0f })),
+						SpriteVertex({ x+w, y-h }, packUnorm16({ 1.0f, 1.0f })),
+						SpriteVertex({ x+w, y+h }, packUnorm16({ 1.0f, 0.0f })),
+						SpriteVertex({ x-w, y+h }, packUnorm16({ 0.0f, 0.0f }))
 					};
 				}
 				else
 				{
 					userShapedBuffers[i].vertices = {
-						{ { x-w, y-h, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
-						{ { x+w, y-h, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 1.0f, 0.0f } },
-						{ { x+w, y+h, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 1.0f } },
-						{ { x-w, y+h, 0.0f },{ 1.0f, 1.0f, 1.0f },{ 0.0f, 1.0f } }
+						SpriteVertex({ x-w, y-h }, packUnorm16({ 0.0f, 0.0f })),
+						SpriteVertex({ x+w, y-h }, packUnorm16({ 1.0f, 0.0f })),
+						SpriteVertex({ x+w, y+h }, packUnorm16({ 1.0f, 1.0f })),
+						SpriteVertex({ x-w, y+h }, packUnorm16({ 0.0f, 1.0f }))
 					};
 				}
 				userShapedBuffers[i].indices = { 0, 1, 2, 2, 3, 0 };
 
-				createBuffers(userShapedBuffers[i], &pGpu, &pDevice, &pCommandPool, &pGraphicsQueue);
+				createBuffers(userShapedBuffers[i], &pGpu, &pDevice);
 				userShapedBuffers[i].occupied = true;
 				return i;
 			}
@@ -129,6 +166,7 @@ namespace vm {
 		resourceManagerInitialized = true;
 
 		createSpriteSampler();
+		textureCooker.create(pGpu);
 
 		userShapedBuffers.resize(MAX_SHAPED_BUFFERS);
 
@@ -157,6 +195,8 @@ namespace vm {
 			.setAddressModeW(vk::SamplerAddressMode::eRepeat)
 			.setAnisotropyEnable(VK_TRUE)
 			.setMaxAnisotropy(16)
+			.setMinLod(0.0f)
+			.setMaxLod(VK_LOD_CLAMP_NONE) // 0 by default, only level 0 would ever be sampled
 			.setCompareEnable(VK_FALSE)
 			.setCompareOp(vk::CompareOp::eAlways)
 			.setBorderColor(vk::BorderColor::eIntOpaqueBlack)
@@ -165,7 +205,7 @@ namespace vm {
 		errCheck(pDevice.createSampler(&createInfo, nullptr, &spriteSampler));
 	}
 
-	void ResourceManager::createBuffers(ShapedBuffers &sBufffer, vk::PhysicalDevice*gpu, vk::Device *device, vk::CommandPool *commandPool, vk::Queue *graphicsQueue)
+	void ResourceManager::createBuffers(ShapedBuffers &sBufffer, vk::PhysicalDevice*gpu, vk::Device *device)
 	{
 		if (!resourceManagerInitialized) {
 			LOG("******Init resource manager first******\n");
@@ -175,60 +215,28 @@ namespace vm {
 		{
 			vk::DeviceSize bufferSize = sizeof(sBufffer.vertices[0]) * sBufffer.vertices.size();
 
-			// staging buffer (GPU mem : CPU accessible)
-			vk::Buffer stagingBuffer;
-			vk::DeviceMemory stagingBufferMemory;
-			helper.createBuffer(*gpu, *device, bufferSize,
-				vk::BufferUsageFlagBits::eTransferSrc,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-				stagingBuffer, stagingBufferMemory);
-
-			// get a pointer to the staging buffer memory and copy the (CPU) data in it
-			void* data;
-			auto const offset = vk::DeviceSize(); //0
-			auto const memFlags = vk::MemoryMapFlags(); //0
-			errCheck(device->mapMemory(stagingBufferMemory, offset, bufferSize, memFlags, &data));
-			memcpy(data, sBufffer.vertices.data(), (size_t)bufferSize);
-			device->unmapMemory(stagingBufferMemory);
-
 			// local device buffer (GPU mem : CPU not accessible)
 			helper.createBuffer(*gpu, *device, bufferSize,
 				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
 				vk::MemoryPropertyFlagBits::eDeviceLocal,
 				sBufffer.vertexBuffer, sBufffer.vertexBufferMem);
 
-			// copy staging buffer to local buffer
-			helper.copyBuffer(*device, *commandPool, *graphicsQueue, &stagingBuffer, &sBufffer.vertexBuffer, &bufferSize);
-			helper.destroyBuffer(*device, stagingBuffer, stagingBufferMemory);
+			// staged now, copied with the next upload flush
+			uploadContext.uploadBuffer(sBufffer.vertices.data(), bufferSize, sBufffer.vertexBuffer, vk::AccessFlagBits::eVertexAttributeRead, vk::PipelineStageFlagBits::eVertexInput);
 		}
 
 		// ********** index buffer **********
 		{
 			vk::DeviceSize bufferSize = sizeof(sBufffer.indices[0]) * sBufffer.indices.size();
 
-			// staging buffer (CPU accessible)
-			vk::Buffer stagingBuffer;
-			vk::DeviceMemory stagingBufferMem;
-			helper.createBuffer(*gpu, *device, bufferSize,
-				vk::BufferUsageFlagBits::eTransferSrc,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-				stagingBuffer, stagingBufferMem);
-
-			// copy data (CPU mem) to the staging buffer(temporary buffer)
-			void* data;
-			errCheck(device->mapMemory(stagingBufferMem, vk::DeviceSize(), bufferSize, vk::MemoryMapFlags(), &data));
-			memcpy(data, sBufffer.indices.data(), (size_t)bufferSize);
-			device->unmapMemory(stagingBufferMem);
-
 			// local device buffer (GPU)
 			helper.createBuffer(*gpu, *device, bufferSize,
 				vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
 				vk::MemoryPropertyFlagBits::eDeviceLocal,
 				sBufffer.indexBuffer, sBufffer.indexBufferMem);
 
-			// copy staging buffer to local buffer
-			helper.copyBuffer(*device, *commandPool, *graphicsQueue, &stagingBuffer, &sBufffer.indexBuffer, &bufferSize);
-			helper.destroyBuffer(*device, stagingBuffer, stagingBufferMem);
+			// staged now, copied with the next upload flush
+			uploadContext.uploadBuffer(sBufffer.indices.data(), bufferSize, sBufffer.indexBuffer, vk::AccessFlagBits::eIndexRead, vk::PipelineStageFlagBits::eVertexInput);
 		}
 	}
 
@@ -4,8 +4,19 @@
 #include "Rect.h"
 #include "Vulkan_.h"
 #include "Vertex.h"
+#include "FrameAllocator.h"
+#include "UploadContext.h"
+#include "TextureAtlas.h"
+#include "SpriteStorage.h"
+#include "DescriptorAllocator.h"
+#include "TextureCooker.h"
+#include "AssetArchive.h"
+#include "TextureStreamer.h"
+#include "TextureResidency.h"
 #include "Box2D\Box2D.h"
 
+#define MAX_TEXTURES 64
+
 namespace vm {
 	struct ShapedBuffers {
 		vk::Buffer				vertexBuffer;
@@ -13,7 +24,7 @@ namespace vm {
 		vk::Buffer				indexBuffer;
 		vk::DeviceMemory		indexBufferMem;
 
-		std::vector<Vertex>		vertices;
+		std::vector<SpriteVertex>	vertices;
 		std::vector<uint32_t>	indices;
 		bool					occupied = false;
 	};
@@ -29,30 +40,39 @@ namespace vm {
 		b2World							*world;
 		b2Body							*groundBody;
 		Rect							groundRect;
-		vk::Buffer						spritesVertexBuffer;
 		vk::Buffer						spritesIndexBuffer;
-		vk::Buffer						spritesUniformBuffer;
-		vk::Buffer						pointLightsUniformBuffer;
-		vk::DeviceMemory				spritesVertexBufferMem;
 		vk::DeviceMemory				spritesIndexBufferMem;
-		vk::DeviceMemory				spritesUniformBufferMem;
-		vk::DeviceMemory				pointLightsUniformBufferMem;
 		vk::DescriptorSet				spritesDescriptorSet;
 		vk::DescriptorSet				playerDescriptorSet;
-		vk::DescriptorSet				pointLightsDescriptorSet;
-		void							*spritesUniformData;
-		void							*pointLightsUniformData;
 
+		UploadContext					uploadContext;		// batched staging copies, flushed before the first frame that needs them
+		FrameAllocator					frameAllocator;		// transient sprite uniforms and instance data, a region per frame in flight
+		SpriteStorage					spriteStorage;		// the quads of the sprites, a slot each, sprites can come and go at any time
+		DescriptorAllocator				descriptorAllocator; // the sprite and texture array dSets, pools added as they are needed
+		AssetArchive					assetArchive;		// the packed assets mapped, the loose files if there is no archive
 		std::map<std::string, Texture>	textures;
+		TextureAtlas					textureAtlas;		// small textures wait here until the scene is pushed
+		TextureCooker					textureCooker;		// the other ones are loaded cooked (bc1/bc3, mipped) if the gpu takes bc
+		TextureStreamer					textureStreamer;	// loads the textures on worker threads, a placeholder until then
+		TextureResidency				textureResidency;	// evicts the least recently drawn textures over the budget
+		std::map<std::string, vk::DescriptorSet> textureDescriptorSets; // one dSet per texture, shared by all the sprites using it
 		std::vector<Rect>				definedRects{};
 		std::vector<ShapedBuffers>		userShapedBuffers{};
 		vk::DescriptorSetLayout         cameraDescriptorSetLayout;
 		vk::DescriptorSetLayout			spritesDescriptorSetLayout;
-		vk::DescriptorSetLayout			pointLightsDescriptorSetLayout;
+		vk::DescriptorSetLayout			pointLightsDescriptorSetLayout;	// lights, tiles and light indices (storage buffers)
+		vk::DescriptorSetLayout			texturesDescriptorSetLayout;	// all the textures in one sampler array
+		vk::DescriptorSet				texturesDescriptorSet;
+		uint32_t						textureArraySize = 0;			// slots of the array, MAX_TEXTURES or less if the gpu limits are lower
+		uint32_t						textureSlotCount = 0;			// slots the loaded textures need (atlas pages count once)
 		vk::Sampler                     spriteSampler;
+		bool							mipmaps = true;					// full mip chains for the textures with an image of their own
+		uint32_t						cpuMipTextures = 0;				// chains made with stb_image_resize, the format couldn't be blitted
+		vk::DeviceSize					mipBytes = 0;					// the levels below 0 of all the textures
 		void setUpCameraDescriptorSetLayout();
 		void setUpSpriteDescriptorSetLayout();
 		void setUpPointLightsDescriptorSetLayout();
+		void setUpTexturesDescriptorSetLayout();
 		
 		int createUserDefinedBuffers(Rect &definedRect, bool reverseY = false);
 		void init(vk::PhysicalDevice& pGpu, vk::Device& pDevice, vk::CommandPool& pCommandPool, vk::Queue& pGraphicsQueue, vk::PhysicalDeviceProperties& pGpuProperties, vk::Extent2D& pSChainExt2D);
@@ -78,7 +98,7 @@ namespace vm {
 		Helper							helper;
 
 		void createSpriteSampler(); // one immutable sampler
-		void createBuffers(ShapedBuffers &sBufffer, vk::PhysicalDevice*gpu, vk::Device *device, vk::CommandPool *commandPool, vk::Queue *graphicsQueue);
+		void createBuffers(ShapedBuffers &sBufffer, vk::PhysicalDevice*gpu, vk::Device *device);
 
 		ResourceManager() {}; // ctor hidden
 		ResourceManager(ResourceManager const&) {}; // copy ctor hidden
@@ -0,0 +1,491 @@
+#include "ShadowCasting.h"
+#include "ResourceManager.h"
+#include "Entity.h"
+#include "ErrorAndLog.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#define SHADOW_CELLS_PER_ROW (SHADOW_ATLAS_SIZE / SHADOW_CELL_SIZE)
+
+namespace vm {
+	// collects the fixtures whose (fat) aabb overlaps the query, from the broad-phase dynamic tree
+	class FixtureQuery : public b2QueryCallback
+	{
+	public:
+		explicit FixtureQuery(std::vector<b2Fixture*> &fixtures) : fixtures(fixtures) {}
+		bool ReportFixture(b2Fixture *fixture) override
+		{
+			fixtures.push_back(fixture);
+			return true;
+		}
+	private:
+		std::vector<b2Fixture*> &fixtures;
+	};
+
+	bool ShadowCasting::create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, uint32_t frameCount)
+	{
+		this->gpu = gpu;
+		this->device = device;
+
+		helper.createImage(gpu, device, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, vk::Format::eR8Unorm, vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, atlasImage, atlasImageMem);
+		helper.createImageView(device, atlasImage, vk::Format::eR8Unorm, atlasImageView);
+
+		// the shaders clamp inside the cell, linear gives the edges a texel of softness
+		auto const sci = vk::SamplerCreateInfo()
+			.setMagFilter(vk::Filter::eLinear)
+			.setMinFilter(vk::Filter::eLinear)
+			.setMipmapMode(vk::SamplerMipmapMode::eNearest)
+			.setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+			.setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+			.setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+			.setAnisotropyEnable(VK_FALSE)
+			.setMaxAnisotropy(1.f)
+			.setCompareEnable(VK_FALSE)
+			.setCompareOp(vk::CompareOp::eAlways)
+			.setBorderColor(vk::BorderColor::eFloatTransparentBlack)
+			.setUnnormalizedCoordinates(VK_FALSE);
+		errCheck(device.createSampler(&sci, nullptr, &atlasSampler));
+
+		createRenderPass();
+		auto const fbci = vk::FramebufferCreateInfo()
+			.setRenderPass(renderPass)
+			.setAttachmentCount(1)
+			.setPAttachments(&atlasImageView)
+			.setWidth(SHADOW_ATLAS_SIZE)
+			.setHeight(SHADOW_ATLAS_SIZE)
+			.setLayers(1);
+		errCheck(device.createFramebuffer(&fbci, nullptr, &frameBuffer));
+
+		const AssetArchive &assets = ResourceManager::getInstance().assetArchive;
+		if (!assets.exists("shaders/shadow.vert.spv") || !assets.exists("shaders/shadow.frag.spv")) {
+			LOG("shadow shaders not found, shadows are disabled\n");
+			return false;
+		}
+		createPipeline(pipelineCache);
+
+		// a first guess, the buffers grow with the casters
+		frames.resize(frameCount);
+		for (auto &frame : frames)
+			resize(frame, 64 * 1024);
+		available = true;
+		return true;
+	}
+
+	void ShadowCasting::createRenderPass()
+	{
+		// only the cells in use are cleared (in the pass), the others are not sampled
+		auto const attachment = vk::AttachmentDescription()
+			.setFormat(vk::Format::eR8Unorm)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setLoadOp(vk::AttachmentLoadOp::eDontCare)
+			.setStoreOp(vk::AttachmentStoreOp::eStore)
+			.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+			.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setInitialLayout(vk::ImageLayout::eUndefined)
+			.setFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+		auto const colorRef = vk::AttachmentReference().setAttachment(0).setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+		auto const subpass = vk::SubpassDescription()
+			.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+			.setColorAttachmentCount(1)
+			.setPColorAttachments(&colorRef);
+
+		vk::SubpassDependency dependencies[2];
+		// the fragment shaders of the previous frame in flight are done with the masks
+		dependencies[0] = vk::SubpassDependency()
+			.setSrcSubpass(VK_SUBPASS_EXTERNAL)
+			.setDstSubpass(0)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eFragmentShader)
+			.setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite);
+		// and this frame's read them after
+		dependencies[1] = vk::SubpassDependency()
+			.setSrcSubpass(0)
+			.setDstSubpass(VK_SUBPASS_EXTERNAL)
+			.setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+			.setDstStageMask(vk::PipelineStageFlagBits::eFragmentShader)
+			.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+		auto const rpci = vk::RenderPassCreateInfo()
+			.setAttachmentCount(1)
+			.setPAttachments(&attachment)
+			.setSubpassCount(1)
+			.setPSubpasses(&subpass)
+			.setDependencyCount(2)
+			.setPDependencies(dependencies);
+		errCheck(device.createRenderPass(&rpci, nullptr, &renderPass));
+	}
+
+	void ShadowCasting::createPipeline(vk::PipelineCache pipelineCache)
+	{
+		const AssetArchive &assets = ResourceManager::getInstance().assetArchive;
+		AssetView vertCode, fragCode;
+		assets.read("shaders/shadow.vert.spv", vertCode);
+		assets.read("shaders/shadow.frag.spv", fragCode);
+		vk::ShaderModule vertModule, fragModule;
+		auto const vsmci = vk::ShaderModuleCreateInfo()
+			.setCodeSize(vertCode.size())
+			.setPCode(reinterpret_cast<const uint32_t*>(vertCode.data()));
+		errCheck(device.createShaderModule(&vsmci, nullptr, &vertModule));
+		auto const fsmci = vk::ShaderModuleCreateInfo()
+			.setCodeSize(fragCode.size())
+			.setPCode(reinterpret_cast<const uint32_t*>(fragCode.data()));
+		errCheck(device.createShaderModule(&fsmci, nullptr, &fragModule));
+		vk::PipelineShaderStageCreateInfo stages[2];
+		stages[0].setStage(vk::ShaderStageFlagBits::eVertex).setModule(vertModule).setPName("main");
+		stages[1].setStage(vk::ShaderStageFlagBits::eFragment).setModule(fragModule).setPName("main");
+
+		// x, y, w of the volumes, already in cell space
+		auto const vibd = vk::VertexInputBindingDescription()
+			.setBinding(0)
+			.setStride(sizeof(glm::vec3))
+			.setInputRate(vk::VertexInputRate::eVertex);
+		auto const viad = vk::VertexInputAttributeDescription()
+			.setBinding(0)
+			.setLocation(0)
+			.setFormat(vk::Format::eR32G32B32Sfloat)
+			.setOffset(0);
+		auto const visci = vk::PipelineVertexInputStateCreateInfo()
+			.setVertexBindingDescriptionCount(1)
+			.setPVertexBindingDescriptions(&vibd)
+			.setVertexAttributeDescriptionCount(1)
+			.setPVertexAttributeDescriptions(&viad);
+		auto const iasci = vk::PipelineInputAssemblyStateCreateInfo()
+			.setTopology(vk::PrimitiveTopology::eTriangleList)
+			.setPrimitiveRestartEnable(VK_FALSE);
+		auto const viewportState = vk::PipelineViewportStateCreateInfo()
+			.setViewportCount(1)
+			.setScissorCount(1);
+		vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+		auto const dynamicState = vk::PipelineDynamicStateCreateInfo()
+			.setDynamicStateCount(2)
+			.setPDynamicStates(dynamicStates);
+		auto const rasterizer = vk::PipelineRasterizationStateCreateInfo()
+			.setPolygonMode(vk::PolygonMode::eFill)
+			.setLineWidth(1.0f)
+			.setCullMode(vk::CullModeFlagBits::eNone);
+		auto const multisampling = vk::PipelineMultisampleStateCreateInfo()
+			.setRasterizationSamples(vk::SampleCountFlagBits::e1);
+		auto const depthStencil = vk::PipelineDepthStencilStateCreateInfo()
+			.setDepthTestEnable(VK_FALSE)
+			.setDepthWriteEnable(VK_FALSE);
+		// overlapping volumes all write 1, no blending
+		auto const blendAttachment = vk::PipelineColorBlendAttachmentState()
+			.setColorWriteMask(vk::ColorComponentFlagBits::eR)
+			.setBlendEnable(VK_FALSE);
+		auto const colorBlending = vk::PipelineColorBlendStateCreateInfo()
+			.setAttachmentCount(1)
+			.setPAttachments(&blendAttachment);
+
+		auto const plci = vk::PipelineLayoutCreateInfo();
+		errCheck(device.createPipelineLayout(&plci, nullptr, &pipelineLayout));
+
+		auto const gpci = vk::GraphicsPipelineCreateInfo()
+			.setStageCount(2)
+			.setPStages(stages)
+			.setPVertexInputState(&visci)
+			.setPInputAssemblyState(&iasci)
+			.setPViewportState(&viewportState)
+			.setPRasterizationState(&rasterizer)
+			.setPMultisampleState(&multisampling)
+			.setPDepthStencilState(&depthStencil)
+			.setPColorBlendState(&colorBlending)
+			.setPDynamicState(&dynamicState)
+			.setLayout(pipelineLayout)
+			.setRenderPass(renderPass)
+			.setSubpass(0);
+		errCheck(device.createGraphicsPipelines(pipelineCache, 1, &gpci, nullptr, &pipeline));
+		device.destroyShaderModule(vertModule);
+		device.destroyShaderModule(fragModule);
+	}
+
+	void ShadowCasting::destroy()
+	{
+		for (auto &frame : frames) {
+			if (!frame.buffer)
+				continue;
+			helper.destroyBuffer(device, frame.buffer, frame.memory);
+		}
+		frames.clear();
+		if (available) {
+			device.destroyPipeline(pipeline);
+			device.destroyPipelineLayout(pipelineLayout);
+		}
+		device.destroyFramebuffer(frameBuffer);
+		device.destroyRenderPass(renderPass);
+		device.destroySampler(atlasSampler);
+		device.destroyImageView(atlasImageView);
+		helper.destroyImage(device, atlasImage, atlasImageMem);
+		available = false;
+		atlasReady = false;
+	}
+
+	bool ShadowCasting::isAvailable() const
+	{
+		return available;
+	}
+
+	vk::DescriptorImageInfo ShadowCasting::getMaskInfo() const
+	{
+		return vk::DescriptorImageInfo()
+			.setSampler(atlasSampler)
+			.setImageView(atlasImageView)
+			.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+	}
+
+	void ShadowCasting::resize(FrameBuffers &frame, vk::DeviceSize size)
+	{
+		if (frame.buffer) {
+			helper.destroyBuffer(device, frame.buffer, frame.memory);
+		}
+		frame.size = size;
+		helper.createBuffer(gpu, device, size, vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, frame.buffer, frame.memory);
+		frame.data = helper.mapBuffer(device, frame.buffer);
+	}
+
+	void ShadowCasting::gatherEdges(const glm::vec2 &lightPos, float range)
+	{
+		edgeX0.clear();
+		edgeY0.clear();
+		edgeX1.clear();
+		edgeY1.clear();
+		auto const pushEdge = [this](const glm::vec2 &a, const glm::vec2 &b) {
+			edgeX0.push_back(a.x);
+			edgeY0.push_back(a.y);
+			edgeX1.push_back(b.x);
+			edgeY1.push_back(b.y);
+		};
+
+		// only the fixtures in the light's square, the world is in meters
+		fixtures.clear();
+		FixtureQuery query(fixtures);
+		b2AABB aabb;
+		aabb.lowerBound = b2Vec2((lightPos.x - range) * P2M, (lightPos.y - range) * P2M);
+		aabb.upperBound = b2Vec2((lightPos.x + range) * P2M, (lightPos.y + range) * P2M);
+		ResourceManager::getInstance().world->QueryAABB(&query, aabb);
+
+		const b2Vec2 lightM(lightPos.x * P2M, lightPos.y * P2M);
+		for (auto fixture : fixtures) {
+			if (fixture->IsSensor())
+				continue;
+			const b2Transform &xf = fixture->GetBody()->GetTransform();
+			const b2Shape *shape = fixture->GetShape();
+			if (shape->GetType() == b2Shape::e_polygon) {
+				const b2PolygonShape *polygon = static_cast<const b2PolygonShape*>(shape);
+				// a light inside its caster (the player's) would be all shadow
+				if (polygon->TestPoint(xf, lightM))
+					continue;
+				// every edge in pixels from the light, ccw like box2d keeps them
+				b2Vec2 v = b2Mul(xf, polygon->m_vertices[polygon->m_count - 1]);
+				glm::vec2 prev(v.x * M2P - lightPos.x, v.y * M2P - lightPos.y);
+				for (int32 i = 0; i < polygon->m_count; ++i) {
+					v = b2Mul(xf, polygon->m_vertices[i]);
+					const glm::vec2 cur(v.x * M2P - lightPos.x, v.y * M2P - lightPos.y);
+					pushEdge(prev, cur);
+					prev = cur;
+				}
+			}
+			else if (shape->GetType() == b2Shape::e_circle) {
+				const b2CircleShape *circle = static_cast<const b2CircleShape*>(shape);
+				const b2Vec2 c = b2Mul(xf, circle->m_p);
+				const glm::vec2 center(c.x * M2P - lightPos.x, c.y * M2P - lightPos.y);
+				const float radius = circle->m_radius * M2P;
+				const float distance = glm::length(center);
+				if (distance <= radius)
+					continue;
+				// the silhouette is the chord between the two tangent points
+				const glm::vec2 toLight = -center / distance;
+				const glm::vec2 side(-toLight.y, toLight.x);
+				const float cosA = radius / distance;
+				const float sinA = std::sqrt(1.f - cosA * cosA);
+				const glm::vec2 t0 = center + radius * (cosA * toLight + sinA * side);
+				const glm::vec2 t1 = center + radius * (cosA * toLight - sinA * side);
+				// wound so it faces away from the light, like the back edges of the polygons
+				if ((t1.x - t0.x) * t0.y - (t1.y - t0.y) * t0.x < 0.f)
+					pushEdge(t0, t1);
+				else
+					pushEdge(t1, t0);
+			}
+		}
+	}
+
+	void ShadowCasting::extrudeEdges(float range)
+	{
+		// every edge writes its 6 vertices, only the ones facing away from the light advance the output,
+		// no branch in the loop so the compiler can vectorize it
+		const float invRange = 1.f / range;
+		const size_t count = edgeX0.size();
+		const size_t first = vertices.size();
+		vertices.resize(first + count * 6);
+		glm::vec3 *out = vertices.data() + first;
+		const float *x0 = edgeX0.data(), *y0 = edgeY0.data(), *x1 = edgeX1.data(), *y1 = edgeY1.data();
+		size_t written = 0;
+		for (size_t e = 0; e < count; ++e) {
+			// the light (the origin) is on the inner side of a ccw edge that faces away from it
+			const float turn = (x1[e] - x0[e]) * y0[e] - (y1[e] - y0[e]) * x0[e];
+			const glm::vec3 a(x0[e] * invRange, y0[e] * invRange, 1.f);
+			const glm::vec3 b(x1[e] * invRange, y1[e] * invRange, 1.f);
+			const glm::vec3 farA(x0[e], y0[e], 0.f); // the directions from the light, at infinity
+			const glm::vec3 farB(x1[e], y1[e], 0.f);
+			out[written + 0] = a;
+			out[written + 1] = b;
+			out[written + 2] = farB;
+			out[written + 3] = a;
+			out[written + 4] = farB;
+			out[written + 5] = farA;
+			written += turn < 0.f ? 6 : 0;
+		}
+		vertices.resize(first + written);
+		edgeCount += static_cast<uint32_t>(written / 6);
+	}
+
+	void ShadowCasting::build(const std::vector<UniformLightObject> &lights, const std::vector<uint32_t> &shadowLights)
+	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		vertices.clear();
+		cellRanges.resize(shadowLights.size());
+		edgeCount = 0;
+		for (size_t cell = 0; cell < shadowLights.size(); ++cell) {
+			const UniformLightObject &light = lights[shadowLights[cell]];
+			const float range = light.radius * LIGHT_RANGE;
+			const uint32_t first = static_cast<uint32_t>(vertices.size());
+			gatherEdges(light.position, range);
+			extrudeEdges(range);
+			cellRanges[cell] = glm::uvec2(first, static_cast<uint32_t>(vertices.size()) - first);
+		}
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		buildTime = time.count();
+	}
+
+	void ShadowCasting::update(uint32_t frameIndex, const std::vector<UniformLightObject> &lights, const std::vector<uint32_t> &shadowLights)
+	{
+		if (!available) {
+			cellRanges.clear();
+			return;
+		}
+		build(lights, shadowLights);
+
+		FrameBuffers &frame = frames[frameIndex];
+		const vk::DeviceSize size = vertices.size() * sizeof(glm::vec3);
+		if (size > frame.size)
+			resize(frame, size * 2);
+		memcpy(frame.data, vertices.data(), static_cast<size_t>(size));
+	}
+
+	void ShadowCasting::record(vk::CommandBuffer cmd, uint32_t frameIndex)
+	{
+		// nothing to draw, but the atlas needs its layout once for the light sets
+		if (cellRanges.empty() && atlasReady)
+			return;
+
+		auto const renderPassInfo = vk::RenderPassBeginInfo()
+			.setRenderPass(renderPass)
+			.setFramebuffer(frameBuffer)
+			.setRenderArea({ { 0, 0 }, { SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE } });
+		cmd.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+		if (!cellRanges.empty()) {
+			std::vector<vk::ClearRect> clearRects(cellRanges.size());
+			for (uint32_t cell = 0; cell < cellRanges.size(); ++cell) {
+				clearRects[cell]
+					.setRect({ { static_cast<int32_t>(cell % SHADOW_CELLS_PER_ROW * SHADOW_CELL_SIZE), static_cast<int32_t>(cell / SHADOW_CELLS_PER_ROW * SHADOW_CELL_SIZE) }, { SHADOW_CELL_SIZE, SHADOW_CELL_SIZE } })
+					.setBaseArrayLayer(0)
+					.setLayerCount(1);
+			}
+			auto const clearAttachment = vk::ClearAttachment()
+				.setAspectMask(vk::ImageAspectFlagBits::eColor)
+				.setColorAttachment(0)
+				.setClearValue(vk::ClearColorValue().setFloat32({ 0.f, 0.f, 0.f, 0.f }));
+			cmd.clearAttachments(1, &clearAttachment, static_cast<uint32_t>(clearRects.size()), clearRects.data());
+
+			const vk::DeviceSize offset = 0;
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+			cmd.bindVertexBuffers(0, 1, &frames[frameIndex].buffer, &offset);
+			for (uint32_t cell = 0; cell < cellRanges.size(); ++cell) {
+				if (cellRanges[cell].y == 0)
+					continue;
+				// the cell is the viewport, -1..1 of the volumes is the light's reach
+				const vk::Rect2D rect({ static_cast<int32_t>(cell % SHADOW_CELLS_PER_ROW * SHADOW_CELL_SIZE), static_cast<int32_t>(cell / SHADOW_CELLS_PER_ROW * SHADOW_CELL_SIZE) }, { SHADOW_CELL_SIZE, SHADOW_CELL_SIZE });
+				auto const viewport = vk::Viewport()
+					.setX(static_cast<float>(rect.offset.x))
+					.setY(static_cast<float>(rect.offset.y))
+					.setWidth(static_cast<float>(SHADOW_CELL_SIZE))
+					.setHeight(static_cast<float>(SHADOW_CELL_SIZE))
+					.setMinDepth(0.0f)
+					.setMaxDepth(1.0f);
+				cmd.setViewport(0, 1, &viewport);
+				cmd.setScissor(0, 1, &rect);
+				cmd.draw(cellRanges[cell].y, 1, cellRanges[cell].x, 0);
+			}
+		}
+		cmd.endRenderPass();
+		atlasReady = true;
+	}
+
+	uint32_t ShadowCasting::getShadowLightCount() const
+	{
+		return static_cast<uint32_t>(cellRanges.size());
+	}
+
+	uint32_t ShadowCasting::getEdgeCount() const
+	{
+		return edgeCount;
+	}
+
+	double ShadowCasting::getBuildTime() const
+	{
+		return buildTime;
+	}
+
+	void ShadowCasting::benchmark()
+	{
+		// the lights are spread over the bounds of every fixture, with the radius of the small lights of the demo
+		b2World *world = ResourceManager::getInstance().world;
+		b2AABB bounds;
+		bool empty = true;
+		for (b2Body *body = world->GetBodyList(); body; body = body->GetNext()) {
+			for (b2Fixture *fixture = body->GetFixtureList(); fixture; fixture = fixture->GetNext()) {
+				if (empty)
+					bounds = fixture->GetAABB(0);
+				else
+					bounds.Combine(fixture->GetAABB(0));
+				empty = false;
+			}
+		}
+		if (empty) {
+			REPORT("No fixtures to cast shadows\n");
+			return;
+		}
+
+		std::mt19937 gen(7);
+		std::uniform_real_distribution<float> x(bounds.lowerBound.x * M2P, bounds.upperBound.x * M2P);
+		std::uniform_real_distribution<float> y(bounds.lowerBound.y * M2P, bounds.upperBound.y * M2P);
+		const uint32_t counts[] = { 20, 50, 100, 200 };
+		const int runs = 20;
+		std::vector<UniformLightObject> lights;
+		std::vector<uint32_t> shadowLights;
+
+		REPORT("Shadow volumes, cpu build time (" << runs << " runs each):\n");
+		for (uint32_t count : counts) {
+			lights.resize(count);
+			shadowLights.resize(count);
+			for (uint32_t i = 0; i < count; ++i) {
+				lights[i] = UniformLightObject{ glm::vec4(1.f), glm::vec2(x(gen), y(gen)), 20.f, static_cast<float>(i) };
+				shadowLights[i] = i;
+			}
+			double total = 0.0;
+			for (int r = 0; r < runs; ++r) {
+				build(lights, shadowLights);
+				total += buildTime;
+			}
+			REPORT("  " << count << " lights: " << total / runs << " ms, " << edgeCount << " edges extruded, " << vertices.size() << " vertices\n");
+		}
+		cellRanges.clear(); // the benchmark's cells are not drawn
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+#include "glm_.h"
+#include "Light.h"
+
+class b2Fixture;
+
+namespace vm {
+	// Hard shadows of the Box2D fixtures for the lights that got a shadow cell in the light culling.
+	// Every frame the fixtures in a light's reach are found through the world's dynamic tree, their edges
+	// facing away from the light are extruded to infinity (w = 0 vertices, the clipper cuts them at the cell)
+	// and drawn into the light's cell of the shadow atlas, 1 where the light is blocked.
+	// The fragment shaders scale every light by 1 - its mask, so the casters themselves stay lit.
+	class ShadowCasting
+	{
+	public:
+		// the atlas always exists (the light sets sample it), false if the shaders are missing
+		bool create(vk::PhysicalDevice gpu, vk::Device device, vk::PipelineCache pipelineCache, uint32_t frameCount);
+		void destroy();
+		bool isAvailable() const;
+		vk::DescriptorImageInfo getMaskInfo() const;
+
+		// the frame's fence is waited: builds the shadow volumes of the cells and rewrites its vertex buffer
+		void update(uint32_t frameIndex, const std::vector<UniformLightObject> &lights, const std::vector<uint32_t> &shadowLights);
+		// outside of a render pass, before the passes sampling the masks
+		void record(vk::CommandBuffer cmd, uint32_t frameIndex);
+
+		uint32_t getShadowLightCount() const;	// cells drawn in the last update
+		uint32_t getEdgeCount() const;			// caster edges extruded in the last update
+		double getBuildTime() const;			// ms, the cpu part of the last update
+
+		// logs the cpu time of building the volumes of 20 to 200 lights spread over the fixtures of the world
+		void benchmark();
+
+	private:
+		// one per frame in flight, host visible and persistently mapped
+		struct FrameBuffers
+		{
+			vk::Buffer			buffer;
+			vk::DeviceMemory	memory;
+			void				*data = nullptr;
+			vk::DeviceSize		size = 0;
+		};
+		vk::PhysicalDevice			gpu;
+		vk::Device					device;
+		vk::Image					atlasImage;
+		vk::DeviceMemory			atlasImageMem;
+		vk::ImageView				atlasImageView;
+		vk::Sampler					atlasSampler;
+		vk::RenderPass				renderPass;
+		vk::Framebuffer				frameBuffer;
+		vk::PipelineLayout			pipelineLayout;
+		vk::Pipeline				pipeline;
+		std::vector<FrameBuffers>	frames{};
+		bool						available = false;
+		bool						atlasReady = false;	// in eShaderReadOnlyOptimal
+
+		// cpu side of the build, kept between the frames
+		std::vector<b2Fixture*>		fixtures{};		// in the reach of the light being built
+		std::vector<float>			edgeX0{}, edgeY0{}, edgeX1{}, edgeY1{};	// caster edges of one light, relative to it, soa so the extrusion loop vectorizes
+		std::vector<glm::vec3>		vertices{};		// xy, w: cell space (the light's reach is -1..1), w = 0 for the extruded ends
+		std::vector<glm::uvec2>		cellRanges{};	// (first vertex, count) per shadow cell
+
+		uint32_t		edgeCount = 0;
+		double			buildTime = 0.0;
+		Helper			helper;
+
+		void build(const std::vector<UniformLightObject> &lights, const std::vector<uint32_t> &shadowLights);
+		void gatherEdges(const glm::vec2 &lightPos, float range);
+		void extrudeEdges(float range);
+		void createRenderPass();
+		void createPipeline(vk::PipelineCache pipelineCache);
+		void resize(FrameBuffers &frame, vk::DeviceSize size);
+	};
+}
@@ -0,0 +1,136 @@
+#include "SpatialGrid.h"
+#include <cmath>
+#include <algorithm>
+
+namespace vm {
+	uint64_t SpatialGrid::cellKey(int x, int y)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+	}
+
+	void SpatialGrid::update(Entity *entity, const glm::vec2 &min, const glm::vec2 &max)
+	{
+		Item item;
+		item.min = min;
+		item.max = max;
+		item.cellMinX = static_cast<int>(std::floor(min.x / GRID_CELL_SIZE));
+		item.cellMinY = static_cast<int>(std::floor(min.y / GRID_CELL_SIZE));
+		item.cellMaxX = static_cast<int>(std::floor(max.x / GRID_CELL_SIZE));
+		item.cellMaxY = static_cast<int>(std::floor(max.y / GRID_CELL_SIZE));
+		item.stamp = 0;
+		item.drawnFrame = 0;
+
+		auto it = items.find(entity);
+		if (it == items.end()) {
+			items[entity] = item;
+			insertCells(entity, item);
+			return;
+		}
+
+		// same cells, only the bounds for the exact test change
+		Item &old = it->second;
+		item.stamp = old.stamp;
+		item.drawnFrame = old.drawnFrame;
+		if (old.cellMinX != item.cellMinX || old.cellMinY != item.cellMinY || old.cellMaxX != item.cellMaxX || old.cellMaxY != item.cellMaxY) {
+			removeCells(entity, old);
+			insertCells(entity, item);
+		}
+		old = item;
+	}
+
+	void SpatialGrid::remove(Entity *entity)
+	{
+		auto it = items.find(entity);
+		if (it == items.end())
+			return;
+		removeCells(entity, it->second);
+		items.erase(it);
+	}
+
+	bool SpatialGrid::contains(Entity *entity) const
+	{
+		return items.find(entity) != items.end();
+	}
+
+	void SpatialGrid::beginFrame()
+	{
+		++frame;
+	}
+
+	bool SpatialGrid::markDrawn(Entity *entity)
+	{
+		auto it = items.find(entity);
+		if (it == items.end())
+			return false;
+		it->second.drawnFrame = frame;
+		return true;
+	}
+
+	void SpatialGrid::query(const glm::vec2 &min, const glm::vec2 &max, std::vector<Entity*> &result)
+	{
+		++queryStamp;
+
+		auto visit = [&](const std::vector<Entity*> &cell) {
+			for (auto entity : cell) {
+				Item &item = items[entity];
+				if (item.stamp == queryStamp)
+					continue; // already seen in an other cell
+				item.stamp = queryStamp;
+				if (item.drawnFrame == frame && item.max.x >= min.x && item.min.x <= max.x && item.max.y >= min.y && item.min.y <= max.y)
+					result.push_back(entity);
+			}
+		};
+
+		const int cellMinX = static_cast<int>(std::floor(min.x / GRID_CELL_SIZE));
+		const int cellMinY = static_cast<int>(std::floor(min.y / GRID_CELL_SIZE));
+		const int cellMaxX = static_cast<int>(std::floor(max.x / GRID_CELL_SIZE));
+		const int cellMaxY = static_cast<int>(std::floor(max.y / GRID_CELL_SIZE));
+
+		// zoomed far out the rect covers more cells than there are, walk the occupied ones instead
+		const double rectCells = (static_cast<double>(cellMaxX) - cellMinX + 1) * (static_cast<double>(cellMaxY) - cellMinY + 1);
+		if (rectCells > static_cast<double>(cells.size())) {
+			for (auto &cell : cells)
+				visit(cell.second);
+			return;
+		}
+		for (int y = cellMinY; y <= cellMaxY; ++y) {
+			for (int x = cellMinX; x <= cellMaxX; ++x) {
+				auto cell = cells.find(cellKey(x, y));
+				if (cell != cells.end())
+					visit(cell->second);
+			}
+		}
+	}
+
+	size_t SpatialGrid::getCellCount() const
+	{
+		return cells.size();
+	}
+
+	void SpatialGrid::insertCells(Entity *entity, const Item &item)
+	{
+		for (int y = item.cellMinY; y <= item.cellMaxY; ++y) {
+			for (int x = item.cellMinX; x <= item.cellMaxX; ++x)
+				cells[cellKey(x, y)].push_back(entity);
+		}
+	}
+
+	void SpatialGrid::removeCells(Entity *entity, const Item &item)
+	{
+		for (int y = item.cellMinY; y <= item.cellMaxY; ++y) {
+			for (int x = item.cellMinX; x <= item.cellMaxX; ++x) {
+				auto cell = cells.find(cellKey(x, y));
+				if (cell == cells.end())
+					continue;
+				std::vector<Entity*> &list = cell->second;
+				auto it = std::find(list.begin(), list.end(), entity);
+				if (it != list.end()) {
+					*it = list.back(); // order in a cell does not matter
+					list.pop_back();
+				}
+				if (list.empty())
+					cells.erase(cell);
+			}
+		}
+	}
+}
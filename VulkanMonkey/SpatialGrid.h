@@ -0,0 +1,46 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "glm_.h"
+
+#define GRID_CELL_SIZE 256.0f	// world units (pixels), a few sprites wide
+
+namespace vm {
+	class Entity;
+
+	// Uniform grid over the world for the visibility culling, an entity is listed in every cell its bounds touch.
+	// Moving an entity only changes the cells when it crosses a cell border, a query only visits the cells of its rect.
+	class SpatialGrid
+	{
+	public:
+		void update(Entity *entity, const glm::vec2 &min, const glm::vec2 &max);
+		void remove(Entity *entity);
+		bool contains(Entity *entity) const;
+
+		// only the entities marked since beginFrame are returned by query, the others are not dereferenced at all
+		void beginFrame();
+		bool markDrawn(Entity *entity); // false if the entity is not in the grid
+
+		// appends the drawn entities with bounds overlapping the rect, every entity once
+		void query(const glm::vec2 &min, const glm::vec2 &max, std::vector<Entity*> &result);
+		size_t getCellCount() const;
+
+	private:
+		struct Item
+		{
+			glm::vec2	min;
+			glm::vec2	max;
+			int			cellMinX, cellMinY, cellMaxX, cellMaxY;
+			uint32_t	stamp;		// last query that visited it
+			uint32_t	drawnFrame;
+		};
+		std::unordered_map<uint64_t, std::vector<Entity*>>	cells;
+		std::unordered_map<Entity*, Item>					items;
+		uint32_t											queryStamp = 0;
+		uint32_t											frame = 1;
+
+		static uint64_t cellKey(int x, int y);
+		void insertCells(Entity *entity, const Item &item);
+		void removeCells(Entity *entity, const Item &item);
+	};
+}
@@ -1,6 +1,7 @@
 #include "Sprite.h"
 #include "ErrorAndLog.h"
 #include <cstdarg>
+#include <algorithm>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb-master/stb_image.h>
 
@@ -8,23 +9,16 @@ namespace vm {
 	std::vector<Sprite*> Sprite::sprites{};
 	Sprite::Sprite(Rect _rect, std::vector<std::string> imagePathNames)
 	{
-		ResourceManager &rm = ResourceManager::getInstance();
-		static unsigned int spriteNumber = 0;		// every sprite has a unique ID
-		spriteID = spriteNumber++;
-
 		vBuffInfo.usage = vk::BufferUsageFlagBits::eVertexBuffer;
-		vBuffInfo.size = sizeof(Vertex) * 4;
-		vBuffInfo.offset = spriteID * vBuffInfo.size;
+		vBuffInfo.size = sizeof(SpriteVertex) * 4;
 
 		iBuffInfo.usage = vk::BufferUsageFlagBits::eIndexBuffer;
 		iBuffInfo.size = sizeof(uint32_t) * 6;
-		iBuffInfo.offset = spriteID * iBuffInfo.size;
+		iBuffInfo.offset = 0; // every quad has the same indices
 
 		uBuffInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer;
 		uBuffInfo.size = sizeof(UniformBufferObject);
-		if (uBuffInfo.size < rm.getGpuProperties().limits.minUniformBufferOffsetAlignment)
-			uBuffInfo.size = rm.getGpuProperties().limits.minUniformBufferOffsetAlignment;
-		uBuffInfo.offset = spriteID * uBuffInfo.size;
+		uBuffInfo.offset = 0; // allocated every frame from the frame allocator
 
 		isSpriteMapped = false;
 		needsUpdate = false;
@@ -43,20 +37,37 @@ namespace vm {
 		w = _rect.size.x;
 		h = _rect.size.y;
 		vertices = {
-			{ { -w, -h, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 1.0f } },
-			{ {  w, -h, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 1.0f, 1.0f } },
-			{ {  w,  h, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f } },
-			{ { -w,  h, 0.0f },{ 1.0f, 1.0f, 1.0f },{ 0.0f, 0.0f } }
+			SpriteVertex({ -w, -h }, packUnorm16({ 0.0f, 1.0f })),
+			SpriteVertex({  w, -h }, packUnorm16({ 1.0f, 1.0f })),
+			SpriteVertex({  w,  h }, packUnorm16({ 1.0f, 0.0f })),
+			SpriteVertex({ -w,  h }, packUnorm16({ 0.0f, 0.0f }))
 		};
 		indices = { 0, 1, 2, 2, 3, 0 };
 		rect = _rect;
 
 		setTextures(imagePathNames);
 
+		// the quad in a free slot of the vertex buffer, every live sprite has a unique ID
+		ResourceManager &rm = ResourceManager::getInstance();
+		spriteID = rm.spriteStorage.allocate(vertices.data());
+		vBuffInfo.offset = spriteID * vBuffInfo.size;
+
 		descriptorSet = nullptr;
+		// created after the scene was pushed, the pools are there already
+		if (rm.descriptorAllocator.isCreated())
+			createDescriptorSets();
 
+		spritesIndex = Sprite::sprites.size();
 		Sprite::sprites.push_back(this);
 	}
+	Sprite::~Sprite()
+	{
+		// the textures and dSets are shared, only the slot and the place in the list are freed
+		ResourceManager::getInstance().spriteStorage.free(spriteID);
+		Sprite::sprites[spritesIndex] = Sprite::sprites.back();
+		Sprite::sprites[spritesIndex]->spritesIndex = spritesIndex;
+		Sprite::sprites.pop_back();
+	}
 	Rect Sprite::getRect() const
 	{
 		return rect;
@@ -104,14 +115,21 @@ namespace vm {
 			num--;
 		}
 	}
-	void Sprite::setPointerToUniformBufferMem(vk::DeviceMemory& uniformBufferMem)
+	uint32_t Sprite::getTextureIndex() const
 	{
-		ResourceManager &rm = ResourceManager::getInstance();
-		// just get the pointer to the spritesUniformBufferMem offset for this sprite
-		rm.getDevice().mapMemory(uniformBufferMem, uBuffInfo.offset, uBuffInfo.size, vk::MemoryMapFlags(), &_uniformMemory);
-		rm.getDevice().unmapMemory(uniformBufferMem);
+		return getActiveTexture().index;
+	}
+	bool Sprite::isOpaque() const
+	{
+		return getActiveTexture().opaque;
+	}
+	const Texture& Sprite::getActiveTexture() const
+	{
+		// descriptorSets and textures are in the same order
+		if (!descriptorSet || descriptorSets.empty())
+			return textures[0];
+		return textures[descriptorSet - descriptorSets.data()];
 	}
-
 	void Sprite::setTextures(const std::vector<std::string>& imagePathNames)
 	{
 		textures.clear();
@@ -142,89 +160,69 @@ namespace vm {
 	{
 		if (!needsUpdate)
 			return;
-		// DYNAMIC
-		if (type == SpriteType::userDefinedRect)
-		{
-			ResourceManager &rm = ResourceManager::getInstance();
-			if (!_uniformMemory) {
-				LOG("Uniform Buffer Memory of Sprite: " << spriteID << " is not mapped\n");
-				return;
-			}
-			memcpy(_uniformMemory, &ubo, uBuffInfo.size);
-		}
-		// STATIC   // TODO needs rework
-		else if (type == SpriteType::userDefinedRectStatic) {
-			ResourceManager &rm = ResourceManager::getInstance();
-			vk::Buffer stagingBuffer;
-			vk::DeviceMemory stagingBufferMemory;
-			helper.createBuffer(rm.getGpu(), rm.getDevice(), uBuffInfo.size,
-				vk::BufferUsageFlagBits::eTransferSrc,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, // eHostCoherent means no cache and there is no need flushing the memory
-				stagingBuffer, stagingBufferMemory);
-
-			rm.getDevice().mapMemory(stagingBufferMemory, vk::DeviceSize(), uBuffInfo.size, vk::MemoryMapFlags(), &_uniformMemory);
-			memcpy(_uniformMemory, &ubo, uBuffInfo.size);
-			rm.getDevice().unmapMemory(stagingBufferMemory);
-
-			helper.copyBuffer(rm.getDevice(), rm.getCommandPool(), rm.getGraphicsQueue(), &stagingBuffer, &rm.spritesUniformBuffer, &uBuffInfo.size);
-			isSpriteMapped = false;
-
-			helper.destroyBuffer(rm.getDevice(), stagingBuffer, stagingBufferMemory);
-			LOG("Updating static object has a critical drop on frames/sec. Not wise...\n");
-		}
-		else {
-			LOG("Unsupported sprite type\n");
-			exit(-1);
-		}
+		// nothing to upload here, the renderer copies the ubo of every drawn sprite
+		// in the per frame uniform allocator while recording
 		needsUpdate = false;
 	}
-	void Sprite::createDescriptorSets(const vk::DescriptorPool &descriptorPool)
+	void Sprite::createDescriptorSets()
 	{
 		// clear the dSets
 		descriptorSets.clear();
 
 		for (auto &t : textures) {
-			// push a new dSet in vector
-			descriptorSets.push_back(vk::DescriptorSet());
-
 			ResourceManager &rm = ResourceManager::getInstance();
-			if (!rm.spritesUniformBuffer) exit(-1);
-
-			auto const allocateInfo = vk::DescriptorSetAllocateInfo()
-				.setDescriptorPool(descriptorPool)
-				.setDescriptorSetCount(1)
-				.setPSetLayouts(&rm.spritesDescriptorSetLayout);
-			errCheck(rm.getDevice().allocateDescriptorSets(&allocateInfo, &descriptorSets.back()));
+			if (!rm.frameAllocator.getBuffer()) exit(-1);
+
+			// the uniform range is the same for every sprite (the offset is dynamic),
+			// so sprites with the same texture (or atlas page) can share one dSet and be drawn in one batch
+			const std::string &imageName = t.atlasPage.empty() ? t.name : t.atlasPage;
+			auto shared = rm.textureDescriptorSets.find(imageName);
+			if (shared != rm.textureDescriptorSets.end()) {
+				descriptorSets.push_back(shared->second);
+				continue;
+			}
 
-			vk::WriteDescriptorSet writeDset[2];
-			//----------for mvp-----------
-			writeDset[0] = vk::WriteDescriptorSet()
-				.setDstSet(descriptorSets.back())										//descriptor set
-				.setDstBinding(0)												//binding number in shader
-				.setDstArrayElement(0)											//start element in array
-				.setDescriptorType(vk::DescriptorType::eUniformBufferDynamic)	//descriptor type
-				.setDescriptorCount(1)											//descriptor count
-				.setPBufferInfo(&vk::DescriptorBufferInfo()
-					.setBuffer(rm.spritesUniformBuffer)								//buffer
-					.setOffset(0)													//buffer offset
-					.setRange(uBuffInfo.size));										//buffer size	
-			//----------for textures-------
-			writeDset[1] = vk::WriteDescriptorSet()
-				.setDstSet(descriptorSets.back())										//descriptor set
-				.setDstBinding(1)												//binding number in shader
-				.setDstArrayElement(0)											//start element in array
-				.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)	//descriptor type
-				.setDescriptorCount(1)											//descriptor count
-				.setPImageInfo(&vk::DescriptorImageInfo()
-					.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-					.setImageView(t.imageView)
-					.setSampler(rm.spriteSampler));
-			// update DescriptorSets
-			rm.getDevice().updateDescriptorSets(2, writeDset, 0, nullptr);
+			descriptorSets.push_back(createTextureDescriptorSet(t));
+			rm.textureDescriptorSets[imageName] = descriptorSets.back();
 		}
 		descriptorSet = &descriptorSets.back();
 	}
 
+	vk::DescriptorSet Sprite::createTextureDescriptorSet(const Texture &texture)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		vk::DescriptorSet dSet = rm.descriptorAllocator.allocate(rm.spritesDescriptorSetLayout, {
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eUniformBufferDynamic).setDescriptorCount(1),
+			vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(1) });
+
+		vk::WriteDescriptorSet writeDset[2];
+		//----------for mvp-----------
+		writeDset[0] = vk::WriteDescriptorSet()
+			.setDstSet(dSet)												//descriptor set
+			.setDstBinding(0)												//binding number in shader
+			.setDstArrayElement(0)											//start element in array
+			.setDescriptorType(vk::DescriptorType::eUniformBufferDynamic)	//descriptor type
+			.setDescriptorCount(1)											//descriptor count
+			.setPBufferInfo(&vk::DescriptorBufferInfo()
+				.setBuffer(rm.frameAllocator.getBuffer())						//buffer
+				.setOffset(0)													//buffer offset
+				.setRange(sizeof(UniformBufferObject)));						//buffer size
+		//----------for textures-------
+		writeDset[1] = vk::WriteDescriptorSet()
+			.setDstSet(dSet)												//descriptor set
+			.setDstBinding(1)												//binding number in shader
+			.setDstArrayElement(0)											//start element in array
+			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)	//descriptor type
+			.setDescriptorCount(1)											//descriptor count
+			.setPImageInfo(&vk::DescriptorImageInfo()
+				.setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+				.setImageView(texture.imageView)
+				.setSampler(rm.spriteSampler));
+		// update DescriptorSets
+		rm.getDevice().updateDescriptorSets(2, writeDset, 0, nullptr);
+		return dSet;
+	}
+
 	Texture Sprite::createNewTexture(std::string imagePath)
 	{
 		ResourceManager &rm = ResourceManager::getInstance();
@@ -237,40 +235,47 @@ namespace vm {
 
 		Texture &tex = rm.textures[imagePath];
 		tex.name = imagePath;
+		tex.index = static_cast<uint32_t>(rm.textures.size() - 1);
 
-		int texWidth, texHeight, texChannels;
-		stbi_set_flip_vertically_on_load(true);
-		stbi_uc* pixels = stbi_load(imagePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		vk::DeviceSize imageSize = texWidth * texHeight * 4;
+		int texWidth, texHeight;
 
-		if (!pixels) {
-			throw std::runtime_error("failed to load texture image!");
+		// only the header is read here, the streaming threads load the rest, the sprite shows the placeholder until then
+		if (rm.textureStreamer.isEnabled()) {
+			if (!rm.assetArchive.getImageSize(imagePath, texWidth, texHeight)) {
+				throw std::runtime_error("failed to load texture image!");
+			}
+			const bool atlas = rm.textureAtlas.accepts(texWidth, texHeight);
+			if (!atlas)
+				tex.residencyId = rm.textureResidency.add(imagePath);
+			rm.textureStreamer.request(tex, atlas);
+			return tex;
 		}
 
-		vk::Buffer stagingBuffer;
-		vk::DeviceMemory stagingBufferMemory;
-		helper.createBuffer(rm.getGpu(), rm.getDevice(), imageSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-		void* data;
-		vkMapMemory(rm.getDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, static_cast<size_t>(imageSize));
-		vkUnmapMemory(rm.getDevice(), stagingBufferMemory);
-
-		stbi_image_free(pixels);
-
-		helper.createImage(rm.getGpu(), rm.getDevice(), texWidth, texHeight, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-			vk::MemoryPropertyFlagBits::eDeviceLocal, tex.image, tex.imageMem);
-
-		helper.transitionImageLayout(rm.getDevice(), rm.getCommandPool(), rm.getGraphicsQueue(), tex.image, vk::ImageLayout::ePreinitialized, vk::ImageLayout::eTransferDstOptimal);
-		helper.copyBufferToImage(rm.getDevice(), rm.getCommandPool(), rm.getGraphicsQueue(), stagingBuffer, tex.image, 0, 0, texWidth, texHeight);
-		helper.transitionImageLayout(rm.getDevice(), rm.getCommandPool(), rm.getGraphicsQueue(), tex.image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+		// the ones with an image of their own come cooked, compressed and mipped, nothing to decode
+		if (rm.textureCooker.isAvailable() && rm.assetArchive.getImageSize(imagePath, texWidth, texHeight) && !rm.textureAtlas.accepts(texWidth, texHeight)) {
+			CookedTexture cooked;
+			if (rm.textureCooker.load(imagePath, cooked)) {
+				const vk::DeviceSize bytes = TextureStreamer::createTexture(tex, cooked);
+				tex.residencyId = rm.textureResidency.add(imagePath);
+				rm.textureResidency.loaded(tex.residencyId, bytes, cooked.width, cooked.height, 0);
+				return tex;
+			}
+		}
 
-		rm.getDevice().destroyBuffer(stagingBuffer);
-		rm.getDevice().freeMemory(stagingBufferMemory);
+		// premultiplied, from the archive or decoded
+		stbi_set_flip_vertically_on_load(true);
+		AssetImage image;
+		if (!rm.assetArchive.loadImage(imagePath, image)) {
+			throw std::runtime_error("failed to load texture image!");
+		}
 
-		// create texture image view ------------------------------------
-		helper.createImageView(rm.getDevice(), tex.image, vk::Format::eR8G8B8A8Unorm, tex.imageView);
+		// small images wait for the atlas to be packed (Renderer::createTextureAtlas), no image of their own
+		if (!rm.textureAtlas.add(imagePath, image.data(), image.width, image.height)) {
+			const vk::DeviceSize bytes = TextureStreamer::createTexture(tex, image.data(), image.width, image.height);
+			tex.residencyId = rm.textureResidency.add(imagePath);
+			rm.textureResidency.loaded(tex.residencyId, bytes, image.width, image.height, 0);
+		}
 
 		return tex;
 	}
-}
\ No newline at end of file
+}
@@ -13,6 +13,7 @@ namespace vm {
 
 	struct UniformBufferObject {
 		glm::mat4 model;
+		glm::vec4 uvRect;	// sub-rectangle of the active texture in its (atlas) image
 	};
 
 	class Sprite
@@ -22,16 +23,23 @@ namespace vm {
 		static std::vector<Sprite*>			sprites;
 
 
+		// can be created and deleted at any time, the renderer picks the new ones up in the next frame
 		Sprite(Rect _rect, std::vector<std::string> imagePathNames = {""});
+		~Sprite();
 		Rect getRect() const;
 		void setModelPos(glm::mat4 modelPos);
 		bool isMapped() const;
 		SpriteType getSpriteType() const;
-		unsigned int getSpriteID() const;
+		unsigned int getSpriteID() const; // its slot in the sprite storage, reused after the sprite is deleted
 
 		// a dSet also contains the imageView data of a texture, assign an other one in a dynamic cmdBuffer can change the texture of the sprite
 		void setActiveDescriptorSet(unsigned int num);
 		void acquireNextImage(uint32_t start, uint32_t end);
+		uint32_t getTextureIndex() const; // texture array slot of the active texture
+		bool isOpaque() const; // the active texture has no transparent texel
+		const Texture& getActiveTexture() const;
+		// a dSet of the sprite layout for the texture (with the frame allocator's uniforms), shared by its sprites
+		static vk::DescriptorSet createTextureDescriptorSet(const Texture &texture);
 
 		void update();
 
@@ -39,16 +47,16 @@ namespace vm {
 		vk::DescriptorSet				*descriptorSet;		// the active descriptorSet pointer from the list
 		std::vector<vk::DescriptorSet>	descriptorSets{};
 		std::vector<Texture>			textures{};
-		void							*_uniformMemory;	// pointer to uniform data memory
-		UniformBufferObject				ubo{};
+		UniformBufferObject				ubo{};				// copied in the frame allocator every frame the sprite is drawn
 		SpriteType						type;
 		bool							isSpriteMapped;
 		unsigned int					spriteID;
+		size_t							spritesIndex;		// position in Sprite::sprites
 		Helper							helper;
 		Rect							rect;
-		bool							needsUpdate;		//this sprite needs to be updated (changes to uniform buffer mem)
+		bool							needsUpdate;		//this sprite needs to be updated (changes to the ubo)
 
-		std::vector<Vertex>				vertices;
+		std::vector<SpriteVertex>		vertices;
 		std::vector<uint32_t>			indices;
 
 		BufferInfo						vBuffInfo;
@@ -59,8 +67,6 @@ namespace vm {
 		void setTextures(const std::vector<Texture>& textures);
 		Texture createNewTexture(std::string imagePath);
 
-		void createDescriptorSets(const vk::DescriptorPool &descriptorPool);
-		// only for shared uniform buffers to speed up things
-		void setPointerToUniformBufferMem(vk::DeviceMemory& uniformBufferMem);
+		void createDescriptorSets();
 	};
 }
\ No newline at end of file
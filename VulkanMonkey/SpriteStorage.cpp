@@ -0,0 +1,186 @@
+#include "SpriteStorage.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+
+#define QUAD_SIZE (sizeof(SpriteVertex) * 4)
+#define MAX_UPDATE_SIZE 65536	// vkCmdUpdateBuffer limit
+
+namespace vm {
+	void SpriteStorage::create(vk::PhysicalDevice gpu, vk::Device device)
+	{
+		this->gpu = gpu;
+		this->device = device;
+		if (vertices.empty())
+			addUnitQuad();
+
+		capacity = SPRITE_STORAGE_MIN_SLOTS;
+		while (capacity < slotCount)
+			capacity *= 2;
+		vk::DeviceSize size = capacity * QUAD_SIZE;
+		helper.createBuffer(gpu, device, size,
+			vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, memory);
+
+		// staged and copied with the rest of the uploads
+		ResourceManager::getInstance().uploadContext.uploadBuffer(vertices.data(), slotCount * QUAD_SIZE, buffer, vk::AccessFlagBits::eVertexAttributeRead, vk::PipelineStageFlagBits::eVertexInput);
+		dirtySlots.clear();
+		created = true;
+	}
+
+	void SpriteStorage::destroy()
+	{
+		for (auto &r : retired)
+			helper.destroyBuffer(device, r.buffer, r.memory);
+		retired.clear();
+		if (buffer)
+			helper.destroyBuffer(device, buffer, memory);
+		buffer = nullptr;
+		copySrc = nullptr;
+		copySize = 0;
+		capacity = 0;
+		created = false;
+	}
+
+	bool SpriteStorage::isCreated() const
+	{
+		return created;
+	}
+
+	void SpriteStorage::addUnitQuad()
+	{
+		// slot 0, scaled by the model matrix of the instances
+		vertices.push_back(SpriteVertex({ -1.0f, -1.0f }, packUnorm16({ 0.0f, 1.0f })));
+		vertices.push_back(SpriteVertex({  1.0f, -1.0f }, packUnorm16({ 1.0f, 1.0f })));
+		vertices.push_back(SpriteVertex({  1.0f,  1.0f }, packUnorm16({ 1.0f, 0.0f })));
+		vertices.push_back(SpriteVertex({ -1.0f,  1.0f }, packUnorm16({ 0.0f, 0.0f })));
+		slotCount = 1;
+	}
+
+	uint32_t SpriteStorage::allocate(const SpriteVertex *quad)
+	{
+		if (vertices.empty())
+			addUnitQuad();
+
+		uint32_t slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			slot = static_cast<uint32_t>(vertices.size() / 4);
+			vertices.resize(vertices.size() + 4);
+		}
+		std::copy(quad, quad + 4, vertices.begin() + slot * 4);
+		++slotCount;
+		if (created)
+			dirtySlots.push_back(slot);
+		return slot;
+	}
+
+	void SpriteStorage::free(uint32_t slot)
+	{
+		if (slot == 0 || slot * 4 >= vertices.size())
+			return;
+		freeSlots.push_back(slot);
+		--slotCount;
+	}
+
+	void SpriteStorage::update(uint64_t frameNumber, uint32_t framesInFlight)
+	{
+		// the fence of frame (frameNumber - framesInFlight) is waited, the frames before it are done too
+		for (auto it = retired.begin(); it != retired.end();) {
+			if (frameNumber < it->frameNumber + framesInFlight) {
+				++it;
+				continue;
+			}
+			helper.destroyBuffer(device, it->buffer, it->memory);
+			it = retired.erase(it);
+		}
+
+		const uint32_t needed = static_cast<uint32_t>(vertices.size() / 4);
+		if (!created || needed <= capacity)
+			return;
+
+		// twice as big, the old contents are copied on the gpu by this frame, then it is retired
+		uint32_t newCapacity = capacity;
+		while (newCapacity < needed)
+			newCapacity *= 2;
+		vk::Buffer newBuffer;
+		vk::DeviceMemory newMemory;
+		vk::DeviceSize size = newCapacity * QUAD_SIZE;
+		helper.createBuffer(gpu, device, size,
+			vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, newBuffer, newMemory);
+
+		copySrc = buffer;
+		copySize = capacity * QUAD_SIZE;
+		retired.push_back({ buffer, memory, frameNumber });
+		buffer = newBuffer;
+		memory = newMemory;
+		capacity = newCapacity;
+		++growCount;
+	}
+
+	void SpriteStorage::record(vk::CommandBuffer cmd)
+	{
+		if (!created || (!copySize && dirtySlots.empty()))
+			return;
+
+		// the frames before may still draw from a slot that is rewritten (its sprite was destroyed)
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 0, nullptr);
+
+		if (copySize) {
+			auto const region = vk::BufferCopy().setSrcOffset(0).setDstOffset(0).setSize(copySize);
+			cmd.copyBuffer(copySrc, buffer, 1, &region);
+			copySrc = nullptr;
+			copySize = 0;
+
+			// reused slots are written over the copy
+			auto const copyBarrier = vk::MemoryBarrier()
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+			if (!dirtySlots.empty())
+				cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), 1, &copyBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		// runs of consecutive slots in one update each
+		std::sort(dirtySlots.begin(), dirtySlots.end());
+		dirtySlots.erase(std::unique(dirtySlots.begin(), dirtySlots.end()), dirtySlots.end());
+		const uint32_t maxRun = static_cast<uint32_t>(MAX_UPDATE_SIZE / QUAD_SIZE);
+		for (size_t i = 0; i < dirtySlots.size();) {
+			const uint32_t first = dirtySlots[i];
+			uint32_t count = 1;
+			while (i + count < dirtySlots.size() && dirtySlots[i + count] == first + count && count < maxRun)
+				++count;
+			cmd.updateBuffer(buffer, first * QUAD_SIZE, count * QUAD_SIZE, &vertices[first * 4]);
+			i += count;
+		}
+		dirtySlots.clear();
+
+		auto const barrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eVertexAttributeRead);
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags(), 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	vk::Buffer SpriteStorage::getVertexBuffer() const
+	{
+		return buffer;
+	}
+
+	uint32_t SpriteStorage::getSlotCount() const
+	{
+		return slotCount;
+	}
+
+	uint32_t SpriteStorage::getCapacity() const
+	{
+		return capacity;
+	}
+
+	uint32_t SpriteStorage::getGrowCount() const
+	{
+		return growCount;
+	}
+}
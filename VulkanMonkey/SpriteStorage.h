@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+#include "Vertex.h"
+
+#define SPRITE_STORAGE_MIN_SLOTS 256	// slots of the first buffer, it doubles from there
+
+namespace vm {
+	// The quads of all the sprites in one device local vertex buffer, a slot of 4 vertices per sprite.
+	// Slot 0 is the unit quad of the instanced draws. A destroyed sprite's slot goes to a free list and
+	// is handed out again first; when none is free the buffer doubles, the old one is copied into it on the
+	// gpu in the next frame's command buffer and destroyed once no frame in flight reads it.
+	// The vertices of the slots allocated after create are written with vkCmdUpdateBuffer in that frame too,
+	// so spawning a sprite costs no staging buffer, submit or fence.
+	class SpriteStorage
+	{
+	public:
+		// the buffer for the slots allocated so far, their vertices go with the upload context
+		void create(vk::PhysicalDevice gpu, vk::Device device);
+		void destroy();
+		bool isCreated() const;
+
+		// 4 vertices, returns the slot (its first vertex is slot * 4), on the gpu after the next record
+		uint32_t allocate(const SpriteVertex *quad);
+		void free(uint32_t slot);
+
+		// before recording a frame whose fence is waited: grows the buffer if the slots outgrew it
+		// and destroys the old buffers the frames in flight are done with
+		void update(uint64_t frameNumber, uint32_t framesInFlight);
+		// outside of a render pass, before the draws: the copy of a grown buffer and the new slots
+		void record(vk::CommandBuffer cmd);
+
+		vk::Buffer getVertexBuffer() const;
+		uint32_t getSlotCount() const;		// in use, the unit quad included
+		uint32_t getCapacity() const;		// slots of the buffer
+		uint32_t getGrowCount() const;
+
+	private:
+		struct RetiredBuffer
+		{
+			vk::Buffer			buffer;
+			vk::DeviceMemory	memory;
+			uint64_t			frameNumber;	// the last frame reading it
+		};
+		vk::PhysicalDevice			gpu;
+		vk::Device					device;
+		vk::Buffer					buffer;
+		vk::DeviceMemory			memory;
+		uint32_t					capacity = 0;
+		bool						created = false;
+
+		// the buffer before the last growth, copied in the next record
+		vk::Buffer					copySrc;
+		vk::DeviceSize				copySize = 0;
+		std::vector<RetiredBuffer>	retired{};
+
+		std::vector<SpriteVertex>	vertices{};		// cpu copy of every slot, 4 per slot
+		std::vector<uint32_t>		freeSlots{};
+		std::vector<uint32_t>		dirtySlots{};	// written since the last record
+		uint32_t					slotCount = 0;
+		uint32_t					growCount = 0;
+		Helper						helper;
+
+		void addUnitQuad();
+	};
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "Vulkan_.h"
+#include "glm_.h"
 
 namespace vm {
 	struct Texture {
@@ -7,6 +8,13 @@ namespace vm {
 		vk::DeviceMemory		imageMem;
 		vk::ImageView			imageView;
 		std::string				name;
+		uint32_t				index = 0;			// slot in the texture array, shared by the textures of an atlas page
+		glm::vec4				uvRect{ 0.f, 0.f, 1.f, 1.f };	// xy offset, zw scale of the texture in its image
+		std::string				atlasPage;			// name of the atlas page holding the texture, empty if it has its own image
+		uint32_t				mipLevels = 1;		// of its own image, the atlas pages have none
+		bool					resident = true;	// false: streamed and not loaded yet (or evicted), the image is the placeholder's
+		uint32_t				residencyId = 0;	// in the TextureResidency, 0: never evicted (the atlas and its textures)
+		bool					opaque = false;		// every texel has alpha 1, sorted before the blended ones (RenderQueue)
 	};
 }
 
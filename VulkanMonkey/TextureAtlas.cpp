@@ -0,0 +1,140 @@
+#include "TextureAtlas.h"
+#include "TextureCooker.h"
+#include <chrono>
+#include <cstring>
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <stb-master/stb_rect_pack.h>
+
+namespace vm {
+	bool TextureAtlas::add(const std::string &name, const unsigned char *pixels, int width, int height)
+	{
+		if (!accepts(width, height))
+			return false;
+		Entry &entry = entries[name];
+		entry.width = width;
+		entry.height = height;
+		entry.pixels.assign(pixels, pixels + width * height * 4);
+		entry.opaque = TextureCooker::isOpaque(pixels, width * height);
+		return true;
+	}
+
+	bool TextureAtlas::accepts(int width, int height) const
+	{
+		return !packed && width <= ATLAS_MAX_IMAGE_SIZE && height <= ATLAS_MAX_IMAGE_SIZE;
+	}
+
+	void TextureAtlas::pack()
+	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		std::vector<stbrp_rect> rects;
+		std::vector<Entry*> rectEntries;
+		for (auto &e : entries) {
+			stbrp_rect r{};
+			r.id = static_cast<int>(rects.size());
+			r.w = e.second.width + 2 * ATLAS_PADDING;
+			r.h = e.second.height + 2 * ATLAS_PADDING;
+			rects.push_back(r);
+			rectEntries.push_back(&e.second);
+		}
+
+		// fill a page, the images that did not fit go to the next one
+		std::vector<stbrp_node> nodes(ATLAS_PAGE_SIZE);
+		pageCount = 0;
+		while (!rects.empty()) {
+			stbrp_context context;
+			stbrp_init_target(&context, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, nodes.data(), static_cast<int>(nodes.size()));
+			stbrp_pack_rects(&context, rects.data(), static_cast<int>(rects.size()));
+
+			std::vector<stbrp_rect> remaining;
+			for (auto &r : rects) {
+				if (!r.was_packed) {
+					remaining.push_back(r);
+					continue;
+				}
+				Entry *entry = rectEntries[r.id];
+				entry->page = pageCount;
+				entry->x = r.x + ATLAS_PADDING;
+				entry->y = r.y + ATLAS_PADDING;
+			}
+			++pageCount;
+			rects.swap(remaining);
+		}
+		packed = true;
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		packTime = time.count();
+	}
+
+	bool TextureAtlas::isPacked() const
+	{
+		return packed;
+	}
+
+	bool TextureAtlas::contains(const std::string &name) const
+	{
+		return entries.find(name) != entries.end();
+	}
+
+	uint32_t TextureAtlas::getPageCount() const
+	{
+		return pageCount;
+	}
+
+	std::vector<unsigned char> TextureAtlas::getPagePixels(uint32_t page) const
+	{
+		const size_t rowSize = ATLAS_PAGE_SIZE * 4;
+		std::vector<unsigned char> pagePixels(rowSize * ATLAS_PAGE_SIZE, 0);
+		for (auto &e : entries) {
+			const Entry &entry = e.second;
+			if (entry.page != page)
+				continue;
+			// the padding rows and columns repeat the edge pixels (clamped source coordinates)
+			for (int y = -ATLAS_PADDING; y < entry.height + ATLAS_PADDING; ++y) {
+				int srcY = y < 0 ? 0 : (y >= entry.height ? entry.height - 1 : y);
+				const unsigned char *srcRow = entry.pixels.data() + srcY * entry.width * 4;
+				unsigned char *dstRow = pagePixels.data() + (entry.y + y) * rowSize + entry.x * 4;
+				memcpy(dstRow, srcRow, entry.width * 4);
+				for (int p = 1; p <= ATLAS_PADDING; ++p) {
+					memcpy(dstRow - p * 4, srcRow, 4);
+					memcpy(dstRow + (entry.width - 1 + p) * 4, srcRow + (entry.width - 1) * 4, 4);
+				}
+			}
+		}
+		return pagePixels;
+	}
+
+	uint32_t TextureAtlas::getPage(const std::string &name) const
+	{
+		auto it = entries.find(name);
+		return it != entries.end() ? it->second.page : 0;
+	}
+
+	glm::vec4 TextureAtlas::getUVRect(const std::string &name) const
+	{
+		auto it = entries.find(name);
+		if (it == entries.end())
+			return glm::vec4(0.f, 0.f, 1.f, 1.f);
+		const float size = static_cast<float>(ATLAS_PAGE_SIZE);
+		return glm::vec4(it->second.x / size, it->second.y / size, it->second.width / size, it->second.height / size);
+	}
+
+	bool TextureAtlas::isOpaque(const std::string &name) const
+	{
+		auto it = entries.find(name);
+		return it != entries.end() && it->second.opaque;
+	}
+
+	double TextureAtlas::getPackTime() const
+	{
+		return packTime;
+	}
+
+	void TextureAtlas::clear()
+	{
+		for (auto &e : entries) {
+			e.second.pixels.clear();
+			e.second.pixels.shrink_to_fit();
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "glm_.h"
+
+#define ATLAS_PAGE_SIZE 2048
+#define ATLAS_MAX_IMAGE_SIZE 512	// bigger images keep their own texture
+#define ATLAS_PADDING 1				// edge pixels repeated around every image, so linear filtering does not bleed
+
+namespace vm {
+	// Packs small rgba8 images in shared pages with stb_rect_pack.
+	// Cpu only, the renderer creates the page textures from getPagePixels after pack().
+	class TextureAtlas
+	{
+	public:
+		// false if the image is too big for the atlas (or it is already packed), the pixels are copied
+		bool add(const std::string &name, const unsigned char *pixels, int width, int height);
+		bool accepts(int width, int height) const; // small enough and not packed yet
+		void pack();
+		bool isPacked() const;
+		bool contains(const std::string &name) const;
+
+		uint32_t getPageCount() const;
+		std::vector<unsigned char> getPagePixels(uint32_t page) const; // ATLAS_PAGE_SIZE^2 rgba8
+		uint32_t getPage(const std::string &name) const;
+		glm::vec4 getUVRect(const std::string &name) const; // xy offset, zw scale, in page uv space
+		bool isOpaque(const std::string &name) const; // no transparent texel in its image
+		double getPackTime() const; // ms
+		void clear(); // frees the cpu copies of the pixels
+
+	private:
+		struct Entry
+		{
+			int							width;
+			int							height;
+			std::vector<unsigned char>	pixels;
+			bool						opaque = false;
+			uint32_t					page = 0;
+			int							x = 0;		// top left of the image in the page, padding excluded
+			int							y = 0;
+		};
+		std::map<std::string, Entry>	entries;
+		uint32_t						pageCount = 0;
+		bool							packed = false;
+		double							packTime = 0.0;
+	};
+}
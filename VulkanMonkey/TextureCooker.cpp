@@ -0,0 +1,273 @@
+#include "TextureCooker.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stb-master/stb_image.h>
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb-master/stb_image_resize.h>
+#define STB_DXT_IMPLEMENTATION
+#define STBD_MEMSET memset // the default one of this stb_dxt takes a single argument
+#include <stb-master/stb_dxt.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+namespace vm {
+	// the start of every cooked file, the blocks follow
+	struct CookedHeader
+	{
+		char		magic[4];		// VMTX
+		uint32_t	version;
+		uint64_t	sourceHash;		// of the source file's bytes
+		uint32_t	width;
+		uint32_t	height;
+		uint32_t	mipLevels;
+		uint32_t	format;			// VkFormat
+		uint64_t	dataSize;
+	};
+
+	static uint64_t hashBytes(const std::vector<unsigned char> &bytes)
+	{
+		uint64_t h = 14695981039346656037ull; // fnv-1a
+		for (unsigned char b : bytes)
+			h = (h ^ b) * 1099511628211ull;
+		return h;
+	}
+
+	static std::string cookedPath(uint64_t sourceHash)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(sourceHash));
+		return std::string(COOKED_TEXTURE_DIR) + "/" + name + ".vmtex";
+	}
+
+	void TextureCooker::create(vk::PhysicalDevice gpu)
+	{
+		const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+		available = gpu.getFeatures().textureCompressionBC &&
+			(gpu.getFormatProperties(vk::Format::eBc1RgbUnormBlock).optimalTilingFeatures & needed) == needed &&
+			(gpu.getFormatProperties(vk::Format::eBc3UnormBlock).optimalTilingFeatures & needed) == needed;
+		if (!available) {
+			LOG("No bc texture compression, the textures are uploaded as rgba8\n");
+		}
+	}
+
+	bool TextureCooker::isAvailable() const
+	{
+		return available && enabled;
+	}
+
+	void TextureCooker::setEnabled(bool enabled)
+	{
+		this->enabled = enabled;
+	}
+
+	bool TextureCooker::load(const std::string &sourcePath, CookedTexture &cooked)
+	{
+		auto const startTime = std::chrono::high_resolution_clock::now();
+
+		// packed cooked already, read where it is in the archive
+		if (!ResourceManager::getInstance().assetArchive.loadCooked(sourcePath, cooked)) {
+			// the source is read to hash it, it is only decoded when it has to be cooked
+			std::ifstream file(sourcePath, std::ios::binary);
+			if (!file.good())
+				return false;
+			const std::vector<unsigned char> source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			const uint64_t sourceHash = hashBytes(source);
+			const std::string path = cookedPath(sourceHash);
+
+			if (!readCooked(path, sourceHash, cooked)) {
+				auto const cookStart = std::chrono::high_resolution_clock::now();
+				if (!cook(source, cooked))
+					return false;
+				std::lock_guard<std::mutex> lock(mutex);
+				writeCooked(path, sourceHash, cooked);
+				std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - cookStart;
+				cookTime += time.count();
+				++cookCount;
+				LOG("Cooked " << sourcePath.c_str() << " to " << path.c_str() << " (" << cooked.width << "x" << cooked.height << ", " << (cooked.format == vk::Format::eBc1RgbUnormBlock ? "bc1" : "bc3") << ", " << time.count() << " ms)\n");
+			}
+		}
+
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		std::lock_guard<std::mutex> lock(mutex);
+		loadTime += time.count();
+		++loadCount;
+		cookedBytes += cooked.blockBytes();
+		for (uint32_t i = 0; i < cooked.mipLevels; i++)
+			uncompressedBytes += helper.mipLevelSize(vk::Format::eR8G8B8A8Unorm, cooked.width, cooked.height, i);
+		return true;
+	}
+
+	bool TextureCooker::cook(const std::vector<unsigned char> &source, CookedTexture &cooked) const
+	{
+		int width, height, channels;
+		stbi_set_flip_vertically_on_load(true);
+		stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+			return false;
+
+		premultiplyAlpha(pixels, width * height);
+		std::vector<unsigned char> chain;
+		const uint32_t mipLevels = helper.mipLevelCount(width, height);
+		createMipChain(pixels, width, height, mipLevels, chain);
+		stbi_image_free(pixels);
+
+		// bc1 has no alpha, half the size of bc3
+		const bool opaque = isOpaque(chain.data(), chain.size() / 4);
+		cooked.width = width;
+		cooked.height = height;
+		cooked.mipLevels = mipLevels;
+		cooked.format = opaque ? vk::Format::eBc1RgbUnormBlock : vk::Format::eBc3UnormBlock;
+		const int blockSize = opaque ? 8 : 16;
+
+		vk::DeviceSize size = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+			size += helper.mipLevelSize(cooked.format, width, height, i);
+		cooked.data.resize(static_cast<size_t>(size));
+
+		// 4x4 texel blocks, row by row, the edge texels repeated where a level is not a multiple of 4
+		unsigned char *dst = cooked.data.data();
+		const unsigned char *level = chain.data();
+		for (uint32_t i = 0; i < mipLevels; i++) {
+			const int w = std::max(width >> i, 1);
+			const int h = std::max(height >> i, 1);
+			for (int by = 0; by < h; by += 4) {
+				for (int bx = 0; bx < w; bx += 4) {
+					unsigned char block[64];
+					for (int y = 0; y < 4; y++) {
+						for (int x = 0; x < 4; x++)
+							memcpy(&block[(y * 4 + x) * 4], &level[(std::min(by + y, h - 1) * w + std::min(bx + x, w - 1)) * 4], 4);
+					}
+					stb_compress_dxt_block(dst, block, opaque ? 0 : 1, STB_DXT_HIGHQUAL);
+					dst += blockSize;
+				}
+			}
+			level += w * h * 4;
+		}
+		return true;
+	}
+
+	bool TextureCooker::readCooked(const std::string &path, uint64_t sourceHash, CookedTexture &cooked) const
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file.good())
+			return false;
+
+		CookedHeader header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+			memcmp(header.magic, "VMTX", 4) != 0 || header.version != COOKED_TEXTURE_VERSION || header.sourceHash != sourceHash)
+			return false;
+
+		cooked.width = header.width;
+		cooked.height = header.height;
+		cooked.mipLevels = header.mipLevels;
+		cooked.format = static_cast<vk::Format>(header.format);
+		vk::DeviceSize size = 0;
+		for (uint32_t i = 0; i < cooked.mipLevels; i++)
+			size += helper.mipLevelSize(cooked.format, cooked.width, cooked.height, i);
+		if (size != header.dataSize)
+			return false;
+
+		cooked.data.resize(static_cast<size_t>(size));
+		return static_cast<bool>(file.read(reinterpret_cast<char*>(cooked.data.data()), cooked.data.size()));
+	}
+
+	void TextureCooker::writeCooked(const std::string &path, uint64_t sourceHash, const CookedTexture &cooked) const
+	{
+		makeDirectory(COOKED_TEXTURE_DIR); // fails if it is there already
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.good()) {
+			LOG("Could not write " << path.c_str() << ", the texture is cooked again next time\n");
+			return;
+		}
+
+		CookedHeader header;
+		memcpy(header.magic, "VMTX", 4);
+		header.version = COOKED_TEXTURE_VERSION;
+		header.sourceHash = sourceHash;
+		header.width = cooked.width;
+		header.height = cooked.height;
+		header.mipLevels = cooked.mipLevels;
+		header.format = static_cast<uint32_t>(cooked.format);
+		header.dataSize = cooked.data.size();
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(cooked.data.data()), cooked.data.size());
+	}
+
+	bool TextureCooker::isOpaque(const unsigned char *pixels, size_t texelCount)
+	{
+		for (size_t i = 0; i < texelCount; i++) {
+			if (pixels[i * 4 + 3] != 255)
+				return false;
+		}
+		return true;
+	}
+
+	void TextureCooker::premultiplyAlpha(unsigned char *pixels, size_t texelCount)
+	{
+		for (size_t i = 0; i < texelCount; i++) {
+			unsigned char *p = &pixels[i * 4];
+			for (int c = 0; c < 3; c++)
+				p[c] = static_cast<unsigned char>((p[c] * p[3] + 127) / 255);
+		}
+	}
+
+	void TextureCooker::createMipChain(const unsigned char *pixels, int width, int height, uint32_t mipLevels, std::vector<unsigned char> &chain)
+	{
+		// every level resized from the one before it, the color is already weighted by the alpha
+		size_t size = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+			size += std::max(width >> i, 1) * std::max(height >> i, 1) * 4;
+		chain.resize(size);
+		memcpy(chain.data(), pixels, width * height * 4);
+
+		size_t offset = 0;
+		for (uint32_t i = 1; i < mipLevels; i++) {
+			const int w = std::max(width >> (i - 1), 1), h = std::max(height >> (i - 1), 1);
+			const int mw = std::max(width >> i, 1), mh = std::max(height >> i, 1);
+			stbir_resize_uint8_generic(&chain[offset], w, h, 0, &chain[offset + w * h * 4], mw, mh, 0,
+				4, 3, STBIR_FLAG_ALPHA_PREMULTIPLIED, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, nullptr);
+			offset += w * h * 4;
+		}
+	}
+
+	uint32_t TextureCooker::getLoadCount() const
+	{
+		return loadCount;
+	}
+
+	uint32_t TextureCooker::getCookCount() const
+	{
+		return cookCount;
+	}
+
+	double TextureCooker::getCookTime() const
+	{
+		return cookTime;
+	}
+
+	double TextureCooker::getLoadTime() const
+	{
+		return loadTime;
+	}
+
+	vk::DeviceSize TextureCooker::getCookedBytes() const
+	{
+		return cookedBytes;
+	}
+
+	vk::DeviceSize TextureCooker::getUncompressedBytes() const
+	{
+		return uncompressedBytes;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include "Vulkan_.h"
+
+#define COOKED_TEXTURE_DIR "cooked"		// next to the exe, safe to delete, it is cooked again
+#define COOKED_TEXTURE_VERSION 1		// bump when the cooking changes, the old files are cooked again
+
+namespace vm {
+	// what the gpu samples, ready to be copied to the image
+	struct CookedTexture
+	{
+		uint32_t					width = 0;
+		uint32_t					height = 0;
+		uint32_t					mipLevels = 0;
+		vk::Format					format = vk::Format::eUndefined;	// eBc1RgbUnormBlock (opaque) or eBc3UnormBlock
+		std::vector<unsigned char>	data;		// the blocks of every level, one level after the other
+		const unsigned char			*mapped = nullptr;	// the blocks in the asset archive instead, data is empty then
+		size_t						mappedSize = 0;
+		const unsigned char *blocks() const { return mapped ? mapped : data.data(); }
+		size_t blockBytes() const { return mapped ? mappedSize : data.size(); }
+	};
+
+	// Cooks the source images once into premultiplied alpha, mipmapped, BC1/BC3 (stb_dxt) textures.
+	// The cooked file is named after a hash of the source file's contents, so an edited image is cooked
+	// again the next time it is loaded and the same image under two names is cooked once.
+	class TextureCooker
+	{
+	public:
+		// available if the gpu samples bc1 and bc3 with linear filtering
+		void create(vk::PhysicalDevice gpu);
+		bool isAvailable() const;
+		void setEnabled(bool enabled);		// off: the textures are decoded and uploaded as rgba8, for comparison
+
+		// from the asset archive, or from the cache, cooked first if it is not there (or stale), false if the source can't be read
+		// thread safe, the texture streaming threads load with it
+		bool load(const std::string &sourcePath, CookedTexture &cooked);
+
+		// straight to premultiplied alpha, every texture is premultiplied, cooked or not
+		static void premultiplyAlpha(unsigned char *pixels, size_t texelCount);
+		// every texel of the rgba8 pixels has alpha 255
+		static bool isOpaque(const unsigned char *pixels, size_t texelCount);
+		// rgba8 premultiplied, every level of the chain one after the other, level 0 is the pixels
+		static void createMipChain(const unsigned char *pixels, int width, int height, uint32_t mipLevels, std::vector<unsigned char> &chain);
+
+		uint32_t getLoadCount() const;		// textures loaded cooked, from the cache or not
+		uint32_t getCookCount() const;		// of those, cooked in this run
+		double getCookTime() const;			// ms, decoding, mips and compression
+		double getLoadTime() const;			// ms, reading the cooked files
+		vk::DeviceSize getCookedBytes() const;		// of the cooked textures, every level
+		vk::DeviceSize getUncompressedBytes() const;	// the same levels as rgba8
+
+	private:
+		bool			available = false;
+		bool			enabled = true;
+		uint32_t		loadCount = 0;
+		uint32_t		cookCount = 0;
+		double			cookTime = 0.0;
+		double			loadTime = 0.0;
+		vk::DeviceSize	cookedBytes = 0;
+		vk::DeviceSize	uncompressedBytes = 0;
+		Helper			helper;
+		std::mutex		mutex;			// the stats and the cache files
+
+		bool cook(const std::vector<unsigned char> &source, CookedTexture &cooked) const;
+		bool readCooked(const std::string &path, uint64_t sourceHash, CookedTexture &cooked) const;
+		void writeCooked(const std::string &path, uint64_t sourceHash, const CookedTexture &cooked) const;
+	};
+}
@@ -0,0 +1,246 @@
+#include "TextureResidency.h"
+#include "ResourceManager.h"
+#include <algorithm>
+
+namespace vm {
+	void TextureResidency::destroy()
+	{
+		vk::Device &device = ResourceManager::getInstance().getDevice();
+		for (auto &r : retired) {
+			helper.destroyImage(device, r.image, r.memory);
+			device.destroyImageView(r.view);
+		}
+		retired.clear();
+	}
+
+	void TextureResidency::setBudget(vk::DeviceSize bytes)
+	{
+		budget = bytes;
+	}
+
+	vk::DeviceSize TextureResidency::getBudget() const
+	{
+		return budget;
+	}
+
+	uint32_t TextureResidency::add(const std::string &name)
+	{
+		Entry e;
+		e.name = name;
+		e.lastUsed = frameNumber;
+		entries.push_back(e);
+		return static_cast<uint32_t>(entries.size() - 1);
+	}
+
+	void TextureResidency::loaded(uint32_t id, vk::DeviceSize bytes, uint32_t width, uint32_t height, uint32_t tier)
+	{
+		Entry &e = entries[id];
+		residentBytes = residentBytes - e.bytes + bytes;
+		peakBytes = std::max(peakBytes, residentBytes);
+		e.bytes = bytes;
+		e.tier = tier;
+		e.state = State::Resident;
+		if (tier == 0) {
+			e.fullBytes = bytes;
+			e.width = width;
+			e.height = height;
+		}
+	}
+
+	void TextureResidency::markUsed(const Texture &tex, uint64_t frameNumber)
+	{
+		if (tex.residencyId == 0)
+			return;
+		Entry &e = entries[tex.residencyId];
+		e.lastUsed = frameNumber;
+		if (e.state == State::Evicted) {
+			e.state = State::Wanted;
+			wanted.push_back(tex.residencyId);
+		}
+	}
+
+	void TextureResidency::update(uint64_t frameNumber, uint32_t framesInFlight, std::vector<std::string> &evicted)
+	{
+		this->frameNumber = frameNumber;
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		// the frames before (frameNumber - framesInFlight) are done, their fences were waited by the summits since
+		for (auto it = retired.begin(); it != retired.end();) {
+			if (frameNumber < it->frameNumber + framesInFlight) {
+				++it;
+				continue;
+			}
+			helper.destroyImage(rm.getDevice(), it->image, it->memory);
+			rm.getDevice().destroyImageView(it->view);
+			it = retired.erase(it);
+		}
+
+		// no placeholder to show instead, nothing is evicted
+		if (!rm.textureStreamer.isCreated())
+			return;
+
+		// drawn while evicted, the placeholder is drawn until it is back
+		for (uint32_t id : wanted) {
+			Entry &e = entries[id];
+			e.tier = reloadTier(e);
+			e.state = State::Loading;
+			rm.textureStreamer.request(rm.textures[e.name], false, e.tier);
+			++reloadCount;
+		}
+		wanted.clear();
+		if (budget && residentBytes < budget / 100 * RESIDENCY_RAISE_PERCENT)
+			raise(framesInFlight);
+		if (budget == 0 || residentBytes <= budget)
+			return;
+
+		// least recently drawn first, the ones the last frame drew stay
+		std::vector<uint32_t> order;
+		for (uint32_t id = 1; id < entries.size(); ++id) {
+			if (entries[id].state == State::Resident)
+				order.push_back(id);
+		}
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return entries[a].lastUsed < entries[b].lastUsed; });
+		for (uint32_t id : order) {
+			if (residentBytes <= budget || entries[id].lastUsed + 1 >= frameNumber)
+				break;
+			evict(id, evicted);
+		}
+		if (residentBytes <= budget)
+			return;
+
+		// the textures on screen don't fit: the biggest ones a tier lower, a quarter of the size.
+		// the tiers already requested count as loaded
+		vk::DeviceSize projected = projectedBytes();
+		order.erase(std::remove_if(order.begin(), order.end(), [this](uint32_t id) { return entries[id].state != State::Resident; }), order.end());
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return entries[a].bytes > entries[b].bytes; });
+		for (uint32_t id : order) {
+			if (projected <= budget)
+				break;
+			Entry &e = entries[id];
+			if (e.tier >= maxTier(e))
+				continue;
+			// it keeps its image until the lower tier replaces it
+			projected -= e.bytes - e.bytes / 4;
+			e.state = State::Loading;
+			rm.textureStreamer.request(rm.textures[e.name], false, ++e.tier);
+			++lowerCount;
+		}
+		++overBudgetFrames;
+	}
+
+	void TextureResidency::retire(Texture &tex)
+	{
+		retired.push_back({ tex.image, tex.imageMem, tex.imageView, frameNumber });
+		tex.image = nullptr;
+		tex.imageMem = nullptr;
+		tex.imageView = nullptr;
+	}
+
+	void TextureResidency::evict(uint32_t id, std::vector<std::string> &evicted)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		Entry &e = entries[id];
+		Texture &tex = rm.textures[e.name];
+		retire(tex);
+		rm.textureStreamer.showPlaceholder(tex);
+		residentBytes -= e.bytes;
+		e.bytes = 0;
+		e.state = State::Evicted;
+		evicted.push_back(e.name);
+		++evictCount;
+	}
+
+	void TextureResidency::raise(uint32_t framesInFlight)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		// the images requested count as loaded, the old ones go when they are replaced
+		vk::DeviceSize projected = projectedBytes();
+		// the lowered ones drawn by the frames in flight, most recently drawn first
+		std::vector<uint32_t> order;
+		for (uint32_t id = 1; id < entries.size(); ++id) {
+			const Entry &e = entries[id];
+			if (e.state == State::Resident && e.tier > 0 && e.fullBytes && e.lastUsed + framesInFlight >= frameNumber)
+				order.push_back(id);
+		}
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return entries[a].lastUsed > entries[b].lastUsed; });
+		for (uint32_t id : order) {
+			Entry &e = entries[id];
+			uint32_t tier = 0;
+			while (tier < e.tier && projected - std::min(e.bytes, projected) + (e.fullBytes >> (2 * tier)) > budget)
+				++tier;
+			if (tier == e.tier)
+				continue;
+			// it keeps its image until the higher tier replaces it
+			projected = projected - std::min(e.bytes, projected) + (e.fullBytes >> (2 * tier));
+			e.tier = tier;
+			e.state = State::Loading;
+			rm.textureStreamer.request(rm.textures[e.name], false, tier);
+			++raiseCount;
+		}
+	}
+
+	vk::DeviceSize TextureResidency::projectedBytes() const
+	{
+		vk::DeviceSize projected = residentBytes;
+		for (auto &e : entries) {
+			if (e.state == State::Loading && e.bytes && e.fullBytes) {
+				projected += e.fullBytes >> (2 * e.tier);
+				projected -= std::min(e.bytes, projected);
+			}
+		}
+		return projected;
+	}
+
+	uint32_t TextureResidency::maxTier(const Entry &e) const
+	{
+		uint32_t tier = 0;
+		while ((std::max(e.width, e.height) >> (tier + 1)) >= RESIDENCY_MIN_SIZE)
+			++tier;
+		return tier;
+	}
+
+	uint32_t TextureResidency::reloadTier(const Entry &e) const
+	{
+		const uint32_t max = maxTier(e);
+		uint32_t tier = 0;
+		while (tier < max && budget && residentBytes + (e.fullBytes >> (2 * tier)) > budget)
+			++tier;
+		return tier;
+	}
+
+	vk::DeviceSize TextureResidency::getResidentBytes() const
+	{
+		return residentBytes;
+	}
+
+	vk::DeviceSize TextureResidency::getPeakBytes() const
+	{
+		return peakBytes;
+	}
+
+	uint32_t TextureResidency::getEvictCount() const
+	{
+		return evictCount;
+	}
+
+	uint32_t TextureResidency::getReloadCount() const
+	{
+		return reloadCount;
+	}
+
+	uint32_t TextureResidency::getLowerCount() const
+	{
+		return lowerCount;
+	}
+
+	uint32_t TextureResidency::getRaiseCount() const
+	{
+		return raiseCount;
+	}
+
+	uint32_t TextureResidency::getOverBudgetFrames() const
+	{
+		return overBudgetFrames;
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Vulkan_.h"
+#include "Texture.h"
+
+#define TEXTURE_BUDGET_MB 256			// default, of the textures with an image of their own, 0: no budget
+#define RESIDENCY_MIN_SIZE 64			// a lower tier never takes the bigger side of a texture below this
+#define RESIDENCY_RAISE_PERCENT 50		// below this much of the budget the lowered textures on screen go back up
+
+namespace vm {
+	// Keeps the textures with an image of their own within a budget of device memory.
+	// The renderer marks the textures of the drawn sprites with the frame, over the budget the least recently drawn
+	// ones are evicted: their sprites show the streaming placeholder and their image is destroyed when the frames in
+	// flight are done with it. An evicted texture drawn again is requested from the streaming threads again.
+	// If the textures drawn by the last frame don't fit, the biggest ones are loaded again a tier lower (the top mip
+	// level dropped, or the image downscaled with stb_image_resize) and a reload takes the lowest tier that fits.
+	// Once the resident ones are well under the budget again, the lowered textures drawn lately are loaded at the
+	// lowest tier that fits too.
+	// The atlas pages and their textures are not evicted, they are small and shared.
+	class TextureResidency
+	{
+	public:
+		void destroy();		// the retired images, device idle
+		void setBudget(vk::DeviceSize bytes);
+		vk::DeviceSize getBudget() const;
+
+		// a texture with an image of its own, its id goes in Texture::residencyId, it is loading until loaded
+		uint32_t add(const std::string &name);
+		// its image is created (again), the bytes of every level, the size of level 0 at the given tier
+		void loaded(uint32_t id, vk::DeviceSize bytes, uint32_t width, uint32_t height, uint32_t tier);
+		// single threaded, an evicted texture is requested again by the next update
+		void markUsed(const Texture &tex, uint64_t frameNumber);
+		// game thread, before the textures streamed in are made resident: destroys the images the frames in flight
+		// are done with, requests the evicted textures drawn again, evicts (or lowers) over the budget and raises well under it.
+		// the evicted textures are the placeholder now, their names are added to evicted
+		void update(uint64_t frameNumber, uint32_t framesInFlight, std::vector<std::string> &evicted);
+		// the image of the texture is destroyed when the frames in flight are done with it
+		void retire(Texture &tex);
+
+		vk::DeviceSize getResidentBytes() const;	// of the images of the textures now
+		vk::DeviceSize getPeakBytes() const;
+		uint32_t getEvictCount() const;
+		uint32_t getReloadCount() const;
+		uint32_t getLowerCount() const;			// tiers dropped under pressure
+		uint32_t getRaiseCount() const;			// lowered textures loaded again at a higher tier
+		uint32_t getOverBudgetFrames() const;	// updates that ended over the budget
+
+	private:
+		enum class State {
+			Loading,	// requested, or a lower tier requested, it keeps its image until then
+			Resident,
+			Evicted,	// the placeholder
+			Wanted		// evicted and drawn, requested by the next update
+		};
+		struct Entry
+		{
+			std::string		name;
+			State			state = State::Loading;
+			uint64_t		lastUsed = 0;
+			vk::DeviceSize	bytes = 0;			// of its image now, 0 if evicted
+			vk::DeviceSize	fullBytes = 0;		// at tier 0
+			uint32_t		width = 0;			// of level 0 at tier 0
+			uint32_t		height = 0;
+			uint32_t		tier = 0;			// top mip levels dropped
+		};
+		struct RetiredImage
+		{
+			vk::Image			image;
+			vk::DeviceMemory	memory;
+			vk::ImageView		view;
+			uint64_t			frameNumber;	// retired before this frame was recorded
+		};
+		std::vector<Entry>			entries{ Entry() };	// id 0 is no texture
+		std::vector<uint32_t>		wanted;
+		std::vector<RetiredImage>	retired;
+		vk::DeviceSize				budget = TEXTURE_BUDGET_MB * 1024ull * 1024ull;
+		vk::DeviceSize				residentBytes = 0;
+		vk::DeviceSize				peakBytes = 0;
+		uint64_t					frameNumber = 0;
+		uint32_t					evictCount = 0;
+		uint32_t					reloadCount = 0;
+		uint32_t					lowerCount = 0;
+		uint32_t					raiseCount = 0;
+		uint32_t					overBudgetFrames = 0;
+		Helper						helper;
+
+		void evict(uint32_t id, std::vector<std::string> &evicted);
+		void raise(uint32_t framesInFlight);
+		vk::DeviceSize projectedBytes() const;		// the resident bytes once the tiers requested are loaded
+		uint32_t maxTier(const Entry &e) const;
+		uint32_t reloadTier(const Entry &e) const;	// the lowest tier that fits in the budget
+	};
+}
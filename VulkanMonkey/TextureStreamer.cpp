@@ -0,0 +1,360 @@
+#include "TextureStreamer.h"
+#include "ResourceManager.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+#include <chrono>
+#include <stb-master/stb_image.h>
+#include <stb-master/stb_image_resize.h>
+
+namespace vm {
+	void TextureStreamer::create(uint32_t workerCount)
+	{
+		// a global of stb_image, set once here and not by every thread
+		stbi_set_flip_vertically_on_load(true);
+
+		// the placeholder is there before anything is requested
+		Result result;
+		if (!decode(STREAMING_PLACEHOLDER, result)) {
+			LOG("failed to load " << STREAMING_PLACEHOLDER << ", no texture streaming\n");
+			return;
+		}
+		placeholder.name = STREAMING_PLACEHOLDER;
+		createTexture(placeholder, result.image.data(), result.image.width, result.image.height);
+
+		quit = false;
+		for (uint32_t i = 0; i < std::max(workerCount, 1u); ++i)
+			workers.emplace_back(&TextureStreamer::work, this);
+		created = true;
+	}
+
+	void TextureStreamer::destroy()
+	{
+		if (!created)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+			jobs.clear();
+		}
+		wake.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+		workers.clear();
+		results.clear();
+
+		// the images still uploading are not in a texture yet, the device is idle
+		vk::Device &device = ResourceManager::getInstance().getDevice();
+		for (auto &u : uploads) {
+			helper.destroyImage(device, u.image, u.imageMem);
+			device.destroyImageView(u.imageView);
+		}
+		uploads.clear();
+
+		// the textures still pending share the placeholder's image, they are not destroyed with the textures
+		helper.destroyImage(device, placeholder.image, placeholder.imageMem);
+		device.destroyImageView(placeholder.imageView);
+		created = false;
+	}
+
+	void TextureStreamer::setEnabled(bool enabled)
+	{
+		this->enabled = enabled;
+	}
+
+	bool TextureStreamer::isEnabled() const
+	{
+		return created && enabled;
+	}
+
+	bool TextureStreamer::isCreated() const
+	{
+		return created;
+	}
+
+	void TextureStreamer::request(Texture &tex, bool atlas, uint32_t tier)
+	{
+		if (!atlas) {
+			if (!tex.imageMem)
+				showPlaceholder(tex);
+			++pendingCount;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back({ tex.name, atlas, tier });
+			if (atlas)
+				++atlasJobs;
+		}
+		wake.notify_one();
+	}
+
+	void TextureStreamer::showPlaceholder(Texture &tex) const
+	{
+		tex.image = placeholder.image;
+		tex.imageMem = nullptr;
+		tex.imageView = placeholder.imageView;
+		tex.uvRect = placeholder.uvRect;
+		tex.mipLevels = placeholder.mipLevels;
+		tex.opaque = placeholder.opaque;
+		tex.resident = false;
+	}
+
+	void TextureStreamer::finishAtlasImages(TextureAtlas &atlas)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		atlasDone.wait(lock, [this] { return atlasJobs == 0; });
+		for (auto it = results.begin(); it != results.end();) {
+			if (!it->atlas) {
+				++it;
+				continue;
+			}
+			if (it->ok)
+				atlas.add(it->name, it->image.data(), it->image.width, it->image.height);
+			else {
+				// no image for it in the atlas, it keeps the placeholder
+				LOG("failed to load texture image " << it->name.c_str() << "\n");
+				showPlaceholder(ResourceManager::getInstance().textures[it->name]);
+			}
+			it = results.erase(it);
+		}
+	}
+
+	void TextureStreamer::update(std::vector<std::string> &resident)
+	{
+		if (!created)
+			return;
+
+		// the oldest results first, at least one per frame so a texture bigger than the budget gets in too
+		std::vector<Result> ready;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t bytes = 0;
+			for (auto it = results.begin(); it != results.end() && bytes < STREAMING_UPLOAD_BUDGET;) {
+				if (it->atlas) {
+					++it;
+					continue;
+				}
+				bytes += it->cooked ? it->cookedTexture.blockBytes() : it->image.width * it->image.height * 4;
+				ready.push_back(std::move(*it));
+				it = results.erase(it);
+			}
+		}
+		auto const startTime = std::chrono::high_resolution_clock::now();
+		ResourceManager &rm = ResourceManager::getInstance();
+
+		// the copies done on the gpu: the textures switch to their new image, the old one (a higher tier) is retired
+		const size_t residentBefore = resident.size();
+		for (auto it = uploads.begin(); it != uploads.end();) {
+			if (!rm.uploadContext.isComplete(it->submission)) {
+				++it;
+				continue;
+			}
+			Texture &tex = rm.textures[it->name];
+			if (tex.imageMem)
+				rm.textureResidency.retire(tex);
+			tex.image = it->image;
+			tex.imageMem = it->imageMem;
+			tex.imageView = it->imageView;
+			tex.mipLevels = it->mipLevels;
+			tex.opaque = it->opaque;
+			tex.uvRect = glm::vec4(0.f, 0.f, 1.f, 1.f);
+			tex.resident = true;
+			if (tex.residencyId)
+				rm.textureResidency.loaded(tex.residencyId, it->bytes, it->width, it->height, it->tier);
+			resident.push_back(it->name);
+			--pendingCount;
+			++residentCount;
+			it = uploads.erase(it);
+		}
+		if (ready.empty() && resident.size() == residentBefore)
+			return;
+
+		// the new images are uploaded in a submission of their own, the textures keep their image until it is done
+		const size_t firstUpload = uploads.size();
+		for (auto &r : ready) {
+			if (!r.ok) {
+				LOG("failed to load texture image " << r.name.c_str() << ", it keeps the placeholder\n");
+				--pendingCount;
+				continue;
+			}
+			Texture staged;
+			const vk::DeviceSize bytes = r.cooked ? createTexture(staged, r.cookedTexture) : createTexture(staged, r.image.data(), r.image.width, r.image.height);
+			Upload upload;
+			upload.name = r.name;
+			upload.image = staged.image;
+			upload.imageMem = staged.imageMem;
+			upload.imageView = staged.imageView;
+			upload.mipLevels = staged.mipLevels;
+			upload.opaque = staged.opaque;
+			upload.bytes = bytes;
+			upload.width = r.cooked ? r.cookedTexture.width : static_cast<uint32_t>(r.image.width);
+			upload.height = r.cooked ? r.cookedTexture.height : static_cast<uint32_t>(r.image.height);
+			upload.tier = r.tier;
+			uploads.push_back(upload);
+		}
+		if (uploads.size() > firstUpload) {
+			const uint64_t submission = rm.uploadContext.submit();
+			for (size_t i = firstUpload; i < uploads.size(); ++i)
+				uploads[i].submission = submission;
+		}
+		std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+		updateTime = time.count();
+		maxUpdateTime = std::max(maxUpdateTime, updateTime);
+	}
+
+	void TextureStreamer::work()
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [this] { return quit || !jobs.empty(); });
+			if (quit)
+				return;
+			const Job job = jobs.front();
+			jobs.pop_front();
+			lock.unlock();
+
+			auto const startTime = std::chrono::high_resolution_clock::now();
+			Result result;
+			result.name = job.name;
+			result.atlas = job.atlas;
+			// the atlas takes rgba8, the others come cooked if the gpu takes bc
+			if (!job.atlas && rm.textureCooker.isAvailable())
+				result.cooked = result.ok = rm.textureCooker.load(job.name, result.cookedTexture);
+			if (!result.ok)
+				result.ok = decode(job.name, result);
+			if (result.ok && job.tier)
+				lowerTier(result, job.tier);
+			std::chrono::duration<double, std::milli> const time = std::chrono::high_resolution_clock::now() - startTime;
+
+			lock.lock();
+			decodeTime += time.count();
+			results.push_back(std::move(result));
+			if (job.atlas && --atlasJobs == 0)
+				atlasDone.notify_all();
+		}
+	}
+
+	bool TextureStreamer::decode(const std::string &path, Result &result)
+	{
+		// in place in the archive, or decoded and premultiplied like it
+		return ResourceManager::getInstance().assetArchive.loadImage(path, result.image);
+	}
+
+	void TextureStreamer::lowerTier(Result &result, uint32_t tier)
+	{
+		Helper helper;
+		if (result.cooked) {
+			// the top levels are dropped, the next one is level 0
+			CookedTexture &cooked = result.cookedTexture;
+			tier = std::min(tier, cooked.mipLevels - 1);
+			vk::DeviceSize offset = 0;
+			for (uint32_t i = 0; i < tier; i++)
+				offset += helper.mipLevelSize(cooked.format, cooked.width, cooked.height, i);
+			if (cooked.mapped) {
+				cooked.mapped += offset;
+				cooked.mappedSize -= static_cast<size_t>(offset);
+			}
+			else
+				cooked.data.erase(cooked.data.begin(), cooked.data.begin() + static_cast<size_t>(offset));
+			cooked.width = std::max(cooked.width >> tier, 1u);
+			cooked.height = std::max(cooked.height >> tier, 1u);
+			cooked.mipLevels -= tier;
+		}
+		else {
+			// downscaled in one go, the mips of the smaller image are made as usual
+			AssetImage &image = result.image;
+			const int width = std::max(image.width >> tier, 1);
+			const int height = std::max(image.height >> tier, 1);
+			std::vector<unsigned char> pixels(width * height * 4);
+			stbir_resize_uint8_generic(image.data(), image.width, image.height, 0, pixels.data(), width, height, 0,
+				4, 3, STBIR_FLAG_ALPHA_PREMULTIPLIED, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, nullptr);
+			image.mapped = nullptr;
+			image.decoded.swap(pixels);
+			image.width = width;
+			image.height = height;
+		}
+		result.tier = tier;
+	}
+
+	vk::DeviceSize TextureStreamer::createTexture(Texture &tex, const unsigned char *pixels, int width, int height)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		Helper helper;
+
+		// the full chain, so zooming out samples a level the size of the sprite on screen and not the whole image
+		const uint32_t mipLevels = rm.mipmaps ? helper.mipLevelCount(width, height) : 1;
+		tex.mipLevels = mipLevels;
+		tex.opaque = TextureCooker::isOpaque(pixels, width * height);
+		helper.createImage(rm.getGpu(), rm.getDevice(), width, height, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, tex.image, tex.imageMem, mipLevels);
+
+		// pixels are staged now, the copy and the layout transitions go with the next upload submit
+		const vk::DeviceSize imageSize = width * height * 4;
+		if (mipLevels == 1 || rm.uploadContext.canBlitMips(vk::Format::eR8G8B8A8Unorm)) {
+			rm.uploadContext.uploadImage(pixels, imageSize, tex.image, width, height, mipLevels);
+		}
+		else {
+			// no linear blits for the format, the levels are made here and copied with level 0
+			std::vector<unsigned char> chain;
+			TextureCooker::createMipChain(pixels, width, height, mipLevels, chain);
+			rm.uploadContext.uploadImage(chain.data(), chain.size(), tex.image, width, height, mipLevels, true);
+			++rm.cpuMipTextures;
+		}
+		for (uint32_t i = 1; i < mipLevels; i++)
+			rm.mipBytes += helper.mipLevelSize(vk::Format::eR8G8B8A8Unorm, width, height, i);
+
+		helper.createImageView(rm.getDevice(), tex.image, vk::Format::eR8G8B8A8Unorm, tex.imageView, vk::ImageAspectFlagBits::eColor, mipLevels);
+		vk::DeviceSize bytes = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+			bytes += helper.mipLevelSize(vk::Format::eR8G8B8A8Unorm, width, height, i);
+		return bytes;
+	}
+
+	vk::DeviceSize TextureStreamer::createTexture(Texture &tex, const CookedTexture &cooked)
+	{
+		ResourceManager &rm = ResourceManager::getInstance();
+		Helper helper;
+
+		// the levels are in the file, without mips only level 0 is copied
+		const uint32_t mipLevels = rm.mipmaps ? cooked.mipLevels : 1;
+		tex.mipLevels = mipLevels;
+		tex.opaque = cooked.format == vk::Format::eBc1RgbUnormBlock;
+		helper.createImage(rm.getGpu(), rm.getDevice(), cooked.width, cooked.height, cooked.format, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, tex.image, tex.imageMem, mipLevels);
+
+		vk::DeviceSize size = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+			size += helper.mipLevelSize(cooked.format, cooked.width, cooked.height, i);
+		rm.uploadContext.uploadImage(cooked.blocks(), size, tex.image, cooked.width, cooked.height, mipLevels, true, cooked.format);
+		rm.mipBytes += size - helper.mipLevelSize(cooked.format, cooked.width, cooked.height, 0);
+
+		helper.createImageView(rm.getDevice(), tex.image, cooked.format, tex.imageView, vk::ImageAspectFlagBits::eColor, mipLevels);
+		return size;
+	}
+
+	uint32_t TextureStreamer::getPendingCount() const
+	{
+		return pendingCount;
+	}
+
+	uint32_t TextureStreamer::getResidentCount() const
+	{
+		return residentCount;
+	}
+
+	double TextureStreamer::getDecodeTime() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return decodeTime;
+	}
+
+	double TextureStreamer::getUpdateTime() const
+	{
+		return updateTime;
+	}
+
+	double TextureStreamer::getMaxUpdateTime() const
+	{
+		return maxUpdateTime;
+	}
+}
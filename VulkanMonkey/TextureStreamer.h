@@ -0,0 +1,113 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Vulkan_.h"
+#include "Texture.h"
+#include "TextureCooker.h"
+#include "AssetArchive.h"
+
+#define STREAMING_THREADS 4								// at most, the game and the record threads need the cores too
+#define STREAMING_UPLOAD_BUDGET (16 * 1024 * 1024)		// bytes turned into images per frame, the rest waits for the next frames
+#define STREAMING_PLACEHOLDER "textures/default.jpg"
+
+namespace vm {
+	class TextureAtlas;
+
+	// Reads and decodes the textures on worker threads, so creating a sprite never waits for the disk or the decoder.
+	// A requested texture is the placeholder (the default texture, in an image of its own) until it is resident:
+	// a worker loads it cooked or decodes it, then update on the game thread creates its image and submits its
+	// upload without waiting for it. A later update finds the fence of that submission signalled, the texture takes
+	// the new image and the renderer switches the dSets of its sprites over to it.
+	// The small images of the atlas are decoded on the workers too, the atlas waits for them before it is packed.
+	class TextureStreamer
+	{
+	public:
+		void create(uint32_t workerCount);
+		void destroy();
+		void setEnabled(bool enabled);	// off: the textures are loaded in Sprite::createNewTexture, for comparison
+		bool isEnabled() const;			// created and not turned off
+		bool isCreated() const;			// the placeholder is there, the textures can be requested
+
+		// returns at once, a texture with an image of its own is a copy of the placeholder until it is resident.
+		// the tier drops that many top mip levels (reloads under a texture budget), a texture that has an image
+		// keeps it until the new one replaces it
+		void request(Texture &tex, bool atlas, uint32_t tier = 0);
+		// the texture samples the placeholder, its own image (if any) is not destroyed here
+		void showPlaceholder(Texture &tex) const;
+		// the requested atlas images go to the atlas, waits for the ones still decoding
+		void finishAtlasImages(TextureAtlas &atlas);
+		// game thread, once per frame: the textures whose upload is done take their image and their names are added
+		// to resident, then the images of the loaded textures within the budget are created and their uploads submitted
+		void update(std::vector<std::string> &resident);
+
+		// the image of a loaded texture, for the synchronous loads too, the pixels are premultiplied rgba8.
+		// returns the bytes of the image, every level
+		static vk::DeviceSize createTexture(Texture &tex, const unsigned char *pixels, int width, int height);
+		static vk::DeviceSize createTexture(Texture &tex, const CookedTexture &cooked);
+
+		uint32_t getPendingCount() const;	// requested and not resident yet, uploading included
+		uint32_t getResidentCount() const;	// made resident by update
+		double getDecodeTime() const;		// ms, of all the workers
+		double getUpdateTime() const;		// ms, the last update that made textures resident
+		double getMaxUpdateTime() const;	// ms
+
+	private:
+		struct Job
+		{
+			std::string					name;
+			bool						atlas;
+			uint32_t					tier;
+		};
+		struct Result
+		{
+			std::string					name;
+			bool						atlas = false;
+			bool						ok = false;
+			bool						cooked = false;
+			CookedTexture				cookedTexture;
+			AssetImage					image;			// if not cooked
+			uint32_t					tier = 0;		// applied, lower than asked if the texture is small
+		};
+		struct Upload
+		{
+			std::string					name;
+			vk::Image					image;			// the texture keeps its image (or the placeholder's) until the copy is done
+			vk::DeviceMemory			imageMem;
+			vk::ImageView				imageView;
+			uint32_t					mipLevels = 1;
+			bool						opaque = false;
+			vk::DeviceSize				bytes = 0;		// every level, for the residency
+			uint32_t					width = 0;		// of level 0
+			uint32_t					height = 0;
+			uint32_t					tier = 0;
+			uint64_t					submission = 0;	// of the upload context
+		};
+		std::vector<std::thread>		workers;
+		mutable std::mutex				mutex;
+		std::condition_variable			wake;			// a job is there (or quit)
+		std::condition_variable			atlasDone;		// the last atlas job is done
+		std::deque<Job>					jobs;
+		std::deque<Result>				results;
+		std::vector<Upload>				uploads;		// game thread
+		uint32_t						atlasJobs = 0;	// queued or decoding
+		double							decodeTime = 0.0;
+		bool							quit = false;
+
+		Texture							placeholder;
+		bool							created = false;
+		bool							enabled = true;
+		uint32_t						pendingCount = 0;
+		uint32_t						residentCount = 0;
+		double							updateTime = 0.0;
+		double							maxUpdateTime = 0.0;
+		Helper							helper;
+
+		void work();
+		static bool decode(const std::string &path, Result &result);
+		static void lowerTier(Result &result, uint32_t tier);
+	};
+}
@@ -0,0 +1,70 @@
+#include "ThreadPool.h"
+
+namespace vm {
+	void ThreadPool::create(uint32_t workerCount)
+	{
+		quit = false;
+		for (uint32_t i = 0; i < workerCount; ++i)
+			workers.emplace_back(&ThreadPool::work, this);
+	}
+
+	void ThreadPool::destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	void ThreadPool::run(uint32_t count, const std::function<void(uint32_t)> &_job)
+	{
+		if (count == 0)
+			return;
+		std::unique_lock<std::mutex> lock(mutex);
+		job = &_job;
+		sliceCount = count;
+		nextSlice = 0;
+		pendingSlices = count;
+		if (count > 1)
+			wake.notify_all();
+
+		runSlices(lock);
+		done.wait(lock, [this] { return pendingSlices == 0; });
+		job = nullptr;
+		sliceCount = 0;
+		nextSlice = 0;
+	}
+
+	uint32_t ThreadPool::getWorkerCount() const
+	{
+		return static_cast<uint32_t>(workers.size());
+	}
+
+	void ThreadPool::work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [this] { return quit || nextSlice < sliceCount; });
+			if (quit)
+				return;
+			runSlices(lock);
+		}
+	}
+
+	void ThreadPool::runSlices(std::unique_lock<std::mutex> &lock)
+	{
+		while (nextSlice < sliceCount) {
+			const uint32_t slice = nextSlice++;
+			const std::function<void(uint32_t)> &sliceJob = *job;
+			lock.unlock();
+			sliceJob(slice);
+			lock.lock();
+			if (--pendingSlices == 0)
+				done.notify_all();
+		}
+	}
+}
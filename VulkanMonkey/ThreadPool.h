@@ -0,0 +1,36 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+namespace vm {
+	// A few worker threads waiting for jobs split in slices, made for the per frame command recording:
+	// the threads are created once, run() only wakes them up and waits until every slice is done.
+	class ThreadPool
+	{
+	public:
+		void create(uint32_t workerCount);
+		void destroy();
+
+		// job(slice) for every slice in [0, sliceCount), the calling thread works on the slices too
+		void run(uint32_t sliceCount, const std::function<void(uint32_t)> &job);
+		uint32_t getWorkerCount() const;
+
+	private:
+		std::vector<std::thread>				workers;
+		std::mutex								mutex;
+		std::condition_variable					wake;		// a job is there (or quit)
+		std::condition_variable					done;		// the last slice of the job is done
+		const std::function<void(uint32_t)>		*job = nullptr;
+		uint32_t								sliceCount = 0;
+		uint32_t								nextSlice = 0;
+		uint32_t								pendingSlices = 0;
+		bool									quit = false;
+
+		void work();
+		// takes slices of the current job until there are none left, the lock is held on return
+		void runSlices(std::unique_lock<std::mutex> &lock);
+	};
+}
@@ -0,0 +1,430 @@
+#include "UploadContext.h"
+#include "ErrorAndLog.h"
+#include <algorithm>
+
+namespace vm {
+	void UploadContext::create(vk::PhysicalDevice gpu, vk::Device device, uint32_t graphicsFamilyId, vk::Queue graphicsQueue, uint32_t transferFamilyId, vk::Queue transferQueue)
+	{
+		this->gpu = gpu;
+		this->device = device;
+		this->graphicsFamilyId = graphicsFamilyId;
+		this->graphicsQueue = graphicsQueue;
+		this->transferFamilyId = transferFamilyId;
+		this->transferQueue = transferQueue;
+
+		// the command buffers of a slot are begun again when the slot is recycled
+		auto const tcpci = vk::CommandPoolCreateInfo()
+			.setQueueFamilyIndex(transferFamilyId)
+			.setFlags(vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+		errCheck(device.createCommandPool(&tcpci, nullptr, &transferCmdPool));
+		if (usesTransferQueue()) {
+			auto const gcpci = vk::CommandPoolCreateInfo()
+				.setQueueFamilyIndex(graphicsFamilyId)
+				.setFlags(vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+			errCheck(device.createCommandPool(&gcpci, nullptr, &graphicsCmdPool));
+		}
+
+		for (uint32_t i = 0; i < UPLOAD_SLOTS; i++) {
+			Slot &slot = slots[i];
+			auto const tcbai = vk::CommandBufferAllocateInfo()
+				.setCommandPool(transferCmdPool)
+				.setLevel(vk::CommandBufferLevel::ePrimary)
+				.setCommandBufferCount(1);
+			errCheck(device.allocateCommandBuffers(&tcbai, &slot.transferCmd));
+			if (usesTransferQueue()) {
+				auto const gcbai = vk::CommandBufferAllocateInfo()
+					.setCommandPool(graphicsCmdPool)
+					.setLevel(vk::CommandBufferLevel::ePrimary)
+					.setCommandBufferCount(1);
+				errCheck(device.allocateCommandBuffers(&gcbai, &slot.graphicsCmd));
+
+				auto const si = vk::SemaphoreCreateInfo();
+				errCheck(device.createSemaphore(&si, nullptr, &slot.semaphore));
+			}
+			auto const fci = vk::FenceCreateInfo();
+			errCheck(device.createFence(&fci, nullptr, &slot.fence));
+			slot.stagingOffset = i * UPLOAD_STAGING_SIZE;
+			slot.submission = 0;
+		}
+		currentSlot = 0;
+
+		vk::DeviceSize stagingSize = UPLOAD_SLOTS * UPLOAD_STAGING_SIZE;
+		helper.createBuffer(gpu, device, stagingSize,
+			vk::BufferUsageFlagBits::eTransferSrc,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			stagingBuffer, stagingBufferMem);
+		stagingData = static_cast<char*>(helper.mapBuffer(device, stagingBuffer));
+	}
+
+	void UploadContext::destroy()
+	{
+		if (!device)
+			return;
+		flush();
+		helper.destroyBuffer(device, stagingBuffer, stagingBufferMem);
+		for (auto &slot : slots) {
+			device.destroyFence(slot.fence);
+			if (slot.semaphore)
+				device.destroySemaphore(slot.semaphore);
+			slot.semaphore = nullptr;
+		}
+		if (graphicsCmdPool)
+			device.destroyCommandPool(graphicsCmdPool);
+		device.destroyCommandPool(transferCmdPool); // cmd buffers are auto destroyed with cmd pool
+		device = nullptr;
+	}
+
+	void UploadContext::begin()
+	{
+		if (recording)
+			return;
+		// the oldest slot, its submission is normally long done
+		Slot &slot = slots[currentSlot];
+		recycle(slot);
+		auto const beginInfo = vk::CommandBufferBeginInfo()
+			.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+		errCheck(slot.transferCmd.begin(&beginInfo));
+		if (usesTransferQueue())
+			errCheck(slot.graphicsCmd.begin(&beginInfo));
+		stagingHead = 0;
+		recording = true;
+	}
+
+	void UploadContext::recycle(Slot &slot)
+	{
+		if (!slot.submission)
+			return;
+		errCheck(device.waitForFences(1, &slot.fence, VK_TRUE, UINT64_MAX));
+		errCheck(device.resetFences(1, &slot.fence));
+		for (auto &s : slot.oversizedStaging)
+			helper.destroyBuffer(device, s.first, s.second);
+		slot.oversizedStaging.clear();
+		slot.submission = 0;
+	}
+
+	void UploadContext::stage(const void *data, vk::DeviceSize size, vk::Buffer &srcBuffer, vk::DeviceSize &srcOffset)
+	{
+		if (size > UPLOAD_STAGING_SIZE) {
+			// too big to ever fit, a staging buffer of its own until its submission is done
+			vk::DeviceMemory memory;
+			helper.createBuffer(gpu, device, size,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				srcBuffer, memory);
+			memcpy(helper.mapBuffer(device, srcBuffer), data, static_cast<size_t>(size));
+			slots[currentSlot].oversizedStaging.push_back({ srcBuffer, memory });
+			srcOffset = 0;
+			return;
+		}
+
+		// 16 covers the texel size and the 4 byte alignment of buffer to image copies
+		vk::DeviceSize offset = (stagingHead + 15) & ~vk::DeviceSize(15);
+		if (offset + size > UPLOAD_STAGING_SIZE) {
+			// the share is full, the rest goes in the next slot
+			submit();
+			begin();
+			offset = 0;
+		}
+		memcpy(stagingData + slots[currentSlot].stagingOffset + offset, data, static_cast<size_t>(size));
+		stagingHead = offset + size;
+		srcBuffer = stagingBuffer;
+		srcOffset = slots[currentSlot].stagingOffset + offset;
+	}
+
+	void UploadContext::uploadBuffer(const void *data, vk::DeviceSize size, vk::Buffer dstBuffer, vk::AccessFlags dstAccess, vk::PipelineStageFlags dstStage)
+	{
+		// the slot must be free before its staging share is written
+		begin();
+		vk::Buffer srcBuffer;
+		vk::DeviceSize srcOffset;
+		stage(data, size, srcBuffer, srcOffset);
+		vk::CommandBuffer transferCmd = slots[currentSlot].transferCmd;
+
+		auto const region = vk::BufferCopy()
+			.setSrcOffset(srcOffset)
+			.setDstOffset(0)
+			.setSize(size);
+		transferCmd.copyBuffer(srcBuffer, dstBuffer, 1, &region);
+
+		bufferBarriers.push_back(vk::BufferMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(dstAccess)
+			.setSrcQueueFamilyIndex(usesTransferQueue() ? transferFamilyId : VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(usesTransferQueue() ? graphicsFamilyId : VK_QUEUE_FAMILY_IGNORED)
+			.setBuffer(dstBuffer)
+			.setOffset(0)
+			.setSize(VK_WHOLE_SIZE));
+		dstStages |= dstStage;
+		++uploadCount;
+	}
+
+	void UploadContext::uploadImage(const void *pixels, vk::DeviceSize size, vk::Image dstImage, uint32_t width, uint32_t height, uint32_t mipLevels, bool mipsIncluded, vk::Format format)
+	{
+		begin();
+		vk::Buffer srcBuffer;
+		vk::DeviceSize srcOffset;
+		stage(pixels, size, srcBuffer, srcOffset);
+		vk::CommandBuffer transferCmd = slots[currentSlot].transferCmd;
+
+		// the previous contents are not needed
+		auto const toTransfer = vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlags())
+			.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setOldLayout(vk::ImageLayout::eUndefined)
+			.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(dstImage)
+			.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1 });
+		transferCmd.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(),
+			0, nullptr,
+			0, nullptr,
+			1, &toTransfer);
+
+		// one region per level that is in the pixels
+		const uint32_t copiedLevels = mipsIncluded ? mipLevels : 1;
+		std::vector<vk::BufferImageCopy> regions(copiedLevels);
+		vk::DeviceSize levelOffset = srcOffset;
+		for (uint32_t i = 0; i < copiedLevels; i++) {
+			const uint32_t w = std::max(width >> i, 1u);
+			const uint32_t h = std::max(height >> i, 1u);
+			regions[i].bufferOffset = levelOffset;
+			regions[i].bufferRowLength = 0;
+			regions[i].bufferImageHeight = 0;
+			regions[i].imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+			regions[i].imageSubresource.mipLevel = i;
+			regions[i].imageSubresource.baseArrayLayer = 0;
+			regions[i].imageSubresource.layerCount = 1;
+			regions[i].imageOffset = vk::Offset3D(0, 0, 0);
+			regions[i].imageExtent = vk::Extent3D(w, h, 1);
+			levelOffset += helper.mipLevelSize(format, width, height, i);
+		}
+		transferCmd.copyBufferToImage(srcBuffer, dstImage, vk::ImageLayout::eTransferDstOptimal, (uint32_t)regions.size(), regions.data());
+
+		if (copiedLevels < mipLevels) {
+			// a dedicated transfer family can't blit, the chain is made after the acquire on the graphics family
+			mipChains.push_back({ dstImage, width, height, mipLevels });
+			if (usesTransferQueue()) {
+				mipBarriers.push_back(vk::ImageMemoryBarrier()
+					.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+					.setDstAccessMask(vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite)
+					.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+					.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+					.setSrcQueueFamilyIndex(transferFamilyId)
+					.setDstQueueFamilyIndex(graphicsFamilyId)
+					.setImage(dstImage)
+					.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1 }));
+			}
+			++uploadCount;
+			return;
+		}
+
+		imageBarriers.push_back(vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+			.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+			.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+			.setSrcQueueFamilyIndex(usesTransferQueue() ? transferFamilyId : VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(usesTransferQueue() ? graphicsFamilyId : VK_QUEUE_FAMILY_IGNORED)
+			.setImage(dstImage)
+			.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1 }));
+		dstStages |= vk::PipelineStageFlagBits::eFragmentShader;
+		++uploadCount;
+	}
+
+	bool UploadContext::canBlitMips(vk::Format format) const
+	{
+		const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+		return (gpu.getFormatProperties(format).optimalTilingFeatures & needed) == needed;
+	}
+
+	void UploadContext::blitMips(vk::CommandBuffer cmd, const MipChain &chain) const
+	{
+		// every level is made from the one above it, which is then done and goes to the shaders
+		auto barrier = vk::ImageMemoryBarrier()
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(chain.image);
+		int32_t w = static_cast<int32_t>(chain.width);
+		int32_t h = static_cast<int32_t>(chain.height);
+		for (uint32_t i = 1; i < chain.levels; i++) {
+			barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+				.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+				.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+				.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, i - 1, 1, 0, 1 });
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+
+			const int32_t mw = std::max(w / 2, 1);
+			const int32_t mh = std::max(h / 2, 1);
+			auto const blit = vk::ImageBlit()
+				.setSrcSubresource({ vk::ImageAspectFlagBits::eColor, i - 1, 0, 1 })
+				.setSrcOffsets({ { vk::Offset3D(0, 0, 0), vk::Offset3D(w, h, 1) } })
+				.setDstSubresource({ vk::ImageAspectFlagBits::eColor, i, 0, 1 })
+				.setDstOffsets({ { vk::Offset3D(0, 0, 0), vk::Offset3D(mw, mh, 1) } });
+			cmd.blitImage(chain.image, vk::ImageLayout::eTransferSrcOptimal, chain.image, vk::ImageLayout::eTransferDstOptimal, 1, &blit, vk::Filter::eLinear);
+
+			barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferRead)
+				.setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+				.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+				.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+			w = mw;
+			h = mh;
+		}
+
+		// the last level was only written
+		barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+			.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+			.setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+			.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, chain.levels - 1, 1, 0, 1 });
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	uint64_t UploadContext::submit()
+	{
+		if (!recording)
+			return 0;
+		Slot &slot = slots[currentSlot];
+		vk::CommandBuffer transferCmd = slot.transferCmd;
+		vk::CommandBuffer graphicsCmd = slot.graphicsCmd;
+
+		if (usesTransferQueue()) {
+			// release on the transfer family (dst access is ignored there)...
+			std::vector<vk::BufferMemoryBarrier> releaseBuffers = bufferBarriers;
+			std::vector<vk::ImageMemoryBarrier> releaseImages = imageBarriers;
+			releaseImages.insert(releaseImages.end(), mipBarriers.begin(), mipBarriers.end());
+			for (auto &b : releaseBuffers) b.setDstAccessMask(vk::AccessFlags());
+			for (auto &b : releaseImages) b.setDstAccessMask(vk::AccessFlags());
+			transferCmd.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+				vk::DependencyFlags(),
+				0, nullptr,
+				(uint32_t)releaseBuffers.size(), releaseBuffers.data(),
+				(uint32_t)releaseImages.size(), releaseImages.data());
+
+			// ...and the matching acquire on the graphics family (src access is ignored there)
+			for (auto &b : bufferBarriers) b.setSrcAccessMask(vk::AccessFlags());
+			for (auto &b : imageBarriers) b.setSrcAccessMask(vk::AccessFlags());
+			for (auto &b : mipBarriers) b.setSrcAccessMask(vk::AccessFlags());
+			if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+				graphicsCmd.pipelineBarrier(
+					vk::PipelineStageFlagBits::eTopOfPipe, dstStages,
+					vk::DependencyFlags(),
+					0, nullptr,
+					(uint32_t)bufferBarriers.size(), bufferBarriers.data(),
+					(uint32_t)imageBarriers.size(), imageBarriers.data());
+			}
+			if (!mipBarriers.empty()) {
+				graphicsCmd.pipelineBarrier(
+					vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+					vk::DependencyFlags(),
+					0, nullptr,
+					0, nullptr,
+					(uint32_t)mipBarriers.size(), mipBarriers.data());
+			}
+			for (auto &chain : mipChains)
+				blitMips(graphicsCmd, chain);
+		}
+		else {
+			if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+				transferCmd.pipelineBarrier(
+					vk::PipelineStageFlagBits::eTransfer, dstStages,
+					vk::DependencyFlags(),
+					0, nullptr,
+					(uint32_t)bufferBarriers.size(), bufferBarriers.data(),
+					(uint32_t)imageBarriers.size(), imageBarriers.data());
+			}
+			// the transfer queue is the graphics queue here, it can blit
+			for (auto &chain : mipChains)
+				blitMips(transferCmd, chain);
+		}
+		mipBlitCount += static_cast<uint32_t>(mipChains.size());
+		errCheck(transferCmd.end());
+
+		if (usesTransferQueue()) {
+			errCheck(graphicsCmd.end());
+
+			auto const tsi = vk::SubmitInfo()
+				.setCommandBufferCount(1)
+				.setPCommandBuffers(&transferCmd)
+				.setSignalSemaphoreCount(1)
+				.setPSignalSemaphores(&slot.semaphore);
+			errCheck(transferQueue.submit(1, &tsi, nullptr));
+
+			// every stage of the acquire waits, the frames behind it on the graphics queue rely on it
+			vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+			auto const gsi = vk::SubmitInfo()
+				.setWaitSemaphoreCount(1)
+				.setPWaitSemaphores(&slot.semaphore)
+				.setPWaitDstStageMask(&waitStage)
+				.setCommandBufferCount(1)
+				.setPCommandBuffers(&graphicsCmd);
+			errCheck(graphicsQueue.submit(1, &gsi, slot.fence));
+		}
+		else {
+			auto const si = vk::SubmitInfo()
+				.setCommandBufferCount(1)
+				.setPCommandBuffers(&transferCmd);
+			errCheck(transferQueue.submit(1, &si, slot.fence));
+		}
+		slot.submission = ++submitCount;
+
+		// not waited, the slot is recycled when it comes round again
+		bufferBarriers.clear();
+		imageBarriers.clear();
+		mipChains.clear();
+		mipBarriers.clear();
+		dstStages = vk::PipelineStageFlags();
+		currentSlot = (currentSlot + 1) % UPLOAD_SLOTS;
+		recording = false;
+		return slot.submission;
+	}
+
+	void UploadContext::flush()
+	{
+		submit();
+		for (auto &slot : slots)
+			recycle(slot);
+	}
+
+	bool UploadContext::hasPending() const
+	{
+		return recording;
+	}
+
+	bool UploadContext::isComplete(uint64_t submission)
+	{
+		if (!submission)
+			return true;
+		for (auto &slot : slots) {
+			if (slot.submission == submission)
+				return device.getFenceStatus(slot.fence) == vk::Result::eSuccess;
+		}
+		// its slot was recycled, or nothing was submitted
+		return true;
+	}
+
+	bool UploadContext::usesTransferQueue() const
+	{
+		return transferFamilyId != graphicsFamilyId;
+	}
+
+	uint32_t UploadContext::getSubmitCount() const
+	{
+		return submitCount;
+	}
+
+	uint32_t UploadContext::getUploadCount() const
+	{
+		return uploadCount;
+	}
+
+	uint32_t UploadContext::getMipBlitCount() const
+	{
+		return mipBlitCount;
+	}
+}
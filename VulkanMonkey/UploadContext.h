@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include "Vulkan_.h"
+
+#define UPLOAD_SLOTS 3						// submissions in flight at once
+#define UPLOAD_STAGING_SIZE (8 * 1024 * 1024)	// of the staging buffer, per slot
+
+namespace vm {
+	// Gathers the staging copies and layout transitions of many resources in one command buffer
+	// and submits them together with a fence, instead of a submit and queue.waitIdle() per copy.
+	// Uses a dedicated transfer queue family if there is one, handing the resources over to the
+	// graphics family with release/acquire barriers.
+	// The submissions go round UPLOAD_SLOTS slots, each with its command buffers, fence and share of the staging
+	// buffer. The frames don't wait for them: the graphics queue runs them (or their acquire) before the frame
+	// submitted after, and a slot is recycled when its fence is found signalled.
+	class UploadContext
+	{
+	public:
+		void create(vk::PhysicalDevice gpu, vk::Device device, uint32_t graphicsFamilyId, vk::Queue graphicsQueue, uint32_t transferFamilyId, vk::Queue transferQueue);
+		void destroy();
+
+		// the data are copied to the staging memory at once, the gpu copies happen at the next submit
+		void uploadBuffer(const void *data, vk::DeviceSize size, vk::Buffer dstBuffer, vk::AccessFlags dstAccess, vk::PipelineStageFlags dstStage);
+		// the image ends up in eShaderReadOnlyOptimal, ready for the fragment shader
+		// with mipLevels > 1 the pixels are the whole chain one level after the other (mipsIncluded),
+		// or level 0 only and the rest is blitted down on the graphics queue (see canBlitMips)
+		// the format sizes the levels in the pixels, rgba8 or the bc blocks of a cooked texture
+		void uploadImage(const void *pixels, vk::DeviceSize size, vk::Image dstImage, uint32_t width, uint32_t height, uint32_t mipLevels = 1, bool mipsIncluded = false, vk::Format format = vk::Format::eR8G8B8A8Unorm);
+		// linear filtered blits from and to optimal tiling images of the format
+		bool canBlitMips(vk::Format format) const;
+
+		// one submission for everything recorded since the last one, without waiting for it. returns its number
+		// for isComplete, 0 if nothing was recorded
+		uint64_t submit();
+		// submits and waits for every submission, for the loading and the destruction
+		void flush();
+		bool hasPending() const;
+		// the gpu is done with the submission, its resources can be used outside the graphics queue order
+		bool isComplete(uint64_t submission);
+
+		bool usesTransferQueue() const;
+		uint32_t getSubmitCount() const;
+		uint32_t getUploadCount() const;
+		uint32_t getMipBlitCount() const;	// images whose mips were blitted
+
+	private:
+		vk::PhysicalDevice		gpu;
+		vk::Device				device;
+		uint32_t				graphicsFamilyId;
+		uint32_t				transferFamilyId;
+		vk::Queue				graphicsQueue;
+		vk::Queue				transferQueue;
+
+		vk::CommandPool			transferCmdPool;
+		vk::CommandPool			graphicsCmdPool;
+		struct Slot
+		{
+			vk::CommandBuffer	transferCmd;		// the copies (and the releases to the graphics family)
+			vk::CommandBuffer	graphicsCmd;		// the acquires, only with a dedicated transfer family
+			vk::Fence			fence;
+			vk::Semaphore		semaphore;			// transfer submit -> graphics acquire submit
+			vk::DeviceSize		stagingOffset;		// its share of the staging buffer
+			std::vector<std::pair<vk::Buffer, vk::DeviceMemory>> oversizedStaging; // too big for the share, destroyed with the slot's submission
+			uint64_t			submission = 0;		// in flight, 0: free
+		};
+		Slot					slots[UPLOAD_SLOTS];
+		uint32_t				currentSlot = 0;	// recording, or the next to record
+
+		// persistently mapped, bump allocated in the share of the current slot
+		vk::Buffer				stagingBuffer;
+		vk::DeviceMemory		stagingBufferMem;
+		char					*stagingData = nullptr;
+		vk::DeviceSize			stagingHead = 0;
+
+		// recorded after all the copies, in one pipeline barrier
+		std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+		std::vector<vk::ImageMemoryBarrier> imageBarriers;
+		vk::PipelineStageFlags	dstStages;
+
+		// images whose mips are blitted after the copies, on a graphics family command buffer
+		struct MipChain
+		{
+			vk::Image	image;
+			uint32_t	width;
+			uint32_t	height;
+			uint32_t	levels;
+		};
+		std::vector<MipChain>	mipChains;
+		std::vector<vk::ImageMemoryBarrier> mipBarriers;	// their hand over to the graphics family, in eTransferDstOptimal
+
+		bool					recording = false;
+		uint32_t				uploadCount = 0;
+		uint32_t				submitCount = 0;
+		uint32_t				mipBlitCount = 0;
+		Helper					helper;
+
+		void begin();			// waits for the current slot if it is still in flight
+		void recycle(Slot &slot);	// waits for its submission
+		void stage(const void *data, vk::DeviceSize size, vk::Buffer &srcBuffer, vk::DeviceSize &srcOffset);
+		void blitMips(vk::CommandBuffer cmd, const MipChain &chain) const;
+	};
+}
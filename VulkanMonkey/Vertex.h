@@ -1,52 +1,58 @@
 #pragma once
 #include "glm_.h"
 #include "Vulkan_.h"
+#include "VertexLayout.h"
 #include <array>
 #include <unordered_set>
 
-
-
 namespace vm {
-	struct Vertex {
-		glm::vec3 pos;
-		glm::vec3 color;
-		glm::vec2 texCoord;
-		bool operator==(const Vertex& other) const {
-			return pos == other.pos && color == other.color && texCoord == other.texCoord;
-		}
+	// the sprite quads: pixel positions (z is 0 in the shaders) and uvs, 12 bytes, locations 0 and 1
+	typedef VertexLayout<attr::Float2, attr::Unorm16x2> SpriteVertex;
+	static_assert(sizeof(SpriteVertex) == SpriteVertex::stride, "SpriteVertex is packed");
+
+	// per-instance data of the batched sprite draws, read from a second vertex binding
+	// same layout as the std430 Instance of shaders/cullSprites.comp, the gpu culling writes them too
+	struct InstanceData {
+		glm::mat4 model;
+		glm::vec4 uvRect;		// sub-rectangle of the texture in its (atlas) image
+		uint32_t textureIndex;	// slot in the texture array, used by the texture array pipeline only
+		uint32_t pad[3];
 		static vk::VertexInputBindingDescription getBindingDescription() {
 			auto const bindDescription = vk::VertexInputBindingDescription()
-				.setBinding(0) //index of the binding in the array of bindings
-				.setStride(sizeof(Vertex))
-				.setInputRate(vk::VertexInputRate::eVertex);
+				.setBinding(1) //index of the binding in the array of bindings
+				.setStride(sizeof(InstanceData))
+				.setInputRate(vk::VertexInputRate::eInstance);
 			return bindDescription;
 		}
-		static std::array<vk::VertexInputAttributeDescription, 3> getAttributeDescription() {
-			std::array<vk::VertexInputAttributeDescription, 3> const attributeDescriptions = {
-				vk::VertexInputAttributeDescription()
-				.setBinding(0) //index of the binding to get per-vertex data
-				.setLocation(0) //location directive of the input in the vertex shader
-				.setFormat(vk::Format::eR32G32B32Sfloat) //vec3
-				.setOffset(offsetof(Vertex, pos)),
-				vk::VertexInputAttributeDescription()
-				.setBinding(0)
-				.setLocation(1)
-				.setFormat(vk::Format::eR32G32B32Sfloat) //vec3
-				.setOffset(offsetof(Vertex, color)),
-				vk::VertexInputAttributeDescription()
-				.setBinding(0)
-				.setLocation(2)
-				.setFormat(vk::Format::eR32G32Sfloat) //vec2
-				.setOffset(offsetof(Vertex, texCoord))
-			};
+		static std::array<vk::VertexInputAttributeDescription, 6> getAttributeDescription() {
+			// a mat4 input takes 4 consecutive locations, one for every column
+			std::array<vk::VertexInputAttributeDescription, 6> attributeDescriptions{};
+			for (uint32_t i = 0; i < 4; i++) {
+				attributeDescriptions[i]
+					.setBinding(1) //index of the binding to get per-instance data
+					.setLocation(3 + i) //location directive of the input in the vertex shader
+					.setFormat(vk::Format::eR32G32B32A32Sfloat) //vec4
+					.setOffset(offsetof(InstanceData, model) + i * sizeof(glm::vec4));
+			}
+			attributeDescriptions[4]
+				.setBinding(1)
+				.setLocation(7)
+				.setFormat(vk::Format::eR32Uint) //uint
+				.setOffset(offsetof(InstanceData, textureIndex));
+			attributeDescriptions[5]
+				.setBinding(1)
+				.setLocation(8)
+				.setFormat(vk::Format::eR32G32B32A32Sfloat) //vec4
+				.setOffset(offsetof(InstanceData, uvRect));
 			return attributeDescriptions;
 		}
 	};
+
+	// input of the gpu culling, one per drawn sprite (std430 SpriteData of shaders/cullSprites.comp)
+	struct SpriteCullData {
+		glm::mat4 model;		// the unit quad scaled to the sprite, as InstanceData::model
+		glm::vec4 uvRect;
+		uint32_t textureIndex;
+		uint32_t pad[3];
+	};
 }
-template<> struct std::hash<vm::Vertex> {
-	size_t operator()(vm::Vertex const& vertex) const {
-		return ((hash<glm::vec3>()(vertex.pos) ^
-			(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-			(hash<glm::vec2>()(vertex.texCoord) << 1);
-	}
-};
\ No newline at end of file
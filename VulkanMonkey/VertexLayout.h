@@ -0,0 +1,120 @@
+#pragma once
+#include "glm_.h"
+#include "Vulkan_.h"
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <cstring>
+
+namespace vm {
+	// a vertex attribute: the cpu type stored in the vertex and the format the vertex shader reads it with
+	template<typename T, vk::Format F>
+	struct VertexAttribute {
+		typedef T Type;
+		static constexpr vk::Format format() { return F; }
+	};
+
+	namespace attr {
+		typedef VertexAttribute<glm::vec2, vk::Format::eR32G32Sfloat>			Float2;
+		typedef VertexAttribute<glm::vec3, vk::Format::eR32G32B32Sfloat>		Float3;
+		typedef VertexAttribute<glm::vec4, vk::Format::eR32G32B32A32Sfloat>		Float4;
+		typedef VertexAttribute<glm::i16vec2, vk::Format::eR16G16Snorm>			Snorm16x2;	// -1..1 in the shader, positions of normalized shapes
+		typedef VertexAttribute<glm::i16vec4, vk::Format::eR16G16B16A16Snorm>	Snorm16x4;	// normals, tangents
+		typedef VertexAttribute<glm::u16vec2, vk::Format::eR16G16Unorm>			Unorm16x2;	// 0..1 in the shader, uvs
+		typedef VertexAttribute<glm::u8vec4, vk::Format::eR8G8B8A8Unorm>		Rgba8;		// colors
+		typedef VertexAttribute<uint32_t, vk::Format::eR32Uint>					Uint;
+	}
+
+	// the floats the packed attributes are read back as
+	inline glm::i16vec2 packSnorm16(const glm::vec2 &v) { return glm::packSnorm<int16_t>(v); }
+	inline glm::i16vec4 packSnorm16(const glm::vec4 &v) { return glm::packSnorm<int16_t>(v); }
+	inline glm::u16vec2 packUnorm16(const glm::vec2 &v) { return glm::packUnorm<uint16_t>(v); }
+	inline glm::u8vec4 packRgba8(const glm::vec4 &v) { return glm::packUnorm<uint8_t>(v); }
+
+	namespace detail {
+		// every attribute starts at a multiple of 4 bytes, the rest is packed
+		constexpr uint32_t vertexAttributeSize(size_t size) { return static_cast<uint32_t>((size + 3) & ~size_t(3)); }
+
+		template<typename... Attributes>
+		constexpr uint32_t vertexAttributeOffset(size_t index) {
+			const uint32_t sizes[] = { vertexAttributeSize(sizeof(typename Attributes::Type))..., 0 };
+			uint32_t offset = 0;
+			for (size_t i = 0; i < index; i++)
+				offset += sizes[i];
+			return offset;
+		}
+	}
+
+	// A vertex made of the given attributes, in order, at locations firstLocation, firstLocation + 1, ...
+	// The offsets, the stride and the formats are compile time constants the binding and attribute descriptions
+	// are made from, so a pipeline and the buffer it reads can't disagree on the layout.
+	// e.g. VertexLayout<attr::Float2, attr::Unorm16x2> v(pos, packUnorm16(uv)); v.get<0>() is the pos
+	template<typename... Attributes>
+	struct VertexLayout {
+		static constexpr uint32_t attributeCount = sizeof...(Attributes);
+		static constexpr uint32_t stride = detail::vertexAttributeOffset<Attributes...>(sizeof...(Attributes));
+
+		template<size_t I> using Type = typename std::tuple_element<I, std::tuple<typename Attributes::Type...>>::type;
+		template<size_t I> static constexpr uint32_t offset() { return detail::vertexAttributeOffset<Attributes...>(I); }
+
+		alignas(4) unsigned char data[stride];
+
+		VertexLayout() { memset(data, 0, stride); }
+		VertexLayout(const typename Attributes::Type&... values) {
+			memset(data, 0, stride); // the padding too, the hash and == read the bytes
+			setAll(std::index_sequence_for<Attributes...>(), values...);
+		}
+
+		template<size_t I> Type<I> get() const {
+			Type<I> value;
+			memcpy(&value, data + offset<I>(), sizeof(value));
+			return value;
+		}
+		template<size_t I> void set(const Type<I> &value) {
+			memcpy(data + offset<I>(), &value, sizeof(value));
+		}
+
+		bool operator==(const VertexLayout &other) const {
+			return memcmp(data, other.data, stride) == 0;
+		}
+		bool operator!=(const VertexLayout &other) const {
+			return !(*this == other);
+		}
+
+		static vk::VertexInputBindingDescription getBindingDescription(uint32_t binding = 0) {
+			return vk::VertexInputBindingDescription()
+				.setBinding(binding) //index of the binding in the array of bindings
+				.setStride(stride)
+				.setInputRate(vk::VertexInputRate::eVertex);
+		}
+		static std::array<vk::VertexInputAttributeDescription, sizeof...(Attributes)> getAttributeDescription(uint32_t binding = 0, uint32_t firstLocation = 0) {
+			return makeAttributeDescription(binding, firstLocation, std::index_sequence_for<Attributes...>());
+		}
+
+	private:
+		template<size_t... I>
+		void setAll(std::index_sequence<I...>, const typename Attributes::Type&... values) {
+			const int unused[] = { (set<I>(values), 0)..., 0 };
+			(void)unused;
+		}
+		template<size_t... I>
+		static std::array<vk::VertexInputAttributeDescription, sizeof...(Attributes)> makeAttributeDescription(uint32_t binding, uint32_t firstLocation, std::index_sequence<I...>) {
+			return { { vk::VertexInputAttributeDescription(firstLocation + static_cast<uint32_t>(I), binding, Attributes::format(), offset<I>())... } };
+		}
+	};
+}
+
+// hashes the bytes, for the vertex deduplication in unordered containers
+namespace std {
+	template<typename... Attributes>
+	struct hash<vm::VertexLayout<Attributes...>> {
+		size_t operator()(vm::VertexLayout<Attributes...> const& vertex) const {
+			size_t h = 14695981039346656037ull; // fnv-1a
+			for (uint32_t i = 0; i < vm::VertexLayout<Attributes...>::stride; i++)
+				h = (h ^ vertex.data[i]) * 1099511628211ull;
+			return h;
+		}
+	};
+}
@@ -1,5 +1,7 @@
 #include "Vulkan_.h"
+#include "MemoryAllocator.h"
 #include "ErrorAndLog.h"
+#include <algorithm>
 
 namespace vm {
 	// helper vk functions
@@ -29,19 +31,27 @@ namespace vm {
 		vk::MemoryRequirements memRequirements;
 		device.getBufferMemoryRequirements(buffer, &memRequirements);
 
-		//allocate memory of buffer
-		auto const allocInfo = vk::MemoryAllocateInfo()
-			.setAllocationSize(memRequirements.size)
-			.setMemoryTypeIndex(findMemoryType(gpu, memRequirements.memoryTypeBits, properties));
-		errCheck(device.allocateMemory(&allocInfo, nullptr, &bufferMemory));
+		//allocate memory of buffer (a range of a shared block)
+		vk::DeviceSize offset;
+		MemoryAllocator::getInstance().allocate(device, memRequirements, findMemoryType(gpu, memRequirements.memoryTypeBits, properties),
+			ResourceType::Buffer, (uint64_t)(VkBuffer)buffer, bufferMemory, offset);
 
 		//binding memory with buffer
-		errCheck(device.bindBufferMemory(buffer, bufferMemory, 0));
+		errCheck(device.bindBufferMemory(buffer, bufferMemory, offset));
 	}
 	void Helper::destroyBuffer(vk::Device &device, vk::Buffer &buffer, vk::DeviceMemory &bufferMemory) const
 	{
+		uint64_t handle = (uint64_t)(VkBuffer)buffer;
 		device.destroyBuffer(buffer);
-		device.freeMemory(bufferMemory);
+		MemoryAllocator::getInstance().free(device, ResourceType::Buffer, handle, bufferMemory);
+	}
+	void *Helper::mapBuffer(vk::Device device, vk::Buffer buffer) const
+	{
+		return MemoryAllocator::getInstance().map(device, ResourceType::Buffer, (uint64_t)(VkBuffer)buffer);
+	}
+	vk::DeviceSize Helper::getBufferMemoryOffset(vk::Buffer buffer) const
+	{
+		return MemoryAllocator::getInstance().getOffset(ResourceType::Buffer, (uint64_t)(VkBuffer)buffer);
 	}
 	void Helper::copyBuffer(vk::Device &device, vk::CommandPool &cmdPool, vk::Queue &queue, vk::Buffer *srcBuffer, vk::Buffer *dstBuffer, vk::DeviceSize *size) const
 	{
@@ -63,21 +73,26 @@ namespace vm {
 
 		errCheck(copyCmd.end());
 
+		// wait this submission only, not everything the queue has
+		vk::Fence fence;
+		auto const fci = vk::FenceCreateInfo();
+		errCheck(device.createFence(&fci, nullptr, &fence));
 		auto const si = vk::SubmitInfo()
 			.setCommandBufferCount(1)
 			.setPCommandBuffers(&copyCmd);
-		errCheck(queue.submit(1, &si, nullptr));
-		errCheck(queue.waitIdle());
+		errCheck(queue.submit(1, &si, fence));
+		errCheck(device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX));
+		device.destroyFence(fence);
 
 		device.freeCommandBuffers(cmdPool, 1, &copyCmd);
 	}
-	void Helper::createImage(vk::PhysicalDevice gpu, vk::Device device, uint32_t width, uint32_t height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image & image, vk::DeviceMemory & imageMemory) const
+	void Helper::createImage(vk::PhysicalDevice gpu, vk::Device device, uint32_t width, uint32_t height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image & image, vk::DeviceMemory & imageMemory, uint32_t mipLevels) const
 	{
 		auto const imageInfo = vk::ImageCreateInfo()
 			.setImageType(vk::ImageType::e2D)
 			.setFormat(format)
 			.setExtent({ width, height, 1 })
-			.setMipLevels(1)
+			.setMipLevels(mipLevels)
 			.setArrayLayers(1)
 			.setSamples(vk::SampleCountFlagBits::e1)
 			.setTiling(tiling)
@@ -89,18 +104,18 @@ namespace vm {
 
 		auto const memRequirements = device.getImageMemoryRequirements(image);
 
-		auto const allocInfo = vk::MemoryAllocateInfo()
-			.setAllocationSize(memRequirements.size)
-			.setMemoryTypeIndex(findMemoryType(gpu, memRequirements.memoryTypeBits, properties));
-
-		errCheck(device.allocateMemory(&allocInfo, nullptr, &imageMemory));
+		vk::DeviceSize offset;
+		MemoryAllocator::getInstance().allocate(device, memRequirements, findMemoryType(gpu, memRequirements.memoryTypeBits, properties),
+			tiling == vk::ImageTiling::eOptimal ? ResourceType::OptimalImage : ResourceType::LinearImage, (uint64_t)(VkImage)image, imageMemory, offset);
 
-		errCheck(device.bindImageMemory(image, imageMemory, 0));
+		errCheck(device.bindImageMemory(image, imageMemory, offset));
 	}
 	void Helper::destroyImage(vk::Device device, vk::Image image, vk::DeviceMemory bufferMemory) const
 	{
+		uint64_t handle = (uint64_t)(VkImage)image;
 		device.destroyImage(image);
-		device.freeMemory(bufferMemory);
+		// the type only picks the lookup table, linear and optimal images share it
+		MemoryAllocator::getInstance().free(device, ResourceType::OptimalImage, handle, bufferMemory);
 	}
 	vk::CommandBuffer Helper::beginSingleCommandBuffer(vk::Device device, vk::CommandPool cmdPool) const
 	{
@@ -127,8 +142,13 @@ namespace vm {
 			.setCommandBufferCount(1)
 			.setPCommandBuffers(&commandBuffer);
 
-		errCheck(queue.submit(1, &submitInfo, nullptr));
-		errCheck(queue.waitIdle());
+		// wait this submission only, not everything the queue has
+		vk::Fence fence;
+		auto const fci = vk::FenceCreateInfo();
+		errCheck(device.createFence(&fci, nullptr, &fence));
+		errCheck(queue.submit(1, &submitInfo, fence));
+		errCheck(device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX));
+		device.destroyFence(fence);
 
 		device.freeCommandBuffers(cmdPool, 1, &commandBuffer);
 	}
@@ -208,13 +228,13 @@ namespace vm {
 
 		endSingleCommandBuffer(device, cmdPool, queue, commandBuffer);
 	}
-	void Helper::createImageView(vk::Device device, vk::Image image, vk::Format format, vk::ImageView &imageView, vk::ImageAspectFlags aspectFlags) const
+	void Helper::createImageView(vk::Device device, vk::Image image, vk::Format format, vk::ImageView &imageView, vk::ImageAspectFlags aspectFlags, uint32_t mipLevels) const
 	{
 		auto const viewInfo = vk::ImageViewCreateInfo()
 			.setImage(image)
 			.setViewType(vk::ImageViewType::e2D)
 			.setFormat(format)
-			.setSubresourceRange({ aspectFlags, 0, 1, 0, 1 });
+			.setSubresourceRange({ aspectFlags, 0, mipLevels, 0, 1 });
 
 		errCheck(device.createImageView(&viewInfo, nullptr, &imageView));
 	}
@@ -258,4 +278,25 @@ namespace vm {
 			vk::ImageTiling::eOptimal,
 			vk::FormatFeatureFlagBits::eDepthStencilAttachment);
 	}
-}
\ No newline at end of file
+	uint32_t Helper::mipLevelCount(uint32_t width, uint32_t height) const
+	{
+		uint32_t levels = 1;
+		for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+			++levels;
+		return levels;
+	}
+	vk::DeviceSize Helper::mipLevelSize(vk::Format format, uint32_t width, uint32_t height, uint32_t level) const
+	{
+		const vk::DeviceSize w = std::max(width >> level, 1u);
+		const vk::DeviceSize h = std::max(height >> level, 1u);
+		switch (format) {
+		case vk::Format::eBc1RgbUnormBlock:
+		case vk::Format::eBc1RgbaUnormBlock:
+			return ((w + 3) / 4) * ((h + 3) / 4) * 8;
+		case vk::Format::eBc3UnormBlock:
+			return ((w + 3) / 4) * ((h + 3) / 4) * 16;
+		default:
+			return w * h * 4;
+		}
+	}
+}
@@ -9,6 +9,7 @@ namespace vm {
 		width = 0;
 		height = 0;
 		title = "";
+		headless = false;
 	}
 
 
@@ -21,6 +22,12 @@ namespace vm {
 	}
 	void Window::createWindow(int width, int height, std::string title, bool fullscreen)
 	{
+		if (headless) {
+			// glfw only for the timer, there may be no display at all
+			glfwInit();
+			renderer = new Renderer(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+			return;
+		}
 		if (!glfwInit()) exit(-1);
 		if (!glfwVulkanSupported()) exit(-1);
 		windowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -32,28 +39,40 @@ namespace vm {
 		renderer = new Renderer(getWindow());
 	}
 
+	void Window::setHeadless(bool headless)
+	{
+		this->headless = headless;
+	}
+	bool Window::isHeadless() const
+	{
+		return headless;
+	}
 	Renderer& Window::getRenderer() const
 	{
 		return *renderer;
 	}
 	void Window::setWindowUserPointer(void *pointer) const
 	{
+		if (!window) return;
 		glfwSetWindowUserPointer(window, pointer);
 	}
 	void * Window::getWindowUserPointer() const
 	{
-		return glfwGetWindowUserPointer(window);
+		return window ? glfwGetWindowUserPointer(window) : nullptr;
 	}
 	void Window::setWindowSizeCallback(GLFWwindowsizefun callback) const
 	{
+		if (!window) return;
 		glfwSetWindowSizeCallback(window, callback);
 	}
 	void Window::setKeyCallback(GLFWkeyfun callback) const
 	{
+		if (!window) return;
 		glfwSetKeyCallback(window, callback);
 	}
 	void Window::setScrollCallback(GLFWscrollfun callback) const
 	{
+		if (!window) return;
 		glfwSetScrollCallback(window, callback);
 	}
 	void Window::windowHint(int hint, int value) const
@@ -66,22 +85,25 @@ namespace vm {
 	}
 	bool Window::shouldClose() const
 	{
-		return glfwWindowShouldClose(window);
+		return window ? glfwWindowShouldClose(window) != 0 : false;
 	}
 	void Window::setWindowShouldClose(int value) const
 	{
+		if (!window) return;
 		glfwSetWindowShouldClose(window, value);
 	}
 	void Window::setWindowTitle(std::string title) const
 	{
+		if (!window) return;
 		glfwSetWindowTitle(window, title.c_str());
 	}
 	void Window::pollEvents() const
 	{
+		if (!window) return;
 		glfwPollEvents();
 	}
 	bool Window::getKey(int key) const
 	{
-		return glfwGetKey(window, key) == GLFW_PRESS;
+		return window && glfwGetKey(window, key) == GLFW_PRESS;
 	}
 }
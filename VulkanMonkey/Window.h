@@ -184,6 +184,9 @@ namespace vm {
 		~Window();
 
 		void createWindow(int width, int height, std::string title = "", bool fullscreen = false); /*glfwGetPrimaryMonitor()*/
+		// no glfw window, createWindow makes a headless renderer of the same size (set before createWindow)
+		void setHeadless(bool headless);
+		bool isHeadless() const;
 		Renderer& getRenderer() const;
 		void setWindowUserPointer(void *pointer) const;
 		void* getWindowUserPointer() const;
@@ -203,6 +206,7 @@ namespace vm {
 		int height;
 		std::string title;
 		Renderer *renderer;
+		bool headless;
 
 	};
 }
@@ -1,11 +1,88 @@
 #include "Game1.h"
+#include "AssetPacker.h"
+#include "AllocatorTest.h"
+#include "RenderQueue.h"
 #include <thread>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
 
-int main()
+int main(int argc, char *argv[])
 {
+	// tools, no game: --pack [archive] packs the loose assets, --load-benchmark [archive] logs their cold and warm
+	// load times from the loose files and from the archive, --allocator-test [iterations] [seed] drives the memory
+	// block sub-allocation on the cpu and checks every allocation, --sort-benchmark logs std::sort against the radix
+	// sort of the draw list for 1k to 1M entries
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--sort-benchmark") {
+			vm::RenderQueue::benchmark();
+			return 0;
+		}
+		if (std::string(argv[i]) == "--allocator-test") {
+			const uint32_t iterations = i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? static_cast<uint32_t>(std::atoi(argv[i + 1])) : 100000;
+			const uint32_t seed = i + 2 < argc ? static_cast<uint32_t>(std::atoi(argv[i + 2])) : 1;
+			return vm::AllocatorTest::run(iterations, seed) ? 0 : 1;
+		}
+		const char *archive = i + 1 < argc && argv[i + 1][0] != '-' ? argv[i + 1] : ASSET_ARCHIVE;
+		if (std::string(argv[i]) == "--pack")
+			return vm::AssetPacker::pack(archive) ? 0 : 1;
+		if (std::string(argv[i]) == "--load-benchmark") {
+			vm::AssetPacker::benchmark(archive);
+			return 0;
+		}
+	}
+
 	{
 		vm::Game1 game;
 
+		// --headless [frames], no window, for frame time benchmarks on machines without a display
+		// --sdf [scale], distance field shadows at 1/scale of the screen, with their pass times in the headless log
+		// --zoom [zoom], starts zoomed out, --no-mips loads the textures without mips to compare against
+		// --no-cook, the textures are decoded and uploaded as rgba8 instead of loaded cooked (bc1/bc3)
+		// --no-streaming, the textures are loaded while the sprites are created instead of on the streaming threads
+		// --texture-budget [MB], the textures over it are evicted (least recently drawn first), 0: no budget
+		// --archive [archive] reads the assets from another archive, --loose from the loose files even if there is one
+		// --sprites [count], the scene is made with count sprites (500 by default) over an area growing with them
+		// --batching-benchmark, the headless frames are split between sprite batching on and off, each with its average record time
+		// --record-threads [1,2,4,8], the headless frames are split between the record thread counts in the same way
+		// --shadow-benchmark, logs the cpu time of the shadow volumes of 20 to 200 lights after the headless frames
+		for (int i = 1; i < argc; ++i) {
+			if (std::string(argv[i]) == "--headless")
+				game.setHeadless(i + 1 < argc ? static_cast<uint32_t>(std::atoi(argv[i + 1])) : 1000);
+			if (std::string(argv[i]) == "--sdf")
+				game.setDistanceFieldBenchmark(i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? static_cast<uint32_t>(std::atoi(argv[i + 1])) : 2);
+			if (std::string(argv[i]) == "--zoom")
+				game.setZoomBenchmark(i + 1 < argc && std::atof(argv[i + 1]) > 0 ? static_cast<float>(std::atof(argv[i + 1])) : 8.0f);
+			if (std::string(argv[i]) == "--no-mips")
+				game.setMipmaps(false);
+			if (std::string(argv[i]) == "--no-cook")
+				game.setTextureCooking(false);
+			if (std::string(argv[i]) == "--no-streaming")
+				game.setTextureStreaming(false);
+			if (std::string(argv[i]) == "--texture-budget")
+				game.setTextureBudget(i + 1 < argc ? static_cast<uint32_t>(std::atoi(argv[i + 1])) : TEXTURE_BUDGET_MB);
+			if (std::string(argv[i]) == "--archive" && i + 1 < argc)
+				game.setAssetArchive(argv[i + 1]);
+			if (std::string(argv[i]) == "--loose")
+				game.setAssetArchive("");
+			if (std::string(argv[i]) == "--sprites")
+				game.setSpriteCount(i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? static_cast<uint32_t>(std::atoi(argv[i + 1])) : 10000);
+			if (std::string(argv[i]) == "--batching-benchmark")
+				game.setBatchingBenchmark(true);
+			if (std::string(argv[i]) == "--record-threads") {
+				std::vector<uint32_t> threadCounts;
+				std::stringstream list(i + 1 < argc && argv[i + 1][0] != '-' ? argv[i + 1] : "1,2,4,8");
+				std::string count;
+				while (std::getline(list, count, ','))
+					if (std::atoi(count.c_str()) > 0)
+						threadCounts.push_back(static_cast<uint32_t>(std::atoi(count.c_str())));
+				game.setRecordThreadsBenchmark(threadCounts);
+			}
+			if (std::string(argv[i]) == "--shadow-benchmark")
+				game.setShadowBenchmark(true);
+		}
+
 		std::thread t([&] { game.run(); });
 		t.join();
 	}
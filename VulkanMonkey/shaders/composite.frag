@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(push_constant) uniform Ambient {
+	vec4 color;
+} ambient;
+
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput albedo;
+layout(input_attachment_index = 1, set = 0, binding = 1) uniform subpassInput lights;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+
+	// the albedo color is premultiplied by its coverage
+	vec4 color = subpassLoad(albedo);
+	if (color.w <= 0.0)
+		discard;
+	float factor = subpassLoad(lights).r;
+	outColor = vec4(color.xyz / color.w + ambient.color.xyz, color.w);
+	outColor.w *= clamp(ambient.color.w + factor, 0.0, 1.0);
+}
@@ -0,0 +1,77 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define LIGHT_RANGE 16.0
+#define SHADOW_CELL_SIZE 256.0
+#define SHADOW_CELLS_PER_ROW 16u
+#define FIELD_MAX_STEPS 32
+#define FIELD_SOFTNESS 8.0
+
+layout(location = 0) in vec2 inOffset;
+layout(location = 1) flat in float inAlpha;
+layout(location = 2) flat in float inShadowCell;
+layout(location = 3) in vec2 inWorldPos;
+layout(location = 4) flat in vec2 inLightPos;
+
+layout(std430, set = 1, binding = 1) readonly buffer Tiles {
+	uint tilesX;
+	uint tilesY;
+	uint distanceField; // 1: the lights are traced in the distance field
+	uint pad0;
+	vec4 fieldRect; // world to field uv, xy min, zw scale
+	vec2 fieldUVMax; // the field of this frame is the uv rect 0..fieldUVMax
+	float fieldTexel; // world pixels per texel of the field
+	float pad1;
+	uvec2 range[];
+} tile;
+
+layout(set = 1, binding = 3) uniform sampler2D shadowMask;
+layout(set = 1, binding = 4) uniform sampler2D distanceField;
+
+float fieldDistance(vec2 pos) {
+	vec2 uv = (pos - tile.fieldRect.xy) * tile.fieldRect.zw;
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, tile.fieldUVMax)))
+		return 1e6; // out of the field is free, the trace leaves it for good
+	return textureLod(distanceField, uv, 0.0).r;
+}
+
+// sphere traced soft shadow from the pixel to the light, the nearest miss of the ray gives the penumbra
+float fieldVisibility(vec2 pos, vec2 lightPos) {
+	vec2 toLight = lightPos - pos;
+	float end = length(toLight);
+	vec2 dir = toLight / max(end, 0.0001);
+	float t = 0.0;
+	float d = fieldDistance(pos);
+	if (d < 0.0)
+		t = tile.fieldTexel - d; // out of the occluder the pixel belongs to first, the occluders stay lit
+	float lightDistance = fieldDistance(lightPos);
+	if (lightDistance < 0.0)
+		end += lightDistance; // a light inside an occluder (the player's) shines from its edge
+	float visibility = 1.0;
+	for (int i = 0; i < FIELD_MAX_STEPS && t < end; i++) {
+		d = fieldDistance(pos + dir * t);
+		if (d <= 0.0)
+			return 0.0;
+		visibility = min(visibility, FIELD_SOFTNESS * d / t);
+		t += max(d, tile.fieldTexel);
+	}
+	return clamp(visibility, 0.0, 1.0);
+}
+
+layout(location = 0) out vec4 outLight; // additive, r only
+
+void main() {
+
+	float distance = length(inOffset);
+	if (distance >= LIGHT_RANGE)
+		discard;
+	float visibility = 1.0;
+	if (tile.distanceField == 1u)
+		visibility = fieldVisibility(inWorldPos, inLightPos);
+	else if (inShadowCell >= 0.0) {
+		uint cell = uint(inShadowCell);
+		vec2 local = clamp(inOffset / LIGHT_RANGE * 0.5 + 0.5, 0.5 / SHADOW_CELL_SIZE, 1.0 - 0.5 / SHADOW_CELL_SIZE);
+		visibility = 1.0 - textureLod(shadowMask, (vec2(cell % SHADOW_CELLS_PER_ROW, cell / SHADOW_CELLS_PER_ROW) + local) / float(SHADOW_CELLS_PER_ROW), 0.0).r;
+	}
+	outLight = vec4(clamp(1/(distance*distance), 0.0, 1.0) * inAlpha * visibility);
+}
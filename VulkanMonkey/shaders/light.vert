@@ -0,0 +1,47 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define LIGHT_RANGE 16.0 // radius multiple past which a light adds less than 1/256
+
+struct UniformLight{
+	vec4 color;
+	vec2 position;
+	float radius;
+	float shadowCell; // -1 without a shadow mask
+};
+
+layout(set = 0, binding = 0) uniform UniformCamera {
+	mat4 proj;
+	mat4 camPos;
+} camera;
+
+layout(std430, set = 1, binding = 0) readonly buffer Lights {
+	UniformLight pointLight[];
+} light;
+
+layout(location = 0) out vec2 outOffset; // from the light, in radii
+layout(location = 1) flat out float outAlpha;
+layout(location = 2) flat out float outShadowCell;
+layout(location = 3) out vec2 outWorldPos;
+layout(location = 4) flat out vec2 outLightPos;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+// two triangles, the quad the light reaches
+const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0));
+
+void main() {
+
+	UniformLight l = light.pointLight[gl_InstanceIndex];
+	vec2 corner = corners[gl_VertexIndex] * LIGHT_RANGE;
+
+	outOffset = corner;
+	outAlpha = l.color.w;
+	outShadowCell = l.shadowCell;
+	outWorldPos = l.position + corner * l.radius;
+	outLightPos = l.position;
+
+	gl_Position = camera.proj * camera.camPos * vec4(outWorldPos, 0.0, 1.0);
+}
@@ -0,0 +1,9 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) out vec4 outOccupancy; // r only
+
+void main() {
+
+	outOccupancy = vec4(1.0);
+}
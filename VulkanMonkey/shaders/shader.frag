@@ -1,13 +1,18 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-#define lightCount 20
+#define TILE_SIZE 32 // LIGHT_TILE_SIZE
+#define LIGHT_RANGE 16.0 // radius multiple past which a light adds less than 1/256
+#define SHADOW_CELL_SIZE 256.0 // SHADOW_CELL_SIZE
+#define SHADOW_CELLS_PER_ROW 16u // SHADOW_ATLAS_SIZE / SHADOW_CELL_SIZE
+#define FIELD_MAX_STEPS 32
+#define FIELD_SOFTNESS 8.0 // higher is harder
 
 struct UniformLight{
 	vec4 color;
 	vec2 position;
 	float radius;
-	float on;
+	float shadowCell; // -1 without a shadow mask
 };
 layout(push_constant) uniform Ambient {
 	vec4 color;
@@ -15,26 +20,95 @@ layout(push_constant) uniform Ambient {
 
 layout(set = 0, binding = 1) uniform sampler2D texSampler;
 
-layout(set = 2, binding = 0) uniform UniformLights {
-	UniformLight pointLight[lightCount];
+// the lights binned in screen tiles, every tile has the (offset, count) of its light indices
+layout(std430, set = 2, binding = 0) readonly buffer Lights {
+	UniformLight pointLight[];
 } light;
 
+layout(std430, set = 2, binding = 1) readonly buffer Tiles {
+	uint tilesX;
+	uint tilesY;
+	uint distanceField; // 1: the lights are traced in the distance field
+	uint pad0;
+	vec4 fieldRect; // world to field uv, xy min, zw scale
+	vec2 fieldUVMax; // the field of this frame is the uv rect 0..fieldUVMax
+	float fieldTexel; // world pixels per texel of the field
+	float pad1;
+	uvec2 range[];
+} tile;
+
+layout(std430, set = 2, binding = 2) readonly buffer LightIndices {
+	uint index[];
+} lightIndex;
+
+// a cell per shadowed light covering its reach, 1 where the light is blocked
+layout(set = 2, binding = 3) uniform sampler2D shadowMask;
+
+// signed distance to the nearest occluder, in world pixels
+layout(set = 2, binding = 4) uniform sampler2D distanceField;
+
 layout(location = 0) in vec2 inUV;
 layout(location = 1) in vec4 inPos;
 
 layout(location = 0) out vec4 outColor;
 
+float fieldDistance(vec2 pos) {
+	vec2 uv = (pos - tile.fieldRect.xy) * tile.fieldRect.zw;
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, tile.fieldUVMax)))
+		return 1e6; // out of the field is free, the trace leaves it for good
+	return textureLod(distanceField, uv, 0.0).r;
+}
+
+// sphere traced soft shadow from the pixel to the light, the nearest miss of the ray gives the penumbra
+float fieldVisibility(vec2 pos, vec2 lightPos) {
+	vec2 toLight = lightPos - pos;
+	float end = length(toLight);
+	vec2 dir = toLight / max(end, 0.0001);
+	float t = 0.0;
+	float d = fieldDistance(pos);
+	if (d < 0.0)
+		t = tile.fieldTexel - d; // out of the occluder the pixel belongs to first, the occluders stay lit
+	float lightDistance = fieldDistance(lightPos);
+	if (lightDistance < 0.0)
+		end += lightDistance; // a light inside an occluder (the player's) shines from its edge
+	float visibility = 1.0;
+	for (int i = 0; i < FIELD_MAX_STEPS && t < end; i++) {
+		d = fieldDistance(pos + dir * t);
+		if (d <= 0.0)
+			return 0.0;
+		visibility = min(visibility, FIELD_SOFTNESS * d / t);
+		t += max(d, tile.fieldTexel);
+	}
+	return clamp(visibility, 0.0, 1.0);
+}
+
+float lightVisibility(UniformLight l, vec2 pos) {
+	if (tile.distanceField == 1u)
+		return fieldVisibility(pos, l.position);
+	if (l.shadowCell < 0.0)
+		return 1.0;
+	uint cell = uint(l.shadowCell);
+	vec2 local = (pos - l.position) / (l.radius * LIGHT_RANGE) * 0.5 + 0.5;
+	local = clamp(local, 0.5 / SHADOW_CELL_SIZE, 1.0 - 0.5 / SHADOW_CELL_SIZE); // no bleeding from the next cell
+	vec2 uv = (vec2(cell % SHADOW_CELLS_PER_ROW, cell / SHADOW_CELLS_PER_ROW) + local) / float(SHADOW_CELLS_PER_ROW);
+	return 1.0 - textureLod(shadowMask, uv, 0.0).r;
+}
+
 void main() {
 	
 	float factor = 0.0;
 
-	for(int i=0; i<lightCount; i++){
-		if (light.pointLight[i].on == 1.0){
-			float distance = length(light.pointLight[i].position - inPos.xy) / light.pointLight[i].radius;
-			factor += clamp(1/(distance*distance), 0.0, 1.0) * light.pointLight[i].color.w;
-		}
+	// only the lights reaching this tile
+	uvec2 t = min(uvec2(gl_FragCoord.xy) / TILE_SIZE, uvec2(tile.tilesX - 1, tile.tilesY - 1));
+	uvec2 range = tile.range[t.y * tile.tilesX + t.x];
+	for(uint i=0; i<range.y; i++){
+		UniformLight l = light.pointLight[lightIndex.index[range.x + i]];
+		float distance = length(l.position - inPos.xy) / l.radius;
+		if (distance < LIGHT_RANGE)
+			factor += clamp(1/(distance*distance), 0.0, 1.0) * l.color.w * lightVisibility(l, inPos.xy);
 	}
-	outColor = texture(texSampler, inUV);
-	outColor = vec4(outColor.xyz + ambient.color.xyz, outColor.w);
-	outColor.w *= clamp(ambient.color.w + factor, 0.0, 1.0);
+	// premultiplied alpha, the ambient color is added where the texture covers and all of it fades with the light
+	vec4 color = texture(texSampler, inUV);
+	float light = clamp(ambient.color.w + factor, 0.0, 1.0);
+	outColor = vec4(color.xyz + ambient.color.xyz * color.w, color.w) * light;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 layout(set = 0, binding = 0) uniform UniformBufferObject {
 	mat4 model;
+	vec4 uvRect; // xy offset, zw scale of the texture in its (atlas) image
 } sprite;
 
 layout(set = 1, binding = 0) uniform UniformCamera {
@@ -10,9 +11,8 @@ layout(set = 1, binding = 0) uniform UniformCamera {
 	mat4 camPos;
 } camera;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
-layout(location = 2) in vec2 inUV;
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inUV; // unorm16
 
 layout(location = 0) out vec2 outUV;
 layout(location = 1) out vec4 outPos;
@@ -24,11 +24,10 @@ out gl_PerVertex {
 
 void main() {
 
-	outUV.x = inUV.x;
-	outUV.y = 1.0 - inUV.y;
+	outUV = sprite.uvRect.xy + vec2(inUV.x, 1.0 - inUV.y) * sprite.uvRect.zw;
 
-	outPos = sprite.model * vec4(inPosition, 1.0);
+	outPos = sprite.model * vec4(inPosition, 0.0, 1.0);
 
-	gl_Position = camera.proj * camera.camPos * sprite.model * vec4(inPosition, 1.0);
+	gl_Position = camera.proj * camera.camPos * sprite.model * vec4(inPosition, 0.0, 1.0);
 	
 }
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// deferred lighting, the unlit sprite color, lit later by the light and composite subpasses
+
+layout(set = 0, binding = 1) uniform sampler2D texSampler;
+
+layout(location = 0) in vec2 inUV;
+layout(location = 1) in vec4 inPos;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	outColor = texture(texSampler, inUV);
+}
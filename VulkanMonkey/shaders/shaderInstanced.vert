@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 1, binding = 0) uniform UniformCamera {
+	mat4 proj;
+	mat4 camPos;
+} camera;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inUV; // unorm16
+layout(location = 3) in mat4 inModel; // per instance, locations 3 to 6
+layout(location = 8) in vec4 inUVRect; // per instance, xy offset, zw scale of the texture in its (atlas) image
+
+layout(location = 0) out vec2 outUV;
+layout(location = 1) out vec4 outPos;
+
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+
+	outUV = inUVRect.xy + vec2(inUV.x, 1.0 - inUV.y) * inUVRect.zw;
+
+	outPos = inModel * vec4(inPosition, 0.0, 1.0);
+
+	gl_Position = camera.proj * camera.camPos * inModel * vec4(inPosition, 0.0, 1.0);
+	
+}
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// deferred lighting, the unlit sprite color, lit later by the light and composite subpasses
+
+layout(constant_id = 0) const uint textureCount = 64; // specialized to the size of the texture array
+
+layout(set = 0, binding = 0) uniform sampler2D textures[textureCount];
+
+layout(location = 0) in vec2 inUV;
+layout(location = 1) in vec4 inPos;
+layout(location = 2) flat in uint inTextureIndex; // the same for the whole draw (dynamically uniform)
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	outColor = texture(textures[inTextureIndex], inUV);
+}
@@ -0,0 +1,9 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) out vec4 outShadow; // r only, 1 where the light is blocked
+
+void main() {
+
+	outShadow = vec4(1.0);
+}
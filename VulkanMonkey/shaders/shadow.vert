@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// xy in the light's cell (its reach is -1..1), w = 0 for the ends extruded to infinity
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+
+	gl_Position = vec4(inPosition.xy, 0.0, inPosition.z);
+}